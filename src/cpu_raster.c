@@ -0,0 +1,4309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) \
+		|| defined(_M_IX86)
+	#define RASTER_X86 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#endif
+#endif
+
+/* MSVC compiles any intrinsic anywhere, GCC and clang want the function to
+ * say which instruction set it needs. Only called after checking the CPU.
+ */
+#if defined(__GNUC__)
+	#define TARGET_SSE41 __attribute__((target("sse4.1")))
+	#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define TARGET_SSE41
+	#define TARGET_AVX2
+#endif
+
+#include "opengl_shader.h"
+#include "jobs.h"
+#include "occlusion.h"
+#if defined(CPU_RASTER_X11)
+	#include "x11_present.h"
+#endif
+/* Generated from the .spv files by spirv_to_c. */
+#include "win_vulkan_vert_spv.h"
+#include "win_vulkan_frag_spv.h"
+
+#define XRES 1440
+#define YRES 900
+
+const char* app_name = "CPU Raster";
+
+double time_ms()
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+
+/* Linear RGBA8, R in the lowest byte. Rows are padded to whole 8 pixel
+ * blocks, and their count to whole 4x2 blocks, so kernels never check
+ * bounds inside a block. Padding is never shown. Rows start 32 byte
+ * aligned, for the resolve's streaming stores.
+ */
+typedef struct Framebuffer {
+	uint32_t*		pixels;
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		stride;
+} Framebuffer;
+
+Framebuffer create_framebuffer(uint32_t width, uint32_t height)
+{
+	Framebuffer fb = {
+		.pixels					= NULL
+		, .width				= width
+		, .height				= height
+		, .stride				= (width + 7) & ~7u
+	};
+
+	/* aligned_alloc wants a multiple of the alignment, and MSVC has its own. */
+	size_t size = sizeof(uint32_t) * fb.stride * ((height + 1) & ~1u);
+#if defined(_MSC_VER)
+	fb.pixels = _aligned_malloc(size, 64);
+#else
+	fb.pixels = aligned_alloc(64, (size + 63) & ~(size_t)63);
+#endif
+	if (fb.pixels == NULL) {
+		printf("Out of memory for a %dx%d framebuffer.\n", width, height);
+		exit(-1);
+	}
+	memset(fb.pixels, 0, size);
+	return fb;
+}
+
+void destroy_framebuffer(Framebuffer* fb)
+{
+#if defined(_MSC_VER)
+	_aligned_free(fb->pixels);
+#else
+	free(fb->pixels);
+#endif
+	fb->pixels = NULL;
+}
+
+void clear_framebuffer(Framebuffer* fb, uint32_t color)
+{
+	size_t count = (size_t)fb->stride * ((fb->height + 1) & ~1u);
+	for (size_t i = 0; i < count; ++i) {
+		fb->pixels[i] = color;
+	}
+}
+
+uint32_t pack_rgba(const float rgba[4])
+{
+	uint32_t packed = 0;
+	for (int c = 0; c < 4; ++c) {
+		float v = rgba[c] < 0.0f ? 0.0f : rgba[c] > 1.0f ? 1.0f : rgba[c];
+		packed |= (uint32_t)(v * 255.0f + 0.5f) << (c * 8);
+	}
+	return packed;
+}
+
+/* Binary PPM, alpha dropped. */
+void write_ppm(const Framebuffer* fb, const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		printf("Could not write %s.\n", path);
+		exit(-1);
+	}
+
+	fprintf(file, "P6\n%d %d\n255\n", fb->width, fb->height);
+	uint8_t* row = malloc(fb->width * 3);
+	for (uint32_t y = 0; y < fb->height; ++y) {
+		const uint32_t* src = &fb->pixels[(size_t)y * fb->stride];
+		for (uint32_t x = 0; x < fb->width; ++x) {
+			row[x * 3 + 0] = (uint8_t)(src[x]);
+			row[x * 3 + 1] = (uint8_t)(src[x] >> 8);
+			row[x * 3 + 2] = (uint8_t)(src[x] >> 16);
+		}
+		fwrite(row, 1, fb->width * 3, file);
+	}
+	free(row);
+	fclose(file);
+}
+
+
+/* The flat color of fragmentShaderSource, so the CPU and GPU triangles stay
+ * the same.
+ */
+uint32_t shader_color()
+{
+	float rgba[4];
+	const char* vec = strstr(fragmentShaderSource, "vec4(");
+	if (vec == NULL || sscanf(vec + 5, "%f , %f , %f , %f", &rgba[0],
+			&rgba[1], &rgba[2], &rgba[3]) != 4)
+	{
+		printf("No flat color in the fragment shader.\n");
+		exit(-1);
+	}
+	return pack_rgba(rgba);
+}
+
+
+/* Edge functions, e = a * x + (b * y + c), positive inside, already offset
+ * to pixel centers. Every kernel evaluates them in that order, so they all
+ * cover exactly the same pixels. Pixels on an edge are covered, no tie rule.
+ * Bounds are clamped to the framebuffer, max exclusive.
+ */
+typedef struct TriangleSetup {
+	float			a[3];
+	float			b[3];
+	float			c[3];
+	int32_t			min_x;
+	int32_t			min_y;
+	int32_t			max_x;
+	int32_t			max_y;
+} TriangleSetup;
+
+/* Either winding. Returns false when there's nothing to draw. */
+bool setup_triangle(const float* screen, const Framebuffer* fb,
+		TriangleSetup* setup)
+{
+	const float* p0 = &screen[0];
+	const float* p1 = &screen[2];
+	const float* p2 = &screen[4];
+
+	float area = (p1[0] - p0[0]) * (p2[1] - p0[1])
+			- (p2[0] - p0[0]) * (p1[1] - p0[1]);
+	if (area == 0.0f)
+		return false;
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+
+	for (int e = 0; e < 3; ++e) {
+		const float* from = &screen[e * 2];
+		const float* to = &screen[((e + 1) % 3) * 2];
+		float a = (from[1] - to[1]) * sign;
+		float b = (to[0] - from[0]) * sign;
+		setup->a[e] = a;
+		setup->b[e] = b;
+		setup->c[e] = -(a * from[0] + b * from[1]) + 0.5f * (a + b);
+	}
+
+	float min_x = fminf(p0[0], fminf(p1[0], p2[0]));
+	float min_y = fminf(p0[1], fminf(p1[1], p2[1]));
+	float max_x = fmaxf(p0[0], fmaxf(p1[0], p2[0]));
+	float max_y = fmaxf(p0[1], fmaxf(p1[1], p2[1]));
+	setup->min_x = min_x < 0.0f ? 0 : (int32_t)floorf(min_x);
+	setup->min_y = min_y < 0.0f ? 0 : (int32_t)floorf(min_y);
+	setup->max_x = max_x > (float)fb->width
+			? (int32_t)fb->width : (int32_t)ceilf(max_x);
+	setup->max_y = max_y > (float)fb->height
+			? (int32_t)fb->height : (int32_t)ceilf(max_y);
+
+	return setup->min_x < setup->max_x && setup->min_y < setup->max_y;
+}
+
+
+/* Coverage kernels, one per instruction set. */
+typedef enum RasterIsa {
+	RASTER_ISA_SCALAR
+	, RASTER_ISA_SSE41
+	, RASTER_ISA_AVX2
+	, RASTER_ISA_COUNT
+} RasterIsa;
+
+const char* raster_isa_names[RASTER_ISA_COUNT] = {
+	"scalar", "sse4.1", "avx2"
+};
+
+typedef void (*RasterFn)(Framebuffer* fb, const TriangleSetup* setup,
+		uint32_t color);
+
+/* Per pixel, the reference. */
+void raster_scalar(Framebuffer* fb, const TriangleSetup* s, uint32_t color)
+{
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		uint32_t* row = &fb->pixels[(size_t)y * fb->stride];
+		float row0 = s->b[0] * (float)y + s->c[0];
+		float row1 = s->b[1] * (float)y + s->c[1];
+		float row2 = s->b[2] * (float)y + s->c[2];
+
+		for (int32_t x = s->min_x; x < s->max_x; ++x) {
+			float e0 = s->a[0] * (float)x + row0;
+			float e1 = s->a[1] * (float)x + row1;
+			float e2 = s->a[2] * (float)x + row2;
+			if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f) {
+				row[x] = color;
+			}
+		}
+	}
+}
+
+/* Covered pixels, for the benchmark's throughput. */
+uint64_t count_coverage(const TriangleSetup* s)
+{
+	uint64_t count = 0;
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		float row0 = s->b[0] * (float)y + s->c[0];
+		float row1 = s->b[1] * (float)y + s->c[1];
+		float row2 = s->b[2] * (float)y + s->c[2];
+
+		for (int32_t x = s->min_x; x < s->max_x; ++x) {
+			float e0 = s->a[0] * (float)x + row0;
+			float e1 = s->a[1] * (float)x + row1;
+			float e2 = s->a[2] * (float)x + row2;
+			count += e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f;
+		}
+	}
+	return count;
+}
+
+#if defined(RASTER_X86)
+
+/* 4x2 blocks, two rows of 4. Covered lanes are blended over what's there,
+ * fully outside blocks are skipped.
+ */
+TARGET_SSE41 void raster_sse41(Framebuffer* fb, const TriangleSetup* s,
+		uint32_t color)
+{
+	const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 colors = _mm_castsi128_ps(_mm_set1_epi32((int32_t)color));
+	__m128 a[3];
+	for (int e = 0; e < 3; ++e) {
+		a[e] = _mm_set1_ps(s->a[e]);
+	}
+
+	for (int32_t y = s->min_y & ~1; y < s->max_y; y += 2) {
+		uint32_t* rows[2] = {
+			&fb->pixels[(size_t)y * fb->stride]
+			, &fb->pixels[(size_t)(y + 1) * fb->stride]
+		};
+		__m128 row_terms[2][3];
+		for (int r = 0; r < 2; ++r) {
+			for (int e = 0; e < 3; ++e) {
+				row_terms[r][e] = _mm_set1_ps(
+						s->b[e] * (float)(y + r) + s->c[e]);
+			}
+		}
+
+		for (int32_t x = s->min_x & ~3; x < s->max_x; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 ax[3];
+			for (int e = 0; e < 3; ++e) {
+				ax[e] = _mm_mul_ps(a[e], px);
+			}
+
+			__m128 masks[2];
+			for (int r = 0; r < 2; ++r) {
+				masks[r] = _mm_cmpge_ps(_mm_add_ps(ax[0], row_terms[r][0]),
+						zero);
+				masks[r] = _mm_and_ps(masks[r], _mm_cmpge_ps(
+						_mm_add_ps(ax[1], row_terms[r][1]), zero));
+				masks[r] = _mm_and_ps(masks[r], _mm_cmpge_ps(
+						_mm_add_ps(ax[2], row_terms[r][2]), zero));
+			}
+			if ((_mm_movemask_ps(masks[0]) | _mm_movemask_ps(masks[1])) == 0)
+				continue;
+
+			for (int r = 0; r < 2; ++r) {
+				float* dst = (float*)&rows[r][x];
+				_mm_storeu_ps(dst, _mm_blendv_ps(_mm_loadu_ps(dst), colors,
+						masks[r]));
+			}
+		}
+	}
+}
+
+/* 8x1 blocks, covered lanes written with a masked store. */
+TARGET_AVX2 void raster_avx2(Framebuffer* fb, const TriangleSetup* s,
+		uint32_t color)
+{
+	const __m256 offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f,
+			6.0f, 7.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i colors = _mm256_set1_epi32((int32_t)color);
+	__m256 a[3];
+	for (int e = 0; e < 3; ++e) {
+		a[e] = _mm256_set1_ps(s->a[e]);
+	}
+
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		uint32_t* row = &fb->pixels[(size_t)y * fb->stride];
+		__m256 row_terms[3];
+		for (int e = 0; e < 3; ++e) {
+			row_terms[e] = _mm256_set1_ps(s->b[e] * (float)y + s->c[e]);
+		}
+
+		for (int32_t x = s->min_x & ~7; x < s->max_x; x += 8) {
+			__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), offsets);
+			__m256 mask = _mm256_cmp_ps(_mm256_add_ps(
+					_mm256_mul_ps(a[0], px), row_terms[0]), zero, _CMP_GE_OQ);
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(
+					_mm256_mul_ps(a[1], px), row_terms[1]), zero, _CMP_GE_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(
+					_mm256_mul_ps(a[2], px), row_terms[2]), zero, _CMP_GE_OQ));
+			if (_mm256_movemask_ps(mask) == 0)
+				continue;
+
+			_mm256_maskstore_epi32((int*)&row[x], _mm256_castps_si256(mask),
+					colors);
+		}
+	}
+}
+
+#endif
+
+const RasterFn raster_fns[RASTER_ISA_COUNT] = {
+	raster_scalar
+#if defined(RASTER_X86)
+	, raster_sse41
+	, raster_avx2
+#else
+	, NULL
+	, NULL
+#endif
+};
+
+/* AVX2 also needs the OS to save the upper halves of the registers. */
+bool raster_isa_supported(RasterIsa isa)
+{
+	if (isa == RASTER_ISA_SCALAR)
+		return true;
+
+#if defined(RASTER_X86) && defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 1);
+	bool sse41 = (regs[2] & (1 << 19)) != 0;
+	bool os_avx = (regs[2] & (1 << 27)) != 0 && (regs[2] & (1 << 28)) != 0
+			&& (_xgetbv(0) & 6) == 6;
+	__cpuidex(regs, 7, 0);
+	bool avx2 = os_avx && (regs[1] & (1 << 5)) != 0;
+	return isa == RASTER_ISA_SSE41 ? sse41 : avx2;
+#elif defined(RASTER_X86)
+	__builtin_cpu_init();
+	return isa == RASTER_ISA_SSE41 ? __builtin_cpu_supports("sse4.1") != 0
+			: __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+
+RasterIsa best_raster_isa()
+{
+	for (int isa = RASTER_ISA_COUNT - 1; isa > RASTER_ISA_SCALAR; --isa) {
+		if (raster_isa_supported((RasterIsa)isa))
+			return (RasterIsa)isa;
+	}
+	return RASTER_ISA_SCALAR;
+}
+
+
+/* Fixed point edges. Vertices snap to 1/256 pixel, 16.8, and edge
+ * functions are exact 64 bit integers in 1/65536 pixel², nothing is lost
+ * anywhere in FIXED_GUARD_BAND. Triangles sharing an edge compute the same
+ * values with opposite signs, and a pixel center exactly on it goes to the
+ * triangle it is the top or left edge of, the top-left rule of D3D and of
+ * Vulkan drivers. So a mesh covers every pixel under it once, no holes, no
+ * pixel drawn twice. Past setup, values step from pixel to pixel and row to
+ * row with adds.
+ */
+#define FIXED_SUBPIXEL_BITS 8
+#define FIXED_ONE (1 << FIXED_SUBPIXEL_BITS)
+
+/* Pixels from the origin a vertex can be, callers clip to it first as the
+ * vertex stage does to GUARD_BAND, far inside. Snapped that's under 2^28,
+ * edge steps under 2^29, so areas and edge values stay under 2^60.
+ */
+#define FIXED_GUARD_BAND 1048576.0f
+
+typedef struct FixedSetup {
+	/* Steps one pixel right and one row down. */
+	int64_t			a[3];
+	int64_t			b[3];
+	/* At the center of pixel (min_x, min_y), less one on edges that are
+	 * neither top nor left, so covered is all three >= 0.
+	 */
+	int64_t			origin[3];
+	int32_t			min_x;
+	int32_t			min_y;
+	int32_t			max_x;
+	int32_t			max_y;
+} FixedSetup;
+
+/* Same screen coordinates and either winding, as setup_triangle. Returns
+ * false when there's nothing to draw, degenerate once snapped included,
+ * and for vertices outside FIXED_GUARD_BAND or not numbers.
+ */
+bool setup_fixed_triangle(const float* screen, const Framebuffer* fb,
+		FixedSetup* setup)
+{
+	for (int i = 0; i < 6; ++i) {
+		if (!(fabsf(screen[i]) <= FIXED_GUARD_BAND))
+			return false;
+	}
+
+	/* llrintf, long is 32 bits on Windows. */
+	int64_t x[3];
+	int64_t y[3];
+	for (int v = 0; v < 3; ++v) {
+		x[v] = llrintf(screen[v * 2] * FIXED_ONE);
+		y[v] = llrintf(screen[v * 2 + 1] * FIXED_ONE);
+	}
+
+	int64_t area = (x[1] - x[0]) * (y[2] - y[0])
+			- (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0)
+		return false;
+	int64_t sign = area > 0 ? 1 : -1;
+
+	/* Pixels whose centers, at + FIXED_ONE / 2, are within the vertices. */
+	const int64_t half = FIXED_ONE / 2;
+	int64_t min_x = x[0] < x[1] ? (x[0] < x[2] ? x[0] : x[2])
+			: (x[1] < x[2] ? x[1] : x[2]);
+	int64_t min_y = y[0] < y[1] ? (y[0] < y[2] ? y[0] : y[2])
+			: (y[1] < y[2] ? y[1] : y[2]);
+	int64_t max_x = x[0] > x[1] ? (x[0] > x[2] ? x[0] : x[2])
+			: (x[1] > x[2] ? x[1] : x[2]);
+	int64_t max_y = y[0] > y[1] ? (y[0] > y[2] ? y[0] : y[2])
+			: (y[1] > y[2] ? y[1] : y[2]);
+	min_x = (min_x - half + FIXED_ONE - 1) >> FIXED_SUBPIXEL_BITS;
+	min_y = (min_y - half + FIXED_ONE - 1) >> FIXED_SUBPIXEL_BITS;
+	max_x = ((max_x - half) >> FIXED_SUBPIXEL_BITS) + 1;
+	max_y = ((max_y - half) >> FIXED_SUBPIXEL_BITS) + 1;
+	setup->min_x = min_x < 0 ? 0 : (int32_t)min_x;
+	setup->min_y = min_y < 0 ? 0 : (int32_t)min_y;
+	setup->max_x = max_x > (int64_t)fb->width
+			? (int32_t)fb->width : (int32_t)max_x;
+	setup->max_y = max_y > (int64_t)fb->height
+			? (int32_t)fb->height : (int32_t)max_y;
+	if (setup->min_x >= setup->max_x || setup->min_y >= setup->max_y)
+		return false;
+
+	/* y is down, inside is positive : a top edge is flat with the inside
+	 * below, b > 0, a left edge has the inside to its right, a > 0.
+	 */
+	int64_t center_x = (int64_t)setup->min_x * FIXED_ONE + half;
+	int64_t center_y = (int64_t)setup->min_y * FIXED_ONE + half;
+	for (int e = 0; e < 3; ++e) {
+		int from = e;
+		int to = (e + 1) % 3;
+		int64_t a = (y[from] - y[to]) * sign;
+		int64_t b = (x[to] - x[from]) * sign;
+		bool top_left = a > 0 || (a == 0 && b > 0);
+		setup->a[e] = a * FIXED_ONE;
+		setup->b[e] = b * FIXED_ONE;
+		setup->origin[e] = a * (center_x - x[from])
+				+ b * (center_y - y[from]) - (top_left ? 0 : 1);
+	}
+	return true;
+}
+
+/* Rows min_y to max_y only, for bands. The origin moves down exactly. */
+void clip_fixed_setup_rows(FixedSetup* s, int32_t min_y, int32_t max_y)
+{
+	if (s->min_y < min_y) {
+		for (int e = 0; e < 3; ++e) {
+			s->origin[e] += s->b[e] * (min_y - s->min_y);
+		}
+		s->min_y = min_y;
+	}
+	s->max_y = s->max_y < max_y ? s->max_y : max_y;
+}
+
+/* Covered pixels, the benchmark's counts. */
+uint64_t count_fixed_coverage(const FixedSetup* s)
+{
+	uint64_t count = 0;
+	int64_t row[3] = { s->origin[0], s->origin[1], s->origin[2] };
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		int64_t e0 = row[0];
+		int64_t e1 = row[1];
+		int64_t e2 = row[2];
+		for (int32_t x = s->min_x; x < s->max_x; ++x) {
+			count += (e0 | e1 | e2) >= 0;
+			e0 += s->a[0];
+			e1 += s->a[1];
+			e2 += s->a[2];
+		}
+		for (int e = 0; e < 3; ++e) {
+			row[e] += s->b[e];
+		}
+	}
+	return count;
+}
+
+typedef void (*FixedRasterFn)(Framebuffer* fb, const FixedSetup* s,
+		uint32_t color);
+
+/* All three >= 0 is the sign of their or. */
+void fixed_raster_scalar(Framebuffer* fb, const FixedSetup* s, uint32_t color)
+{
+	int64_t row[3] = { s->origin[0], s->origin[1], s->origin[2] };
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		uint32_t* dst = &fb->pixels[(size_t)y * fb->stride];
+		int64_t e0 = row[0];
+		int64_t e1 = row[1];
+		int64_t e2 = row[2];
+		for (int32_t x = s->min_x; x < s->max_x; ++x) {
+			if ((e0 | e1 | e2) >= 0) {
+				dst[x] = color;
+			}
+			e0 += s->a[0];
+			e1 += s->a[1];
+			e2 += s->a[2];
+		}
+		for (int e = 0; e < 3; ++e) {
+			row[e] += s->b[e];
+		}
+	}
+}
+
+#if defined(RASTER_X86)
+
+/* 4x1 blocks, two pixels to a register. The high halves of the or of the
+ * edges, shuffled together, are a sign per pixel, set outside. Pixels left
+ * of the bounds are outside, the values are exact. The registers of a row
+ * are set up once, and step to the next row with adds.
+ */
+TARGET_SSE41 void fixed_raster_sse41(Framebuffer* fb, const FixedSetup* s,
+		uint32_t color)
+{
+	const __m128 colors = _mm_castsi128_ps(_mm_set1_epi32((int32_t)color));
+	int32_t x0 = s->min_x & ~3;
+	__m128i row_lo[3];
+	__m128i row_hi[3];
+	__m128i steps[3];
+	__m128i row_steps[3];
+	for (int e = 0; e < 3; ++e) {
+		int64_t a = s->a[e];
+		int64_t row = s->origin[e] - a * (s->min_x - x0);
+		row_lo[e] = _mm_set_epi64x(row + a, row);
+		row_hi[e] = _mm_set_epi64x(row + a * 3, row + a * 2);
+		steps[e] = _mm_set1_epi64x(a * 4);
+		row_steps[e] = _mm_set1_epi64x(s->b[e]);
+	}
+
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		uint32_t* dst = &fb->pixels[(size_t)y * fb->stride];
+		__m128i lo[3];
+		__m128i hi[3];
+		for (int e = 0; e < 3; ++e) {
+			lo[e] = row_lo[e];
+			hi[e] = row_hi[e];
+			row_lo[e] = _mm_add_epi64(row_lo[e], row_steps[e]);
+			row_hi[e] = _mm_add_epi64(row_hi[e], row_steps[e]);
+		}
+
+		for (int32_t x = x0; x < s->max_x; x += 4) {
+			__m128i out_lo = _mm_or_si128(lo[0], _mm_or_si128(lo[1], lo[2]));
+			__m128i out_hi = _mm_or_si128(hi[0], _mm_or_si128(hi[1], hi[2]));
+			__m128 outside = _mm_shuffle_ps(_mm_castsi128_ps(out_lo),
+					_mm_castsi128_ps(out_hi), _MM_SHUFFLE(3, 1, 3, 1));
+			for (int e = 0; e < 3; ++e) {
+				lo[e] = _mm_add_epi64(lo[e], steps[e]);
+				hi[e] = _mm_add_epi64(hi[e], steps[e]);
+			}
+
+			int bits = _mm_movemask_ps(outside);
+			if (bits == 0xf)
+				continue;
+			float* pixels = (float*)&dst[x];
+			_mm_storeu_ps(pixels, bits == 0 ? colors
+					: _mm_blendv_ps(colors, _mm_loadu_ps(pixels), outside));
+		}
+	}
+}
+
+/* 8x1 blocks. Registers hold pixels 0, 1, 4, 5 and 2, 3, 6, 7, the
+ * shuffle works within 128 bit lanes and puts them back in order.
+ */
+TARGET_AVX2 void fixed_raster_avx2(Framebuffer* fb, const FixedSetup* s,
+		uint32_t color)
+{
+	const __m256i colors = _mm256_set1_epi32((int32_t)color);
+	const __m256i ones = _mm256_set1_epi32(-1);
+	int32_t x0 = s->min_x & ~7;
+	__m256i row_lo[3];
+	__m256i row_hi[3];
+	__m256i steps[3];
+	__m256i row_steps[3];
+	for (int e = 0; e < 3; ++e) {
+		int64_t a = s->a[e];
+		int64_t row = s->origin[e] - a * (s->min_x - x0);
+		row_lo[e] = _mm256_set_epi64x(row + a * 5, row + a * 4, row + a,
+				row);
+		row_hi[e] = _mm256_set_epi64x(row + a * 7, row + a * 6, row + a * 3,
+				row + a * 2);
+		steps[e] = _mm256_set1_epi64x(a * 8);
+		row_steps[e] = _mm256_set1_epi64x(s->b[e]);
+	}
+
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		uint32_t* dst = &fb->pixels[(size_t)y * fb->stride];
+		__m256i lo[3];
+		__m256i hi[3];
+		for (int e = 0; e < 3; ++e) {
+			lo[e] = row_lo[e];
+			hi[e] = row_hi[e];
+			row_lo[e] = _mm256_add_epi64(row_lo[e], row_steps[e]);
+			row_hi[e] = _mm256_add_epi64(row_hi[e], row_steps[e]);
+		}
+
+		for (int32_t x = x0; x < s->max_x; x += 8) {
+			__m256i out_lo = _mm256_or_si256(lo[0],
+					_mm256_or_si256(lo[1], lo[2]));
+			__m256i out_hi = _mm256_or_si256(hi[0],
+					_mm256_or_si256(hi[1], hi[2]));
+			__m256 outside = _mm256_shuffle_ps(_mm256_castsi256_ps(out_lo),
+					_mm256_castsi256_ps(out_hi), _MM_SHUFFLE(3, 1, 3, 1));
+			for (int e = 0; e < 3; ++e) {
+				lo[e] = _mm256_add_epi64(lo[e], steps[e]);
+				hi[e] = _mm256_add_epi64(hi[e], steps[e]);
+			}
+
+			int bits = _mm256_movemask_ps(outside);
+			if (bits == 0xff)
+				continue;
+			if (bits == 0) {
+				_mm256_storeu_si256((__m256i*)&dst[x], colors);
+			} else {
+				_mm256_maskstore_epi32((int*)&dst[x], _mm256_xor_si256(
+						_mm256_castps_si256(outside), ones), colors);
+			}
+		}
+	}
+}
+
+#endif
+
+const FixedRasterFn fixed_raster_fns[RASTER_ISA_COUNT] = {
+	fixed_raster_scalar
+#if defined(RASTER_X86)
+	, fixed_raster_sse41
+	, fixed_raster_avx2
+#else
+	, NULL
+	, NULL
+#endif
+};
+
+
+/* Tiled framebuffer. 8x8 micro tiles, each 8 rows of 8 pixels, in Z order
+ * inside 64x64 macro tiles, macro tiles row by row. A triangle spanning many
+ * rows stays in a few 16 KB macro tiles instead of touching a page per row.
+ * Same RGBA8 pixels as Framebuffer, sizes padded to whole macro tiles.
+ * Resolved to a linear Framebuffer for presentation or encoding.
+ */
+#define MICRO_TILE_SIZE 8
+#define MACRO_TILE_SIZE 64
+#define MACRO_TILE_PIXELS (MACRO_TILE_SIZE * MACRO_TILE_SIZE)
+
+typedef struct TiledFramebuffer {
+	uint32_t*		pixels;
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		macro_columns;
+	uint32_t		macro_rows;
+} TiledFramebuffer;
+
+TiledFramebuffer create_tiled_framebuffer(uint32_t width, uint32_t height)
+{
+	TiledFramebuffer tfb = {
+		.pixels					= NULL
+		, .width				= width
+		, .height				= height
+		, .macro_columns		= (width + MACRO_TILE_SIZE - 1)
+				/ MACRO_TILE_SIZE
+		, .macro_rows			= (height + MACRO_TILE_SIZE - 1)
+				/ MACRO_TILE_SIZE
+	};
+	size_t count = (size_t)tfb.macro_columns * tfb.macro_rows
+			* MACRO_TILE_PIXELS;
+	tfb.pixels = malloc(sizeof(uint32_t) * count);
+	if (tfb.pixels == NULL) {
+		printf("Out of memory for a %dx%d tiled framebuffer.\n", width,
+				height);
+		exit(-1);
+	}
+	return tfb;
+}
+
+void destroy_tiled_framebuffer(TiledFramebuffer* tfb)
+{
+	free(tfb->pixels);
+	tfb->pixels = NULL;
+}
+
+void clear_tiled_framebuffer(TiledFramebuffer* tfb, uint32_t color)
+{
+	size_t count = (size_t)tfb->macro_columns * tfb->macro_rows
+			* MACRO_TILE_PIXELS;
+	for (size_t i = 0; i < count; ++i) {
+		tfb->pixels[i] = color;
+	}
+}
+
+/* Micro tile coordinates, 0 to 7, x in the even bits and y in the odd. */
+uint32_t micro_tile_index(uint32_t x, uint32_t y)
+{
+	uint32_t spread_x = (x & 1) | ((x & 2) << 1) | ((x & 4) << 2);
+	uint32_t spread_y = (y & 1) | ((y & 2) << 1) | ((y & 4) << 2);
+	return spread_x | (spread_y << 1);
+}
+
+/* Micro tile m of a macro tile, in memory order, to its tile coordinates :
+ * x from the even bits, y from the odd.
+ */
+uint32_t micro_tile_x(uint32_t m)
+{
+	return (m & 1) | ((m >> 1) & 2) | ((m >> 2) & 4);
+}
+
+uint32_t micro_tile_y(uint32_t m)
+{
+	return micro_tile_x(m >> 1);
+}
+
+/* The 8 pixel micro tile row holding (x, y), x a multiple of 8. */
+uint32_t* tiled_row(const TiledFramebuffer* tfb, uint32_t x, uint32_t y)
+{
+	size_t macro = (size_t)(y / MACRO_TILE_SIZE) * tfb->macro_columns
+			+ x / MACRO_TILE_SIZE;
+	uint32_t micro = micro_tile_index((x / MICRO_TILE_SIZE) & 7,
+			(y / MICRO_TILE_SIZE) & 7);
+	return &tfb->pixels[macro * MACRO_TILE_PIXELS
+			+ micro * MICRO_TILE_SIZE * MICRO_TILE_SIZE
+			+ (y & 7) * MICRO_TILE_SIZE];
+}
+
+/* Same coverage as the linear kernels, same edge evaluation, walked one
+ * micro tile at a time.
+ */
+typedef void (*TiledRasterFn)(TiledFramebuffer* tfb, const TriangleSetup* s,
+		uint32_t color);
+
+void tiled_raster_scalar(TiledFramebuffer* tfb, const TriangleSetup* s,
+		uint32_t color)
+{
+	for (int32_t ty = s->min_y & ~7; ty < s->max_y; ty += 8) {
+		int32_t y0 = ty > s->min_y ? ty : s->min_y;
+		int32_t y1 = ty + 8 < s->max_y ? ty + 8 : s->max_y;
+
+		for (int32_t tx = s->min_x & ~7; tx < s->max_x; tx += 8) {
+			int32_t x0 = tx > s->min_x ? tx : s->min_x;
+			int32_t x1 = tx + 8 < s->max_x ? tx + 8 : s->max_x;
+
+			uint32_t* tile = tiled_row(tfb, (uint32_t)tx, (uint32_t)ty);
+			for (int32_t y = y0; y < y1; ++y) {
+				uint32_t* row = &tile[(y - ty) * 8];
+				float row0 = s->b[0] * (float)y + s->c[0];
+				float row1 = s->b[1] * (float)y + s->c[1];
+				float row2 = s->b[2] * (float)y + s->c[2];
+
+				for (int32_t x = x0; x < x1; ++x) {
+					float e0 = s->a[0] * (float)x + row0;
+					float e1 = s->a[1] * (float)x + row1;
+					float e2 = s->a[2] * (float)x + row2;
+					if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f) {
+						row[x - tx] = color;
+					}
+				}
+			}
+		}
+	}
+}
+
+/* Pixels packed as RGBA, to BGRA when bgra, the swapchain's
+ * VK_FORMAT_B8G8R8A8_UNORM. Rows past fb's height are dropped.
+ */
+typedef void (*ResolveFn)(const TiledFramebuffer* tfb, Framebuffer* fb,
+		bool bgra);
+
+void resolve_scalar(const TiledFramebuffer* tfb, Framebuffer* fb, bool bgra)
+{
+	for (uint32_t y = 0; y < fb->height; ++y) {
+		uint32_t* dst = &fb->pixels[(size_t)y * fb->stride];
+		for (uint32_t x = 0; x < fb->stride; x += 8) {
+			const uint32_t* src = tiled_row(tfb, x, y);
+			for (int i = 0; i < 8; ++i) {
+				uint32_t p = src[i];
+				dst[x + i] = bgra ? (p & 0xff00ff00) | ((p & 0xff) << 16)
+						| ((p >> 16) & 0xff) : p;
+			}
+		}
+	}
+}
+
+#if defined(RASTER_X86)
+
+/* 4x2 blocks, as raster_sse41, two to a micro tile row pair. */
+TARGET_SSE41 void tiled_raster_sse41(TiledFramebuffer* tfb,
+		const TriangleSetup* s, uint32_t color)
+{
+	const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 colors = _mm_castsi128_ps(_mm_set1_epi32((int32_t)color));
+	__m128 a[3];
+	for (int e = 0; e < 3; ++e) {
+		a[e] = _mm_set1_ps(s->a[e]);
+	}
+
+	for (int32_t ty = s->min_y & ~7; ty < s->max_y; ty += 8) {
+		int32_t y0 = ty > (s->min_y & ~1) ? ty : s->min_y & ~1;
+		int32_t y1 = ty + 8 < s->max_y ? ty + 8 : s->max_y;
+		__m128 row_terms[8][3];
+		for (int32_t y = y0; y < y1 + 1 && y < ty + 8; ++y) {
+			for (int e = 0; e < 3; ++e) {
+				row_terms[y - ty][e] = _mm_set1_ps(
+						s->b[e] * (float)y + s->c[e]);
+			}
+		}
+
+		for (int32_t x = s->min_x & ~3; x < s->max_x; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 ax[3];
+			for (int e = 0; e < 3; ++e) {
+				ax[e] = _mm_mul_ps(a[e], px);
+			}
+			uint32_t* tile = tiled_row(tfb, (uint32_t)x & ~7u, (uint32_t)ty)
+					+ (x & 4);
+
+			for (int32_t y = y0; y < y1; y += 2) {
+				__m128 masks[2];
+				for (int r = 0; r < 2; ++r) {
+					const __m128* terms = row_terms[y - ty + r];
+					masks[r] = _mm_cmpge_ps(_mm_add_ps(ax[0], terms[0]), zero);
+					masks[r] = _mm_and_ps(masks[r], _mm_cmpge_ps(
+							_mm_add_ps(ax[1], terms[1]), zero));
+					masks[r] = _mm_and_ps(masks[r], _mm_cmpge_ps(
+							_mm_add_ps(ax[2], terms[2]), zero));
+				}
+				if ((_mm_movemask_ps(masks[0])
+						| _mm_movemask_ps(masks[1])) == 0)
+					continue;
+
+				for (int r = 0; r < 2; ++r) {
+					float* dst = (float*)&tile[(y - ty + r) * 8];
+					_mm_storeu_ps(dst, _mm_blendv_ps(_mm_loadu_ps(dst), colors,
+							masks[r]));
+				}
+			}
+		}
+	}
+}
+
+/* 8x1 blocks, as raster_avx2, one per micro tile row. */
+TARGET_AVX2 void tiled_raster_avx2(TiledFramebuffer* tfb,
+		const TriangleSetup* s, uint32_t color)
+{
+	const __m256 offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f,
+			6.0f, 7.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i colors = _mm256_set1_epi32((int32_t)color);
+	__m256 a[3];
+	for (int e = 0; e < 3; ++e) {
+		a[e] = _mm256_set1_ps(s->a[e]);
+	}
+
+	for (int32_t ty = s->min_y & ~7; ty < s->max_y; ty += 8) {
+		int32_t y0 = ty > s->min_y ? ty : s->min_y;
+		int32_t y1 = ty + 8 < s->max_y ? ty + 8 : s->max_y;
+		__m256 row_terms[8][3];
+		for (int32_t y = y0; y < y1; ++y) {
+			for (int e = 0; e < 3; ++e) {
+				row_terms[y - ty][e] = _mm256_set1_ps(
+						s->b[e] * (float)y + s->c[e]);
+			}
+		}
+
+		for (int32_t x = s->min_x & ~7; x < s->max_x; x += 8) {
+			__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), offsets);
+			__m256 ax[3];
+			for (int e = 0; e < 3; ++e) {
+				ax[e] = _mm256_mul_ps(a[e], px);
+			}
+			uint32_t* tile = tiled_row(tfb, (uint32_t)x, (uint32_t)ty);
+
+			for (int32_t y = y0; y < y1; ++y) {
+				const __m256* terms = row_terms[y - ty];
+				__m256 mask = _mm256_cmp_ps(_mm256_add_ps(ax[0], terms[0]),
+						zero, _CMP_GE_OQ);
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(
+						_mm256_add_ps(ax[1], terms[1]), zero, _CMP_GE_OQ));
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(
+						_mm256_add_ps(ax[2], terms[2]), zero, _CMP_GE_OQ));
+				if (_mm256_movemask_ps(mask) == 0)
+					continue;
+
+				_mm256_maskstore_epi32((int*)&tile[(y - ty) * 8],
+						_mm256_castps_si256(mask), colors);
+			}
+		}
+	}
+}
+
+/* Micro tiles in memory order, two side by side at a time : their 8
+ * contiguous 32 byte rows in, 8 destination rows of 64 bytes out. The
+ * destination is written once and not read again before it's presented,
+ * streaming stores keep it out of the cache, and whole 64 byte lines don't
+ * leave the write combining buffers half full. Framebuffer rows are 32 byte
+ * aligned. pshufb is SSSE3, there with SSE4.1.
+ */
+TARGET_SSE41 void resolve_sse41(const TiledFramebuffer* tfb, Framebuffer* fb,
+		bool bgra)
+{
+	const __m128i swap = bgra
+			? _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12,
+					15)
+			: _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+					15);
+	for (uint32_t my = 0; my < tfb->macro_rows; ++my) {
+		for (uint32_t mx = 0; mx < tfb->macro_columns; ++mx) {
+			const __m128i* macro = (const __m128i*)&tfb->pixels[
+					((size_t)my * tfb->macro_columns + mx) * MACRO_TILE_PIXELS];
+
+			for (uint32_t m = 0; m < 64; m += 2) {
+				uint32_t x = mx * MACRO_TILE_SIZE + micro_tile_x(m) * 8;
+				uint32_t y = my * MACRO_TILE_SIZE + micro_tile_y(m) * 8;
+				if (x >= fb->stride || y >= fb->height)
+					continue;
+				uint32_t rows = fb->height - y < 8 ? fb->height - y : 8;
+				uint32_t blocks = x + 8 < fb->stride ? 4 : 2;
+
+				const __m128i* src = &macro[m * 16];
+				__m128i* dst = (__m128i*)&fb->pixels[(size_t)y * fb->stride
+						+ x];
+				size_t pitch = fb->stride / 4;
+				for (uint32_t r = 0; r < rows; ++r) {
+					for (uint32_t i = 0; i < blocks; ++i) {
+						const __m128i* row = &src[(i / 2) * 16 + r * 2
+								+ (i & 1)];
+						_mm_stream_si128(&dst[r * pitch + i], _mm_shuffle_epi8(
+								_mm_loadu_si128(row), swap));
+					}
+				}
+			}
+		}
+	}
+	_mm_sfence();
+}
+
+TARGET_AVX2 void resolve_avx2(const TiledFramebuffer* tfb, Framebuffer* fb,
+		bool bgra)
+{
+	/* Shuffles stay within 128 bit lanes. */
+	const __m256i swap = bgra
+			? _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13,
+					12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13,
+					12, 15)
+			: _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+					14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+					14, 15);
+	for (uint32_t my = 0; my < tfb->macro_rows; ++my) {
+		for (uint32_t mx = 0; mx < tfb->macro_columns; ++mx) {
+			const __m256i* macro = (const __m256i*)&tfb->pixels[
+					((size_t)my * tfb->macro_columns + mx) * MACRO_TILE_PIXELS];
+
+			for (uint32_t m = 0; m < 64; m += 2) {
+				uint32_t x = mx * MACRO_TILE_SIZE + micro_tile_x(m) * 8;
+				uint32_t y = my * MACRO_TILE_SIZE + micro_tile_y(m) * 8;
+				if (x >= fb->stride || y >= fb->height)
+					continue;
+				uint32_t rows = fb->height - y < 8 ? fb->height - y : 8;
+				bool pair = x + 8 < fb->stride;
+
+				const __m256i* src = &macro[m * 8];
+				__m256i* dst = (__m256i*)&fb->pixels[(size_t)y * fb->stride
+						+ x];
+				size_t pitch = fb->stride / 8;
+				for (uint32_t r = 0; r < rows; ++r) {
+					_mm256_stream_si256(&dst[r * pitch], _mm256_shuffle_epi8(
+							_mm256_loadu_si256(&src[r]), swap));
+					if (pair) {
+						_mm256_stream_si256(&dst[r * pitch + 1],
+								_mm256_shuffle_epi8(_mm256_loadu_si256(
+								&src[8 + r]), swap));
+					}
+				}
+			}
+		}
+	}
+	_mm_sfence();
+}
+
+#endif
+
+const TiledRasterFn tiled_raster_fns[RASTER_ISA_COUNT] = {
+	tiled_raster_scalar
+#if defined(RASTER_X86)
+	, tiled_raster_sse41
+	, tiled_raster_avx2
+#else
+	, NULL
+	, NULL
+#endif
+};
+
+const ResolveFn resolve_fns[RASTER_ISA_COUNT] = {
+	resolve_scalar
+#if defined(RASTER_X86)
+	, resolve_sse41
+	, resolve_avx2
+#else
+	, NULL
+	, NULL
+#endif
+};
+
+
+/* 4x multisampling. Coverage is per sample, shading per pixel : a triangle
+ * writes its one color to the samples it covers. A pixel stays compressed,
+ * one color standing for its four samples, until a triangle covers only
+ * some of them, then it is expanded to four colors. Pixels whole inside a
+ * triangle, most of them, are tested once per edge against the nearest
+ * sample and written as without multisampling, and compress the pixel back.
+ * Clears are compressed too. Samples are the usual rotated grid.
+ */
+#define MSAA_SAMPLES 4
+#define MSAA_FULL 0xfu
+
+/* From the pixel center, in pixels. */
+const float msaa_sample_positions[MSAA_SAMPLES][2] = {
+	{ -0.125f, -0.375f }
+	, { 0.375f, -0.125f }
+	, { -0.375f, 0.125f }
+	, { 0.125f, 0.375f }
+};
+
+typedef struct MsaaFramebuffer {
+	/* Laid out as Framebuffer's, the color of compressed pixels. */
+	uint32_t*		pixels;
+	/* MSAA_SAMPLES per pixel, only meaningful where expanded. */
+	uint32_t*		samples;
+	/* Per pixel, 0 when compressed. */
+	uint8_t*		expanded;
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		stride;
+} MsaaFramebuffer;
+
+MsaaFramebuffer create_msaa_framebuffer(uint32_t width, uint32_t height)
+{
+	MsaaFramebuffer mfb = {
+		.pixels					= NULL
+		, .width				= width
+		, .height				= height
+		, .stride				= (width + 7) & ~7u
+	};
+
+	size_t count = (size_t)mfb.stride * ((height + 1) & ~1u);
+	mfb.pixels = malloc(sizeof(uint32_t) * count);
+	mfb.samples = malloc(sizeof(uint32_t) * MSAA_SAMPLES * count);
+	mfb.expanded = malloc(count);
+	if (mfb.pixels == NULL || mfb.samples == NULL || mfb.expanded == NULL) {
+		printf("Out of memory for a %dx%d multisampled framebuffer.\n",
+				width, height);
+		exit(-1);
+	}
+	return mfb;
+}
+
+void destroy_msaa_framebuffer(MsaaFramebuffer* mfb)
+{
+	free(mfb->pixels);
+	free(mfb->samples);
+	free(mfb->expanded);
+	mfb->pixels = NULL;
+	mfb->samples = NULL;
+	mfb->expanded = NULL;
+}
+
+/* Samples are left alone. */
+void clear_msaa_framebuffer(MsaaFramebuffer* mfb, uint32_t color)
+{
+	size_t count = (size_t)mfb->stride * ((mfb->height + 1) & ~1u);
+	for (size_t i = 0; i < count; ++i) {
+		mfb->pixels[i] = color;
+	}
+	memset(mfb->expanded, 0, count);
+}
+
+/* Visible pixels only. */
+uint64_t count_expanded(const MsaaFramebuffer* mfb)
+{
+	uint64_t count = 0;
+	for (uint32_t y = 0; y < mfb->height; ++y) {
+		const uint8_t* row = &mfb->expanded[(size_t)y * mfb->stride];
+		for (uint32_t x = 0; x < mfb->width; ++x) {
+			count += row[x] != 0;
+		}
+	}
+	return count;
+}
+
+/* What each sample adds to an edge's value at the pixel center, and the
+ * least and most of it. An edge at a sample is a * x + ((b * y + c) + d),
+ * the row's term and offset first, so per row. Sums are monotonic, a pixel
+ * is whole inside when the least passes every edge, and whole outside when
+ * the most fails one. Kernels add in this order, and agree on every sample.
+ */
+typedef struct MsaaEdgeOffsets {
+	float			samples[3][MSAA_SAMPLES];
+	float			min[3];
+	float			max[3];
+} MsaaEdgeOffsets;
+
+void msaa_edge_offsets(const TriangleSetup* s, MsaaEdgeOffsets* o)
+{
+	for (int e = 0; e < 3; ++e) {
+		o->min[e] = INFINITY;
+		o->max[e] = -INFINITY;
+		for (int i = 0; i < MSAA_SAMPLES; ++i) {
+			float d = s->a[e] * msaa_sample_positions[i][0]
+					+ s->b[e] * msaa_sample_positions[i][1];
+			o->samples[e][i] = d;
+			o->min[e] = d < o->min[e] ? d : o->min[e];
+			o->max[e] = d > o->max[e] ? d : o->max[e];
+		}
+	}
+}
+
+/* Expands the pixel first when only some samples are covered. */
+void msaa_write(MsaaFramebuffer* mfb, size_t i, uint32_t mask, uint32_t color)
+{
+	if (mask == MSAA_FULL) {
+		mfb->pixels[i] = color;
+		mfb->expanded[i] = 0;
+		return;
+	}
+
+	uint32_t* samples = &mfb->samples[i * MSAA_SAMPLES];
+	if (mfb->expanded[i] == 0) {
+		for (int s = 0; s < MSAA_SAMPLES; ++s) {
+			samples[s] = mfb->pixels[i];
+		}
+		mfb->expanded[i] = 1;
+	}
+	for (int s = 0; s < MSAA_SAMPLES; ++s) {
+		if (mask & (1u << s)) {
+			samples[s] = color;
+		}
+	}
+}
+
+/* Coverage bits of a pixel, from its a * x and its row's b * y + c. */
+uint32_t msaa_coverage(const float ax[3], const float row[3],
+		const MsaaEdgeOffsets* o)
+{
+	if (ax[0] + (row[0] + o->min[0]) >= 0.0f
+			&& ax[1] + (row[1] + o->min[1]) >= 0.0f
+			&& ax[2] + (row[2] + o->min[2]) >= 0.0f)
+		return MSAA_FULL;
+	if (!(ax[0] + (row[0] + o->max[0]) >= 0.0f
+			&& ax[1] + (row[1] + o->max[1]) >= 0.0f
+			&& ax[2] + (row[2] + o->max[2]) >= 0.0f))
+		return 0;
+
+	uint32_t mask = 0;
+	for (int i = 0; i < MSAA_SAMPLES; ++i) {
+		bool covered = ax[0] + (row[0] + o->samples[0][i]) >= 0.0f
+				&& ax[1] + (row[1] + o->samples[1][i]) >= 0.0f
+				&& ax[2] + (row[2] + o->samples[2][i]) >= 0.0f;
+		mask |= (uint32_t)covered << i;
+	}
+	return mask;
+}
+
+/* Same edge functions and bounds as the other kernels, bounds hold every
+ * sample, they are within the pixels.
+ */
+typedef void (*MsaaRasterFn)(MsaaFramebuffer* mfb, const TriangleSetup* s,
+		uint32_t color);
+
+void msaa_raster_scalar(MsaaFramebuffer* mfb, const TriangleSetup* s,
+		uint32_t color)
+{
+	MsaaEdgeOffsets o;
+	msaa_edge_offsets(s, &o);
+
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		size_t row = (size_t)y * mfb->stride;
+		float row_terms[3];
+		for (int e = 0; e < 3; ++e) {
+			row_terms[e] = s->b[e] * (float)y + s->c[e];
+		}
+
+		for (int32_t x = s->min_x; x < s->max_x; ++x) {
+			float ax[3] = {
+				s->a[0] * (float)x
+				, s->a[1] * (float)x
+				, s->a[2] * (float)x
+			};
+			uint32_t mask = msaa_coverage(ax, row_terms, &o);
+			if (mask != 0) {
+				msaa_write(mfb, row + (size_t)x, mask, color);
+			}
+		}
+	}
+}
+
+/* Compressed pixels are copied, expanded ones averaged. fb is the same
+ * size.
+ */
+typedef void (*MsaaResolveFn)(const MsaaFramebuffer* mfb, Framebuffer* fb);
+
+/* Pairwise, rounding up like pavgb, so every kernel resolves the same. */
+uint32_t msaa_average(const uint32_t* samples)
+{
+	uint32_t average = 0;
+	for (int c = 0; c < 32; c += 8) {
+		uint32_t s0 = (samples[0] >> c) & 0xff;
+		uint32_t s1 = (samples[1] >> c) & 0xff;
+		uint32_t s2 = (samples[2] >> c) & 0xff;
+		uint32_t s3 = (samples[3] >> c) & 0xff;
+		uint32_t v = (((s0 + s1 + 1) >> 1) + ((s2 + s3 + 1) >> 1) + 1) >> 1;
+		average |= v << c;
+	}
+	return average;
+}
+
+void msaa_resolve_scalar(const MsaaFramebuffer* mfb, Framebuffer* fb)
+{
+	for (uint32_t y = 0; y < fb->height; ++y) {
+		size_t row = (size_t)y * mfb->stride;
+		uint32_t* dst = &fb->pixels[(size_t)y * fb->stride];
+		for (uint32_t x = 0; x < fb->width; ++x) {
+			size_t i = row + x;
+			dst[x] = mfb->expanded[i] == 0 ? mfb->pixels[i]
+					: msaa_average(&mfb->samples[i * MSAA_SAMPLES]);
+		}
+	}
+}
+
+#if defined(RASTER_X86)
+
+/* Bits is not 0. */
+uint32_t lowest_bit(uint32_t bits)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return (uint32_t)index;
+#else
+	return (uint32_t)__builtin_ctz(bits);
+#endif
+}
+
+/* Lanes of a block where a * x plus the row's bounds pass every edge. */
+TARGET_SSE41 __m128 msaa_edges_sse41(const __m128 ax[3],
+		const __m128 bounds[3])
+{
+	const __m128 zero = _mm_setzero_ps();
+	__m128 in = _mm_cmpge_ps(_mm_add_ps(ax[0], bounds[0]), zero);
+	in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(ax[1], bounds[1]), zero));
+	return _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(ax[2], bounds[2]), zero));
+}
+
+/* 4x1 blocks. Blocks whole inside are stored as raster_sse41 does. In
+ * blocks on an edge the samples of every lane are tested together and the
+ * expanded flags updated in one go. There is no masked store, so lanes
+ * whole inside store their pixel and partly covered ones their samples
+ * one lane at a time, only loading what a compressed lane needs. A block
+ * after a whole inside one is tested whole inside first, any other for
+ * coverage first, so runs of blocks inside and outside the triangle pay
+ * one test each.
+ */
+TARGET_SSE41 void msaa_raster_sse41(MsaaFramebuffer* mfb,
+		const TriangleSetup* s, uint32_t color)
+{
+	MsaaEdgeOffsets o;
+	msaa_edge_offsets(s, &o);
+
+	const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128i colors = _mm_set1_epi32((int32_t)color);
+	const __m128i full = _mm_set1_epi32(MSAA_FULL);
+	/* Also the sample bits, there are as many samples as lanes. */
+	const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+	__m128 a[3];
+	for (int e = 0; e < 3; ++e) {
+		a[e] = _mm_set1_ps(s->a[e]);
+	}
+
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		size_t row = (size_t)y * mfb->stride;
+		__m128 min[3];
+		__m128 max[3];
+		__m128 sample_terms[3][MSAA_SAMPLES];
+		for (int e = 0; e < 3; ++e) {
+			float row_term = s->b[e] * (float)y + s->c[e];
+			min[e] = _mm_set1_ps(row_term + o.min[e]);
+			max[e] = _mm_set1_ps(row_term + o.max[e]);
+			for (int j = 0; j < MSAA_SAMPLES; ++j) {
+				sample_terms[e][j] = _mm_set1_ps(row_term + o.samples[e][j]);
+			}
+		}
+
+		bool inside = false;
+		for (int32_t x = s->min_x & ~3; x < s->max_x; x += 4) {
+			uint32_t lanes = 0xf;
+			if (x < s->min_x) {
+				lanes &= 0xfu << (s->min_x - x);
+			}
+			if (x + 4 > s->max_x) {
+				lanes &= 0xfu >> (x + 4 - s->max_x);
+			}
+
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 ax[3];
+			for (int e = 0; e < 3; ++e) {
+				ax[e] = _mm_mul_ps(a[e], px);
+			}
+			uint32_t full_bits;
+			uint32_t any_bits;
+			if (inside) {
+				full_bits = (uint32_t)_mm_movemask_ps(
+						msaa_edges_sse41(ax, min)) & lanes;
+				any_bits = full_bits == 0xf ? 0xf : (uint32_t)_mm_movemask_ps(
+						msaa_edges_sse41(ax, max)) & lanes;
+			} else {
+				any_bits = (uint32_t)_mm_movemask_ps(
+						msaa_edges_sse41(ax, max)) & lanes;
+				if (any_bits == 0)
+					continue;
+				/* Only a whole block skips the samples, they tell the
+				 * other lanes apart anyway.
+				 */
+				full_bits = any_bits != 0xf ? 0 : (uint32_t)_mm_movemask_ps(
+						msaa_edges_sse41(ax, min));
+			}
+			inside = (full_bits & 0x8) != 0;
+			if (any_bits == 0)
+				continue;
+
+			size_t i = row + (size_t)x;
+			if (full_bits == 0xf) {
+				_mm_storeu_si128((__m128i*)&mfb->pixels[i], colors);
+				memset(&mfb->expanded[i], 0, 4);
+				continue;
+			}
+
+			__m128i whole = _mm_cmpeq_epi32(_mm_and_si128(
+					_mm_set1_epi32((int32_t)full_bits), lane_bits), lane_bits);
+			__m128i partial = _mm_setzero_si128();
+			__m128i masks = _mm_setzero_si128();
+			uint32_t edge_bits = any_bits & ~full_bits;
+			if (edge_bits != 0) {
+				for (int j = 0; j < MSAA_SAMPLES; ++j) {
+					__m128 in = _mm_cmpge_ps(_mm_add_ps(ax[0],
+							sample_terms[0][j]), zero);
+					in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(ax[1],
+							sample_terms[1][j]), zero));
+					in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(ax[2],
+							sample_terms[2][j]), zero));
+					masks = _mm_or_si128(masks, _mm_and_si128(
+							_mm_castps_si128(in), _mm_set1_epi32(1 << j)));
+				}
+				__m128i edges = _mm_cmpeq_epi32(_mm_and_si128(
+						_mm_set1_epi32((int32_t)edge_bits), lane_bits),
+						lane_bits);
+				__m128i all = _mm_cmpeq_epi32(masks, full);
+				__m128i none = _mm_cmpeq_epi32(masks, _mm_setzero_si128());
+				whole = _mm_or_si128(whole, _mm_and_si128(edges, all));
+				partial = _mm_andnot_si128(_mm_or_si128(all, none), edges);
+			}
+			uint32_t whole_bits = (uint32_t)_mm_movemask_ps(
+					_mm_castsi128_ps(whole));
+			uint32_t partial_bits = (uint32_t)_mm_movemask_ps(
+					_mm_castsi128_ps(partial));
+			inside = (whole_bits & 0x8) != 0;
+			if ((whole_bits | partial_bits) == 0)
+				continue;
+
+			uint32_t flags;
+			memcpy(&flags, &mfb->expanded[i], 4);
+			__m128i expanded = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(
+					(int32_t)flags));
+			/* Compressed lanes store all their samples, from the pixel
+			 * where not covered. Expanded ones store only the covered
+			 * samples, the others go to a scratch word, so nothing waits
+			 * on loading samples or on a branch per sample.
+			 */
+			uint32_t lane_masks[4];
+			_mm_storeu_si128((__m128i*)lane_masks, masks);
+			uint32_t scratch;
+			for (uint32_t bits = partial_bits; bits != 0; bits &= bits - 1) {
+				uint32_t l = lowest_bit(bits);
+				uint32_t* samples = &mfb->samples[
+						(i + (size_t)l) * MSAA_SAMPLES];
+				if (((flags >> (l * 8)) & 0xff) == 0) {
+					__m128i covered = _mm_cmpeq_epi32(_mm_and_si128(
+							_mm_set1_epi32((int32_t)lane_masks[l]),
+							lane_bits), lane_bits);
+					_mm_storeu_si128((__m128i*)samples, _mm_blendv_epi8(
+							_mm_set1_epi32((int32_t)mfb->pixels[i + l]),
+							colors, covered));
+					continue;
+				}
+				for (int j = 0; j < MSAA_SAMPLES; ++j) {
+					uint32_t* dst = (lane_masks[l] & (1u << j)) != 0
+							? &samples[j] : &scratch;
+					*dst = color;
+				}
+			}
+			for (uint32_t bits = whole_bits; bits != 0; bits &= bits - 1) {
+				mfb->pixels[i + lowest_bit(bits)] = color;
+			}
+			/* Whole lanes compress, partly covered ones expand. */
+			expanded = _mm_or_si128(_mm_andnot_si128(whole, expanded),
+					_mm_and_si128(partial, _mm_set1_epi32(1)));
+			expanded = _mm_packus_epi16(_mm_packus_epi32(expanded, expanded),
+					expanded);
+			uint32_t changed = (uint32_t)_mm_cvtsi128_si32(expanded);
+			if (changed != flags) {
+				memcpy(&mfb->expanded[i], &changed, 4);
+			}
+		}
+	}
+}
+
+/* msaa_edges_sse41 for 8x1 blocks. */
+TARGET_AVX2 __m256 msaa_edges_avx2(const __m256 ax[3],
+		const __m256 bounds[3])
+{
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 in = _mm256_cmp_ps(_mm256_add_ps(ax[0], bounds[0]), zero,
+			_CMP_GE_OQ);
+	in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_add_ps(ax[1], bounds[1]),
+			zero, _CMP_GE_OQ));
+	return _mm256_and_ps(in, _mm256_cmp_ps(_mm256_add_ps(ax[2], bounds[2]),
+			zero, _CMP_GE_OQ));
+}
+
+/* 8x1 blocks, as msaa_raster_sse41. Partly covered lanes write their
+ * samples a pair of pixels at a time, the lane masks and pixels broadcast
+ * to the samples, so nothing is done a lane at a time.
+ */
+TARGET_AVX2 void msaa_raster_avx2(MsaaFramebuffer* mfb,
+		const TriangleSetup* s, uint32_t color)
+{
+	MsaaEdgeOffsets o;
+	msaa_edge_offsets(s, &o);
+
+	const __m256 offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f,
+			6.0f, 7.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i colors = _mm256_set1_epi32((int32_t)color);
+	const __m256i full = _mm256_set1_epi32(MSAA_FULL);
+	const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	const __m256i sample_bits = _mm256_setr_epi32(1, 2, 4, 8, 1, 2, 4, 8);
+	/* The first pixel of a pair for its first 4 samples. */
+	const __m256i pair_lanes = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+	__m256 a[3];
+	for (int e = 0; e < 3; ++e) {
+		a[e] = _mm256_set1_ps(s->a[e]);
+	}
+
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		size_t row = (size_t)y * mfb->stride;
+		__m256 min[3];
+		__m256 max[3];
+		__m256 sample_terms[3][MSAA_SAMPLES];
+		for (int e = 0; e < 3; ++e) {
+			float row_term = s->b[e] * (float)y + s->c[e];
+			min[e] = _mm256_set1_ps(row_term + o.min[e]);
+			max[e] = _mm256_set1_ps(row_term + o.max[e]);
+			for (int j = 0; j < MSAA_SAMPLES; ++j) {
+				sample_terms[e][j] = _mm256_set1_ps(row_term + o.samples[e][j]);
+			}
+		}
+
+		bool inside = false;
+		for (int32_t x = s->min_x & ~7; x < s->max_x; x += 8) {
+			uint32_t lanes = 0xff;
+			if (x < s->min_x) {
+				lanes &= 0xffu << (s->min_x - x);
+			}
+			if (x + 8 > s->max_x) {
+				lanes &= 0xffu >> (x + 8 - s->max_x);
+			}
+
+			__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), offsets);
+			__m256 ax[3];
+			for (int e = 0; e < 3; ++e) {
+				ax[e] = _mm256_mul_ps(a[e], px);
+			}
+			uint32_t full_bits;
+			uint32_t any_bits;
+			if (inside) {
+				full_bits = (uint32_t)_mm256_movemask_ps(
+						msaa_edges_avx2(ax, min)) & lanes;
+				any_bits = full_bits == 0xff ? 0xff
+						: (uint32_t)_mm256_movemask_ps(
+						msaa_edges_avx2(ax, max)) & lanes;
+			} else {
+				any_bits = (uint32_t)_mm256_movemask_ps(
+						msaa_edges_avx2(ax, max)) & lanes;
+				if (any_bits == 0)
+					continue;
+				/* Only a whole block skips the samples, they tell the
+				 * other lanes apart anyway.
+				 */
+				full_bits = any_bits != 0xff ? 0 : (uint32_t)_mm256_movemask_ps(
+						msaa_edges_avx2(ax, min));
+			}
+			inside = (full_bits & 0x80) != 0;
+			if (any_bits == 0)
+				continue;
+
+			size_t i = row + (size_t)x;
+			if (full_bits == 0xff) {
+				_mm256_storeu_si256((__m256i*)&mfb->pixels[i], colors);
+				memset(&mfb->expanded[i], 0, 8);
+				continue;
+			}
+
+			__m256i whole = _mm256_cmpeq_epi32(_mm256_and_si256(
+					_mm256_set1_epi32((int32_t)full_bits), lane_bits),
+					lane_bits);
+			__m256i partial = _mm256_setzero_si256();
+			__m256i masks = _mm256_setzero_si256();
+			uint32_t edge_bits = any_bits & ~full_bits;
+			if (edge_bits != 0) {
+				for (int j = 0; j < MSAA_SAMPLES; ++j) {
+					__m256 in = _mm256_cmp_ps(_mm256_add_ps(ax[0],
+							sample_terms[0][j]), zero, _CMP_GE_OQ);
+					in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_add_ps(ax[1],
+							sample_terms[1][j]), zero, _CMP_GE_OQ));
+					in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_add_ps(ax[2],
+							sample_terms[2][j]), zero, _CMP_GE_OQ));
+					masks = _mm256_or_si256(masks, _mm256_and_si256(
+							_mm256_castps_si256(in),
+							_mm256_set1_epi32(1 << j)));
+				}
+				__m256i edges = _mm256_cmpeq_epi32(_mm256_and_si256(
+						_mm256_set1_epi32((int32_t)edge_bits), lane_bits),
+						lane_bits);
+				__m256i all = _mm256_cmpeq_epi32(masks, full);
+				__m256i none = _mm256_cmpeq_epi32(masks,
+						_mm256_setzero_si256());
+				whole = _mm256_or_si256(whole, _mm256_and_si256(edges, all));
+				partial = _mm256_andnot_si256(_mm256_or_si256(all, none),
+						edges);
+			}
+			uint32_t whole_bits = (uint32_t)_mm256_movemask_ps(
+					_mm256_castsi256_ps(whole));
+			uint32_t partial_bits = (uint32_t)_mm256_movemask_ps(
+					_mm256_castsi256_ps(partial));
+			inside = (whole_bits & 0x80) != 0;
+			if ((whole_bits | partial_bits) == 0)
+				continue;
+
+			__m256i* pixels = (__m256i*)&mfb->pixels[i];
+			__m128i* flags = (__m128i*)&mfb->expanded[i];
+			__m256i expanded = _mm256_cvtepu8_epi32(_mm_loadl_epi64(flags));
+			if (partial_bits != 0) {
+				/* Compressed lanes store all their samples, from the pixel
+				 * where not covered. Pixels are only loaded for them, most
+				 * edge pixels are expanded already.
+				 */
+				__m256i compressed = _mm256_and_si256(partial,
+						_mm256_cmpeq_epi32(expanded, _mm256_setzero_si256()));
+				__m256i old = _mm256_testz_si256(compressed, compressed)
+						? _mm256_setzero_si256() : _mm256_loadu_si256(pixels);
+				for (int p = 0; p < 4; ++p) {
+					__m256i pair = _mm256_add_epi32(pair_lanes,
+							_mm256_set1_epi32(2 * p));
+					__m256i covered = _mm256_cmpeq_epi32(_mm256_and_si256(
+							_mm256_permutevar8x32_epi32(masks, pair),
+							sample_bits), sample_bits);
+					__m256i store = _mm256_or_si256(
+							_mm256_permutevar8x32_epi32(compressed, pair),
+							_mm256_and_si256(covered,
+							_mm256_permutevar8x32_epi32(partial, pair)));
+					_mm256_maskstore_epi32((int*)&mfb->samples[
+							(i + 2 * (size_t)p) * MSAA_SAMPLES], store,
+							_mm256_blendv_epi8(
+							_mm256_permutevar8x32_epi32(old, pair), colors,
+							covered));
+				}
+			}
+			if (whole_bits != 0) {
+				_mm256_maskstore_epi32((int*)pixels, whole, colors);
+			}
+			/* Whole lanes compress, partly covered ones expand. */
+			expanded = _mm256_or_si256(_mm256_andnot_si256(whole, expanded),
+					_mm256_and_si256(partial, _mm256_set1_epi32(1)));
+			__m128i bytes = _mm_packus_epi32(_mm256_castsi256_si128(expanded),
+					_mm256_extracti128_si256(expanded, 1));
+			_mm_storel_epi64(flags, _mm_packus_epi16(bytes, bytes));
+		}
+	}
+}
+
+/* msaa_average with two pavgb, the samples are 16 contiguous bytes. */
+TARGET_SSE41 uint32_t msaa_average_sse41(const uint32_t* samples)
+{
+	__m128i v = _mm_loadu_si128((const __m128i*)samples);
+	v = _mm_avg_epu8(v, _mm_srli_si128(v, 4));
+	v = _mm_avg_epu8(v, _mm_srli_si128(v, 8));
+	return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+/* Runs of 4 compressed pixels are copied whole. */
+TARGET_SSE41 void msaa_resolve_sse41(const MsaaFramebuffer* mfb,
+		Framebuffer* fb)
+{
+	for (uint32_t y = 0; y < fb->height; ++y) {
+		size_t row = (size_t)y * mfb->stride;
+		uint32_t* dst = &fb->pixels[(size_t)y * fb->stride];
+		for (uint32_t x = 0; x < fb->stride; x += 4) {
+			size_t i = row + x;
+			uint32_t expanded;
+			memcpy(&expanded, &mfb->expanded[i], 4);
+			if (expanded == 0) {
+				_mm_storeu_si128((__m128i*)&dst[x], _mm_loadu_si128(
+						(const __m128i*)&mfb->pixels[i]));
+				continue;
+			}
+			for (int l = 0; l < 4; ++l) {
+				dst[x + l] = mfb->expanded[i + l] == 0 ? mfb->pixels[i + l]
+						: msaa_average_sse41(
+								&mfb->samples[(i + l) * MSAA_SAMPLES]);
+			}
+		}
+	}
+}
+
+/* Runs of 8. */
+TARGET_AVX2 void msaa_resolve_avx2(const MsaaFramebuffer* mfb,
+		Framebuffer* fb)
+{
+	for (uint32_t y = 0; y < fb->height; ++y) {
+		size_t row = (size_t)y * mfb->stride;
+		uint32_t* dst = &fb->pixels[(size_t)y * fb->stride];
+		for (uint32_t x = 0; x < fb->stride; x += 8) {
+			size_t i = row + x;
+			uint64_t expanded;
+			memcpy(&expanded, &mfb->expanded[i], 8);
+			if (expanded == 0) {
+				_mm256_storeu_si256((__m256i*)&dst[x], _mm256_loadu_si256(
+						(const __m256i*)&mfb->pixels[i]));
+				continue;
+			}
+			for (int l = 0; l < 8; ++l) {
+				dst[x + l] = mfb->expanded[i + l] == 0 ? mfb->pixels[i + l]
+						: msaa_average_sse41(
+								&mfb->samples[(i + l) * MSAA_SAMPLES]);
+			}
+		}
+	}
+}
+
+#endif
+
+const MsaaRasterFn msaa_raster_fns[RASTER_ISA_COUNT] = {
+	msaa_raster_scalar
+#if defined(RASTER_X86)
+	, msaa_raster_sse41
+	, msaa_raster_avx2
+#else
+	, NULL
+	, NULL
+#endif
+};
+
+const MsaaResolveFn msaa_resolve_fns[RASTER_ISA_COUNT] = {
+	msaa_resolve_scalar
+#if defined(RASTER_X86)
+	, msaa_resolve_sse41
+	, msaa_resolve_avx2
+#else
+	, NULL
+	, NULL
+#endif
+};
+
+
+/* Visibility buffer. Drawing takes two passes : the first only depth tests,
+ * and keeps the depth and index of the nearest triangle in each pixel. The
+ * second interpolates and shades each pixel once, for the triangle that won
+ * it. Under overdraw, covered pixels cost an edge and depth test, shading
+ * is paid once per visible pixel. Forward drawing, shading every pixel that
+ * passes the depth test, is kept to compare.
+ */
+#define VISIBILITY_NONE 0xffffffffu
+
+/* Depth and vertex colors. Planes are f = a * x + (b * y + c) at pixel
+ * centers, like the edge functions.
+ */
+typedef struct ShadedTriangle {
+	TriangleSetup	setup;
+	float			z[3];
+	/* Weights of vertices 1 and 2, vertex 0 has what's left. */
+	float			w1[3];
+	float			w2[3];
+	float			colors[3][4];
+} ShadedTriangle;
+
+void setup_plane(const float* screen, const float f[3], float plane[3])
+{
+	float x10 = screen[2] - screen[0];
+	float y10 = screen[3] - screen[1];
+	float x20 = screen[4] - screen[0];
+	float y20 = screen[5] - screen[1];
+	float area = x10 * y20 - x20 * y10;
+	float dfdx = ((f[1] - f[0]) * y20 - (f[2] - f[0]) * y10) / area;
+	float dfdy = (x10 * (f[2] - f[0]) - (f[1] - f[0]) * x20) / area;
+	plane[0] = dfdx;
+	plane[1] = dfdy;
+	plane[2] = f[0] + dfdx * (0.5f - screen[0]) + dfdy * (0.5f - screen[1]);
+}
+
+bool setup_shaded_triangle(const float* screen, const float z[3],
+		const float colors[3][4], const Framebuffer* fb, ShadedTriangle* t)
+{
+	if (!setup_triangle(screen, fb, &t->setup))
+		return false;
+
+	const float w1[3] = { 0.0f, 1.0f, 0.0f };
+	const float w2[3] = { 0.0f, 0.0f, 1.0f };
+	setup_plane(screen, z, t->z);
+	setup_plane(screen, w1, t->w1);
+	setup_plane(screen, w2, t->w2);
+	memcpy(t->colors, colors, sizeof(t->colors));
+	return true;
+}
+
+float plane_at(const float plane[3], int32_t x, int32_t y)
+{
+	return plane[0] * (float)x + (plane[1] * (float)y + plane[2]);
+}
+
+/* The fragment shader, vertex colors interpolated. */
+uint32_t shade_pixel(const ShadedTriangle* t, int32_t x, int32_t y)
+{
+	float w1 = plane_at(t->w1, x, y);
+	float w2 = plane_at(t->w2, x, y);
+	float w0 = 1.0f - w1 - w2;
+	float rgba[4];
+	for (int c = 0; c < 4; ++c) {
+		rgba[c] = w0 * t->colors[0][c] + w1 * t->colors[1][c]
+				+ w2 * t->colors[2][c];
+	}
+	return pack_rgba(rgba);
+}
+
+/* Laid out as Framebuffer. Forward drawing only uses the depth. */
+typedef struct VisibilityBuffer {
+	float*			depth;
+	uint32_t*		ids;
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		stride;
+} VisibilityBuffer;
+
+VisibilityBuffer create_visibility_buffer(uint32_t width, uint32_t height)
+{
+	VisibilityBuffer vb = {
+		.depth					= NULL
+		, .width				= width
+		, .height				= height
+		, .stride				= (width + 7) & ~7u
+	};
+
+	size_t count = (size_t)vb.stride * ((height + 1) & ~1u);
+	vb.depth = malloc(sizeof(float) * count);
+	vb.ids = malloc(sizeof(uint32_t) * count);
+	if (vb.depth == NULL || vb.ids == NULL) {
+		printf("Out of memory for a %dx%d visibility buffer.\n", width,
+				height);
+		exit(-1);
+	}
+	return vb;
+}
+
+void destroy_visibility_buffer(VisibilityBuffer* vb)
+{
+	free(vb->depth);
+	free(vb->ids);
+	vb->depth = NULL;
+	vb->ids = NULL;
+}
+
+/* Far plane, no triangle. */
+void clear_visibility_buffer(VisibilityBuffer* vb)
+{
+	size_t count = (size_t)vb->stride * ((vb->height + 1) & ~1u);
+	for (size_t i = 0; i < count; ++i) {
+		vb->depth[i] = 1.0f;
+		vb->ids[i] = VISIBILITY_NONE;
+	}
+}
+
+/* Shades every pixel nearer than what's there. Returns how many. */
+uint64_t draw_forward(Framebuffer* fb, VisibilityBuffer* vb,
+		const ShadedTriangle* triangles, uint32_t count)
+{
+	uint64_t shaded = 0;
+	for (uint32_t t = 0; t < count; ++t) {
+		const ShadedTriangle* triangle = &triangles[t];
+		const TriangleSetup* s = &triangle->setup;
+		for (int32_t y = s->min_y; y < s->max_y; ++y) {
+			uint32_t* row = &fb->pixels[(size_t)y * fb->stride];
+			float* depth = &vb->depth[(size_t)y * vb->stride];
+			float row0 = s->b[0] * (float)y + s->c[0];
+			float row1 = s->b[1] * (float)y + s->c[1];
+			float row2 = s->b[2] * (float)y + s->c[2];
+			float row_z = triangle->z[1] * (float)y + triangle->z[2];
+
+			for (int32_t x = s->min_x; x < s->max_x; ++x) {
+				float e0 = s->a[0] * (float)x + row0;
+				float e1 = s->a[1] * (float)x + row1;
+				float e2 = s->a[2] * (float)x + row2;
+				float z = triangle->z[0] * (float)x + row_z;
+				if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f && z < depth[x]) {
+					depth[x] = z;
+					row[x] = shade_pixel(triangle, x, y);
+					++shaded;
+				}
+			}
+		}
+	}
+	return shaded;
+}
+
+/* First pass, same coverage and depth as draw_forward, triangle indices
+ * instead of colors.
+ */
+typedef void (*VisibilityFn)(VisibilityBuffer* vb,
+		const ShadedTriangle* triangles, uint32_t count);
+
+/* No branch on the depth test. */
+void draw_visibility_scalar(VisibilityBuffer* vb,
+		const ShadedTriangle* triangles, uint32_t count)
+{
+	for (uint32_t t = 0; t < count; ++t) {
+		const ShadedTriangle* triangle = &triangles[t];
+		const TriangleSetup* s = &triangle->setup;
+		for (int32_t y = s->min_y; y < s->max_y; ++y) {
+			float* depth = &vb->depth[(size_t)y * vb->stride];
+			uint32_t* ids = &vb->ids[(size_t)y * vb->stride];
+			float row0 = s->b[0] * (float)y + s->c[0];
+			float row1 = s->b[1] * (float)y + s->c[1];
+			float row2 = s->b[2] * (float)y + s->c[2];
+			float row_z = triangle->z[1] * (float)y + triangle->z[2];
+
+			for (int32_t x = s->min_x; x < s->max_x; ++x) {
+				float e0 = s->a[0] * (float)x + row0;
+				float e1 = s->a[1] * (float)x + row1;
+				float e2 = s->a[2] * (float)x + row2;
+				float z = triangle->z[0] * (float)x + row_z;
+				bool write = e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f
+						&& z < depth[x];
+				depth[x] = write ? z : depth[x];
+				ids[x] = write ? t : ids[x];
+			}
+		}
+	}
+}
+
+#if defined(RASTER_X86)
+
+/* 4x1 blocks. Blocks no pixel of the triangle covers don't touch the
+ * buffer, the others blend depth and index in where the test passes.
+ */
+TARGET_SSE41 void draw_visibility_sse41(VisibilityBuffer* vb,
+		const ShadedTriangle* triangles, uint32_t count)
+{
+	const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 zero = _mm_setzero_ps();
+	for (uint32_t t = 0; t < count; ++t) {
+		const ShadedTriangle* triangle = &triangles[t];
+		const TriangleSetup* s = &triangle->setup;
+		const __m128 min_x = _mm_set1_ps((float)s->min_x);
+		const __m128 max_x = _mm_set1_ps((float)s->max_x);
+		const __m128 ids = _mm_castsi128_ps(_mm_set1_epi32((int32_t)t));
+		__m128 a[4];
+		for (int e = 0; e < 3; ++e) {
+			a[e] = _mm_set1_ps(s->a[e]);
+		}
+		a[3] = _mm_set1_ps(triangle->z[0]);
+
+		for (int32_t y = s->min_y; y < s->max_y; ++y) {
+			size_t row = (size_t)y * vb->stride;
+			__m128 row_terms[4];
+			for (int e = 0; e < 3; ++e) {
+				row_terms[e] = _mm_set1_ps(s->b[e] * (float)y + s->c[e]);
+			}
+			row_terms[3] = _mm_set1_ps(triangle->z[1] * (float)y
+					+ triangle->z[2]);
+
+			for (int32_t x = s->min_x & ~3; x < s->max_x; x += 4) {
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+				__m128 mask = _mm_and_ps(_mm_cmpge_ps(px, min_x),
+						_mm_cmplt_ps(px, max_x));
+				for (int e = 0; e < 3; ++e) {
+					mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(
+							_mm_mul_ps(a[e], px), row_terms[e]), zero));
+				}
+				if (_mm_movemask_ps(mask) == 0)
+					continue;
+
+				float* depth = &vb->depth[row + (size_t)x];
+				float* id = (float*)&vb->ids[row + (size_t)x];
+				__m128 old = _mm_loadu_ps(depth);
+				__m128 z = _mm_add_ps(_mm_mul_ps(a[3], px), row_terms[3]);
+				mask = _mm_and_ps(mask, _mm_cmplt_ps(z, old));
+				if (_mm_movemask_ps(mask) == 0)
+					continue;
+
+				_mm_storeu_ps(depth, _mm_blendv_ps(old, z, mask));
+				_mm_storeu_ps(id, _mm_blendv_ps(_mm_loadu_ps(id), ids, mask));
+			}
+		}
+	}
+}
+
+/* 8x1 blocks, as draw_visibility_sse41, masked stores. */
+TARGET_AVX2 void draw_visibility_avx2(VisibilityBuffer* vb,
+		const ShadedTriangle* triangles, uint32_t count)
+{
+	const __m256 offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f,
+			6.0f, 7.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	for (uint32_t t = 0; t < count; ++t) {
+		const ShadedTriangle* triangle = &triangles[t];
+		const TriangleSetup* s = &triangle->setup;
+		const __m256 min_x = _mm256_set1_ps((float)s->min_x);
+		const __m256 max_x = _mm256_set1_ps((float)s->max_x);
+		const __m256i ids = _mm256_set1_epi32((int32_t)t);
+		__m256 a[4];
+		for (int e = 0; e < 3; ++e) {
+			a[e] = _mm256_set1_ps(s->a[e]);
+		}
+		a[3] = _mm256_set1_ps(triangle->z[0]);
+
+		for (int32_t y = s->min_y; y < s->max_y; ++y) {
+			size_t row = (size_t)y * vb->stride;
+			__m256 row_terms[4];
+			for (int e = 0; e < 3; ++e) {
+				row_terms[e] = _mm256_set1_ps(s->b[e] * (float)y + s->c[e]);
+			}
+			row_terms[3] = _mm256_set1_ps(triangle->z[1] * (float)y
+					+ triangle->z[2]);
+
+			for (int32_t x = s->min_x & ~7; x < s->max_x; x += 8) {
+				__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), offsets);
+				__m256 mask = _mm256_and_ps(
+						_mm256_cmp_ps(px, min_x, _CMP_GE_OQ),
+						_mm256_cmp_ps(px, max_x, _CMP_LT_OQ));
+				for (int e = 0; e < 3; ++e) {
+					mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(
+							_mm256_mul_ps(a[e], px), row_terms[e]), zero,
+							_CMP_GE_OQ));
+				}
+				if (_mm256_movemask_ps(mask) == 0)
+					continue;
+
+				float* depth = &vb->depth[row + (size_t)x];
+				__m256 z = _mm256_add_ps(_mm256_mul_ps(a[3], px),
+						row_terms[3]);
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(z,
+						_mm256_loadu_ps(depth), _CMP_LT_OQ));
+				if (_mm256_movemask_ps(mask) == 0)
+					continue;
+
+				__m256i store = _mm256_castps_si256(mask);
+				_mm256_maskstore_ps(depth, store, z);
+				_mm256_maskstore_epi32((int*)&vb->ids[row + (size_t)x], store,
+						ids);
+			}
+		}
+	}
+}
+
+#endif
+
+const VisibilityFn visibility_fns[RASTER_ISA_COUNT] = {
+	draw_visibility_scalar
+#if defined(RASTER_X86)
+	, draw_visibility_sse41
+	, draw_visibility_avx2
+#else
+	, NULL
+	, NULL
+#endif
+};
+
+/* Second pass, pixels without a triangle are left alone. Returns how many
+ * were shaded.
+ */
+uint64_t shade_visibility(const VisibilityBuffer* vb,
+		const ShadedTriangle* triangles, Framebuffer* fb)
+{
+	uint64_t shaded = 0;
+	for (uint32_t y = 0; y < fb->height; ++y) {
+		const uint32_t* ids = &vb->ids[(size_t)y * vb->stride];
+		uint32_t* row = &fb->pixels[(size_t)y * fb->stride];
+		for (uint32_t x = 0; x < fb->width; ++x) {
+			if (ids[x] == VISIBILITY_NONE)
+				continue;
+			row[x] = shade_pixel(&triangles[ids[x]], (int32_t)x, (int32_t)y);
+			++shaded;
+		}
+	}
+	return shaded;
+}
+
+/* The demo triangle through both passes, its flat color at every vertex.
+ * Its z is 0, halfway into the depth range.
+ */
+void draw_visibility_demo(const float* screen, uint32_t color,
+		Framebuffer* fb, VisibilityFn draw_visibility)
+{
+	const float z[3] = { 0.5f, 0.5f, 0.5f };
+	float colors[3][4];
+	for (int v = 0; v < 3; ++v) {
+		for (int c = 0; c < 4; ++c) {
+			colors[v][c] = (float)((color >> (c * 8)) & 0xff) / 255.0f;
+		}
+	}
+
+	ShadedTriangle triangle;
+	uint32_t count = setup_shaded_triangle(screen, z, colors, fb, &triangle)
+			? 1 : 0;
+	VisibilityBuffer vb = create_visibility_buffer(fb->width, fb->height);
+	clear_visibility_buffer(&vb);
+	draw_visibility(&vb, &triangle, count);
+	shade_visibility(&vb, &triangle, fb);
+	destroy_visibility_buffer(&vb);
+}
+
+
+/* Vertex stage, for everything the CPU draws or tests itself. Positions are
+ * transposed to structure of arrays, then transformed, projected and given
+ * clip codes 8 at a time. Triangles are culled 8 at a time too, only the
+ * few crossing the near plane or the guard band are clipped, one by one.
+ * Clip space is Vulkan's, y down and z from 0 to 1. Front faces are counter
+ * clockwise on screen.
+ */
+
+/* How far out of the viewport, in viewports, triangles go before they are
+ * clipped. The raster clamps its bounds, the limit is float precision.
+ */
+#define GUARD_BAND 4.0f
+
+#define CLIP_LEFT		0x01
+#define CLIP_RIGHT		0x02
+#define CLIP_TOP		0x04
+#define CLIP_BOTTOM		0x08
+#define CLIP_NEAR		0x10
+#define CLIP_FAR		0x20
+#define CLIP_GUARD		0x40
+/* All 3 vertices out of the same plane, the triangle is gone. */
+#define CLIP_FRUSTUM	0x3f
+/* Any vertex out of these, the triangle is clipped. */
+#define CLIP_NEEDED		(CLIP_NEAR | CLIP_GUARD)
+
+/* Arrays are padded to whole 8 vertex blocks. Screen positions are only
+ * meaningful for vertices in front of the near plane.
+ */
+typedef struct VertexStream {
+	float*			x;
+	float*			y;
+	float*			z;
+	float*			sx;
+	float*			sy;
+	float*			sz;
+	uint32_t*		codes;
+	uint32_t		count;
+} VertexStream;
+
+/* Screen positions as setup_triangle takes them, depth apart. */
+typedef struct ScreenTriangle {
+	float			xy[6];
+	float			z[3];
+} ScreenTriangle;
+
+typedef struct TriangleStats {
+	uint32_t		emitted;
+	uint32_t		outside;
+	uint32_t		back_faces;
+	uint32_t		clipped;
+} TriangleStats;
+
+VertexStream create_vertex_stream(uint32_t count)
+{
+	uint32_t padded = (count + 7) & ~7u;
+	VertexStream vs = { .count = count };
+	float** arrays[6] = { &vs.x, &vs.y, &vs.z, &vs.sx, &vs.sy, &vs.sz };
+	for (int i = 0; i < 6; ++i) {
+		*arrays[i] = calloc(padded, sizeof(float));
+	}
+	vs.codes = calloc(padded, sizeof(uint32_t));
+	if (vs.x == NULL || vs.y == NULL || vs.z == NULL || vs.sx == NULL
+			|| vs.sy == NULL || vs.sz == NULL || vs.codes == NULL)
+	{
+		printf("Out of memory for %d vertices.\n", count);
+		exit(-1);
+	}
+	return vs;
+}
+
+void destroy_vertex_stream(VertexStream* vs)
+{
+	free(vs->x);
+	free(vs->y);
+	free(vs->z);
+	free(vs->sx);
+	free(vs->sy);
+	free(vs->sz);
+	free(vs->codes);
+	*vs = (VertexStream){0};
+}
+
+/* From interleaved xyz, the layout the OpenGL demos hand the driver. */
+void load_vertex_stream(VertexStream* vs, const float* positions)
+{
+	for (uint32_t v = 0; v < vs->count; ++v) {
+		vs->x[v] = positions[v * 3 + 0];
+		vs->y[v] = positions[v * 3 + 1];
+		vs->z[v] = positions[v * 3 + 2];
+	}
+}
+
+void transform_position(const float m[16], float x, float y, float z,
+		float clip[4])
+{
+	for (int r = 0; r < 4; ++r) {
+		clip[r] = m[r] * x + m[4 + r] * y + m[8 + r] * z + m[12 + r];
+	}
+}
+
+uint32_t clip_code(const float clip[4])
+{
+	float x = clip[0];
+	float y = clip[1];
+	float z = clip[2];
+	float w = clip[3];
+	float gw = GUARD_BAND * w;
+	return (x < -w ? CLIP_LEFT : 0) | (x > w ? CLIP_RIGHT : 0)
+			| (y < -w ? CLIP_TOP : 0) | (y > w ? CLIP_BOTTOM : 0)
+			| (z < 0.0f ? CLIP_NEAR : 0) | (z > w ? CLIP_FAR : 0)
+			| (x < -gw || x > gw || y < -gw || y > gw ? CLIP_GUARD : 0);
+}
+
+typedef void (*TransformFn)(VertexStream* vs, const float m[16],
+		float width, float height);
+
+void transform_vertices_scalar(VertexStream* vs, const float m[16],
+		float width, float height)
+{
+	for (uint32_t v = 0; v < vs->count; ++v) {
+		float clip[4];
+		transform_position(m, vs->x[v], vs->y[v], vs->z[v], clip);
+		float inv_w = 1.0f / clip[3];
+		vs->sx[v] = (clip[0] * inv_w * 0.5f + 0.5f) * width;
+		vs->sy[v] = (clip[1] * inv_w * 0.5f + 0.5f) * height;
+		vs->sz[v] = clip[2] * inv_w;
+		vs->codes[v] = clip_code(clip);
+	}
+}
+
+/* Against z >= 0 and the guard band, then back to the screen as a fan.
+ * Returns how many triangles it wrote, at most 6.
+ */
+uint32_t clip_triangle(const VertexStream* vs, const float m[16],
+		const uint32_t* indices, bool cull_back, float width, float height,
+		ScreenTriangle* out)
+{
+	float polygon[2][9][4];
+	uint32_t count = 3;
+	for (int v = 0; v < 3; ++v) {
+		uint32_t i = indices[v];
+		transform_position(m, vs->x[i], vs->y[i], vs->z[i], polygon[0][v]);
+	}
+
+	/* Distances to near, left, right, top and bottom, >= 0 inside. */
+	const float planes[5][4] = {
+		{ 0.0f, 0.0f, 1.0f, 0.0f }
+		, { 1.0f, 0.0f, 0.0f, GUARD_BAND }
+		, { -1.0f, 0.0f, 0.0f, GUARD_BAND }
+		, { 0.0f, 1.0f, 0.0f, GUARD_BAND }
+		, { 0.0f, -1.0f, 0.0f, GUARD_BAND }
+	};
+
+	int src = 0;
+	for (int p = 0; p < 5 && count >= 3; ++p) {
+		const float* plane = planes[p];
+		uint32_t kept = 0;
+		for (uint32_t v = 0; v < count; ++v) {
+			const float* a = polygon[src][v];
+			const float* b = polygon[src][(v + 1) % count];
+			float da = plane[0] * a[0] + plane[1] * a[1] + plane[2] * a[2]
+					+ plane[3] * a[3];
+			float db = plane[0] * b[0] + plane[1] * b[1] + plane[2] * b[2]
+					+ plane[3] * b[3];
+			if (da >= 0.0f) {
+				memcpy(polygon[1 - src][kept++], a, sizeof(float) * 4);
+			}
+			if ((da >= 0.0f) != (db >= 0.0f)) {
+				float t = da / (da - db);
+				for (int c = 0; c < 4; ++c) {
+					polygon[1 - src][kept][c] = a[c] + (b[c] - a[c]) * t;
+				}
+				++kept;
+			}
+		}
+		count = kept;
+		src = 1 - src;
+	}
+	if (count < 3)
+		return 0;
+
+	float screen[9][3];
+	float area = 0.0f;
+	for (uint32_t v = 0; v < count; ++v) {
+		const float* c = polygon[src][v];
+		float inv_w = 1.0f / c[3];
+		screen[v][0] = (c[0] * inv_w * 0.5f + 0.5f) * width;
+		screen[v][1] = (c[1] * inv_w * 0.5f + 0.5f) * height;
+		screen[v][2] = c[2] * inv_w;
+	}
+	for (uint32_t v = 0; v < count; ++v) {
+		const float* a = screen[v];
+		const float* b = screen[(v + 1) % count];
+		area += a[0] * b[1] - b[0] * a[1];
+	}
+	if (cull_back ? area >= 0.0f : area == 0.0f)
+		return 0;
+
+	for (uint32_t t = 0; t + 2 < count; ++t) {
+		const uint32_t fan[3] = { 0, t + 1, t + 2 };
+		for (int v = 0; v < 3; ++v) {
+			out[t].xy[v * 2 + 0] = screen[fan[v]][0];
+			out[t].xy[v * 2 + 1] = screen[fan[v]][1];
+			out[t].z[v] = screen[fan[v]][2];
+		}
+	}
+	return count - 2;
+}
+
+void emit_triangle(const VertexStream* vs, const uint32_t* indices,
+		ScreenTriangle* out)
+{
+	for (int v = 0; v < 3; ++v) {
+		uint32_t i = indices[v];
+		out->xy[v * 2 + 0] = vs->sx[i];
+		out->xy[v * 2 + 1] = vs->sy[i];
+		out->z[v] = vs->sz[i];
+	}
+}
+
+/* One triangle of the scalar path, the vector one falls back to it. */
+uint32_t process_triangle(const VertexStream* vs, const float m[16],
+		const uint32_t* indices, bool cull_back, float width, float height,
+		ScreenTriangle* out, TriangleStats* stats)
+{
+	uint32_t c0 = vs->codes[indices[0]];
+	uint32_t c1 = vs->codes[indices[1]];
+	uint32_t c2 = vs->codes[indices[2]];
+	if ((c0 & c1 & c2 & CLIP_FRUSTUM) != 0) {
+		++stats->outside;
+		return 0;
+	}
+
+	if (((c0 | c1 | c2) & CLIP_NEEDED) != 0) {
+		uint32_t written = clip_triangle(vs, m, indices, cull_back, width,
+				height, out);
+		stats->clipped += written > 0;
+		stats->emitted += written;
+		return written;
+	}
+
+	float x0 = vs->sx[indices[0]];
+	float y0 = vs->sy[indices[0]];
+	float area = (vs->sx[indices[1]] - x0) * (vs->sy[indices[2]] - y0)
+			- (vs->sx[indices[2]] - x0) * (vs->sy[indices[1]] - y0);
+	if (cull_back ? area >= 0.0f : area == 0.0f) {
+		++stats->back_faces;
+		return 0;
+	}
+
+	emit_triangle(vs, indices, out);
+	++stats->emitted;
+	return 1;
+}
+
+/* Out needs room for 6 per triangle, in case they are all clipped. Returns
+ * how many were written, in the order of the indices.
+ */
+typedef uint32_t (*TriangleFn)(const VertexStream* vs, const float m[16],
+		const uint32_t* indices, uint32_t triangle_count, bool cull_back,
+		float width, float height, ScreenTriangle* out, TriangleStats* stats);
+
+uint32_t process_triangles_scalar(const VertexStream* vs, const float m[16],
+		const uint32_t* indices, uint32_t triangle_count, bool cull_back,
+		float width, float height, ScreenTriangle* out, TriangleStats* stats)
+{
+	uint32_t written = 0;
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		written += process_triangle(vs, m, &indices[t * 3], cull_back, width,
+				height, &out[written], stats);
+	}
+	return written;
+}
+
+#if defined(RASTER_X86)
+
+uint32_t count_bits(uint32_t bits)
+{
+	uint32_t count = 0;
+	for (; bits != 0; bits &= bits - 1) {
+		++count;
+	}
+	return count;
+}
+
+/* 4x4 by 8 vertices, one matrix element broadcast per multiply. Same
+ * operations in the same order as the scalar path, so the results match.
+ */
+TARGET_AVX2 void transform_vertices_avx2(VertexStream* vs, const float m[16],
+		float width, float height)
+{
+	__m256 mat[16];
+	for (int i = 0; i < 16; ++i) {
+		mat[i] = _mm256_set1_ps(m[i]);
+	}
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 guard = _mm256_set1_ps(GUARD_BAND);
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256 w_size = _mm256_set1_ps(width);
+	const __m256 h_size = _mm256_set1_ps(height);
+
+	for (uint32_t v = 0; v < vs->count; v += 8) {
+		__m256 x = _mm256_loadu_ps(&vs->x[v]);
+		__m256 y = _mm256_loadu_ps(&vs->y[v]);
+		__m256 z = _mm256_loadu_ps(&vs->z[v]);
+
+		__m256 clip[4];
+		for (int r = 0; r < 4; ++r) {
+			clip[r] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(mat[r], x), _mm256_mul_ps(mat[4 + r], y)),
+					_mm256_mul_ps(mat[8 + r], z)), mat[12 + r]);
+		}
+
+		__m256 inv_w = _mm256_div_ps(one, clip[3]);
+		_mm256_storeu_ps(&vs->sx[v], _mm256_mul_ps(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_mul_ps(clip[0], inv_w), half), half),
+				w_size));
+		_mm256_storeu_ps(&vs->sy[v], _mm256_mul_ps(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_mul_ps(clip[1], inv_w), half), half),
+				h_size));
+		_mm256_storeu_ps(&vs->sz[v], _mm256_mul_ps(clip[2], inv_w));
+
+		__m256 w = clip[3];
+		__m256 neg_w = _mm256_xor_ps(w, sign);
+		__m256 gw = _mm256_mul_ps(guard, w);
+		__m256 neg_gw = _mm256_xor_ps(gw, sign);
+		__m256 out_guard = _mm256_or_ps(
+				_mm256_or_ps(_mm256_cmp_ps(clip[0], neg_gw, _CMP_LT_OQ),
+						_mm256_cmp_ps(clip[0], gw, _CMP_GT_OQ)),
+				_mm256_or_ps(_mm256_cmp_ps(clip[1], neg_gw, _CMP_LT_OQ),
+						_mm256_cmp_ps(clip[1], gw, _CMP_GT_OQ)));
+
+		const struct { __m256 mask; uint32_t bit; } tests[7] = {
+			{ _mm256_cmp_ps(clip[0], neg_w, _CMP_LT_OQ), CLIP_LEFT }
+			, { _mm256_cmp_ps(clip[0], w, _CMP_GT_OQ), CLIP_RIGHT }
+			, { _mm256_cmp_ps(clip[1], neg_w, _CMP_LT_OQ), CLIP_TOP }
+			, { _mm256_cmp_ps(clip[1], w, _CMP_GT_OQ), CLIP_BOTTOM }
+			, { _mm256_cmp_ps(clip[2], zero, _CMP_LT_OQ), CLIP_NEAR }
+			, { _mm256_cmp_ps(clip[2], w, _CMP_GT_OQ), CLIP_FAR }
+			, { out_guard, CLIP_GUARD }
+		};
+		__m256i codes = _mm256_setzero_si256();
+		for (int t = 0; t < 7; ++t) {
+			codes = _mm256_or_si256(codes, _mm256_and_si256(
+					_mm256_castps_si256(tests[t].mask),
+					_mm256_set1_epi32((int32_t)tests[t].bit)));
+		}
+		_mm256_storeu_si256((__m256i*)&vs->codes[v], codes);
+	}
+}
+
+/* 8 triangles per step, vertices gathered by index. Lanes are then handled
+ * in order, so the output is the scalar path's.
+ */
+TARGET_AVX2 uint32_t process_triangles_avx2(const VertexStream* vs,
+		const float m[16], const uint32_t* indices, uint32_t triangle_count,
+		bool cull_back, float width, float height, ScreenTriangle* out,
+		TriangleStats* stats)
+{
+	const __m256i strides = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	const __m256i frustum = _mm256_set1_epi32(CLIP_FRUSTUM);
+	const __m256i needed = _mm256_set1_epi32(CLIP_NEEDED);
+	const __m256 zero = _mm256_setzero_ps();
+
+	uint32_t written = 0;
+	uint32_t t = 0;
+	for (; t + 8 <= triangle_count; t += 8) {
+		const int* base = (const int*)&indices[t * 3];
+		__m256i i0 = _mm256_i32gather_epi32(base, strides, 4);
+		__m256i i1 = _mm256_i32gather_epi32(base + 1, strides, 4);
+		__m256i i2 = _mm256_i32gather_epi32(base + 2, strides, 4);
+
+		const int* codes = (const int*)vs->codes;
+		__m256i c0 = _mm256_i32gather_epi32(codes, i0, 4);
+		__m256i c1 = _mm256_i32gather_epi32(codes, i1, 4);
+		__m256i c2 = _mm256_i32gather_epi32(codes, i2, 4);
+		__m256i all = _mm256_and_si256(_mm256_and_si256(c0, c1), c2);
+		__m256i any = _mm256_or_si256(_mm256_or_si256(c0, c1), c2);
+		__m256i outside = _mm256_xor_si256(_mm256_cmpeq_epi32(
+				_mm256_and_si256(all, frustum), _mm256_setzero_si256()),
+				_mm256_set1_epi32(-1));
+		uint32_t outside_bits = (uint32_t)_mm256_movemask_ps(
+				_mm256_castsi256_ps(outside));
+		if (outside_bits == 0xff) {
+			stats->outside += 8;
+			continue;
+		}
+		__m256i clip = _mm256_xor_si256(_mm256_cmpeq_epi32(
+				_mm256_and_si256(any, needed), _mm256_setzero_si256()),
+				_mm256_set1_epi32(-1));
+
+		__m256 x0 = _mm256_i32gather_ps(vs->sx, i0, 4);
+		__m256 y0 = _mm256_i32gather_ps(vs->sy, i0, 4);
+		__m256 x1 = _mm256_i32gather_ps(vs->sx, i1, 4);
+		__m256 y1 = _mm256_i32gather_ps(vs->sy, i1, 4);
+		__m256 x2 = _mm256_i32gather_ps(vs->sx, i2, 4);
+		__m256 y2 = _mm256_i32gather_ps(vs->sy, i2, 4);
+		__m256 area = _mm256_sub_ps(
+				_mm256_mul_ps(_mm256_sub_ps(x1, x0), _mm256_sub_ps(y2, y0)),
+				_mm256_mul_ps(_mm256_sub_ps(x2, x0), _mm256_sub_ps(y1, y0)));
+		__m256 back = cull_back ? _mm256_cmp_ps(area, zero, _CMP_GE_OQ)
+				: _mm256_cmp_ps(area, zero, _CMP_EQ_OQ);
+
+		uint32_t clip_bits = (uint32_t)_mm256_movemask_ps(
+				_mm256_castsi256_ps(clip)) & ~outside_bits;
+		uint32_t back_bits = (uint32_t)_mm256_movemask_ps(back)
+				& ~(outside_bits | clip_bits);
+		uint32_t kept_bits = ~(outside_bits | back_bits) & 0xff;
+
+		stats->outside += count_bits(outside_bits);
+		stats->back_faces += count_bits(back_bits);
+		if (kept_bits == 0)
+			continue;
+
+		/* Kept lanes only, a branch per lane mispredicts too often. */
+		float xy[6][8];
+		uint32_t vertex[3][8];
+		const __m256 xy_lanes[6] = { x0, y0, x1, y1, x2, y2 };
+		for (int k = 0; k < 6; ++k) {
+			_mm256_storeu_ps(xy[k], xy_lanes[k]);
+		}
+		_mm256_storeu_si256((__m256i*)vertex[0], i0);
+		_mm256_storeu_si256((__m256i*)vertex[1], i1);
+		_mm256_storeu_si256((__m256i*)vertex[2], i2);
+
+		while (kept_bits != 0) {
+			uint32_t lane = lowest_bit(kept_bits);
+			kept_bits &= kept_bits - 1;
+			if ((clip_bits & (1u << lane)) != 0) {
+				uint32_t clipped = clip_triangle(vs, m,
+						&indices[(t + lane) * 3], cull_back, width, height,
+						&out[written]);
+				stats->clipped += clipped > 0;
+				stats->emitted += clipped;
+				written += clipped;
+				continue;
+			}
+
+			ScreenTriangle* tri = &out[written++];
+			for (int k = 0; k < 6; ++k) {
+				tri->xy[k] = xy[k][lane];
+			}
+			for (int v = 0; v < 3; ++v) {
+				tri->z[v] = vs->sz[vertex[v][lane]];
+			}
+			++stats->emitted;
+		}
+	}
+
+	for (; t < triangle_count; ++t) {
+		written += process_triangle(vs, m, &indices[t * 3], cull_back, width,
+				height, &out[written], stats);
+	}
+	return written;
+}
+
+#endif
+
+/* SSE4.1 runs the scalar vertex stage. */
+const TransformFn transform_fns[RASTER_ISA_COUNT] = {
+	transform_vertices_scalar
+	, transform_vertices_scalar
+#if defined(RASTER_X86)
+	, transform_vertices_avx2
+#else
+	, NULL
+#endif
+};
+
+const TriangleFn triangle_fns[RASTER_ISA_COUNT] = {
+	process_triangles_scalar
+	, process_triangles_scalar
+#if defined(RASTER_X86)
+	, process_triangles_avx2
+#else
+	, NULL
+#endif
+};
+
+/* One triangle through the vertex stage, for the demos. */
+void project_triangle(const float* positions, const float m[16],
+		const Framebuffer* fb, float screen[6])
+{
+	const uint32_t indices[3] = { 0, 1, 2 };
+
+	VertexStream vs = create_vertex_stream(3);
+	load_vertex_stream(&vs, positions);
+	transform_vertices_scalar(&vs, m, (float)fb->width, (float)fb->height);
+
+	ScreenTriangle triangles[6];
+	TriangleStats stats = {0};
+	uint32_t count = process_triangles_scalar(&vs, m, indices, 1, false,
+			(float)fb->width, (float)fb->height, triangles, &stats);
+	memset(screen, 0, sizeof(float) * 6);
+	if (count > 0) {
+		memcpy(screen, triangles[0].xy, sizeof(float) * 6);
+	}
+	destroy_vertex_stream(&vs);
+}
+
+/* The OpenGL demos' triangle. Their vertex shader passes positions through,
+ * the flip takes GL's y up to the framebuffer's y down.
+ */
+void project_demo_triangle(const float* positions, const Framebuffer* fb,
+		float screen[6])
+{
+	const float flip_y[16] = {
+		1.0f, 0.0f, 0.0f, 0.0f
+		, 0.0f, -1.0f, 0.0f, 0.0f
+		, 0.0f, 0.0f, 1.0f, 0.0f
+		, 0.0f, 0.0f, 0.0f, 1.0f
+	};
+	project_triangle(positions, flip_y, fb, screen);
+}
+
+/* win_vulkan's triangle, from the SPIR-V it loads, translated to C at build
+ * time. Vulkan clip space is already y down. The raster is flat, so the
+ * fragment shader runs once, for the color. Returns it.
+ */
+uint32_t run_vulkan_shaders(const Framebuffer* fb, float screen[6])
+{
+	const float identity[16] = {
+		1.0f, 0.0f, 0.0f, 0.0f
+		, 0.0f, 1.0f, 0.0f, 0.0f
+		, 0.0f, 0.0f, 1.0f, 0.0f
+		, 0.0f, 0.0f, 0.0f, 1.0f
+	};
+
+	SpvInvocations io = {0};
+	for (int l = 0; l < SPV_LANES; ++l) {
+		io.vertex_index[l] = l < 3 ? l : 0;
+	}
+	win_vulkan_vert_spv(&io);
+
+	/* The vertex stage takes positions, the shader writes w = 1. */
+	float positions[9];
+	for (int v = 0; v < 3; ++v) {
+		if (io.position[3][v] != 1.0f) {
+			printf("Vertex %d has w = %f, only 1 is supported.\n", v,
+					io.position[3][v]);
+			exit(-1);
+		}
+		for (int c = 0; c < 3; ++c) {
+			positions[v * 3 + c] = io.position[c][v];
+		}
+	}
+	project_triangle(positions, identity, fb, screen);
+
+	win_vulkan_frag_spv(&io);
+	const float rgba[4] = {
+		io.outputs[0][0][0], io.outputs[0][1][0]
+		, io.outputs[0][2][0], io.outputs[0][3][0]
+	};
+	return pack_rgba(rgba);
+}
+
+
+/* Frames are split in bands of whole rows, one job each. Triangles are
+ * binned by band first, so a band only looks at the ones touching it. Bands
+ * start on even rows, for the 4x2 kernel. Nothing is shared between jobs but
+ * the setups, read only. Fixed point and multisampled kernels are banded the
+ * same way.
+ */
+#define RASTER_BAND_ROWS 32
+
+typedef struct RasterBatch {
+	Framebuffer*			fb;
+	const TriangleSetup*	setups;
+	uint32_t				setup_count;
+	RasterFn				raster;
+	uint32_t				color;
+
+	/* Fixed point setups and kernel instead, when fixed_setups is set. */
+	const FixedSetup*		fixed_setups;
+	FixedRasterFn			fixed_raster;
+	/* Multisampled into mfb instead of fb, when mfb is set. Same size. */
+	MsaaFramebuffer*		mfb;
+	MsaaRasterFn			msaa_raster;
+
+	/* Band b's triangles are indices[offsets[b]] to indices[offsets[b + 1]]. */
+	uint32_t				band_count;
+	uint32_t*				offsets;
+	uint32_t*				indices;
+	uint32_t				index_capacity;
+} RasterBatch;
+
+void destroy_raster_batch(RasterBatch* batch)
+{
+	free(batch->offsets);
+	free(batch->indices);
+	batch->offsets = NULL;
+	batch->indices = NULL;
+	batch->index_capacity = 0;
+}
+
+/* Bands triangle i touches, whichever setups the batch has. */
+void raster_batch_bands(const RasterBatch* batch, uint32_t i, uint32_t* first,
+		uint32_t* last)
+{
+	int32_t min_y = batch->fixed_setups != NULL
+			? batch->fixed_setups[i].min_y : batch->setups[i].min_y;
+	int32_t max_y = batch->fixed_setups != NULL
+			? batch->fixed_setups[i].max_y : batch->setups[i].max_y;
+	*first = (uint32_t)min_y / RASTER_BAND_ROWS;
+	*last = (uint32_t)(max_y - 1) / RASTER_BAND_ROWS;
+}
+
+/* Counting sort, the bins are rebuilt for every frame. */
+void bin_raster_batch(RasterBatch* batch)
+{
+	uint32_t band_count = (batch->fb->height + RASTER_BAND_ROWS - 1)
+			/ RASTER_BAND_ROWS;
+	if (batch->offsets == NULL || batch->band_count != band_count) {
+		free(batch->offsets);
+		batch->offsets = malloc(sizeof(uint32_t) * (band_count + 1));
+		batch->band_count = band_count;
+		if (batch->offsets == NULL) {
+			printf("Out of memory for %d raster bands.\n", band_count);
+			exit(-1);
+		}
+	}
+	memset(batch->offsets, 0, sizeof(uint32_t) * (band_count + 1));
+
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < batch->setup_count; ++i) {
+		uint32_t first;
+		uint32_t last;
+		raster_batch_bands(batch, i, &first, &last);
+		for (uint32_t b = first; b <= last; ++b) {
+			batch->offsets[b + 1] += 1;
+		}
+		total += last - first + 1;
+	}
+	for (uint32_t b = 0; b < band_count; ++b) {
+		batch->offsets[b + 1] += batch->offsets[b];
+	}
+
+	if (total > batch->index_capacity) {
+		free(batch->indices);
+		batch->indices = malloc(sizeof(uint32_t) * total);
+		batch->index_capacity = total;
+	}
+	if (total > 0 && batch->indices == NULL) {
+		printf("Out of memory for %d binned triangles.\n", total);
+		exit(-1);
+	}
+
+	/* Bumps each band's offset to its end, then shifts them back. */
+	for (uint32_t i = 0; i < batch->setup_count; ++i) {
+		uint32_t first;
+		uint32_t last;
+		raster_batch_bands(batch, i, &first, &last);
+		for (uint32_t b = first; b <= last; ++b) {
+			batch->indices[batch->offsets[b]++] = i;
+		}
+	}
+	for (uint32_t b = band_count; b > 0; --b) {
+		batch->offsets[b] = batch->offsets[b - 1];
+	}
+	batch->offsets[0] = 0;
+}
+
+void raster_band_job(void* data, uint32_t begin, uint32_t end)
+{
+	RasterBatch* batch = data;
+	for (uint32_t band = begin; band < end; ++band) {
+		int32_t band_min = (int32_t)(band * RASTER_BAND_ROWS);
+		int32_t band_max = band_min + RASTER_BAND_ROWS;
+
+		for (uint32_t i = batch->offsets[band]; i < batch->offsets[band + 1];
+				++i) {
+			if (batch->fixed_setups != NULL) {
+				FixedSetup clipped = batch->fixed_setups[batch->indices[i]];
+				clip_fixed_setup_rows(&clipped, band_min, band_max);
+				batch->fixed_raster(batch->fb, &clipped, batch->color);
+				continue;
+			}
+
+			TriangleSetup clipped = batch->setups[batch->indices[i]];
+			clipped.min_y = clipped.min_y > band_min ? clipped.min_y : band_min;
+			clipped.max_y = clipped.max_y < band_max ? clipped.max_y : band_max;
+			if (batch->mfb != NULL) {
+				batch->msaa_raster(batch->mfb, &clipped, batch->color);
+			} else {
+				batch->raster(batch->fb, &clipped, batch->color);
+			}
+		}
+	}
+}
+
+/* Draws in submission order within a band, so the result is the same as
+ * one thread's.
+ */
+void raster_parallel(RasterBatch* batch)
+{
+	bin_raster_batch(batch);
+
+	JobCounter counter = {0};
+	job_parallel_for(raster_band_job, batch, batch->band_count, 1, &counter);
+	job_wait(&counter);
+}
+
+/* Resolves of RASTER_BAND_ROWS rows, one job each, on views of both
+ * framebuffers starting at the band's first row.
+ */
+typedef struct MsaaResolveBatch {
+	const MsaaFramebuffer*	mfb;
+	Framebuffer*			fb;
+	MsaaResolveFn			resolve;
+} MsaaResolveBatch;
+
+void msaa_resolve_band_job(void* data, uint32_t begin, uint32_t end)
+{
+	const MsaaResolveBatch* batch = data;
+	for (uint32_t band = begin; band < end; ++band) {
+		uint32_t y = band * RASTER_BAND_ROWS;
+		uint32_t rows = batch->fb->height - y < RASTER_BAND_ROWS
+				? batch->fb->height - y : RASTER_BAND_ROWS;
+
+		size_t offset = (size_t)y * batch->mfb->stride;
+		MsaaFramebuffer mfb = *batch->mfb;
+		mfb.pixels += offset;
+		mfb.samples += offset * MSAA_SAMPLES;
+		mfb.expanded += offset;
+		mfb.height = rows;
+		Framebuffer fb = *batch->fb;
+		fb.pixels += (size_t)y * fb.stride;
+		fb.height = rows;
+		batch->resolve(&mfb, &fb);
+	}
+}
+
+void msaa_resolve_parallel(const MsaaFramebuffer* mfb, Framebuffer* fb,
+		MsaaResolveFn resolve)
+{
+	MsaaResolveBatch batch = {
+		.mfb					= mfb
+		, .fb					= fb
+		, .resolve				= resolve
+	};
+	uint32_t band_count = (fb->height + RASTER_BAND_ROWS - 1)
+			/ RASTER_BAND_ROWS;
+
+	JobCounter counter = {0};
+	job_parallel_for(msaa_resolve_band_job, &batch, band_count, 1, &counter);
+	job_wait(&counter);
+}
+
+
+/* Command line. */
+typedef struct Options {
+	uint32_t			width;
+	uint32_t			height;
+	/* RASTER_ISA_COUNT is the best the CPU has. */
+	RasterIsa			isa;
+	const char*			output;
+	/* Runs win_vulkan's SPIR-V instead of the OpenGL demos' shaders. */
+	bool				vulkan_shaders;
+	/* Rasters multisampled, resolved before it's written. */
+	bool				msaa;
+	/* Fixed point edges and the top-left rule. */
+	bool				fixed;
+	/* Drawn through a visibility buffer, depth pass then shade pass. */
+	bool				visibility;
+	/* Iterations per benchmark run. 0 is off. */
+	uint32_t			bench;
+	/* Job workers, the main thread included. 0 is one per core. */
+	uint32_t			threads;
+	/* Iterations per thread count of the scaling run. 0 is off. */
+	uint32_t			bench_jobs;
+	/* Iterations of the occlusion culling run. 0 is off. */
+	uint32_t			bench_occlusion;
+	/* Iterations of the vertex stage run. 0 is off. */
+	uint32_t			bench_vertices;
+	/* Iterations of the 4K linear against tiled run. 0 is off. */
+	uint32_t			bench_tiled;
+	/* Iterations of the multisampled against plain run. 0 is off. */
+	uint32_t			bench_msaa;
+	/* Iterations of the forward against visibility buffer run. 0 is off. */
+	uint32_t			bench_visibility;
+	/* Iterations of the float against fixed point edges run. 0 is off. */
+	uint32_t			bench_fixed;
+	/* Frames shown in an X11 window. 0 is off, UINT32_MAX until closed. */
+	uint32_t			window;
+} Options;
+
+Options options = {
+	.width							= XRES
+	, .height						= YRES
+	, .isa							= RASTER_ISA_COUNT
+	, .output						= "cpu_raster.ppm"
+	, .vulkan_shaders				= false
+	, .msaa							= false
+	, .fixed						= false
+	, .visibility					= false
+	, .bench						= 0
+	, .threads						= 0
+	, .bench_jobs					= 0
+	, .bench_occlusion				= 0
+	, .bench_vertices				= 0
+	, .bench_tiled					= 0
+	, .bench_msaa					= 0
+	, .bench_visibility				= 0
+	, .bench_fixed					= 0
+	, .window						= 0
+};
+
+
+/* The demo triangle is mostly whole blocks inside. The small ones, a few
+ * pixels each, are mostly setup and edges.
+ */
+#define BENCH_SMALL_TRIANGLES 4096
+
+typedef struct BenchWorkload {
+	const char*		name;
+	TriangleSetup*	setups;
+	/* What each setup was made from, 6 floats a triangle. May be NULL. */
+	float*			screens;
+	uint32_t		setup_count;
+	uint64_t		pixels;
+} BenchWorkload;
+
+/* Visible pixels only, kernels may write the padding. */
+bool framebuffers_match(const Framebuffer* a, const Framebuffer* b)
+{
+	for (uint32_t y = 0; y < a->height; ++y) {
+		if (memcmp(&a->pixels[(size_t)y * a->stride],
+				&b->pixels[(size_t)y * b->stride],
+				sizeof(uint32_t) * a->width) != 0)
+			return false;
+	}
+	return true;
+}
+
+#define BENCH_WORKLOAD_COUNT 2
+
+void create_bench_workloads(const float* screen, const Framebuffer* fb,
+		BenchWorkload* workloads)
+{
+	workloads[0] = (BenchWorkload){ .name = "triangle" };
+	workloads[1] = (BenchWorkload){ .name = "small triangles" };
+
+	workloads[0].setups = malloc(sizeof(TriangleSetup));
+	workloads[0].screens = malloc(sizeof(float) * 6);
+	memcpy(workloads[0].screens, screen, sizeof(float) * 6);
+	workloads[0].setup_count = setup_triangle(screen, fb,
+			workloads[0].setups) ? 1 : 0;
+
+	/* Fixed seed, same triangles every run. */
+	workloads[1].setups = malloc(sizeof(TriangleSetup) * BENCH_SMALL_TRIANGLES);
+	workloads[1].screens = malloc(sizeof(float) * 6 * BENCH_SMALL_TRIANGLES);
+	srand(42);
+	for (uint32_t i = 0; i < BENCH_SMALL_TRIANGLES; ++i) {
+		float x = (float)rand() / (float)RAND_MAX * (float)(fb->width - 8);
+		float y = (float)rand() / (float)RAND_MAX * (float)(fb->height - 8);
+		float small[6] = {
+			x, y
+			, x + 1.0f + (float)(rand() % 7), y + (float)(rand() % 3)
+			, x + (float)(rand() % 3), y + 1.0f + (float)(rand() % 7)
+		};
+		TriangleSetup* setup =
+				&workloads[1].setups[workloads[1].setup_count];
+		memcpy(&workloads[1].screens[workloads[1].setup_count * 6], small,
+				sizeof(small));
+		workloads[1].setup_count += setup_triangle(small, fb, setup) ? 1 : 0;
+	}
+
+	for (int w = 0; w < BENCH_WORKLOAD_COUNT; ++w) {
+		BenchWorkload* workload = &workloads[w];
+		workload->pixels = 0;
+		for (uint32_t i = 0; i < workload->setup_count; ++i) {
+			workload->pixels += count_coverage(&workload->setups[i]);
+		}
+	}
+}
+
+void destroy_bench_workloads(BenchWorkload* workloads)
+{
+	for (int w = 0; w < BENCH_WORKLOAD_COUNT; ++w) {
+		free(workloads[w].setups);
+		free(workloads[w].screens);
+		workloads[w].setups = NULL;
+		workloads[w].screens = NULL;
+	}
+}
+
+void raster_reference(Framebuffer* fb, const BenchWorkload* workload,
+		uint32_t color)
+{
+	clear_framebuffer(fb, 0xff000000);
+	for (uint32_t i = 0; i < workload->setup_count; ++i) {
+		raster_scalar(fb, &workload->setups[i], color);
+	}
+}
+
+void bench_raster(const float* screen, uint32_t color)
+{
+	uint32_t iterations = options.bench;
+	Framebuffer fb = create_framebuffer(options.width, options.height);
+	Framebuffer reference = create_framebuffer(options.width, options.height);
+
+	BenchWorkload workloads[BENCH_WORKLOAD_COUNT];
+	create_bench_workloads(screen, &fb, workloads);
+
+	printf("CPU raster benchmark : %dx%d, %d iterations\n", options.width,
+			options.height, iterations);
+
+	for (int w = 0; w < BENCH_WORKLOAD_COUNT; ++w) {
+		BenchWorkload* workload = &workloads[w];
+		printf("    %s : %d triangles, %llu pixels\n", workload->name,
+				workload->setup_count,
+				(unsigned long long)workload->pixels);
+
+		raster_reference(&reference, workload, color);
+
+		double scalar_rate = 0.0;
+		for (int isa = 0; isa < RASTER_ISA_COUNT; ++isa) {
+			if (!raster_isa_supported((RasterIsa)isa)) {
+				printf("        %-6s : not supported\n", raster_isa_names[isa]);
+				continue;
+			}
+
+			RasterFn raster = raster_fns[isa];
+			clear_framebuffer(&fb, 0xff000000);
+			double start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				for (uint32_t i = 0; i < workload->setup_count; ++i) {
+					raster(&fb, &workload->setups[i], color);
+				}
+			}
+			double elapsed_ms = time_ms() - start;
+
+			double rate = (double)workload->pixels * iterations
+					/ (elapsed_ms / 1000.0);
+			if (isa == RASTER_ISA_SCALAR) {
+				scalar_rate = rate;
+			}
+			printf("        %-6s : %8.1f Mpixels/s, %.2fx%s\n",
+					raster_isa_names[isa], rate / 1000000.0,
+					rate / scalar_rate,
+					framebuffers_match(&fb, &reference) ? "" : ", MISMATCH");
+		}
+	}
+
+	destroy_bench_workloads(workloads);
+	destroy_framebuffer(&reference);
+	destroy_framebuffer(&fb);
+}
+
+void empty_job(void* data, uint32_t begin, uint32_t end)
+{
+	(void)data;
+	(void)begin;
+	(void)end;
+}
+
+/* Banded raster with the best kernel, and bare job overhead, from one
+ * worker up to one per core. Workers are restarted for every count.
+ */
+#define BENCH_EMPTY_JOBS 65536
+
+void bench_jobs(const float* screen, uint32_t color)
+{
+	uint32_t iterations = options.bench_jobs;
+	uint32_t max_threads = options.threads > 0
+			? options.threads : job_cpu_count();
+	if (max_threads > JOB_MAX_WORKERS) {
+		max_threads = JOB_MAX_WORKERS;
+	}
+	RasterIsa isa = best_raster_isa();
+
+	Framebuffer fb = create_framebuffer(options.width, options.height);
+	Framebuffer references[BENCH_WORKLOAD_COUNT];
+	BenchWorkload workloads[BENCH_WORKLOAD_COUNT];
+	create_bench_workloads(screen, &fb, workloads);
+	for (int w = 0; w < BENCH_WORKLOAD_COUNT; ++w) {
+		references[w] = create_framebuffer(options.width, options.height);
+		raster_reference(&references[w], &workloads[w], color);
+	}
+
+	printf("Job scaling benchmark : %dx%d, %s, %d iterations, 1 to %d "
+			"threads, %d cores\n", options.width, options.height,
+			raster_isa_names[isa], iterations, max_threads, job_cpu_count());
+
+	double base_rates[BENCH_WORKLOAD_COUNT + 1] = {0};
+	for (uint32_t threads = 1; threads <= max_threads;
+			threads = threads * 2 > max_threads && threads < max_threads
+					? max_threads : threads * 2)
+	{
+		jobs_init(threads);
+		printf("    %2d threads :\n", threads);
+
+		for (int w = 0; w < BENCH_WORKLOAD_COUNT; ++w) {
+			RasterBatch batch = {
+				.fb						= &fb
+				, .setups				= workloads[w].setups
+				, .setup_count			= workloads[w].setup_count
+				, .raster				= raster_fns[isa]
+				, .color				= color
+			};
+			clear_framebuffer(&fb, 0xff000000);
+			raster_parallel(&batch);
+
+			double start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				raster_parallel(&batch);
+			}
+			double elapsed_ms = time_ms() - start;
+			destroy_raster_batch(&batch);
+
+			double rate = (double)workloads[w].pixels * iterations
+					/ (elapsed_ms / 1000.0);
+			if (threads == 1) {
+				base_rates[w] = rate;
+			}
+			printf("        %-15s : %8.1f Mpixels/s, %.2fx%s\n",
+					workloads[w].name, rate / 1000000.0, rate / base_rates[w],
+					framebuffers_match(&fb, &references[w])
+							? "" : ", MISMATCH");
+		}
+
+		JobCounter counter = {0};
+		unsigned long long steals = atomic_load(&job_system.steal_count);
+		double start = time_ms();
+		job_parallel_for(empty_job, NULL, BENCH_EMPTY_JOBS, 1, &counter);
+		job_wait(&counter);
+		double elapsed_ms = time_ms() - start;
+		double rate = BENCH_EMPTY_JOBS / (elapsed_ms / 1000.0);
+		if (threads == 1) {
+			base_rates[BENCH_WORKLOAD_COUNT] = rate;
+		}
+		printf("        %-15s : %8.2f Mjobs/s, %.2fx, %llu stolen\n",
+				"empty jobs", rate / 1000000.0,
+				rate / base_rates[BENCH_WORKLOAD_COUNT],
+				atomic_load(&job_system.steal_count) - steals);
+
+		jobs_shutdown();
+	}
+
+	for (int w = 0; w < BENCH_WORKLOAD_COUNT; ++w) {
+		destroy_framebuffer(&references[w]);
+	}
+	destroy_bench_workloads(workloads);
+	destroy_framebuffer(&fb);
+}
+
+/* A street : a row of buildings in front of the camera, a field of small
+ * boxes on the ground, most of them behind the buildings. The camera is at
+ * the origin looking down -z, so the view is the identity.
+ */
+#define OCCLUSION_BENCH_WIDTH 256
+#define OCCLUSION_BENCH_HEIGHT 128
+#define OCCLUSION_BENCH_BUILDINGS 8
+#define OCCLUSION_BENCH_SIDE 64
+
+const uint32_t box_indices[36] = {
+	0, 1, 3,	0, 3, 2,	4, 6, 7,	4, 7, 5
+	, 0, 4, 5,	0, 5, 1,	2, 3, 7,	2, 7, 6
+	, 0, 2, 6,	0, 6, 4,	1, 5, 7,	1, 7, 3
+};
+
+/* Corner i has bit 0 for x, 1 for y and 2 for z, like occlusion_test_box. */
+void box_positions(const float box_min[3], const float box_max[3],
+		float positions[24])
+{
+	for (int i = 0; i < 8; ++i) {
+		positions[i * 3 + 0] = i & 1 ? box_max[0] : box_min[0];
+		positions[i * 3 + 1] = i & 2 ? box_max[1] : box_min[1];
+		positions[i * 3 + 2] = i & 4 ? box_max[2] : box_min[2];
+	}
+}
+
+void bench_occlusion()
+{
+	uint32_t iterations = options.bench_occlusion;
+
+	float aspect = (float)options.width / (float)options.height;
+	float f = 1.0f / tanf(0.5f);
+	float z_near = 0.1f;
+	float z_far = 300.0f;
+	float view_proj[16] = {0};
+	view_proj[0] = f / aspect;
+	view_proj[5] = -f;
+	view_proj[10] = z_far / (z_near - z_far);
+	view_proj[11] = -1.0f;
+	view_proj[14] = z_near * z_far / (z_near - z_far);
+
+	float buildings[OCCLUSION_BENCH_BUILDINGS][24];
+	for (int i = 0; i < OCCLUSION_BENCH_BUILDINGS; ++i) {
+		float box_min[3] = { -40.0f + 10.0f * (float)i, -2.0f, -24.0f };
+		float box_max[3] = { -32.0f + 10.0f * (float)i, 8.0f, -20.0f };
+		box_positions(box_min, box_max, buildings[i]);
+	}
+
+	uint32_t object_count = OCCLUSION_BENCH_SIDE * OCCLUSION_BENCH_SIDE;
+	float (*objects)[2][3] = malloc(sizeof(float) * 6 * object_count);
+	for (uint32_t i = 0; i < object_count; ++i) {
+		float x = ((float)(i % OCCLUSION_BENCH_SIDE)
+				- OCCLUSION_BENCH_SIDE * 0.5f) * 2.0f;
+		float z = -4.0f - (float)(i / OCCLUSION_BENCH_SIDE) * 4.0f;
+		objects[i][0][0] = x - 0.5f;
+		objects[i][0][1] = -2.0f;
+		objects[i][0][2] = z - 0.5f;
+		objects[i][1][0] = x + 0.5f;
+		objects[i][1][1] = -1.0f;
+		objects[i][1][2] = z + 0.5f;
+	}
+
+	OcclusionBuffer ob;
+	occlusion_init(&ob, OCCLUSION_BENCH_WIDTH, OCCLUSION_BENCH_HEIGHT);
+
+	double raster_ms = 0.0;
+	double pyramid_ms = 0.0;
+	double test_ms = 0.0;
+	uint32_t visible = 0;
+	for (uint32_t it = 0; it < iterations; ++it) {
+		double start = time_ms();
+		occlusion_begin(&ob, view_proj);
+		for (int i = 0; i < OCCLUSION_BENCH_BUILDINGS; ++i) {
+			occlusion_add_mesh(&ob, NULL, buildings[i], box_indices, 12);
+		}
+		double rastered = time_ms();
+		occlusion_build_pyramid(&ob);
+		double built = time_ms();
+
+		visible = 0;
+		for (uint32_t i = 0; i < object_count; ++i) {
+			visible += occlusion_test_box(&ob, objects[i][0], objects[i][1]);
+		}
+		double tested = time_ms();
+
+		raster_ms += rastered - start;
+		pyramid_ms += built - rastered;
+		test_ms += tested - built;
+	}
+
+	printf("Occlusion culling benchmark : %dx%d buffer, %d levels, "
+			"%d iterations\n", ob.widths[0], ob.heights[0], ob.level_count,
+			iterations);
+	printf("    occluders : %d triangles, %.3f ms\n", ob.occluder_triangles,
+			raster_ms / iterations);
+	printf("    pyramid   : %.3f ms\n", pyramid_ms / iterations);
+	printf("    tests     : %d boxes, %.3f ms, %.1f Mboxes/s\n", ob.tested,
+			test_ms / iterations,
+			(double)ob.tested * iterations / (test_ms / 1000.0) / 1000000.0);
+	printf("    culled    : %d of %d draws, %.1f%%\n", ob.culled,
+			object_count, 100.0 * (double)ob.culled / (double)object_count);
+
+	occlusion_destroy(&ob);
+	free(objects);
+}
+
+/* A bumpy ground grid under a perspective camera, running from behind the
+ * eye to far ahead and well out to the sides : triangles of every kind,
+ * outside, back facing, crossing the near plane or the guard band.
+ * Triangles go through in chunks, the way a frame feeds the raster.
+ */
+#define VERTEX_BENCH_COLUMNS 1024
+#define VERTEX_BENCH_ROWS 512
+#define VERTEX_BENCH_CHUNK 4096
+
+void bench_vertices()
+{
+	uint32_t iterations = options.bench_vertices;
+	float width = (float)options.width;
+	float height = (float)options.height;
+
+	float aspect = width / height;
+	float f = 1.0f / tanf(0.5f);
+	float z_near = 0.1f;
+	float z_far = 300.0f;
+	float view_proj[16] = {0};
+	view_proj[0] = f / aspect;
+	view_proj[5] = -f;
+	view_proj[10] = z_far / (z_near - z_far);
+	view_proj[11] = -1.0f;
+	view_proj[14] = z_near * z_far / (z_near - z_far);
+
+	uint32_t vertex_count = VERTEX_BENCH_COLUMNS * VERTEX_BENCH_ROWS;
+	float* positions = malloc(sizeof(float) * 3 * vertex_count);
+	for (uint32_t r = 0; r < VERTEX_BENCH_ROWS; ++r) {
+		for (uint32_t c = 0; c < VERTEX_BENCH_COLUMNS; ++c) {
+			float* p = &positions[(r * VERTEX_BENCH_COLUMNS + c) * 3];
+			p[0] = -60.0f + 120.0f * (float)c / (VERTEX_BENCH_COLUMNS - 1);
+			p[2] = 10.0f - 160.0f * (float)r / (VERTEX_BENCH_ROWS - 1);
+			p[1] = -1.55f + 1.5f * cosf(p[0] * 0.5f) * cosf(p[2] * 0.5f);
+		}
+	}
+
+	/* Counter clockwise seen from above. */
+	uint32_t triangle_count =
+			(VERTEX_BENCH_COLUMNS - 1) * (VERTEX_BENCH_ROWS - 1) * 2;
+	uint32_t* indices = malloc(sizeof(uint32_t) * 3 * triangle_count);
+	uint32_t* index = indices;
+	for (uint32_t r = 0; r + 1 < VERTEX_BENCH_ROWS; ++r) {
+		for (uint32_t c = 0; c + 1 < VERTEX_BENCH_COLUMNS; ++c) {
+			uint32_t near_left = (r * VERTEX_BENCH_COLUMNS) + c;
+			uint32_t far_left = near_left + VERTEX_BENCH_COLUMNS;
+			const uint32_t quad[6] = {
+				near_left, near_left + 1, far_left + 1
+				, near_left, far_left + 1, far_left
+			};
+			memcpy(index, quad, sizeof(quad));
+			index += 6;
+		}
+	}
+
+	VertexStream vs = create_vertex_stream(vertex_count);
+	VertexStream reference = create_vertex_stream(vertex_count);
+	load_vertex_stream(&vs, positions);
+	load_vertex_stream(&reference, positions);
+	transform_vertices_scalar(&reference, view_proj, width, height);
+	ScreenTriangle* out = malloc(sizeof(ScreenTriangle) * 6
+			* VERTEX_BENCH_CHUNK);
+	ScreenTriangle* reference_out = malloc(sizeof(ScreenTriangle) * 6
+			* VERTEX_BENCH_CHUNK);
+	if (positions == NULL || indices == NULL || out == NULL
+			|| reference_out == NULL)
+	{
+		printf("Out of memory for the vertex benchmark.\n");
+		exit(-1);
+	}
+
+	printf("Vertex stage benchmark : %d vertices, %d triangles, %dx%d, "
+			"%d iterations\n", vertex_count, triangle_count, options.width,
+			options.height, iterations);
+
+	double scalar_rates[2] = {0};
+	for (int isa = 0; isa < RASTER_ISA_COUNT; ++isa) {
+		if (isa == RASTER_ISA_SSE41)
+			continue;
+		if (!raster_isa_supported((RasterIsa)isa)) {
+			printf("    %-6s : not supported\n", raster_isa_names[isa]);
+			continue;
+		}
+		TransformFn transform = transform_fns[isa];
+		TriangleFn triangles = triangle_fns[isa];
+
+		double start = time_ms();
+		for (uint32_t it = 0; it < iterations; ++it) {
+			transform(&vs, view_proj, width, height);
+		}
+		double transformed = time_ms();
+
+		TriangleStats stats = {0};
+		for (uint32_t it = 0; it < iterations; ++it) {
+			stats = (TriangleStats){0};
+			for (uint32_t t = 0; t < triangle_count; t += VERTEX_BENCH_CHUNK) {
+				uint32_t count = triangle_count - t < VERTEX_BENCH_CHUNK
+						? triangle_count - t : VERTEX_BENCH_CHUNK;
+				triangles(&vs, view_proj, &indices[t * 3], count, true,
+						width, height, out, &stats);
+			}
+		}
+		double elapsed_ms = time_ms() - transformed;
+		double transform_ms = transformed - start;
+
+		/* Screen positions behind the near plane are garbage, not used. */
+		bool match = true;
+		for (uint32_t v = 0; v < vertex_count && match; ++v) {
+			match = vs.codes[v] == reference.codes[v]
+					&& ((vs.codes[v] & CLIP_NEAR) != 0
+							|| (vs.sx[v] == reference.sx[v]
+									&& vs.sy[v] == reference.sy[v]
+									&& vs.sz[v] == reference.sz[v]));
+		}
+		for (uint32_t t = 0; t < triangle_count && match;
+				t += VERTEX_BENCH_CHUNK)
+		{
+			uint32_t count = triangle_count - t < VERTEX_BENCH_CHUNK
+					? triangle_count - t : VERTEX_BENCH_CHUNK;
+			TriangleStats unused = {0};
+			uint32_t written = triangles(&vs, view_proj, &indices[t * 3],
+					count, true, width, height, out, &unused);
+			uint32_t expected = process_triangles_scalar(&reference,
+					view_proj, &indices[t * 3], count, true, width, height,
+					reference_out, &unused);
+			match = written == expected && memcmp(out, reference_out,
+					sizeof(ScreenTriangle) * written) == 0;
+		}
+
+		double vertex_rate = (double)vertex_count * iterations
+				/ (transform_ms / 1000.0);
+		double triangle_rate = (double)triangle_count * iterations
+				/ (elapsed_ms / 1000.0);
+		if (isa == RASTER_ISA_SCALAR) {
+			scalar_rates[0] = vertex_rate;
+			scalar_rates[1] = triangle_rate;
+		}
+		printf("    %-6s : %8.1f Mvertices/s, %.2fx, %8.1f Mtriangles/s, "
+				"%.2fx%s\n", raster_isa_names[isa], vertex_rate / 1000000.0,
+				vertex_rate / scalar_rates[0], triangle_rate / 1000000.0,
+				triangle_rate / scalar_rates[1], match ? "" : ", MISMATCH");
+		if (isa == RASTER_ISA_SCALAR) {
+			printf("    %d outside, %d back faces, %d clipped, "
+					"%d triangles out\n", stats.outside, stats.back_faces,
+					stats.clipped, stats.emitted);
+		}
+	}
+
+	free(reference_out);
+	free(out);
+	destroy_vertex_stream(&reference);
+	destroy_vertex_stream(&vs);
+	free(indices);
+	free(positions);
+}
+
+/* Always at 4K, where linear rows are 15 KB apart and a tall triangle
+ * touches a new page on every row. Linear and tiled run the same kernels,
+ * the tiled result is resolved and checked against the linear one.
+ */
+#define TILED_BENCH_WIDTH 3840
+#define TILED_BENCH_HEIGHT 2160
+#define TILED_BENCH_TALL_TRIANGLES 1024
+
+void bench_tiled(const float* vertices, uint32_t color)
+{
+	uint32_t iterations = options.bench_tiled;
+	Framebuffer fb = create_framebuffer(TILED_BENCH_WIDTH, TILED_BENCH_HEIGHT);
+	Framebuffer resolved = create_framebuffer(TILED_BENCH_WIDTH,
+			TILED_BENCH_HEIGHT);
+	Framebuffer reference = create_framebuffer(TILED_BENCH_WIDTH,
+			TILED_BENCH_HEIGHT);
+	TiledFramebuffer tfb = create_tiled_framebuffer(TILED_BENCH_WIDTH,
+			TILED_BENCH_HEIGHT);
+
+	float screen[6];
+	project_demo_triangle(vertices, &fb, screen);
+	BenchWorkload workloads[BENCH_WORKLOAD_COUNT + 1];
+	create_bench_workloads(screen, &fb, workloads);
+
+	/* A few pixels wide, up to most of the screen high. */
+	BenchWorkload* tall = &workloads[BENCH_WORKLOAD_COUNT];
+	*tall = (BenchWorkload){ .name = "tall triangles" };
+	tall->setups = malloc(sizeof(TriangleSetup) * TILED_BENCH_TALL_TRIANGLES);
+	srand(7);
+	for (uint32_t i = 0; i < TILED_BENCH_TALL_TRIANGLES; ++i) {
+		float x = (float)rand() / (float)RAND_MAX * (float)(fb.width - 16);
+		float y = (float)rand() / (float)RAND_MAX * (float)(fb.height / 2);
+		float h = (float)(fb.height / 4)
+				+ (float)rand() / (float)RAND_MAX * (float)(fb.height / 4);
+		float thin[6] = {
+			x, y
+			, x + 4.0f + (float)(rand() % 8), y + h * 0.5f
+			, x + (float)(rand() % 4), y + h
+		};
+		tall->setup_count += setup_triangle(thin, &fb,
+				&tall->setups[tall->setup_count]) ? 1 : 0;
+	}
+	for (uint32_t i = 0; i < tall->setup_count; ++i) {
+		tall->pixels += count_coverage(&tall->setups[i]);
+	}
+
+	printf("Tiled framebuffer benchmark : %dx%d, %d iterations\n", fb.width,
+			fb.height, iterations);
+
+	for (int w = 0; w < BENCH_WORKLOAD_COUNT + 1; ++w) {
+		BenchWorkload* workload = &workloads[w];
+		printf("    %s : %d triangles, %llu pixels\n", workload->name,
+				workload->setup_count, (unsigned long long)workload->pixels);
+
+		for (int isa = 0; isa < RASTER_ISA_COUNT; ++isa) {
+			if (!raster_isa_supported((RasterIsa)isa)) {
+				printf("        %-6s : not supported\n", raster_isa_names[isa]);
+				continue;
+			}
+
+			RasterFn raster = raster_fns[isa];
+			clear_framebuffer(&fb, 0xff000000);
+			double start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				for (uint32_t i = 0; i < workload->setup_count; ++i) {
+					raster(&fb, &workload->setups[i], color);
+				}
+			}
+			double linear_ms = time_ms() - start;
+
+			TiledRasterFn tiled_raster = tiled_raster_fns[isa];
+			clear_tiled_framebuffer(&tfb, 0xff000000);
+			start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				for (uint32_t i = 0; i < workload->setup_count; ++i) {
+					tiled_raster(&tfb, &workload->setups[i], color);
+				}
+			}
+			double tiled_ms = time_ms() - start;
+			resolve_scalar(&tfb, &resolved, false);
+
+			double pixels = (double)workload->pixels * iterations;
+			printf("        %-6s : linear %8.1f Mpixels/s, tiled %8.1f "
+					"Mpixels/s, %.2fx%s\n", raster_isa_names[isa],
+					pixels / (linear_ms / 1000.0) / 1000000.0,
+					pixels / (tiled_ms / 1000.0) / 1000000.0,
+					linear_ms / tiled_ms,
+					framebuffers_match(&fb, &resolved) ? "" : ", MISMATCH");
+		}
+	}
+
+	/* What's left in the tiled framebuffer, the last workload. */
+	printf("    resolve :\n");
+	for (int bgra = 0; bgra < 2; ++bgra) {
+		resolve_scalar(&tfb, &reference, bgra != 0);
+		for (int isa = 0; isa < RASTER_ISA_COUNT; ++isa) {
+			if (!raster_isa_supported((RasterIsa)isa))
+				continue;
+
+			ResolveFn resolve = resolve_fns[isa];
+			double start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				resolve(&tfb, &resolved, bgra != 0);
+			}
+			double elapsed_ms = (time_ms() - start) / iterations;
+			printf("        %-6s : %s, %6.2f ms, %5.1f GB/s%s\n",
+					raster_isa_names[isa], bgra ? "bgra" : "rgba", elapsed_ms,
+					(double)fb.width * fb.height * 4.0
+							/ (elapsed_ms / 1000.0) / 1e9,
+					framebuffers_match(&resolved, &reference)
+							? "" : ", MISMATCH");
+		}
+	}
+
+	free(tall->setups);
+	destroy_bench_workloads(workloads);
+	destroy_tiled_framebuffer(&tfb);
+	destroy_framebuffer(&reference);
+	destroy_framebuffer(&resolved);
+	destroy_framebuffer(&fb);
+}
+
+/* Multisampled against plain raster, on the same workloads. Raster rates
+ * are in pixels, the resolve is timed apart, once per pass over the
+ * triangles. Resolved results are checked against the scalar kernels'.
+ */
+void bench_msaa(const float* screen, uint32_t color)
+{
+	uint32_t iterations = options.bench_msaa;
+	Framebuffer fb = create_framebuffer(options.width, options.height);
+	Framebuffer resolved = create_framebuffer(options.width, options.height);
+	Framebuffer reference = create_framebuffer(options.width, options.height);
+	MsaaFramebuffer mfb = create_msaa_framebuffer(options.width,
+			options.height);
+
+	BenchWorkload workloads[BENCH_WORKLOAD_COUNT];
+	create_bench_workloads(screen, &fb, workloads);
+
+	printf("Multisample benchmark : %dx%d, %dx, %d iterations\n",
+			options.width, options.height, MSAA_SAMPLES, iterations);
+
+	for (int w = 0; w < BENCH_WORKLOAD_COUNT; ++w) {
+		BenchWorkload* workload = &workloads[w];
+		clear_msaa_framebuffer(&mfb, 0xff000000);
+		for (uint32_t i = 0; i < workload->setup_count; ++i) {
+			msaa_raster_scalar(&mfb, &workload->setups[i], color);
+		}
+		msaa_resolve_scalar(&mfb, &reference);
+		printf("    %s : %d triangles, %llu pixels, %llu expanded\n",
+				workload->name, workload->setup_count,
+				(unsigned long long)workload->pixels,
+				(unsigned long long)count_expanded(&mfb));
+
+		for (int isa = 0; isa < RASTER_ISA_COUNT; ++isa) {
+			if (!raster_isa_supported((RasterIsa)isa)) {
+				printf("        %-6s : not supported\n", raster_isa_names[isa]);
+				continue;
+			}
+
+			RasterFn raster = raster_fns[isa];
+			clear_framebuffer(&fb, 0xff000000);
+			double start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				for (uint32_t i = 0; i < workload->setup_count; ++i) {
+					raster(&fb, &workload->setups[i], color);
+				}
+			}
+			double plain_ms = time_ms() - start;
+
+			MsaaRasterFn msaa_raster = msaa_raster_fns[isa];
+			clear_msaa_framebuffer(&mfb, 0xff000000);
+			start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				for (uint32_t i = 0; i < workload->setup_count; ++i) {
+					msaa_raster(&mfb, &workload->setups[i], color);
+				}
+			}
+			double msaa_ms = time_ms() - start;
+
+			MsaaResolveFn resolve = msaa_resolve_fns[isa];
+			start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				resolve(&mfb, &resolved);
+			}
+			double resolve_ms = (time_ms() - start) / iterations;
+
+			double pixels = (double)workload->pixels * iterations;
+			printf("        %-6s : plain %8.1f Mpixels/s, %dx %8.1f "
+					"Mpixels/s, %3.0f%%, resolve %5.2f ms%s\n",
+					raster_isa_names[isa],
+					pixels / (plain_ms / 1000.0) / 1000000.0, MSAA_SAMPLES,
+					pixels / (msaa_ms / 1000.0) / 1000000.0,
+					plain_ms / msaa_ms * 100.0, resolve_ms,
+					framebuffers_match(&resolved, &reference)
+							? "" : ", MISMATCH");
+		}
+	}
+
+	destroy_bench_workloads(workloads);
+	destroy_msaa_framebuffer(&mfb);
+	destroy_framebuffer(&reference);
+	destroy_framebuffer(&resolved);
+	destroy_framebuffer(&fb);
+}
+
+/* The demo triangle, stacked this many times, each copy a little nearer
+ * and colored apart. Drawn back to front every pixel is shaded once per
+ * copy forward, front to back once, shuffled somewhere between.
+ */
+#define VISIBILITY_BENCH_COPIES 1024
+
+typedef enum StackOrder {
+	STACK_BACK_TO_FRONT
+	, STACK_FRONT_TO_BACK
+	, STACK_SHUFFLED
+	, STACK_ORDER_COUNT
+} StackOrder;
+
+const char* stack_order_names[STACK_ORDER_COUNT] = {
+	"back to front", "front to back", "shuffled"
+};
+
+/* Forward against visibility buffer, each from the clears to the shaded
+ * frame. Forward and shading are scalar, the depth pass runs on each
+ * kernel. Frames are compared.
+ */
+void bench_visibility(const float* screen)
+{
+	uint32_t iterations = options.bench_visibility;
+	Framebuffer forward = create_framebuffer(options.width, options.height);
+	Framebuffer deferred = create_framebuffer(options.width, options.height);
+	VisibilityBuffer vb = create_visibility_buffer(options.width,
+			options.height);
+
+	ShadedTriangle* stack = malloc(sizeof(ShadedTriangle)
+			* VISIBILITY_BENCH_COPIES);
+	ShadedTriangle* ordered = malloc(sizeof(ShadedTriangle)
+			* VISIBILITY_BENCH_COPIES);
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < VISIBILITY_BENCH_COPIES; ++i) {
+		float depth = 1.0f - (float)(i + 1) / (VISIBILITY_BENCH_COPIES + 1);
+		const float z[3] = { depth, depth + 0.0002f, depth - 0.0002f };
+		float colors[3][4];
+		for (int v = 0; v < 3; ++v) {
+			for (int c = 0; c < 3; ++c) {
+				colors[v][c] = (float)((i * 7 + v * 5 + c * 3) % 16) / 15.0f;
+			}
+			colors[v][3] = 1.0f;
+		}
+		count += setup_shaded_triangle(screen, z, colors, &forward,
+				&stack[count]) ? 1 : 0;
+	}
+	uint64_t tested = count > 0 ? count_coverage(&stack[0].setup) * count : 0;
+
+	printf("Visibility buffer benchmark : %dx%d, %d iterations\n",
+			options.width, options.height, iterations);
+	printf("    %d stacked triangles, %llu pixels depth tested\n", count,
+			(unsigned long long)tested);
+
+	for (int order = 0; order < STACK_ORDER_COUNT; ++order) {
+		for (uint32_t i = 0; i < count; ++i) {
+			ordered[i] = stack[order == STACK_FRONT_TO_BACK
+					? count - 1 - i : i];
+		}
+		if (order == STACK_SHUFFLED) {
+			srand(11);
+			for (uint32_t i = count; i > 1; --i) {
+				uint32_t j = (uint32_t)rand() % i;
+				ShadedTriangle swap = ordered[i - 1];
+				ordered[i - 1] = ordered[j];
+				ordered[j] = swap;
+			}
+		}
+
+		uint64_t forward_shaded = 0;
+		double start = time_ms();
+		for (uint32_t it = 0; it < iterations; ++it) {
+			clear_framebuffer(&forward, 0xff000000);
+			clear_visibility_buffer(&vb);
+			forward_shaded = draw_forward(&forward, &vb, ordered, count);
+		}
+		double forward_ms = (time_ms() - start) / iterations;
+
+		printf("    %s :\n", stack_order_names[order]);
+		printf("        forward    : %8.2f ms, %10llu pixels shaded\n",
+				forward_ms, (unsigned long long)forward_shaded);
+
+		for (int isa = 0; isa < RASTER_ISA_COUNT; ++isa) {
+			if (!raster_isa_supported((RasterIsa)isa)) {
+				printf("        %-6s     : not supported\n",
+						raster_isa_names[isa]);
+				continue;
+			}
+
+			VisibilityFn draw_visibility = visibility_fns[isa];
+			uint64_t deferred_shaded = 0;
+			double depth_ms = 0.0;
+			start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				double pass_start = time_ms();
+				clear_framebuffer(&deferred, 0xff000000);
+				clear_visibility_buffer(&vb);
+				draw_visibility(&vb, ordered, count);
+				depth_ms += time_ms() - pass_start;
+				deferred_shaded = shade_visibility(&vb, ordered, &deferred);
+			}
+			double deferred_ms = (time_ms() - start) / iterations;
+			depth_ms /= iterations;
+
+			printf("        %-6s     : %8.2f ms, %10llu pixels shaded, "
+					"depth %.2f ms, shade %.2f ms, %.2fx%s\n",
+					raster_isa_names[isa], deferred_ms,
+					(unsigned long long)deferred_shaded, depth_ms,
+					deferred_ms - depth_ms, forward_ms / deferred_ms,
+					framebuffers_match(&forward, &deferred)
+							? "" : ", MISMATCH");
+		}
+	}
+
+	free(ordered);
+	free(stack);
+	destroy_visibility_buffer(&vb);
+	destroy_framebuffer(&deferred);
+	destroy_framebuffer(&forward);
+}
+
+/* How many triangles cover each pixel, for the watertight check. */
+void add_hits(const TriangleSetup* s, uint8_t* hits, uint32_t stride)
+{
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		uint8_t* row = &hits[(size_t)y * stride];
+		float row0 = s->b[0] * (float)y + s->c[0];
+		float row1 = s->b[1] * (float)y + s->c[1];
+		float row2 = s->b[2] * (float)y + s->c[2];
+
+		for (int32_t x = s->min_x; x < s->max_x; ++x) {
+			float e0 = s->a[0] * (float)x + row0;
+			float e1 = s->a[1] * (float)x + row1;
+			float e2 = s->a[2] * (float)x + row2;
+			row[x] += e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f;
+		}
+	}
+}
+
+void add_fixed_hits(const FixedSetup* s, uint8_t* hits, uint32_t stride)
+{
+	int64_t row[3] = { s->origin[0], s->origin[1], s->origin[2] };
+	for (int32_t y = s->min_y; y < s->max_y; ++y) {
+		uint8_t* dst = &hits[(size_t)y * stride];
+		int64_t e0 = row[0];
+		int64_t e1 = row[1];
+		int64_t e2 = row[2];
+		for (int32_t x = s->min_x; x < s->max_x; ++x) {
+			dst[x] += (e0 | e1 | e2) >= 0;
+			e0 += s->a[0];
+			e1 += s->a[1];
+			e2 += s->a[2];
+		}
+		for (int e = 0; e < 3; ++e) {
+			row[e] += s->b[e];
+		}
+	}
+}
+
+/* Cells of the watertight check's grid, in pixels. Whole cells are square,
+ * their diagonals run through pixel centers.
+ */
+#define FIXED_BENCH_CELL 16
+
+/* Float against fixed point edges on the raster workloads, then how each
+ * covers a mesh over the whole framebuffer, as is and with its inner
+ * vertices jittered up to a fifth of a cell, quads stay convex. Fixed
+ * kernels are checked against the scalar one.
+ */
+void bench_fixed(const float* screen, uint32_t color)
+{
+	uint32_t iterations = options.bench_fixed;
+	Framebuffer fb = create_framebuffer(options.width, options.height);
+	Framebuffer reference = create_framebuffer(options.width, options.height);
+
+	BenchWorkload workloads[BENCH_WORKLOAD_COUNT];
+	create_bench_workloads(screen, &fb, workloads);
+
+	printf("Fixed point benchmark : %dx%d, %d iterations\n", options.width,
+			options.height, iterations);
+
+	for (int w = 0; w < BENCH_WORKLOAD_COUNT; ++w) {
+		BenchWorkload* workload = &workloads[w];
+		FixedSetup* setups = malloc(sizeof(FixedSetup)
+				* (workload->setup_count + 1));
+		uint32_t setup_count = 0;
+		uint64_t pixels = 0;
+		for (uint32_t i = 0; i < workload->setup_count; ++i) {
+			setup_count += setup_fixed_triangle(&workload->screens[i * 6],
+					&fb, &setups[setup_count]) ? 1 : 0;
+		}
+		clear_framebuffer(&reference, 0xff000000);
+		for (uint32_t i = 0; i < setup_count; ++i) {
+			pixels += count_fixed_coverage(&setups[i]);
+			fixed_raster_scalar(&reference, &setups[i], color);
+		}
+		printf("    %s : %d triangles, %llu pixels float, %llu fixed\n",
+				workload->name, workload->setup_count,
+				(unsigned long long)workload->pixels,
+				(unsigned long long)pixels);
+
+		for (int isa = 0; isa < RASTER_ISA_COUNT; ++isa) {
+			if (!raster_isa_supported((RasterIsa)isa)) {
+				printf("        %-6s : not supported\n", raster_isa_names[isa]);
+				continue;
+			}
+
+			RasterFn raster = raster_fns[isa];
+			clear_framebuffer(&fb, 0xff000000);
+			double start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				for (uint32_t i = 0; i < workload->setup_count; ++i) {
+					raster(&fb, &workload->setups[i], color);
+				}
+			}
+			double float_ms = time_ms() - start;
+
+			FixedRasterFn fixed_raster = fixed_raster_fns[isa];
+			clear_framebuffer(&fb, 0xff000000);
+			start = time_ms();
+			for (uint32_t it = 0; it < iterations; ++it) {
+				for (uint32_t i = 0; i < setup_count; ++i) {
+					fixed_raster(&fb, &setups[i], color);
+				}
+			}
+			double fixed_ms = time_ms() - start;
+
+			double float_rate = (double)workload->pixels * iterations
+					/ (float_ms / 1000.0);
+			double fixed_rate = (double)pixels * iterations
+					/ (fixed_ms / 1000.0);
+			printf("        %-6s : float %8.1f Mpixels/s, fixed %8.1f "
+					"Mpixels/s, %.2fx%s\n", raster_isa_names[isa],
+					float_rate / 1000000.0, fixed_rate / 1000000.0,
+					fixed_rate / float_rate,
+					framebuffers_match(&fb, &reference) ? "" : ", MISMATCH");
+		}
+		free(setups);
+	}
+
+	uint32_t columns = (options.width + FIXED_BENCH_CELL - 1)
+			/ FIXED_BENCH_CELL;
+	uint32_t rows = (options.height + FIXED_BENCH_CELL - 1)
+			/ FIXED_BENCH_CELL;
+	float* grid = malloc(sizeof(float) * 2 * (columns + 1) * (rows + 1));
+	size_t hit_count = (size_t)fb.stride * fb.height;
+	uint8_t* float_hits = malloc(hit_count);
+	uint8_t* fixed_hits = malloc(hit_count);
+	srand(5);
+	for (int jitter = 0; jitter < 2; ++jitter) {
+		for (uint32_t j = 0; j <= rows; ++j) {
+			for (uint32_t i = 0; i <= columns; ++i) {
+				float* v = &grid[(j * (columns + 1) + i) * 2];
+				uint32_t x = i * FIXED_BENCH_CELL;
+				uint32_t y = j * FIXED_BENCH_CELL;
+				v[0] = (float)(x < fb.width ? x : fb.width);
+				v[1] = (float)(y < fb.height ? y : fb.height);
+				if (jitter && i > 0 && j > 0 && i < columns && j < rows) {
+					v[0] += ((float)rand() / (float)RAND_MAX - 0.5f)
+							* FIXED_BENCH_CELL * 0.4f;
+					v[1] += ((float)rand() / (float)RAND_MAX - 0.5f)
+							* FIXED_BENCH_CELL * 0.4f;
+				}
+			}
+		}
+
+		memset(float_hits, 0, hit_count);
+		memset(fixed_hits, 0, hit_count);
+		for (uint32_t j = 0; j < rows; ++j) {
+			for (uint32_t i = 0; i < columns; ++i) {
+				const float* v00 = &grid[(j * (columns + 1) + i) * 2];
+				const float* v10 = v00 + 2;
+				const float* v01 = v00 + (columns + 1) * 2;
+				const float* v11 = v01 + 2;
+				float triangles[2][6] = {
+					{ v00[0], v00[1], v10[0], v10[1], v11[0], v11[1] }
+					, { v00[0], v00[1], v11[0], v11[1], v01[0], v01[1] }
+				};
+				for (int t = 0; t < 2; ++t) {
+					TriangleSetup setup;
+					if (setup_triangle(triangles[t], &fb, &setup)) {
+						add_hits(&setup, float_hits, fb.stride);
+					}
+					FixedSetup fixed;
+					if (setup_fixed_triangle(triangles[t], &fb, &fixed)) {
+						add_fixed_hits(&fixed, fixed_hits, fb.stride);
+					}
+				}
+			}
+		}
+
+		uint64_t holes[2] = {0};
+		uint64_t twice[2] = {0};
+		for (uint32_t y = 0; y < fb.height; ++y) {
+			for (uint32_t x = 0; x < fb.width; ++x) {
+				size_t i = (size_t)y * fb.stride + x;
+				holes[0] += float_hits[i] == 0;
+				twice[0] += float_hits[i] > 1;
+				holes[1] += fixed_hits[i] == 0;
+				twice[1] += fixed_hits[i] > 1;
+			}
+		}
+		printf("    %s grid : %d triangles\n", jitter ? "jittered" : "aligned",
+				columns * rows * 2);
+		printf("        float  : %8llu holes, %8llu pixels drawn twice\n",
+				(unsigned long long)holes[0], (unsigned long long)twice[0]);
+		printf("        fixed  : %8llu holes, %8llu pixels drawn twice\n",
+				(unsigned long long)holes[1], (unsigned long long)twice[1]);
+	}
+
+	free(fixed_hits);
+	free(float_hits);
+	free(grid);
+	destroy_bench_workloads(workloads);
+	destroy_framebuffer(&reference);
+	destroy_framebuffer(&fb);
+}
+
+#if defined(CPU_RASTER_X11)
+/* The demo triangle spinning in a window, rastered straight into the shared
+ * memory the X server shows. Until the window is closed or the frame count
+ * runs out. Present is the put and any wait for the server to let go of the
+ * buffer, it should be next to nothing.
+ */
+#define WINDOW_REPORT_FRAMES 120
+
+void run_window(const float* vertices, uint32_t color, RasterIsa isa)
+{
+	X11Presenter presenter;
+	x11_present_init(&presenter, app_name, options.width, options.height);
+	uint32_t black = x11_present_pixel(&presenter, 0xff000000);
+	uint32_t pixel = x11_present_pixel(&presenter, color);
+
+	printf("Window : %dx%d, %s, %d threads, MIT-SHM\n", presenter.width,
+			presenter.height, raster_isa_names[isa], job_system.worker_count);
+
+	double render_ms = 0.0;
+	double present_ms = 0.0;
+	uint32_t reported = 0;
+	uint32_t frame = 0;
+	for (; frame < options.window && x11_present_poll(&presenter); ++frame) {
+		double start = time_ms();
+		uint32_t* pixels = x11_present_acquire(&presenter);
+		if (pixels == NULL)
+			break;
+		double acquired = time_ms();
+
+		Framebuffer fb = {
+			.pixels					= pixels
+			, .width				= presenter.width
+			, .height				= presenter.height
+			, .stride				= presenter.stride
+		};
+
+		/* Rotated about z, then y flipped like project_demo_triangle. */
+		float angle = (float)frame * 0.02f;
+		float c = cosf(angle);
+		float s = sinf(angle);
+		const float m[16] = {
+			c, -s, 0.0f, 0.0f
+			, -s, -c, 0.0f, 0.0f
+			, 0.0f, 0.0f, 1.0f, 0.0f
+			, 0.0f, 0.0f, 0.0f, 1.0f
+		};
+		float screen[6];
+		project_triangle(vertices, m, &fb, screen);
+
+		clear_framebuffer(&fb, black);
+		TriangleSetup setup;
+		bool visible = setup_triangle(screen, &fb, &setup);
+		RasterBatch batch = {
+			.fb						= &fb
+			, .setups				= &setup
+			, .setup_count			= visible ? 1 : 0
+			, .raster				= raster_fns[isa]
+			, .color				= pixel
+		};
+		raster_parallel(&batch);
+		destroy_raster_batch(&batch);
+		double rendered = time_ms();
+
+		x11_present_present(&presenter);
+		double presented = time_ms();
+		render_ms += rendered - acquired;
+		present_ms += (acquired - start) + (presented - rendered);
+
+		if (frame + 1 - reported == WINDOW_REPORT_FRAMES) {
+			printf("    frames %5d : render %6.3f ms, present %6.3f ms\n",
+					frame + 1, render_ms / WINDOW_REPORT_FRAMES,
+					present_ms / WINDOW_REPORT_FRAMES);
+			render_ms = 0.0;
+			present_ms = 0.0;
+			reported = frame + 1;
+		}
+	}
+
+	printf("%d frames, %.1f ms waiting for the server\n", frame,
+			presenter.wait_ms);
+	x11_present_destroy(&presenter);
+}
+#endif
+
+
+void print_usage()
+{
+	printf("Options :\n"
+			"    --size=WxH              Framebuffer size, default 1440x900.\n"
+			"    --isa=scalar|sse4.1|avx2  Force a kernel, default the best.\n"
+			"    --output=path           Where the .ppm goes, default cpu_raster.ppm.\n"
+			"    --shaders=gl|vulkan     Whose shaders to run, default gl.\n"
+			"    --msaa                  4x multisampled.\n"
+			"    --fixed                 16.8 fixed point edges, top-left rule.\n"
+			"    --visibility            Depth pass, then one shade per pixel.\n"
+			"    --threads=n             Job workers, default one per core.\n"
+			"    --bench[=iterations]    Pixels per second per kernel, then exit.\n"
+			"    --bench=jobs[=iterations]  Raster and job scaling, then exit.\n"
+			"    --bench=occlusion[=iterations]  Hi-Z culling, then exit.\n"
+			"    --bench=vertices[=iterations]  Vertex stage, then exit.\n"
+			"    --bench=tiled[=iterations]  4K tiled fill rate, then exit.\n"
+			"    --bench=msaa[=iterations]  Multisampled fill rate, then exit.\n"
+			"    --bench=visibility[=iterations]  Overdraw, then exit.\n"
+			"    --bench=fixed[=iterations]  Fixed point edges, then exit.\n"
+			"    --window[=frames]       Spin it in an X11 window, until closed.\n");
+}
+
+void parse_args(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+
+		if (strncmp(arg, "--size=", 7) == 0) {
+			unsigned int width = 0;
+			unsigned int height = 0;
+			if (sscanf(arg + 7, "%ux%u", &width, &height) != 2
+					|| width < 8 || height < 8) {
+				printf("Bad framebuffer size : %s\n", arg + 7);
+				print_usage();
+				exit(-1);
+			}
+			options.width = width;
+			options.height = height;
+
+		} else if (strncmp(arg, "--isa=", 6) == 0) {
+			const char* value = arg + 6;
+			bool found = false;
+			for (int isa = 0; isa < RASTER_ISA_COUNT; ++isa) {
+				if (strcmp(value, raster_isa_names[isa]) == 0) {
+					options.isa = (RasterIsa)isa;
+					found = true;
+				}
+			}
+			if (!found) {
+				printf("Unknown instruction set : %s\n", value);
+				print_usage();
+				exit(-1);
+			}
+
+		} else if (strncmp(arg, "--output=", 9) == 0) {
+			options.output = arg + 9;
+
+		} else if (strncmp(arg, "--shaders=", 10) == 0) {
+			const char* value = arg + 10;
+			if (strcmp(value, "vulkan") == 0) {
+				options.vulkan_shaders = true;
+			} else if (strcmp(value, "gl") == 0) {
+				options.vulkan_shaders = false;
+			} else {
+				printf("Unknown shaders : %s\n", value);
+				print_usage();
+				exit(-1);
+			}
+
+		} else if (strcmp(arg, "--msaa") == 0) {
+			options.msaa = true;
+
+		} else if (strcmp(arg, "--fixed") == 0) {
+			options.fixed = true;
+
+		} else if (strcmp(arg, "--visibility") == 0) {
+			options.visibility = true;
+
+		} else if (strncmp(arg, "--threads=", 10) == 0) {
+			options.threads = (uint32_t)atoi(arg + 10);
+
+		} else if (strncmp(arg, "--bench=jobs", 12) == 0) {
+			options.bench_jobs = arg[12] == '=' ? (uint32_t)atoi(arg + 13) : 0;
+			if (options.bench_jobs == 0) {
+				options.bench_jobs = 200;
+			}
+
+		} else if (strncmp(arg, "--bench=occlusion", 17) == 0) {
+			options.bench_occlusion = arg[17] == '='
+					? (uint32_t)atoi(arg + 18) : 0;
+			if (options.bench_occlusion == 0) {
+				options.bench_occlusion = 200;
+			}
+
+		} else if (strncmp(arg, "--bench=vertices", 16) == 0) {
+			options.bench_vertices = arg[16] == '='
+					? (uint32_t)atoi(arg + 17) : 0;
+			if (options.bench_vertices == 0) {
+				options.bench_vertices = 20;
+			}
+
+		} else if (strncmp(arg, "--bench=tiled", 13) == 0) {
+			options.bench_tiled = arg[13] == '=' ? (uint32_t)atoi(arg + 14) : 0;
+			if (options.bench_tiled == 0) {
+				options.bench_tiled = 20;
+			}
+
+		} else if (strncmp(arg, "--bench=msaa", 12) == 0) {
+			options.bench_msaa = arg[12] == '=' ? (uint32_t)atoi(arg + 13) : 0;
+			if (options.bench_msaa == 0) {
+				options.bench_msaa = 200;
+			}
+
+		} else if (strncmp(arg, "--bench=visibility", 18) == 0) {
+			options.bench_visibility = arg[18] == '='
+					? (uint32_t)atoi(arg + 19) : 0;
+			if (options.bench_visibility == 0) {
+				options.bench_visibility = 2;
+			}
+
+		} else if (strncmp(arg, "--bench=fixed", 13) == 0) {
+			options.bench_fixed = arg[13] == '=' ? (uint32_t)atoi(arg + 14) : 0;
+			if (options.bench_fixed == 0) {
+				options.bench_fixed = 200;
+			}
+
+		} else if (strcmp(arg, "--window") == 0) {
+			options.window = UINT32_MAX;
+
+		} else if (strncmp(arg, "--window=", 9) == 0) {
+			options.window = (uint32_t)atoi(arg + 9);
+			if (options.window == 0) {
+				options.window = UINT32_MAX;
+			}
+
+		} else if (strcmp(arg, "--bench") == 0) {
+			options.bench = 200;
+
+		} else if (strncmp(arg, "--bench=", 8) == 0) {
+			options.bench = (uint32_t)atoi(arg + 8);
+			if (options.bench == 0) {
+				options.bench = 200;
+			}
+
+		} else {
+			printf("Unknown option : %s\n", arg);
+			print_usage();
+			exit(-1);
+		}
+	}
+
+	/* The fixed point kernels have no samples, the visibility buffer's
+	 * neither, nor fixed point edges.
+	 */
+	if ((options.msaa ? 1 : 0) + (options.fixed ? 1 : 0)
+			+ (options.visibility ? 1 : 0) > 1) {
+		printf("Only one of --msaa, --fixed and --visibility.\n");
+		print_usage();
+		exit(-1);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	printf("%s\n\n", app_name);
+
+	parse_args(argc, argv);
+
+	/* Same as the OpenGL demos. */
+	const float vertices[] = {
+		-0.5f, -0.5f, 0.0f,
+		0.5f, -0.5f, 0.0f,
+		0.0f, 0.5f, 0.0f
+	};
+	uint32_t color = shader_color();
+
+	Framebuffer fb = create_framebuffer(options.width, options.height);
+	float screen[6];
+	if (options.vulkan_shaders) {
+		color = run_vulkan_shaders(&fb, screen);
+	} else {
+		project_demo_triangle(vertices, &fb, screen);
+	}
+
+	if (options.bench > 0) {
+		bench_raster(screen, color);
+		destroy_framebuffer(&fb);
+		return 0;
+	}
+
+	if (options.bench_jobs > 0) {
+		bench_jobs(screen, color);
+		destroy_framebuffer(&fb);
+		return 0;
+	}
+
+	if (options.bench_occlusion > 0) {
+		bench_occlusion();
+		destroy_framebuffer(&fb);
+		return 0;
+	}
+
+	if (options.bench_vertices > 0) {
+		bench_vertices();
+		destroy_framebuffer(&fb);
+		return 0;
+	}
+
+	if (options.bench_tiled > 0) {
+		bench_tiled(vertices, color);
+		destroy_framebuffer(&fb);
+		return 0;
+	}
+
+	if (options.bench_msaa > 0) {
+		bench_msaa(screen, color);
+		destroy_framebuffer(&fb);
+		return 0;
+	}
+
+	if (options.bench_visibility > 0) {
+		bench_visibility(screen);
+		destroy_framebuffer(&fb);
+		return 0;
+	}
+
+	if (options.bench_fixed > 0) {
+		bench_fixed(screen, color);
+		destroy_framebuffer(&fb);
+		return 0;
+	}
+
+	RasterIsa isa = options.isa == RASTER_ISA_COUNT
+			? best_raster_isa() : options.isa;
+	if (!raster_isa_supported(isa)) {
+		printf("No %s on this CPU.\n", raster_isa_names[isa]);
+		exit(-1);
+	}
+
+	jobs_init(options.threads);
+
+	if (options.window > 0) {
+#if defined(CPU_RASTER_X11)
+		run_window(vertices, color, isa);
+		jobs_shutdown();
+		destroy_framebuffer(&fb);
+		return 0;
+#else
+		printf("Built without X11, no --window.\n");
+		exit(-1);
+#endif
+	}
+
+	/* Every mode in bands, on the jobs, but the visibility buffer's, whose
+	 * passes take the whole triangle list.
+	 */
+	clear_framebuffer(&fb, 0xff000000);
+	if (options.visibility) {
+		draw_visibility_demo(screen, color, &fb, visibility_fns[isa]);
+	} else {
+		TriangleSetup setup;
+		bool visible = setup_triangle(screen, &fb, &setup);
+		RasterBatch batch = {
+			.fb							= &fb
+			, .setups					= &setup
+			, .setup_count				= visible ? 1 : 0
+			, .raster					= raster_fns[isa]
+			, .color					= color
+		};
+		FixedSetup fixed;
+		MsaaFramebuffer mfb = {0};
+		if (options.fixed) {
+			batch.fixed_setups = &fixed;
+			batch.fixed_raster = fixed_raster_fns[isa];
+			batch.setup_count = setup_fixed_triangle(screen, &fb, &fixed)
+					? 1 : 0;
+		} else if (options.msaa) {
+			mfb = create_msaa_framebuffer(fb.width, fb.height);
+			clear_msaa_framebuffer(&mfb, 0xff000000);
+			batch.mfb = &mfb;
+			batch.msaa_raster = msaa_raster_fns[isa];
+		}
+		raster_parallel(&batch);
+		destroy_raster_batch(&batch);
+		if (options.msaa) {
+			msaa_resolve_parallel(&mfb, &fb, msaa_resolve_fns[isa]);
+			destroy_msaa_framebuffer(&mfb);
+		}
+	}
+
+	write_ppm(&fb, options.output);
+	printf("%dx%d, %s%s, %s shaders, %d threads, written to %s\n", fb.width,
+			fb.height, raster_isa_names[isa], options.fixed ? ", fixed point"
+			: options.msaa ? ", 4x msaa"
+			: options.visibility ? ", visibility buffer" : "",
+			options.vulkan_shaders ? "vulkan" : "gl", job_system.worker_count,
+			options.output);
+
+	jobs_shutdown();
+	destroy_framebuffer(&fb);
+	return 0;
+}
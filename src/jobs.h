@@ -0,0 +1,352 @@
+/* Work-stealing jobs, on C11 atomics and threads. Every worker owns a
+ * Chase-Lev deque : it pushes and pops at the bottom, the others steal from
+ * the top. The thread calling jobs_init is worker 0, it runs jobs whenever
+ * it waits. There are no fibers. A job that depends on others waits on
+ * their counter, and runs other jobs until it reaches zero.
+ *
+ * MSVC needs /experimental:c11atomics for <stdatomic.h>.
+ */
+#include <stdatomic.h>
+#include <threads.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#if defined(_WIN32)
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <unistd.h>
+#endif
+
+#define JOB_DEQUE_SIZE 4096
+#define JOB_MAX_WORKERS 64
+/* Failed steals before a worker goes to sleep. */
+#define JOB_SPIN_COUNT 64
+
+/* Runs [begin, end) of whatever data is. */
+typedef void (*JobFn)(void* data, uint32_t begin, uint32_t end);
+
+/* Jobs not done yet. Zero it before use. */
+typedef struct JobCounter {
+	atomic_uint		pending;
+} JobCounter;
+
+typedef struct Job {
+	JobFn			fn;
+	void*			data;
+	uint32_t		begin;
+	uint32_t		end;
+	JobCounter*		counter;
+} Job;
+
+/* Jobs are stored by value. A thief copies the job before claiming it, and
+ * drops the copy if another thread claimed it first. Top and bottom are
+ * kept on separate cache lines.
+ */
+typedef struct JobDeque {
+	atomic_llong	top;
+	char			pad_top[64];
+	atomic_llong	bottom;
+	char			pad_bottom[64];
+	Job				jobs[JOB_DEQUE_SIZE];
+} JobDeque;
+
+typedef struct JobSystem {
+	uint32_t		worker_count;
+	JobDeque*		deques;
+	thrd_t			threads[JOB_MAX_WORKERS];
+	atomic_bool		running;
+
+	/* Pushed and not taken yet, sleepers wait for it to be > 0. */
+	atomic_uint		queued;
+	atomic_uint		sleeping;
+	mtx_t			lock;
+	cnd_t			wake;
+
+	atomic_ullong	job_count;
+	atomic_ullong	steal_count;
+} JobSystem;
+
+static JobSystem job_system = {0};
+
+/* Worker index of this thread, -1 for threads that aren't workers. Those
+ * run their jobs inline.
+ */
+static _Thread_local int job_worker_index = -1;
+static _Thread_local uint32_t job_random_state = 0;
+
+static inline uint32_t job_cpu_count()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+/* Owner only. Fails when full. */
+static inline bool job_deque_push(JobDeque* q, const Job* job)
+{
+	long long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+	long long t = atomic_load_explicit(&q->top, memory_order_acquire);
+	if (b - t >= JOB_DEQUE_SIZE)
+		return false;
+
+	q->jobs[b & (JOB_DEQUE_SIZE - 1)] = *job;
+	atomic_store_explicit(&q->bottom, b + 1, memory_order_release);
+	return true;
+}
+
+/* Owner only, newest first. Races thieves for the last one. */
+static inline bool job_deque_pop(JobDeque* q, Job* job)
+{
+	long long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+	atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	long long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+	if (t > b) {
+		atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+		return false;
+	}
+
+	*job = q->jobs[b & (JOB_DEQUE_SIZE - 1)];
+	if (t == b) {
+		bool won = atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+				memory_order_seq_cst, memory_order_relaxed);
+		atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+/* Any thread, oldest first. */
+static inline bool job_deque_steal(JobDeque* q, Job* job)
+{
+	long long t = atomic_load_explicit(&q->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	long long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+	if (t >= b)
+		return false;
+
+	*job = q->jobs[t & (JOB_DEQUE_SIZE - 1)];
+	return atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+			memory_order_seq_cst, memory_order_relaxed);
+}
+
+static inline void job_execute(const Job* job)
+{
+	job->fn(job->data, job->begin, job->end);
+	atomic_fetch_add_explicit(&job_system.job_count, 1, memory_order_relaxed);
+	if (job->counter != NULL) {
+		atomic_fetch_sub_explicit(&job->counter->pending, 1,
+				memory_order_release);
+	}
+}
+
+/* Own jobs first, then steal from a random victim onwards. */
+static inline bool job_try_run_one()
+{
+	if (job_worker_index < 0 || job_system.worker_count == 0)
+		return false;
+
+	Job job;
+	bool found = job_deque_pop(&job_system.deques[job_worker_index], &job);
+
+	if (!found && job_system.worker_count > 1) {
+		job_random_state ^= job_random_state << 13;
+		job_random_state ^= job_random_state >> 17;
+		job_random_state ^= job_random_state << 5;
+		uint32_t start = job_random_state % job_system.worker_count;
+
+		for (uint32_t i = 0; i < job_system.worker_count && !found; ++i) {
+			uint32_t victim = (start + i) % job_system.worker_count;
+			if ((int)victim == job_worker_index)
+				continue;
+			found = job_deque_steal(&job_system.deques[victim], &job);
+			if (found) {
+				atomic_fetch_add_explicit(&job_system.steal_count, 1,
+						memory_order_relaxed);
+			}
+		}
+	}
+
+	if (!found)
+		return false;
+
+	atomic_fetch_sub(&job_system.queued, 1);
+	job_execute(&job);
+	return true;
+}
+
+/* Queued is raised before sleeping is read, and sleeping before queued is
+ * read, so either the pusher sees the sleeper or the sleeper sees the job.
+ */
+static inline void job_wake(bool all)
+{
+	if (atomic_load(&job_system.sleeping) == 0)
+		return;
+
+	mtx_lock(&job_system.lock);
+	if (all) {
+		cnd_broadcast(&job_system.wake);
+	} else {
+		cnd_signal(&job_system.wake);
+	}
+	mtx_unlock(&job_system.lock);
+}
+
+static inline int job_worker_main(void* param)
+{
+	job_worker_index = (int)(intptr_t)param;
+	job_random_state = 0x9e3779b9u * (uint32_t)(job_worker_index + 1);
+
+	uint32_t idle = 0;
+	while (atomic_load(&job_system.running)) {
+		if (job_try_run_one()) {
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < JOB_SPIN_COUNT) {
+			thrd_yield();
+			continue;
+		}
+
+		mtx_lock(&job_system.lock);
+		atomic_fetch_add(&job_system.sleeping, 1);
+		while (atomic_load(&job_system.queued) == 0
+				&& atomic_load(&job_system.running))
+		{
+			cnd_wait(&job_system.wake, &job_system.lock);
+		}
+		atomic_fetch_sub(&job_system.sleeping, 1);
+		mtx_unlock(&job_system.lock);
+		idle = 0;
+	}
+	return 0;
+}
+
+/* 0 is one worker per core. The calling thread is worker 0. */
+static inline void jobs_init(uint32_t worker_count)
+{
+	if (worker_count == 0) {
+		worker_count = job_cpu_count();
+	}
+	if (worker_count > JOB_MAX_WORKERS) {
+		worker_count = JOB_MAX_WORKERS;
+	}
+
+	job_system.deques = calloc(worker_count, sizeof(JobDeque));
+	if (job_system.deques == NULL) {
+		printf("Out of memory for %d job deques.\n", worker_count);
+		exit(-1);
+	}
+	job_system.worker_count = worker_count;
+	atomic_store(&job_system.running, true);
+	atomic_store(&job_system.queued, 0);
+	atomic_store(&job_system.sleeping, 0);
+	atomic_store(&job_system.job_count, 0);
+	atomic_store(&job_system.steal_count, 0);
+	mtx_init(&job_system.lock, mtx_plain);
+	cnd_init(&job_system.wake);
+
+	job_worker_index = 0;
+	job_random_state = 0x9e3779b9u;
+	for (uint32_t i = 1; i < worker_count; ++i) {
+		if (thrd_create(&job_system.threads[i], job_worker_main,
+				(void*)(intptr_t)i) != thrd_success)
+		{
+			printf("Could not start job worker %d.\n", i);
+			exit(-1);
+		}
+	}
+}
+
+/* Everything queued must have been waited on. */
+static inline void jobs_shutdown()
+{
+	if (job_system.worker_count == 0)
+		return;
+
+	mtx_lock(&job_system.lock);
+	atomic_store(&job_system.running, false);
+	cnd_broadcast(&job_system.wake);
+	mtx_unlock(&job_system.lock);
+
+	for (uint32_t i = 1; i < job_system.worker_count; ++i) {
+		thrd_join(job_system.threads[i], NULL);
+	}
+
+	cnd_destroy(&job_system.wake);
+	mtx_destroy(&job_system.lock);
+	free(job_system.deques);
+	job_system.deques = NULL;
+	job_system.worker_count = 0;
+	job_worker_index = -1;
+}
+
+/* Without a wake, for batches. */
+static inline void job_push(JobFn fn, void* data, uint32_t begin,
+		uint32_t end, JobCounter* counter)
+{
+	Job job = {
+		.fn						= fn
+		, .data					= data
+		, .begin				= begin
+		, .end					= end
+		, .counter				= counter
+	};
+
+	if (counter != NULL) {
+		atomic_fetch_add_explicit(&counter->pending, 1, memory_order_relaxed);
+	}
+
+	if (job_worker_index >= 0 && job_system.worker_count > 1) {
+		atomic_fetch_add(&job_system.queued, 1);
+		if (job_deque_push(&job_system.deques[job_worker_index], &job))
+			return;
+		atomic_fetch_sub(&job_system.queued, 1);
+	}
+
+	/* Not a worker, a single worker, or a full deque. */
+	job_execute(&job);
+}
+
+static inline void job_run(JobFn fn, void* data, uint32_t begin, uint32_t end,
+		JobCounter* counter)
+{
+	job_push(fn, data, begin, end, counter);
+	job_wake(false);
+}
+
+/* [0, count) in ranges of grain, at least 1. */
+static inline void job_parallel_for(JobFn fn, void* data, uint32_t count,
+		uint32_t grain, JobCounter* counter)
+{
+	if (grain == 0) {
+		grain = 1;
+	}
+	for (uint32_t begin = 0; begin < count; begin += grain) {
+		uint32_t end = count - begin > grain ? begin + grain : count;
+		job_push(fn, data, begin, end, counter);
+	}
+	job_wake(true);
+}
+
+/* Runs jobs until the counter's are all done. */
+static inline void job_wait(JobCounter* counter)
+{
+	while (atomic_load_explicit(&counter->pending, memory_order_acquire) > 0) {
+		if (!job_try_run_one()) {
+			thrd_yield();
+		}
+	}
+}
@@ -0,0 +1,306 @@
+/* Hierarchical Z occlusion culling on the CPU. A few big occluders are
+ * rasterized into a small depth buffer, and every level of the pyramid over
+ * it keeps the farthest depth of the 2x2 texels under it. An object's
+ * screen box is tested on the level where it spans a couple of texels, it
+ * is occluded when its nearest depth is behind all of them.
+ *
+ * Column major matrices, clip space z from 0 to 1 (Vulkan, D3D). Rows are
+ * padded to whole 8 float blocks. Conservative all the way : occluders only
+ * write the pixels they cover whole, at the farthest depth they reach in
+ * them, and objects are tested on their whole screen box.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#define OCCLUSION_MAX_LEVELS 10
+/* Occluders with a vertex closer than this to the eye plane are dropped,
+ * objects are kept.
+ */
+#define OCCLUSION_MIN_W 0.0001f
+
+typedef struct OcclusionBuffer {
+	uint32_t		level_count;
+	uint32_t		widths[OCCLUSION_MAX_LEVELS];
+	uint32_t		heights[OCCLUSION_MAX_LEVELS];
+	uint32_t		strides[OCCLUSION_MAX_LEVELS];
+	float*			levels[OCCLUSION_MAX_LEVELS];
+	float			view_proj[16];
+
+	/* Since occlusion_begin. */
+	uint32_t		occluder_triangles;
+	uint32_t		tested;
+	uint32_t		culled;
+} OcclusionBuffer;
+
+/* Levels down to 4 texels on the short side. */
+static inline void occlusion_init(OcclusionBuffer* ob, uint32_t width,
+		uint32_t height)
+{
+	*ob = (OcclusionBuffer){0};
+	uint32_t w = width;
+	uint32_t h = height;
+	while (ob->level_count < OCCLUSION_MAX_LEVELS) {
+		uint32_t l = ob->level_count++;
+		ob->widths[l] = w;
+		ob->heights[l] = h;
+		ob->strides[l] = (w + 7) & ~7u;
+		ob->levels[l] = malloc(sizeof(float) * ob->strides[l] * h);
+		if (ob->levels[l] == NULL) {
+			printf("Out of memory for a %dx%d occlusion buffer.\n", w, h);
+			exit(-1);
+		}
+		if (w <= 4 || h <= 4)
+			break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+}
+
+static inline void occlusion_destroy(OcclusionBuffer* ob)
+{
+	for (uint32_t l = 0; l < ob->level_count; ++l) {
+		free(ob->levels[l]);
+	}
+	*ob = (OcclusionBuffer){0};
+}
+
+/* Clears to the far plane. */
+static inline void occlusion_begin(OcclusionBuffer* ob,
+		const float view_proj[16])
+{
+	size_t count = (size_t)ob->strides[0] * ob->heights[0];
+	for (size_t i = 0; i < count; ++i) {
+		ob->levels[0][i] = 1.0f;
+	}
+	for (int i = 0; i < 16; ++i) {
+		ob->view_proj[i] = view_proj[i];
+	}
+	ob->occluder_triangles = 0;
+	ob->tested = 0;
+	ob->culled = 0;
+}
+
+static inline void occlusion_transform(const float m[16], const float p[3],
+		float clip[4])
+{
+	for (int r = 0; r < 4; ++r) {
+		clip[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+	}
+}
+
+/* r = a * b, column major. */
+static inline void occlusion_mul(const float a[16], const float b[16],
+		float r[16])
+{
+	for (int c = 0; c < 4; ++c) {
+		for (int row = 0; row < 4; ++row) {
+			float sum = 0.0f;
+			for (int k = 0; k < 4; ++k) {
+				sum += a[k * 4 + row] * b[c * 4 + k];
+			}
+			r[c * 4 + row] = sum;
+		}
+	}
+}
+
+/* Either winding. Edges are moved in by half a pixel's slope, depth back
+ * by as much, so a pixel is written only if the triangle is in front of
+ * all of it. Quads lose the pixels along their diagonal, it's cheap.
+ */
+static inline void occlusion_raster_triangle(OcclusionBuffer* ob,
+		const float clip[3][4])
+{
+	float width = (float)ob->widths[0];
+	float height = (float)ob->heights[0];
+	float x[3];
+	float y[3];
+	float z[3];
+	for (int v = 0; v < 3; ++v) {
+		if (clip[v][3] < OCCLUSION_MIN_W)
+			return;
+		float inv_w = 1.0f / clip[v][3];
+		x[v] = (clip[v][0] * inv_w * 0.5f + 0.5f) * width;
+		y[v] = (clip[v][1] * inv_w * 0.5f + 0.5f) * height;
+		z[v] = clip[v][2] * inv_w;
+	}
+
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0.0f)
+		return;
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+
+	float a[3];
+	float b[3];
+	float c[3];
+	for (int e = 0; e < 3; ++e) {
+		int n = (e + 1) % 3;
+		a[e] = (y[e] - y[n]) * sign;
+		b[e] = (x[n] - x[e]) * sign;
+		c[e] = -(a[e] * x[e] + b[e] * y[e]) + 0.5f * (a[e] + b[e])
+				- 0.5f * (fabsf(a[e]) + fabsf(b[e]));
+	}
+
+	float dzdx = ((z[1] - z[0]) * (y[2] - y[0])
+			- (z[2] - z[0]) * (y[1] - y[0])) / area;
+	float dzdy = ((x[1] - x[0]) * (z[2] - z[0])
+			- (z[1] - z[0]) * (x[2] - x[0])) / area;
+	float z_base = z[0] + dzdx * (0.5f - x[0]) + dzdy * (0.5f - y[0])
+			+ 0.5f * (fabsf(dzdx) + fabsf(dzdy));
+
+	float min_x = fminf(x[0], fminf(x[1], x[2]));
+	float min_y = fminf(y[0], fminf(y[1], y[2]));
+	float max_x = fmaxf(x[0], fmaxf(x[1], x[2]));
+	float max_y = fmaxf(y[0], fmaxf(y[1], y[2]));
+	int32_t x0 = min_x < 0.0f ? 0 : (int32_t)floorf(min_x);
+	int32_t y0 = min_y < 0.0f ? 0 : (int32_t)floorf(min_y);
+	int32_t x1 = max_x > width ? (int32_t)width : (int32_t)ceilf(max_x);
+	int32_t y1 = max_y > height ? (int32_t)height : (int32_t)ceilf(max_y);
+
+	for (int32_t py = y0; py < y1; ++py) {
+		float* row = &ob->levels[0][(size_t)py * ob->strides[0]];
+		float row0 = b[0] * (float)py + c[0];
+		float row1 = b[1] * (float)py + c[1];
+		float row2 = b[2] * (float)py + c[2];
+		float row_z = z_base + dzdy * (float)py;
+
+		/* No branches, the compiler vectorizes it. */
+		for (int32_t px = x0; px < x1; ++px) {
+			float e0 = a[0] * (float)px + row0;
+			float e1 = a[1] * (float)px + row1;
+			float e2 = a[2] * (float)px + row2;
+			float d = row_z + dzdx * (float)px;
+			bool write = e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f
+					&& d < row[px];
+			row[px] = write ? d : row[px];
+		}
+	}
+	++ob->occluder_triangles;
+}
+
+/* Model may be NULL, for world space positions. */
+static inline void occlusion_add_mesh(OcclusionBuffer* ob,
+		const float model[16], const float* positions,
+		const uint32_t* indices, uint32_t triangle_count)
+{
+	float mvp[16];
+	if (model != NULL) {
+		occlusion_mul(ob->view_proj, model, mvp);
+	} else {
+		for (int i = 0; i < 16; ++i) {
+			mvp[i] = ob->view_proj[i];
+		}
+	}
+
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		float clip[3][4];
+		for (int v = 0; v < 3; ++v) {
+			occlusion_transform(mvp, &positions[indices[t * 3 + v] * 3],
+					clip[v]);
+		}
+		occlusion_raster_triangle(ob, clip);
+	}
+}
+
+/* After the last occluder, before the first test. */
+static inline void occlusion_build_pyramid(OcclusionBuffer* ob)
+{
+	for (uint32_t l = 1; l < ob->level_count; ++l) {
+		const float* src = ob->levels[l - 1];
+		uint32_t src_stride = ob->strides[l - 1];
+		uint32_t src_w = ob->widths[l - 1];
+		uint32_t src_h = ob->heights[l - 1];
+		float* dst = ob->levels[l];
+
+		for (uint32_t y = 0; y < ob->heights[l]; ++y) {
+			const float* row_a = &src[(size_t)(y * 2) * src_stride];
+			const float* row_b = &src[(size_t)(y * 2 + 1 < src_h
+					? y * 2 + 1 : y * 2) * src_stride];
+			float* out = &dst[(size_t)y * ob->strides[l]];
+			for (uint32_t x = 0; x < ob->widths[l]; ++x) {
+				uint32_t xa = x * 2;
+				uint32_t xb = xa + 1 < src_w ? xa + 1 : xa;
+				float m_a = row_a[xa] > row_a[xb] ? row_a[xa] : row_a[xb];
+				float m_b = row_b[xa] > row_b[xb] ? row_b[xa] : row_b[xb];
+				out[x] = m_a > m_b ? m_a : m_b;
+			}
+		}
+	}
+}
+
+/* World space box. Boxes crossing the eye plane or off screen are visible,
+ * frustum culling is not this test's job. Only reads the buffer, threads
+ * can test boxes at once once the pyramid is built.
+ */
+static inline bool occlusion_box_visible(const OcclusionBuffer* ob,
+		const float box_min[3], const float box_max[3])
+{
+	float min_x = 1.0f;
+	float min_y = 1.0f;
+	float max_x = -1.0f;
+	float max_y = -1.0f;
+	float min_z = 1.0f;
+	for (int i = 0; i < 8; ++i) {
+		float p[3] = {
+			i & 1 ? box_max[0] : box_min[0]
+			, i & 2 ? box_max[1] : box_min[1]
+			, i & 4 ? box_max[2] : box_min[2]
+		};
+		float clip[4];
+		occlusion_transform(ob->view_proj, p, clip);
+		if (clip[3] < OCCLUSION_MIN_W)
+			return true;
+
+		float inv_w = 1.0f / clip[3];
+		min_x = fminf(min_x, clip[0] * inv_w);
+		min_y = fminf(min_y, clip[1] * inv_w);
+		max_x = fmaxf(max_x, clip[0] * inv_w);
+		max_y = fmaxf(max_y, clip[1] * inv_w);
+		min_z = fminf(min_z, clip[2] * inv_w);
+	}
+
+	float width = (float)ob->widths[0];
+	float height = (float)ob->heights[0];
+	float sx0 = floorf((min_x * 0.5f + 0.5f) * width);
+	float sy0 = floorf((min_y * 0.5f + 0.5f) * height);
+	float sx1 = ceilf((max_x * 0.5f + 0.5f) * width) - 1.0f;
+	float sy1 = ceilf((max_y * 0.5f + 0.5f) * height) - 1.0f;
+	if (sx1 < 0.0f || sy1 < 0.0f || sx0 >= width || sy0 >= height)
+		return true;
+
+	uint32_t x0 = sx0 < 0.0f ? 0 : (uint32_t)sx0;
+	uint32_t y0 = sy0 < 0.0f ? 0 : (uint32_t)sy0;
+	uint32_t x1 = sx1 >= width ? ob->widths[0] - 1 : (uint32_t)sx1;
+	uint32_t y1 = sy1 >= height ? ob->heights[0] - 1 : (uint32_t)sy1;
+
+	/* At most 3x3 texels. */
+	uint32_t span = x1 - x0 > y1 - y0 ? x1 - x0 + 1 : y1 - y0 + 1;
+	uint32_t l = 0;
+	while ((span >> l) > 2 && l + 1 < ob->level_count) {
+		++l;
+	}
+
+	const float* level = ob->levels[l];
+	for (uint32_t y = y0 >> l; y <= y1 >> l; ++y) {
+		const float* row = &level[(size_t)y * ob->strides[l]];
+		for (uint32_t x = x0 >> l; x <= x1 >> l; ++x) {
+			if (min_z <= row[x])
+				return true;
+		}
+	}
+	return false;
+}
+
+/* occlusion_box_visible, counted in tested and culled. */
+static inline bool occlusion_test_box(OcclusionBuffer* ob,
+		const float box_min[3], const float box_max[3])
+{
+	++ob->tested;
+	bool visible = occlusion_box_visible(ob, box_min, box_max);
+	if (!visible) {
+		++ob->culled;
+	}
+	return visible;
+}
@@ -1,12 +1,19 @@
 
-const static char* vertexShaderSource =\
+/* Not every includer uses both. */
+#if defined(__GNUC__)
+#define OPENGL_SHADER_UNUSED __attribute__((unused))
+#else
+#define OPENGL_SHADER_UNUSED
+#endif
+
+static const char* vertexShaderSource OPENGL_SHADER_UNUSED =\
 	"#version 330 core\n"
 	"layout (location = 0) in vec3 position;"
 	"void main()"
 	"{"
 	"gl_Position = vec4(position.x, position.y, position.z, 1.0);"
 	"}\0";
-const static char* fragmentShaderSource =\
+static const char* fragmentShaderSource OPENGL_SHADER_UNUSED =\
 	"#version 330 core\n"
 	"out vec4 color;"
 	"void main() {"
@@ -0,0 +1,1107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+
+/* Translates simple SPIR-V vertex and fragment shaders to C, at build time,
+ * so the CPU raster runs the very modules win_vulkan loads. One invocation
+ * per lane, SPV_LANES of them per call. Every value is an array of lanes per
+ * component, every instruction a loop over the lanes the compiler vectorizes.
+ *
+ * Straight line code only, the way glslang emits small shaders : one
+ * function, one block, no calls, no branches. Float and int scalars, vectors,
+ * arrays and structs of them, in Function, Private, Input and Output
+ * variables. Inputs and outputs are builtins or float locations. Anything
+ * else stops the build with the instruction that isn't supported.
+ *
+ * Usage : spirv_to_c shader.spv shader_spv.h
+ * The function is named after the file, win_vulkan_vert.spv gives
+ * win_vulkan_vert_spv(SpvInvocations* io).
+ */
+
+#define SPV_MAGIC 0x07230203
+
+enum {
+	OP_UNDEF					= 1
+	, OP_EXT_INST_IMPORT		= 11
+	, OP_EXT_INST				= 12
+	, OP_ENTRY_POINT			= 15
+	, OP_TYPE_VOID				= 19
+	, OP_TYPE_BOOL				= 20
+	, OP_TYPE_INT				= 21
+	, OP_TYPE_FLOAT				= 22
+	, OP_TYPE_VECTOR			= 23
+	, OP_TYPE_ARRAY				= 28
+	, OP_TYPE_STRUCT			= 30
+	, OP_TYPE_POINTER			= 32
+	, OP_TYPE_FUNCTION			= 33
+	, OP_CONSTANT_TRUE			= 41
+	, OP_CONSTANT_FALSE			= 42
+	, OP_CONSTANT				= 43
+	, OP_CONSTANT_COMPOSITE		= 44
+	, OP_CONSTANT_NULL			= 46
+	, OP_FUNCTION				= 54
+	, OP_FUNCTION_END			= 56
+	, OP_VARIABLE				= 59
+	, OP_LOAD					= 61
+	, OP_STORE					= 62
+	, OP_ACCESS_CHAIN			= 65
+	, OP_IN_BOUNDS_ACCESS_CHAIN	= 66
+	, OP_DECORATE				= 71
+	, OP_MEMBER_DECORATE		= 72
+	, OP_VECTOR_SHUFFLE			= 79
+	, OP_COMPOSITE_CONSTRUCT	= 80
+	, OP_COMPOSITE_EXTRACT		= 81
+	, OP_COPY_OBJECT			= 83
+	, OP_CONVERT_F_TO_S			= 110
+	, OP_CONVERT_S_TO_F			= 111
+	, OP_BITCAST				= 124
+	, OP_S_NEGATE				= 126
+	, OP_F_NEGATE				= 127
+	, OP_I_ADD					= 128
+	, OP_F_ADD					= 129
+	, OP_I_SUB					= 130
+	, OP_F_SUB					= 131
+	, OP_I_MUL					= 132
+	, OP_F_MUL					= 133
+	, OP_F_DIV					= 136
+	, OP_VECTOR_TIMES_SCALAR	= 142
+	, OP_DOT					= 148
+	, OP_LOGICAL_OR				= 166
+	, OP_LOGICAL_AND			= 167
+	, OP_LOGICAL_NOT			= 168
+	, OP_SELECT					= 169
+	, OP_I_EQUAL				= 170
+	, OP_I_NOT_EQUAL			= 171
+	, OP_S_GREATER_THAN			= 173
+	, OP_S_LESS_THAN			= 177
+	, OP_F_ORD_EQUAL			= 180
+	, OP_F_ORD_LESS_THAN		= 184
+	, OP_F_ORD_GREATER_THAN		= 186
+	, OP_F_ORD_LESS_THAN_EQUAL	= 188
+	, OP_F_ORD_GREATER_THAN_EQUAL	= 190
+	, OP_LABEL					= 248
+	, OP_RETURN					= 253
+};
+
+/* Debug info, modes and capabilities, nothing to run. */
+const uint32_t ignored_ops[] = {
+	0, 2, 3, 4, 5, 6, 7, 8, 10, 14, 16, 17, 317, 330, 331, 332
+};
+
+enum {
+	DECORATION_BUILTIN			= 11
+	, DECORATION_LOCATION		= 30
+};
+
+enum {
+	BUILTIN_POSITION			= 0
+	, BUILTIN_FRAG_COORD		= 15
+	, BUILTIN_VERTEX_INDEX		= 42
+	, BUILTIN_INSTANCE_INDEX	= 43
+};
+
+enum {
+	STORAGE_INPUT				= 1
+	, STORAGE_OUTPUT			= 3
+	, STORAGE_PRIVATE			= 6
+	, STORAGE_FUNCTION			= 7
+};
+
+enum {
+	MODEL_VERTEX				= 0
+	, MODEL_FRAGMENT			= 4
+};
+
+/* GLSL.std.450, component wise only. */
+enum {
+	GLSL_F_ABS					= 4
+	, GLSL_FLOOR				= 8
+	, GLSL_FRACT				= 10
+	, GLSL_SQRT					= 31
+	, GLSL_INVERSE_SQRT			= 32
+	, GLSL_F_MIN				= 37
+	, GLSL_F_MAX				= 40
+	, GLSL_F_CLAMP				= 43
+	, GLSL_F_MIX				= 46
+};
+
+#define MAX_MEMBERS 16
+#define NO_DECORATION UINT32_MAX
+
+typedef enum IdKind {
+	ID_NONE
+	, ID_TYPE
+	, ID_CONSTANT
+	, ID_VARIABLE
+	, ID_POINTER
+	, ID_VALUE
+	, ID_EXT_GLSL
+	, ID_OTHER
+} IdKind;
+
+/* Types are flattened, every one is a run of 32 bit scalars of one kind. */
+typedef struct Id {
+	IdKind			kind;
+	/* Of the value, or the pointee for variables and pointers. */
+	uint32_t		type;
+
+	/* Types. */
+	uint32_t		op;
+	uint32_t		element;
+	uint32_t		length;
+	uint32_t		members[MAX_MEMBERS];
+	uint32_t		member_count;
+	uint32_t		member_builtins[MAX_MEMBERS];
+	uint32_t		width;
+	/* 'f' float, 'i' int and bool, 0 not yet known. */
+	char			scalar;
+
+	/* Constants, width scalars. */
+	uint32_t*		bits;
+
+	/* Variables. */
+	uint32_t		storage;
+	uint32_t		builtin;
+	uint32_t		location;
+
+	/* Pointers, into variable, at offset plus the lanes of dynamic. */
+	uint32_t		variable;
+	uint32_t		offset;
+	bool			dynamic;
+} Id;
+
+typedef struct Module {
+	const uint32_t*	words;
+	size_t			word_count;
+	uint32_t		bound;
+	Id*				ids;
+	uint32_t		entry;
+	uint32_t		model;
+	const char*		name;
+	FILE*			out;
+	/* Removed on failure, a build output never stays half written. */
+	const char*		out_path;
+	bool			in_function;
+	uint32_t		block_count;
+	uint32_t		variables[64];
+	uint32_t		variable_count;
+} Module;
+
+Module module = {0};
+
+void fail(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	printf("spirv_to_c : ");
+	vprintf(format, args);
+	printf("\n");
+	va_end(args);
+	if (module.out != NULL) {
+		fclose(module.out);
+		remove(module.out_path);
+	}
+	exit(-1);
+}
+
+Id* id(uint32_t i)
+{
+	if (i == 0 || i >= module.bound)
+		fail("id %d out of bounds", i);
+	return &module.ids[i];
+}
+
+Id* type_of(uint32_t i)
+{
+	return id(id(i)->type);
+}
+
+void emit(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(module.out, format, args);
+	va_end(args);
+}
+
+const char* c_type(const Id* type)
+{
+	return type->scalar == 'f' ? "float" : "int32_t";
+}
+
+/* Component c of an operand, at lane l. Constants are literals. */
+const char* operand(uint32_t i, uint32_t c)
+{
+	static char buffers[8][64];
+	static int next = 0;
+	char* s = buffers[next];
+	next = (next + 1) % 8;
+
+	Id* value = id(i);
+	Id* type = id(value->type);
+	if (c >= type->width)
+		fail("component %d of %%%d out of range", c, i);
+
+	if (value->kind == ID_CONSTANT) {
+		uint32_t bits = value->bits[c];
+		if (type->scalar == 'f') {
+			float f;
+			memcpy(&f, &bits, sizeof(f));
+			if (f != f || f - f != 0.0f)
+				fail("constant %%%d isn't finite", i);
+			/* 9 digits are enough to get the same float back. */
+			snprintf(s, 64, "%.9ef", f);
+		} else if (bits == 0x80000000u) {
+			snprintf(s, 64, "(-2147483647 - 1)");
+		} else {
+			snprintf(s, 64, "%d", (int32_t)bits);
+		}
+	} else if (value->kind == ID_VALUE) {
+		snprintf(s, 64, "r%d[%d][l]", i, c);
+	} else {
+		fail("%%%d isn't a value", i);
+	}
+	return s;
+}
+
+void declare_value(uint32_t result, uint32_t type)
+{
+	Id* value = id(result);
+	value->kind = ID_VALUE;
+	value->type = type;
+	emit("\t%s r%d[%d][SPV_LANES];\n", c_type(id(type)), result,
+			id(type)->width);
+}
+
+void begin_lanes()
+{
+	emit("\tfor (int l = 0; l < SPV_LANES; ++l) {\n");
+}
+
+void end_lanes()
+{
+	emit("\t}\n");
+}
+
+/* Scalar kind and width, now that the parts are known. */
+void finish_type(Id* type)
+{
+	switch (type->op) {
+		case OP_TYPE_BOOL:
+		case OP_TYPE_INT:
+			type->width = 1;
+			type->scalar = 'i';
+			break;
+		case OP_TYPE_FLOAT:
+			type->width = 1;
+			type->scalar = 'f';
+			break;
+		case OP_TYPE_VECTOR:
+		case OP_TYPE_ARRAY:
+			type->width = id(type->element)->width * type->length;
+			type->scalar = id(type->element)->scalar;
+			break;
+		case OP_TYPE_STRUCT:
+			type->width = 0;
+			for (uint32_t m = 0; m < type->member_count; ++m) {
+				Id* member = id(type->members[m]);
+				if (type->scalar != 0 && member->scalar != type->scalar)
+					fail("struct %%%d mixes floats and ints", type->members[m]);
+				type->scalar = member->scalar;
+				type->width += member->width;
+			}
+			break;
+	}
+}
+
+/* Where index lands in type, and the type it lands on. Struct members need
+ * constant indices.
+ */
+uint32_t element_offset(const Id* type, uint32_t index, uint32_t* element)
+{
+	if (type->op == OP_TYPE_STRUCT) {
+		if (index >= type->member_count)
+			fail("member %d out of range", index);
+		uint32_t offset = 0;
+		for (uint32_t m = 0; m < index; ++m) {
+			offset += id(type->members[m])->width;
+		}
+		*element = type->members[index];
+		return offset;
+	}
+	if (type->op != OP_TYPE_VECTOR && type->op != OP_TYPE_ARRAY)
+		fail("can't index a type %d", type->op);
+	*element = type->element;
+	return id(type->element)->width * index;
+}
+
+void access_chain(const uint32_t* args, uint32_t count)
+{
+	uint32_t result_type = args[0];
+	uint32_t result = args[1];
+	Id* base = id(args[2]);
+	if (base->kind != ID_VARIABLE && base->kind != ID_POINTER)
+		fail("access chain on %%%d, not a pointer", args[2]);
+
+	Id* pointer = id(result);
+	pointer->kind = ID_POINTER;
+	pointer->type = id(result_type)->element;
+	pointer->variable = base->kind == ID_VARIABLE ? args[2] : base->variable;
+	pointer->offset = base->kind == ID_VARIABLE ? 0 : base->offset;
+
+	bool dynamic = base->kind == ID_POINTER && base->dynamic;
+	for (uint32_t i = 3; i < count; ++i) {
+		dynamic = dynamic || id(args[i])->kind != ID_CONSTANT;
+	}
+	pointer->dynamic = dynamic;
+	if (dynamic) {
+		emit("\tint32_t p%d[SPV_LANES];\n", result);
+		begin_lanes();
+		if (base->kind == ID_POINTER && base->dynamic) {
+			emit("\t\tp%d[l] = p%d[l];\n", result, args[2]);
+		} else {
+			emit("\t\tp%d[l] = 0;\n", result);
+		}
+	}
+
+	/* Out of bounds is undefined, the lanes that aren't used clamp. */
+	uint32_t type = base->type;
+	for (uint32_t i = 3; i < count; ++i) {
+		Id* index = id(args[i]);
+		uint32_t element = 0;
+		if (index->kind == ID_CONSTANT) {
+			pointer->offset += element_offset(id(type), index->bits[0],
+					&element);
+		} else {
+			Id* t = id(type);
+			if (t->op == OP_TYPE_STRUCT)
+				fail("struct %%%d indexed by a variable", type);
+			uint32_t stride = element_offset(t, 1, &element);
+			const char* x = operand(args[i], 0);
+			emit("\t\tp%d[l] += (%s < 0 ? 0 : %s > %d ? %d : %s) * %d;\n",
+					result, x, x, t->length - 1, t->length - 1, x, stride);
+		}
+		type = element;
+	}
+	if (dynamic) {
+		end_lanes();
+	}
+	if (type != pointer->type)
+		fail("access chain %%%d ends on the wrong type", result);
+}
+
+/* Variable storage, with the lane offset of dynamic pointers. */
+const char* slot(const Id* pointer, uint32_t pointer_id, uint32_t c)
+{
+	static char buffers[2][64];
+	static int next = 0;
+	char* s = buffers[next];
+	next = (next + 1) % 2;
+
+	if (pointer->kind == ID_VARIABLE) {
+		snprintf(s, 64, "v%d[%d][l]", pointer_id, c);
+	} else if (pointer->dynamic) {
+		snprintf(s, 64, "v%d[p%d[l] + %d][l]", pointer->variable, pointer_id,
+				pointer->offset + c);
+	} else {
+		snprintf(s, 64, "v%d[%d][l]", pointer->variable, pointer->offset + c);
+	}
+	return s;
+}
+
+void load(const uint32_t* args)
+{
+	Id* pointer = id(args[2]);
+	if (pointer->kind != ID_VARIABLE && pointer->kind != ID_POINTER)
+		fail("load from %%%d, not a pointer", args[2]);
+	declare_value(args[1], args[0]);
+	begin_lanes();
+	for (uint32_t c = 0; c < id(args[0])->width; ++c) {
+		emit("\t\tr%d[%d][l] = %s;\n", args[1], c,
+				slot(pointer, args[2], c));
+	}
+	end_lanes();
+}
+
+void store(const uint32_t* args)
+{
+	Id* pointer = id(args[0]);
+	if (pointer->kind != ID_VARIABLE && pointer->kind != ID_POINTER)
+		fail("store to %%%d, not a pointer", args[0]);
+	begin_lanes();
+	for (uint32_t c = 0; c < type_of(args[1])->width; ++c) {
+		emit("\t\t%s = %s;\n", slot(pointer, args[0], c),
+				operand(args[1], c));
+	}
+	end_lanes();
+}
+
+/* Builtins and locations in the io block, for one component. */
+const char* io_slot(const Id* variable, uint32_t builtin, uint32_t c)
+{
+	static char s[64];
+	switch (builtin) {
+		case BUILTIN_POSITION:
+			snprintf(s, 64, "io->position[%d][l]", c);
+			return s;
+		case BUILTIN_FRAG_COORD:
+			snprintf(s, 64, "io->frag_coord[%d][l]", c);
+			return s;
+		case BUILTIN_VERTEX_INDEX:
+			return "io->vertex_index[l]";
+		case BUILTIN_INSTANCE_INDEX:
+			return "io->instance_index[l]";
+		case NO_DECORATION:
+			break;
+		default:
+			return NULL;
+	}
+	if (variable->location == NO_DECORATION)
+		fail("input or output without a location or builtin");
+	if (variable->location >= 8 || c >= 4)
+		fail("location %d is past what SpvInvocations holds",
+				variable->location);
+	if (id(variable->type)->scalar != 'f')
+		fail("location %d isn't float", variable->location);
+	snprintf(s, 64, "io->%s[%d][%d][l]", variable->storage == STORAGE_INPUT
+			? "inputs" : "outputs", variable->location, c);
+	return s;
+}
+
+/* Copies inputs in, or outputs out. Builtins nobody reads, point size or
+ * clip distances, are dropped.
+ */
+void copy_io(uint32_t storage)
+{
+	for (uint32_t v = 0; v < module.variable_count; ++v) {
+		uint32_t var_id = module.variables[v];
+		Id* var = id(var_id);
+		if (var->storage != storage)
+			continue;
+
+		Id* type = id(var->type);
+		begin_lanes();
+		if (type->op == OP_TYPE_STRUCT) {
+			uint32_t offset = 0;
+			for (uint32_t m = 0; m < type->member_count; ++m) {
+				uint32_t width = id(type->members[m])->width;
+				for (uint32_t c = 0; c < width; ++c) {
+					const char* io = io_slot(var, type->member_builtins[m], c);
+					if (io == NULL)
+						continue;
+					if (storage == STORAGE_INPUT) {
+						emit("\t\tv%d[%d][l] = %s;\n", var_id, offset + c, io);
+					} else {
+						emit("\t\t%s = v%d[%d][l];\n", io, var_id, offset + c);
+					}
+				}
+				offset += width;
+			}
+		} else {
+			for (uint32_t c = 0; c < type->width; ++c) {
+				const char* io = io_slot(var, var->builtin, c);
+				if (io == NULL)
+					continue;
+				if (storage == STORAGE_INPUT) {
+					emit("\t\tv%d[%d][l] = %s;\n", var_id, c, io);
+				} else {
+					emit("\t\t%s = v%d[%d][l];\n", io, var_id, c);
+				}
+			}
+		}
+		end_lanes();
+	}
+}
+
+void declare_variable(uint32_t var_id)
+{
+	Id* var = id(var_id);
+	emit("\t%s v%d[%d][SPV_LANES] = {{0}};\n", c_type(id(var->type)), var_id,
+			id(var->type)->width);
+}
+
+void begin_function(const uint32_t* args)
+{
+	if (args[1] != module.entry)
+		fail("function %%%d isn't the entry point, calls aren't supported",
+				args[1]);
+	module.in_function = true;
+
+	emit("/* %s shader. */\n", module.model == MODEL_VERTEX
+			? "Vertex" : "Fragment");
+	emit("static inline void %s(SpvInvocations* io)\n{\n", module.name);
+	for (uint32_t v = 0; v < module.variable_count; ++v) {
+		declare_variable(module.variables[v]);
+	}
+	copy_io(STORAGE_INPUT);
+}
+
+void variable(const uint32_t* args, uint32_t count)
+{
+	Id* var = id(args[1]);
+	var->kind = ID_VARIABLE;
+	var->type = id(args[0])->element;
+	var->storage = args[2];
+
+	switch (var->storage) {
+		case STORAGE_INPUT:
+		case STORAGE_OUTPUT:
+		case STORAGE_PRIVATE:
+		case STORAGE_FUNCTION:
+			break;
+		default:
+			fail("variable %%%d in storage class %d, no buffers or uniforms",
+					args[1], var->storage);
+	}
+	if (id(var->type)->scalar == 0)
+		fail("variable %%%d has no scalars", args[1]);
+
+	if (module.in_function) {
+		declare_variable(args[1]);
+	} else {
+		if (module.variable_count == 64)
+			fail("too many variables");
+		module.variables[module.variable_count++] = args[1];
+	}
+
+	if (count > 3) {
+		if (!module.in_function)
+			fail("initialized global %%%d", args[1]);
+		begin_lanes();
+		for (uint32_t c = 0; c < id(var->type)->width; ++c) {
+			emit("\t\tv%d[%d][l] = %s;\n", args[1], c, operand(args[3], c));
+		}
+		end_lanes();
+	}
+}
+
+void constant(uint32_t op, const uint32_t* args, uint32_t count)
+{
+	Id* value = id(args[1]);
+	Id* type = id(args[0]);
+	value->kind = ID_CONSTANT;
+	value->type = args[0];
+	value->bits = calloc(type->width, sizeof(uint32_t));
+
+	switch (op) {
+		case OP_CONSTANT:
+			if (count != 3 || type->width != 1)
+				fail("constant %%%d isn't 32 bit", args[1]);
+			value->bits[0] = args[2];
+			break;
+		case OP_CONSTANT_TRUE:
+			value->bits[0] = 1;
+			break;
+		case OP_CONSTANT_COMPOSITE: {
+			uint32_t offset = 0;
+			for (uint32_t i = 2; i < count; ++i) {
+				Id* part = id(args[i]);
+				if (part->kind != ID_CONSTANT)
+					fail("composite %%%d of non constants", args[1]);
+				uint32_t width = id(part->type)->width;
+				memcpy(&value->bits[offset], part->bits,
+						sizeof(uint32_t) * width);
+				offset += width;
+			}
+		} break;
+	}
+}
+
+/* Same operation on every component, operands of the result's width.
+ * Format has $0, $1 and $2 for them.
+ */
+void component_wise(const uint32_t* args, uint32_t operand_count,
+		const char* format)
+{
+	declare_value(args[1], args[0]);
+	begin_lanes();
+	for (uint32_t c = 0; c < id(args[0])->width; ++c) {
+		const char* a = operand(args[2], c);
+		const char* b = operand_count > 1 ? operand(args[3], c) : "";
+		const char* d = operand_count > 2 ? operand(args[4], c) : "";
+		emit("\t\tr%d[%d][l] = ", args[1], c);
+		/* $0 to $2 are the operands. */
+		char line[512];
+		const char* parts[3] = { a, b, d };
+		size_t n = 0;
+		for (const char* f = format; *f != 0 && n + 64 < sizeof(line); ++f) {
+			if (f[0] == '$' && f[1] >= '0' && f[1] <= '2') {
+				n += (size_t)snprintf(&line[n], sizeof(line) - n, "%s",
+						parts[f[1] - '0']);
+				++f;
+			} else {
+				line[n++] = *f;
+			}
+		}
+		line[n] = 0;
+		emit("%s;\n", line);
+	}
+	end_lanes();
+}
+
+/* Result type, result, set, instruction, then the operands. */
+void ext_inst(const uint32_t* args, uint32_t count)
+{
+	if (id(args[2])->kind != ID_EXT_GLSL)
+		fail("extended instruction set %%%d isn't GLSL.std.450", args[2]);
+	if (count > 7)
+		fail("GLSL.std.450 instruction %d has too many operands", args[3]);
+	uint32_t shifted[5] = { args[0], args[1] };
+	for (uint32_t i = 4; i < count; ++i) {
+		shifted[i - 2] = args[i];
+	}
+
+	switch (args[3]) {
+		case GLSL_F_ABS:
+			component_wise(shifted, 1, "fabsf($0)");
+			break;
+		case GLSL_FLOOR:
+			component_wise(shifted, 1, "floorf($0)");
+			break;
+		case GLSL_FRACT:
+			component_wise(shifted, 1, "$0 - floorf($0)");
+			break;
+		case GLSL_SQRT:
+			component_wise(shifted, 1, "sqrtf($0)");
+			break;
+		case GLSL_INVERSE_SQRT:
+			component_wise(shifted, 1, "1.0f / sqrtf($0)");
+			break;
+		case GLSL_F_MIN:
+			component_wise(shifted, 2, "$1 < $0 ? $1 : $0");
+			break;
+		case GLSL_F_MAX:
+			component_wise(shifted, 2, "$0 < $1 ? $1 : $0");
+			break;
+		case GLSL_F_CLAMP:
+			component_wise(shifted, 3, "$0 < $1 ? $1 : ($2 < $0 ? $2 : $0)");
+			break;
+		case GLSL_F_MIX:
+			component_wise(shifted, 3, "$0 * (1.0f - $2) + $1 * $2");
+			break;
+		default:
+			fail("GLSL.std.450 instruction %d isn't supported", args[3]);
+	}
+}
+
+void instruction(uint32_t op, const uint32_t* args, uint32_t count)
+{
+	for (size_t i = 0; i < sizeof(ignored_ops) / sizeof(ignored_ops[0]); ++i) {
+		if (op == ignored_ops[i])
+			return;
+	}
+
+	switch (op) {
+		case OP_EXT_INST_IMPORT:
+			if (strcmp((const char*)&args[1], "GLSL.std.450") != 0)
+				fail("extended instructions %s", (const char*)&args[1]);
+			id(args[0])->kind = ID_EXT_GLSL;
+			break;
+
+		case OP_ENTRY_POINT:
+			if (module.entry != 0)
+				fail("more than one entry point");
+			if (args[0] != MODEL_VERTEX && args[0] != MODEL_FRAGMENT)
+				fail("execution model %d, vertex and fragment only", args[0]);
+			module.model = args[0];
+			module.entry = args[1];
+			break;
+
+		case OP_DECORATE:
+			if (args[1] == DECORATION_BUILTIN) {
+				id(args[0])->builtin = args[2];
+			} else if (args[1] == DECORATION_LOCATION) {
+				id(args[0])->location = args[2];
+			}
+			break;
+
+		case OP_MEMBER_DECORATE:
+			if (args[2] == DECORATION_BUILTIN && args[1] < MAX_MEMBERS) {
+				id(args[0])->member_builtins[args[1]] = args[3];
+			}
+			break;
+
+		case OP_TYPE_VOID:
+		case OP_TYPE_FUNCTION:
+			id(args[0])->kind = ID_OTHER;
+			break;
+
+		case OP_TYPE_BOOL:
+		case OP_TYPE_INT:
+		case OP_TYPE_FLOAT:
+		case OP_TYPE_VECTOR:
+		case OP_TYPE_ARRAY:
+		case OP_TYPE_STRUCT:
+		case OP_TYPE_POINTER: {
+			Id* type = id(args[0]);
+			type->kind = ID_TYPE;
+			type->op = op;
+			if ((op == OP_TYPE_INT || op == OP_TYPE_FLOAT) && args[1] != 32)
+				fail("%d bit scalars", args[1]);
+			if (op == OP_TYPE_VECTOR) {
+				type->element = args[1];
+				type->length = args[2];
+			} else if (op == OP_TYPE_ARRAY) {
+				type->element = args[1];
+				type->length = id(args[2])->bits[0];
+			} else if (op == OP_TYPE_POINTER) {
+				type->element = args[2];
+			} else if (op == OP_TYPE_STRUCT) {
+				if (count - 1 > MAX_MEMBERS)
+					fail("struct %%%d has too many members", args[0]);
+				type->member_count = count - 1;
+				memcpy(type->members, &args[1], sizeof(uint32_t) * (count - 1));
+			}
+			finish_type(type);
+		} break;
+
+		case OP_CONSTANT:
+		case OP_CONSTANT_TRUE:
+		case OP_CONSTANT_FALSE:
+		case OP_CONSTANT_COMPOSITE:
+		case OP_CONSTANT_NULL:
+		case OP_UNDEF:
+			constant(op, args, count);
+			break;
+
+		case OP_VARIABLE:
+			variable(args, count);
+			break;
+
+		case OP_FUNCTION:
+			begin_function(args);
+			break;
+
+		case OP_LABEL:
+			if (!module.in_function || module.block_count++ > 0)
+				fail("more than one block, branches aren't supported");
+			break;
+
+		case OP_RETURN:
+			copy_io(STORAGE_OUTPUT);
+			break;
+
+		case OP_FUNCTION_END:
+			emit("}\n");
+			module.in_function = false;
+			break;
+
+		case OP_LOAD:
+			load(args);
+			break;
+
+		case OP_STORE:
+			store(args);
+			break;
+
+		case OP_ACCESS_CHAIN:
+		case OP_IN_BOUNDS_ACCESS_CHAIN:
+			access_chain(args, count);
+			break;
+
+		case OP_COMPOSITE_EXTRACT: {
+			uint32_t type = id(args[2])->type;
+			uint32_t offset = 0;
+			for (uint32_t i = 3; i < count; ++i) {
+				uint32_t element = 0;
+				offset += element_offset(id(type), args[i], &element);
+				type = element;
+			}
+			declare_value(args[1], args[0]);
+			begin_lanes();
+			for (uint32_t c = 0; c < id(args[0])->width; ++c) {
+				emit("\t\tr%d[%d][l] = %s;\n", args[1], c,
+						operand(args[2], offset + c));
+			}
+			end_lanes();
+		} break;
+
+		case OP_COMPOSITE_CONSTRUCT: {
+			declare_value(args[1], args[0]);
+			begin_lanes();
+			uint32_t c = 0;
+			for (uint32_t i = 2; i < count; ++i) {
+				for (uint32_t p = 0; p < type_of(args[i])->width; ++p) {
+					emit("\t\tr%d[%d][l] = %s;\n", args[1], c++,
+							operand(args[i], p));
+				}
+			}
+			end_lanes();
+		} break;
+
+		case OP_VECTOR_SHUFFLE: {
+			uint32_t first = type_of(args[2])->width;
+			declare_value(args[1], args[0]);
+			begin_lanes();
+			for (uint32_t i = 4; i < count; ++i) {
+				uint32_t c = args[i];
+				emit("\t\tr%d[%d][l] = %s;\n", args[1], i - 4,
+						c == UINT32_MAX ? "0"
+						: c < first ? operand(args[2], c)
+						: operand(args[3], c - first));
+			}
+			end_lanes();
+		} break;
+
+		case OP_COPY_OBJECT:
+			component_wise(args, 1, "$0");
+			break;
+
+		case OP_CONVERT_F_TO_S:
+			component_wise(args, 1, "(int32_t)$0");
+			break;
+
+		case OP_CONVERT_S_TO_F:
+			component_wise(args, 1, "(float)$0");
+			break;
+
+		case OP_BITCAST:
+			component_wise(args, 1, id(args[0])->scalar == 'f'
+					? "spv_as_float($0)" : "spv_as_int($0)");
+			break;
+
+		/* Signed overflow wraps in SPIR-V, not in C. */
+		case OP_S_NEGATE:
+			component_wise(args, 1, "(int32_t)(0u - (uint32_t)$0)");
+			break;
+
+		case OP_I_ADD:
+			component_wise(args, 2, "(int32_t)((uint32_t)$0 + (uint32_t)$1)");
+			break;
+
+		case OP_I_SUB:
+			component_wise(args, 2, "(int32_t)((uint32_t)$0 - (uint32_t)$1)");
+			break;
+
+		case OP_I_MUL:
+			component_wise(args, 2, "(int32_t)((uint32_t)$0 * (uint32_t)$1)");
+			break;
+
+		case OP_F_NEGATE:
+			component_wise(args, 1, "-$0");
+			break;
+
+		case OP_F_ADD:
+			component_wise(args, 2, "$0 + $1");
+			break;
+
+		case OP_F_SUB:
+			component_wise(args, 2, "$0 - $1");
+			break;
+
+		case OP_F_MUL:
+			component_wise(args, 2, "$0 * $1");
+			break;
+
+		case OP_F_DIV:
+			component_wise(args, 2, "$0 / $1");
+			break;
+
+		case OP_VECTOR_TIMES_SCALAR: {
+			declare_value(args[1], args[0]);
+			begin_lanes();
+			for (uint32_t c = 0; c < id(args[0])->width; ++c) {
+				emit("\t\tr%d[%d][l] = %s * %s;\n", args[1], c,
+						operand(args[2], c), operand(args[3], 0));
+			}
+			end_lanes();
+		} break;
+
+		case OP_DOT: {
+			declare_value(args[1], args[0]);
+			begin_lanes();
+			emit("\t\tr%d[0][l] = %s * %s", args[1], operand(args[2], 0),
+					operand(args[3], 0));
+			for (uint32_t c = 1; c < type_of(args[2])->width; ++c) {
+				emit("\n\t\t\t\t+ %s * %s", operand(args[2], c),
+						operand(args[3], c));
+			}
+			emit(";\n");
+			end_lanes();
+		} break;
+
+		case OP_SELECT: {
+			bool scalar_condition = type_of(args[2])->width == 1;
+			declare_value(args[1], args[0]);
+			begin_lanes();
+			for (uint32_t c = 0; c < id(args[0])->width; ++c) {
+				emit("\t\tr%d[%d][l] = %s ? %s : %s;\n", args[1], c,
+						operand(args[2], scalar_condition ? 0 : c),
+						operand(args[3], c), operand(args[4], c));
+			}
+			end_lanes();
+		} break;
+
+		case OP_LOGICAL_OR:
+			component_wise(args, 2, "$0 | $1");
+			break;
+
+		case OP_LOGICAL_AND:
+			component_wise(args, 2, "$0 & $1");
+			break;
+
+		case OP_LOGICAL_NOT:
+			component_wise(args, 1, "$0 ^ 1");
+			break;
+
+		case OP_I_EQUAL:
+		case OP_F_ORD_EQUAL:
+			component_wise(args, 2, "$0 == $1");
+			break;
+
+		case OP_I_NOT_EQUAL:
+			component_wise(args, 2, "$0 != $1");
+			break;
+
+		case OP_S_LESS_THAN:
+		case OP_F_ORD_LESS_THAN:
+			component_wise(args, 2, "$0 < $1");
+			break;
+
+		case OP_S_GREATER_THAN:
+		case OP_F_ORD_GREATER_THAN:
+			component_wise(args, 2, "$0 > $1");
+			break;
+
+		case OP_F_ORD_LESS_THAN_EQUAL:
+			component_wise(args, 2, "$0 <= $1");
+			break;
+
+		case OP_F_ORD_GREATER_THAN_EQUAL:
+			component_wise(args, 2, "$0 >= $1");
+			break;
+
+		case OP_EXT_INST:
+			ext_inst(args, count);
+			break;
+
+		default:
+			fail("instruction %d isn't supported", op);
+	}
+}
+
+const char* base_name(const char* path)
+{
+	const char* base = path;
+	for (const char* p = path; *p != 0; ++p) {
+		if (*p == '/' || *p == '\\') {
+			base = p + 1;
+		}
+	}
+	return base;
+}
+
+/* Everything the generated functions share, once per translation unit. */
+void emit_prelude(const char* source)
+{
+	emit("/* Generated by spirv_to_c from %s, do not edit. */\n",
+			base_name(source));
+	emit("#include <stdint.h>\n#include <string.h>\n#include <math.h>\n\n");
+	emit("#ifndef SPV_LANES\n"
+			"#define SPV_LANES 8\n"
+			"#define SPV_LOCATIONS 8\n"
+			"\n"
+			"/* SPV_LANES invocations, component then lane. Callers pad the\n"
+			" * last batch, every lane runs.\n"
+			" */\n"
+			"typedef struct SpvInvocations {\n"
+			"\tint32_t\t\t\tvertex_index[SPV_LANES];\n"
+			"\tint32_t\t\t\tinstance_index[SPV_LANES];\n"
+			"\tfloat\t\t\tfrag_coord[4][SPV_LANES];\n"
+			"\tfloat\t\t\tinputs[SPV_LOCATIONS][4][SPV_LANES];\n"
+			"\n"
+			"\tfloat\t\t\tposition[4][SPV_LANES];\n"
+			"\tfloat\t\t\toutputs[SPV_LOCATIONS][4][SPV_LANES];\n"
+			"} SpvInvocations;\n"
+			"\n"
+			"static inline float spv_as_float(int32_t i)\n"
+			"{\n"
+			"\tfloat f;\n"
+			"\tmemcpy(&f, &i, sizeof(f));\n"
+			"\treturn f;\n"
+			"}\n"
+			"\n"
+			"static inline int32_t spv_as_int(float f)\n"
+			"{\n"
+			"\tint32_t i;\n"
+			"\tmemcpy(&i, &f, sizeof(i));\n"
+			"\treturn i;\n"
+			"}\n"
+			"#endif\n\n");
+}
+
+/* win_vulkan_vert.spv is win_vulkan_vert_spv. */
+char* function_name(const char* path)
+{
+	const char* base = base_name(path);
+	char* name = malloc(strlen(base) + 1);
+	size_t n = 0;
+	for (const char* p = base; *p != 0; ++p) {
+		bool alnum = (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')
+				|| (*p >= '0' && *p <= '9');
+		name[n++] = alnum ? *p : '_';
+	}
+	name[n] = 0;
+	return name;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		printf("Usage : spirv_to_c shader.spv shader_spv.h\n");
+		return -1;
+	}
+
+	FILE* f = fopen(argv[1], "rb");
+	if (f == NULL)
+		fail("can't read %s", argv[1]);
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint32_t* words = malloc((size_t)size + 4);
+	if (size < 20 || words == NULL
+			|| fread(words, 1, (size_t)size, f) != (size_t)size)
+		fail("can't read %s", argv[1]);
+	fclose(f);
+	if (words[0] != SPV_MAGIC)
+		fail("%s isn't SPIR-V, or not little endian", argv[1]);
+
+	module.words = words;
+	module.word_count = (size_t)size / 4;
+	module.bound = words[3];
+	module.ids = calloc(module.bound, sizeof(Id));
+	module.name = function_name(argv[1]);
+	for (uint32_t i = 0; i < module.bound; ++i) {
+		module.ids[i].builtin = NO_DECORATION;
+		module.ids[i].location = NO_DECORATION;
+		for (int m = 0; m < MAX_MEMBERS; ++m) {
+			module.ids[i].member_builtins[m] = NO_DECORATION;
+		}
+	}
+
+	module.out = fopen(argv[2], "w");
+	if (module.out == NULL)
+		fail("can't write %s", argv[2]);
+	module.out_path = argv[2];
+	emit_prelude(argv[1]);
+
+	size_t w = 5;
+	while (w < module.word_count) {
+		uint32_t op = words[w] & 0xffff;
+		uint32_t count = words[w] >> 16;
+		if (count == 0 || w + count > module.word_count)
+			fail("instruction at word %d runs past the end", (int)w);
+		instruction(op, &words[w + 1], count - 1);
+		w += count;
+	}
+
+	if (module.entry == 0)
+		fail("no entry point");
+	if (fflush(module.out) != 0 || ferror(module.out))
+		fail("can't write %s", argv[2]);
+	fclose(module.out);
+	return 0;
+}
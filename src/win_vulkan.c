@@ -8,9 +8,14 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <math.h>
+#include <float.h>
 #include <windows.h>
 #include <vulkan/vulkan.h>
 
+#include "jobs.h"
+#include "occlusion.h"
+
 void vk_error(VkResult res) {
 	if (res >= 0) {
 		return;
@@ -88,6 +93,16 @@ void vk_error(VkResult res) {
 		exit(-1);															\
 	}
 
+/* Same, but checks the loaded pointer. Use for functions the loader
+ * doesn't export.
+ */
+#define VK_DEVICE_EXTENSION_FUNCTION( fun )									\
+	vk_ext_pfn.fun = (PFN_##fun)vkGetDeviceProcAddr(vk_data.device, #fun);	\
+	if(vk_ext_pfn.fun == NULL) {											\
+		printf("Could not load device extension function: %s\n", #fun);	\
+		exit(-1);															\
+	}
+
 typedef struct DeviceFunctionPointers {
 	PFN_vkGetPhysicalDeviceSurfaceFormatsKHR fpGetPhysicalDeviceSurfaceFormatsKHR;
 	PFN_vkCreateWin32SurfaceKHR		fpCreateWin32SurfaceKHR;
@@ -96,6 +111,12 @@ typedef struct DeviceFunctionPointers {
 	PFN_vkGetSwapchainImagesKHR		vkGetSwapchainImagesKHR;
 	PFN_vkAcquireNextImageKHR		vkAcquireNextImageKHR;
 	PFN_vkQueuePresentKHR			vkQueuePresentKHR;
+	PFN_vkWaitForPresentKHR			vkWaitForPresentKHR;
+	PFN_vkCmdBeginRenderingKHR		vkCmdBeginRendering;
+	PFN_vkCmdEndRenderingKHR		vkCmdEndRendering;
+	PFN_vkCmdDrawIndexedIndirectCountKHR	vkCmdDrawIndexedIndirectCount;
+	PFN_vkCmdPipelineBarrier2KHR	vkCmdPipelineBarrier2;
+	PFN_vkCmdDrawMeshTasksEXT		vkCmdDrawMeshTasksEXT;
 } DeviceFunctionPointers;
 
 /* Has to be assigned after device creation. */
@@ -110,17 +131,34 @@ typedef struct InstanceData {
 	VkPhysicalDevice	phys_device;
 	VkDevice			device;
 	VkQueue				queue;
+	VkQueue				compute_queue;
 	VkSurfaceKHR		surface;
 	VkSwapchainKHR		swapchain;
 	VkRenderPass		render_pass;
+	VkPipelineLayout	pipeline_layout;
+	VkPipeline			pipeline;
+	/* Shared by every pipeline build, hot reloads included. */
+	VkPipelineCache		pipeline_cache;
 	uint32_t			queue_family_index;
 	VkCommandPool		queue_cmd_pool;
-	size_t				queue_cmd_buffers_size;
-	VkCommandBuffer*	queue_cmd_buffers;
+	/* Async compute, same family as graphics if it only has a second queue.
+	 * When there is neither, compute work is recorded on the graphics queue.
+	 */
+	bool				async_compute;
+	bool				async_compute_active;
+	uint32_t			compute_family_index;
+	uint32_t			compute_queue_index;
+	VkCommandPool		compute_cmd_pool;
+	size_t				swapchain_images_size;
+	VkImage*			swapchain_images;
 	size_t				frame_buffers_size;
 	VkFramebuffer*		frame_buffers;
 	size_t				image_views_size;
 	VkImageView*		image_views;
+	uint32_t			timestamp_valid_bits;
+	float				timestamp_period;
+	uint32_t			device_api_version;
+	uint32_t			max_draw_indirect_count;
 
 } InstanceData;
 
@@ -129,25 +167,69 @@ InstanceData vk_data = {
 	, .phys_device					= VK_NULL_HANDLE
 	, .device						= VK_NULL_HANDLE
 	, .queue						= VK_NULL_HANDLE
+	, .compute_queue				= VK_NULL_HANDLE
 	, .surface						= VK_NULL_HANDLE
 	, .swapchain					= VK_NULL_HANDLE
 	, .render_pass					= VK_NULL_HANDLE
+	, .pipeline_layout				= VK_NULL_HANDLE
+	, .pipeline						= VK_NULL_HANDLE
+	, .pipeline_cache				= VK_NULL_HANDLE
 	, .queue_family_index			= VK_NULL_HANDLE
 	, .queue_cmd_pool				= VK_NULL_HANDLE
-	, .queue_cmd_buffers_size		= 0
+	, .async_compute				= false
+	, .async_compute_active			= false
+	, .compute_family_index			= 0
+	, .compute_queue_index			= 0
+	, .compute_cmd_pool				= VK_NULL_HANDLE
+	, .swapchain_images_size		= 0
 	, .frame_buffers_size			= 0
+	, .timestamp_valid_bits			= 0
+	, .timestamp_period				= 0.0f
+	, .device_api_version			= 0
+	, .max_draw_indirect_count		= 0
 };
 
 
-typedef struct SyncData {
+/* Each frame in flight owns its command buffer, sync objects and a
+ * timestamp query pool. The CPU only waits on a slot's fence when it comes
+ * back around, so anything the GPU wrote in it is ready by then.
+ */
+#define FRAMES_IN_FLIGHT 2
+#define MAX_GPU_SCOPES 16
+
+typedef struct FrameData {
+	VkCommandBuffer	cmd_buffer;
+	VkFence			f_in_flight;
 	VkSemaphore		s_image_available;
 	VkSemaphore		s_render_finished;
-} SyncData;
-
-SyncData vk_sync_data = {
-	.s_image_available				= VK_NULL_HANDLE
-	, .s_render_finished			= VK_NULL_HANDLE
-};
+	VkCommandBuffer	compute_cmd_buffer;
+	VkFence			f_compute;
+	VkSemaphore		s_compute_finished;
+	bool			compute_submitted;
+	VkQueryPool		timestamp_pool;
+	uint32_t		scope_count;
+	const char*		scope_names[MAX_GPU_SCOPES];
+	bool			submitted;
+} FrameData;
+
+FrameData vk_frames[FRAMES_IN_FLIGHT] = {0};
+uint32_t vk_frame_index = 0;
+/* Submitted frames, never wraps. */
+uint64_t vk_frame_number = 0;
+
+
+/* Latest timings, GPU values lag FRAMES_IN_FLIGHT frames behind. */
+typedef struct FrameStats {
+	double			cpu_frame_ms;
+	double			cpu_wait_ms;
+	double			gpu_frame_ms;
+	uint32_t		gpu_scope_count;
+	const char*		gpu_scope_names[MAX_GPU_SCOPES];
+	double			gpu_scope_ms[MAX_GPU_SCOPES];
+	double			present_latency_ms;
+} FrameStats;
+
+FrameStats vk_frame_stats = {0};
 
 
 typedef struct SurfaceData {
@@ -163,9 +245,23 @@ SurfaceData vk_surface_data = {
 };
 
 
+#define MAX_DEVICE_EXTENSIONS 16
+
 typedef struct ExtensionData {
-	const char*		instance_extensions[2];
-	const char*		device_extensions[1];
+	const char*				instance_extensions[2];
+	const char*				device_extensions[1];
+	uint32_t				available_device_extensions_size;
+	VkExtensionProperties*	available_device_extensions;
+	uint32_t				enabled_device_extensions_size;
+	const char*				enabled_device_extensions[MAX_DEVICE_EXTENSIONS];
+	bool					present_id;
+	bool					present_wait;
+	bool					dynamic_rendering;
+	bool					draw_indirect_count;
+	bool					descriptor_indexing;
+	bool					synchronization2;
+	bool					mesh_shader;
+	bool					sw_raster;
 } ExtensionData;
 
 ExtensionData vk_extensions_data  = {
@@ -177,13 +273,610 @@ ExtensionData vk_extensions_data  = {
 	}
 
 	, .device_extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME }
+	, .available_device_extensions_size = 0
+	, .available_device_extensions = NULL
+	, .enabled_device_extensions_size = 0
+	, .present_id = false
+	, .present_wait = false
+	, .dynamic_rendering = false
+	, .draw_indirect_count = false
+	, .descriptor_indexing = false
+	, .synchronization2 = false
+	, .mesh_shader = false
+	, .sw_raster = false
+};
+
+
+/* Optional device features, only chained when their extension exists.
+ * Vulkan 1.2 features go through the aggregate struct, so the 1.2 promoted
+ * structs must never be chained next to it.
+ */
+typedef struct FeatureData {
+	VkPhysicalDeviceFeatures				supported;
+	VkPhysicalDeviceVulkan12Features		vulkan12_supported;
+	VkPhysicalDeviceFeatures2				features2;
+	VkPhysicalDeviceVulkan12Features		vulkan12;
+	VkPhysicalDevicePresentIdFeaturesKHR	present_id;
+	VkPhysicalDevicePresentWaitFeaturesKHR	present_wait;
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR	dynamic_rendering;
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT	descriptor_indexing;
+	VkPhysicalDeviceSynchronization2FeaturesKHR	synchronization2;
+	VkPhysicalDeviceMeshShaderFeaturesEXT	mesh_shader;
+} FeatureData;
+
+FeatureData vk_features_data = {0};
+
+
+/* Present mode policies, in order of preference. FIFO is always there. */
+typedef enum PresentPolicy {
+	PRESENT_POLICY_DEFAULT
+	, PRESENT_POLICY_VSYNC
+	, PRESENT_POLICY_LATENCY
+	, PRESENT_POLICY_THROUGHPUT
+	, PRESENT_POLICY_COUNT
+} PresentPolicy;
+
+const char* present_policy_names[PRESENT_POLICY_COUNT] = {
+	"default", "vsync", "latency", "throughput"
+};
+
+const VkPresentModeKHR present_policy_modes[PRESENT_POLICY_COUNT][4] = {
+	/* Games like MAILBOX. */
+	{ VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR
+			, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR }
+	/* Never tear, never drop. */
+	, { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR
+			, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR }
+	/* Newest frame wins, tear if we have to. */
+	, { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR
+			, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR }
+	/* Never block on the display. */
+	, { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR
+			, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR }
+};
+
+const char* present_mode_name(VkPresentModeKHR mode)
+{
+	switch (mode) {
+		case VK_PRESENT_MODE_IMMEDIATE_KHR:
+			return "immediate";
+		case VK_PRESENT_MODE_MAILBOX_KHR:
+			return "mailbox";
+		case VK_PRESENT_MODE_FIFO_KHR:
+			return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+			return "fifo_relaxed";
+		default:
+			return "unknown";
+	}
+}
+
+
+/* Pipeline variants, all at startup or each on first use. */
+typedef enum VariantMode {
+	VARIANTS_OFF
+	, VARIANTS_EAGER
+	, VARIANTS_LAZY
+} VariantMode;
+
+
+/* Command line. */
+typedef struct Options {
+	PresentPolicy		present_policy;
+	bool				force_present_mode;
+	VkPresentModeKHR	present_mode;
+	/* 0 means no cap other than FRAMES_IN_FLIGHT. */
+	uint32_t			max_queued_frames;
+	bool				no_dynamic_rendering;
+	/* GPU driven scene instead of the triangle when > 0. */
+	uint32_t			scene_objects;
+	/* Occlusion cull the scene on the CPU first. */
+	bool				occlusion;
+	bool				no_async_compute;
+	/* Synthetic compute work per frame, in loop iterations. 0 is off. */
+	uint32_t			compute_load;
+	/* Frames per phase of the async compute benchmark. 0 is off. */
+	uint32_t			bench_async_compute;
+	/* Dense sphere grid instead of the triangle when > 0. */
+	uint32_t			dense_mesh_segments;
+	bool				mesh_shader;
+	/* Frames per phase of the mesh shader benchmark. 0 is off. */
+	uint32_t			bench_mesh_shader;
+	/* Leave host allocations to the driver. */
+	bool				no_host_allocator;
+	/* Rebuild pipelines when their SPIR-V changes. */
+	bool				hot_reload;
+	VariantMode			pipeline_variants;
+	bool				bench_pipeline_variants;
+	/* Offscreen targets, no window and no swapchain. */
+	bool				headless;
+	uint32_t			offscreen_width;
+	uint32_t			offscreen_height;
+	/* Frames copied back to the host, this late. 0 is off. */
+	uint32_t			readback_latency;
+	/* Read back frames are written here when set. */
+	const char*			readback_dir;
+	/* Headless runs stop after this. */
+	uint32_t			frame_count;
+	/* Draw samples, resolved into the target. 1 is off. */
+	uint32_t			msaa_samples;
+	bool				depth;
+	/* Transient attachments in plain device memory, to compare. */
+	bool				no_lazy_memory;
+	/* Windows, the first one renders and the others mirror it. */
+	uint32_t			output_count;
+	/* Dense mesh meshlets under this many pixels per triangle are
+	 * rasterized in compute.
+	 */
+	bool				sw_raster;
+	float				sw_raster_threshold;
+	/* Frames per threshold of the software raster benchmark. 0 is off. */
+	uint32_t			bench_sw_raster;
+	/* Startup job workers, the main thread included. 0 is one per core. */
+	uint32_t			job_threads;
+} Options;
+
+Options vk_options = {
+	.present_policy					= PRESENT_POLICY_DEFAULT
+	, .force_present_mode			= false
+	, .present_mode					= VK_PRESENT_MODE_FIFO_KHR
+	, .max_queued_frames			= 0
+	, .no_dynamic_rendering			= false
+	, .scene_objects				= 0
+	, .occlusion					= false
+	, .no_async_compute				= false
+	, .compute_load					= 0
+	, .bench_async_compute			= 0
+	, .dense_mesh_segments			= 0
+	, .mesh_shader					= false
+	, .bench_mesh_shader			= 0
+	, .no_host_allocator			= false
+	, .hot_reload					= false
+	, .pipeline_variants			= VARIANTS_OFF
+	, .bench_pipeline_variants		= false
+	, .headless						= false
+	, .offscreen_width				= 512
+	, .offscreen_height				= 512
+	, .readback_latency				= 0
+	, .readback_dir					= NULL
+	, .frame_count					= 300
+	, .msaa_samples					= 1
+	, .depth						= false
+	, .no_lazy_memory				= false
+	, .output_count					= 1
+	, .sw_raster					= false
+	, .sw_raster_threshold			= 1.0f
+	, .bench_sw_raster				= 0
+	, .job_threads					= 0
+};
+
+
+/* Present ids are 1 based and increase every present. Submit times are kept
+ * for the last few, so latency can be computed once presentation is seen.
+ */
+#define PRESENT_HISTORY 16
+
+typedef struct PresentData {
+	VkPresentModeKHR	present_mode;
+	uint64_t			last_present_id;
+	uint64_t			last_completed_id;
+	double				submit_ms[PRESENT_HISTORY];
+} PresentData;
+
+PresentData vk_present_data = {
+	.present_mode					= VK_PRESENT_MODE_FIFO_KHR
+	, .last_present_id				= 0
+	, .last_completed_id			= 0
+	, .submit_ms					= {0}
+};
+
+
+/* Host allocations of the driver, through VkAllocationCallbacks. Command
+ * scope allocations only live for the duration of one call, they are bumped
+ * from an arena reset every frame. Object scope ones go to size class
+ * pools. Everything else, and what doesn't fit, goes to the heap. Counts,
+ * bytes and peaks are kept per scope.
+ */
+#define HOST_SCOPE_COUNT 5
+#define HOST_ARENA_SIZE (256 * 1024)
+#define HOST_POOL_CLASS_COUNT 8
+#define HOST_POOL_MIN_BLOCK 32
+#define HOST_POOL_CHUNK_SIZE (64 * 1024)
+
+typedef enum HostSource {
+	HOST_SOURCE_HEAP
+	, HOST_SOURCE_ARENA
+	/* Followed by the pool class index. */
+	, HOST_SOURCE_POOL
+} HostSource;
+
+/* Right before every pointer handed out. 16 bytes, so the default alignment
+ * holds.
+ */
+typedef struct HostHeader {
+	uint64_t		size;
+	/* From the start of the raw block. */
+	uint32_t		offset;
+	uint8_t			scope;
+	uint8_t			source;
+	uint16_t		pad;
+} HostHeader;
+
+typedef struct HostScopeStats {
+	uint64_t		allocations;
+	uint64_t		frees;
+	uint64_t		live_count;
+	uint64_t		live_bytes;
+	uint64_t		peak_bytes;
+	/* Driver internal allocations, only notified. */
+	uint64_t		internal_bytes;
+	uint64_t		internal_peak_bytes;
+} HostScopeStats;
+
+/* Freed blocks hold the next free block. Chunks hold the next chunk in their
+ * first bytes.
+ */
+typedef struct HostPool {
+	size_t			block_size;
+	void*			free_list;
+	void*			chunks;
+	uint32_t		chunk_count;
+} HostPool;
+
+typedef struct HostAllocatorData {
+	VkAllocationCallbacks	callbacks;
+	/* Drivers may allocate from their own threads. */
+	CRITICAL_SECTION		lock;
+	HostScopeStats			scopes[HOST_SCOPE_COUNT];
+
+	uint8_t*				arena;
+	size_t					arena_offset;
+	size_t					arena_peak;
+	uint64_t				arena_live_count;
+	uint64_t				arena_resets;
+	uint64_t				arena_overflows;
+
+	HostPool				pools[HOST_POOL_CLASS_COUNT];
+} HostAllocatorData;
+
+HostAllocatorData vk_host_allocator = {0};
+
+/* What every vkCreate* and vkDestroy* gets. NULL leaves it to the driver. */
+const VkAllocationCallbacks* vk_allocator = NULL;
+
+const char* host_scope_names[HOST_SCOPE_COUNT] = {
+	"command"
+	, "object"
+	, "cache"
+	, "device"
+	, "instance"
 };
 
+void* host_pool_take(HostPool* pool)
+{
+	if (pool->free_list == NULL) {
+		uint8_t* chunk = malloc(HOST_POOL_CHUNK_SIZE);
+		if (chunk == NULL)
+			return NULL;
+
+		*(void**)chunk = pool->chunks;
+		pool->chunks = chunk;
+		++pool->chunk_count;
+
+		/* The first block is lost to the chunk link, keeps blocks aligned. */
+		size_t block_count = HOST_POOL_CHUNK_SIZE / pool->block_size;
+		for (size_t i = block_count - 1; i >= 1; --i) {
+			void* block = chunk + i * pool->block_size;
+			*(void**)block = pool->free_list;
+			pool->free_list = block;
+		}
+	}
+
+	void* block = pool->free_list;
+	pool->free_list = *(void**)block;
+	return block;
+}
+
+void host_pool_give(HostPool* pool, void* block)
+{
+	*(void**)block = pool->free_list;
+	pool->free_list = block;
+}
+
+void* VKAPI_PTR host_allocation(void* user_data, size_t size,
+		size_t alignment, VkSystemAllocationScope scope)
+{
+	HostAllocatorData* data = user_data;
+	if (size == 0)
+		return NULL;
+
+	/* Room for the header, and to align past it from wherever the raw
+	 * block starts, malloc on 32 bit only promises 8 bytes.
+	 */
+	if (alignment < sizeof(HostHeader)) {
+		alignment = sizeof(HostHeader);
+	}
+	size_t raw_size = size + alignment + sizeof(HostHeader);
+
+	EnterCriticalSection(&data->lock);
+
+	uint8_t* raw = NULL;
+	uint8_t source = HOST_SOURCE_HEAP;
+
+	if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+		size_t start = (data->arena_offset + 15) & ~(size_t)15;
+		if (data->arena != NULL && start + raw_size <= HOST_ARENA_SIZE) {
+			raw = data->arena + start;
+			data->arena_offset = start + raw_size;
+			if (data->arena_offset > data->arena_peak) {
+				data->arena_peak = data->arena_offset;
+			}
+			++data->arena_live_count;
+			source = HOST_SOURCE_ARENA;
+		} else {
+			++data->arena_overflows;
+		}
+
+	} else if (scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT) {
+		for (uint8_t c = 0; c < HOST_POOL_CLASS_COUNT; ++c) {
+			if (raw_size <= data->pools[c].block_size) {
+				raw = host_pool_take(&data->pools[c]);
+				source = (uint8_t)(HOST_SOURCE_POOL + c);
+				break;
+			}
+		}
+	}
+
+	if (raw == NULL) {
+		raw = malloc(raw_size);
+		source = HOST_SOURCE_HEAP;
+	}
+	if (raw == NULL) {
+		LeaveCriticalSection(&data->lock);
+		return NULL;
+	}
+
+	uint8_t* ptr = (uint8_t*)(((uintptr_t)raw + sizeof(HostHeader)
+			+ alignment - 1) & ~(uintptr_t)(alignment - 1));
+	HostHeader* header = (HostHeader*)ptr - 1;
+	header->size = size;
+	header->offset = (uint32_t)(ptr - raw);
+	header->scope = (uint8_t)scope;
+	header->source = source;
+
+	HostScopeStats* stats = &data->scopes[scope];
+	++stats->allocations;
+	++stats->live_count;
+	stats->live_bytes += size;
+	if (stats->live_bytes > stats->peak_bytes) {
+		stats->peak_bytes = stats->live_bytes;
+	}
+
+	LeaveCriticalSection(&data->lock);
+	return ptr;
+}
+
+void VKAPI_PTR host_free(void* user_data, void* memory)
+{
+	HostAllocatorData* data = user_data;
+	if (memory == NULL)
+		return;
+
+	HostHeader* header = (HostHeader*)memory - 1;
+	uint8_t* raw = (uint8_t*)memory - header->offset;
+
+	EnterCriticalSection(&data->lock);
+
+	HostScopeStats* stats = &data->scopes[header->scope];
+	++stats->frees;
+	--stats->live_count;
+	stats->live_bytes -= header->size;
+
+	/* Arena space comes back at the next reset. */
+	if (header->source == HOST_SOURCE_ARENA) {
+		--data->arena_live_count;
+	} else if (header->source >= HOST_SOURCE_POOL) {
+		host_pool_give(&data->pools[header->source - HOST_SOURCE_POOL], raw);
+	} else {
+		free(raw);
+	}
+
+	LeaveCriticalSection(&data->lock);
+}
+
+void* VKAPI_PTR host_reallocation(void* user_data, void* original,
+		size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (original == NULL)
+		return host_allocation(user_data, size, alignment, scope);
+
+	if (size == 0) {
+		host_free(user_data, original);
+		return NULL;
+	}
+
+	/* Scope may change, so always move. */
+	void* memory = host_allocation(user_data, size, alignment, scope);
+	if (memory == NULL)
+		return NULL;
+
+	HostHeader* header = (HostHeader*)original - 1;
+	memcpy(memory, original, header->size < size ? header->size : size);
+	host_free(user_data, original);
+	return memory;
+}
+
+void VKAPI_PTR host_internal_allocation(void* user_data, size_t size,
+		VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+	HostAllocatorData* data = user_data;
+	(void)type;
+
+	EnterCriticalSection(&data->lock);
+	HostScopeStats* stats = &data->scopes[scope];
+	stats->internal_bytes += size;
+	if (stats->internal_bytes > stats->internal_peak_bytes) {
+		stats->internal_peak_bytes = stats->internal_bytes;
+	}
+	LeaveCriticalSection(&data->lock);
+}
+
+void VKAPI_PTR host_internal_free(void* user_data, size_t size,
+		VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+	HostAllocatorData* data = user_data;
+	(void)type;
+
+	EnterCriticalSection(&data->lock);
+	data->scopes[scope].internal_bytes -= size;
+	LeaveCriticalSection(&data->lock);
+}
+
+/* Before the instance, everything Vulkan uses it. */
+void init_host_allocator()
+{
+	InitializeCriticalSection(&vk_host_allocator.lock);
+
+	vk_host_allocator.arena = malloc(HOST_ARENA_SIZE);
+	for (int c = 0; c < HOST_POOL_CLASS_COUNT; ++c) {
+		vk_host_allocator.pools[c].block_size =
+				(size_t)HOST_POOL_MIN_BLOCK << c;
+	}
+
+	vk_host_allocator.callbacks = (VkAllocationCallbacks){
+		.pUserData					= &vk_host_allocator
+		, .pfnAllocation			= host_allocation
+		, .pfnReallocation			= host_reallocation
+		, .pfnFree					= host_free
+		, .pfnInternalAllocation	= host_internal_allocation
+		, .pfnInternalFree			= host_internal_free
+	};
+	vk_allocator = &vk_host_allocator.callbacks;
+}
+
+/* After the instance is gone. */
+void deinit_host_allocator()
+{
+	if (vk_allocator == NULL)
+		return;
+
+	for (int c = 0; c < HOST_POOL_CLASS_COUNT; ++c) {
+		void* chunk = vk_host_allocator.pools[c].chunks;
+		while (chunk != NULL) {
+			void* next = *(void**)chunk;
+			free(chunk);
+			chunk = next;
+		}
+	}
+	free(vk_host_allocator.arena);
+	DeleteCriticalSection(&vk_host_allocator.lock);
+	vk_allocator = NULL;
+}
+
+/* Once per frame. Command scope allocations still alive, from another thread
+ * in the middle of a call, push the reset to the next frame.
+ */
+void host_allocator_new_frame()
+{
+	if (vk_allocator == NULL)
+		return;
+
+	EnterCriticalSection(&vk_host_allocator.lock);
+	if (vk_host_allocator.arena_live_count == 0
+			&& vk_host_allocator.arena_offset > 0)
+	{
+		vk_host_allocator.arena_offset = 0;
+		++vk_host_allocator.arena_resets;
+	}
+	LeaveCriticalSection(&vk_host_allocator.lock);
+}
+
+uint64_t host_allocator_live_bytes()
+{
+	uint64_t bytes = 0;
+	EnterCriticalSection(&vk_host_allocator.lock);
+	for (int s = 0; s < HOST_SCOPE_COUNT; ++s) {
+		bytes += vk_host_allocator.scopes[s].live_bytes;
+	}
+	LeaveCriticalSection(&vk_host_allocator.lock);
+	return bytes;
+}
+
+void print_host_memory_report()
+{
+	if (vk_allocator == NULL)
+		return;
+
+	printf("Host memory :\n");
+	printf("    %-9s %10s %10s %8s %12s %12s %12s\n", "scope", "allocs",
+			"frees", "live", "live bytes", "peak bytes", "internal");
+	for (int s = 0; s < HOST_SCOPE_COUNT; ++s) {
+		HostScopeStats* stats = &vk_host_allocator.scopes[s];
+		printf("    %-9s %10llu %10llu %8llu %12llu %12llu %12llu\n",
+				host_scope_names[s],
+				(unsigned long long)stats->allocations,
+				(unsigned long long)stats->frees,
+				(unsigned long long)stats->live_count,
+				(unsigned long long)stats->live_bytes,
+				(unsigned long long)stats->peak_bytes,
+				(unsigned long long)stats->internal_peak_bytes);
+	}
+
+	printf("    arena : %llu / %d bytes peak, %llu resets, %llu overflows\n",
+			(unsigned long long)vk_host_allocator.arena_peak, HOST_ARENA_SIZE,
+			(unsigned long long)vk_host_allocator.arena_resets,
+			(unsigned long long)vk_host_allocator.arena_overflows);
+	printf("    pools :");
+	for (int c = 0; c < HOST_POOL_CLASS_COUNT; ++c) {
+		printf(" %d:%d", (int)vk_host_allocator.pools[c].block_size,
+				vk_host_allocator.pools[c].chunk_count);
+	}
+	printf(" chunks\n");
+}
+
 
 
 HINSTANCE win32_instance = NULL;
 HWND win32_window = NULL;
 const char* win32_class_name;
+bool vk_resize_pending = false;
+
+
+/* Extra outputs, each its own window, surface and swapchain. The main
+ * swapchain's frame is blitted to all of them, and every swapchain goes out
+ * in a single present. An output that fails to acquire sits the frame out.
+ */
+#define MAX_OUTPUTS 4
+
+typedef struct OutputData {
+	HWND			window;
+	VkSurfaceKHR	surface;
+	VkSwapchainKHR	swapchain;
+	VkFormat		color_format;
+	VkColorSpaceKHR	color_space;
+	VkExtent2D		extent_2d;
+	uint32_t		images_size;
+	VkImage*		images;
+	VkSemaphore		s_image_available[FRAMES_IN_FLIGHT];
+	bool			resize_pending;
+
+	/* This frame. */
+	bool			acquired;
+	uint32_t		image_index;
+
+	uint64_t		present_count;
+	uint64_t		skip_count;
+	VkResult		last_result;
+} OutputData;
+
+typedef struct OutputsData {
+	/* Extra ones, the main swapchain isn't counted. */
+	uint32_t		count;
+	OutputData		outputs[MAX_OUTPUTS - 1];
+	VkFilter		filter;
+} OutputsData;
+
+OutputsData vk_outputs_data = {0};
 
 void close_window()
 {
@@ -198,8 +891,18 @@ LRESULT CALLBACK WindowsEventHandler(HWND hWnd, UINT uMsg, WPARAM wParam,
 		case WM_CLOSE:
 			close_window();
 			return 0;
+		case WM_DESTROY:
+			PostQuitMessage(0);
+			return 0;
 		case WM_SIZE:
-			/* We don't allow resize for now. */
+			/* Swapchain gets rebuilt before the next frame. */
+			for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+				if (vk_outputs_data.outputs[i].window == hWnd) {
+					vk_outputs_data.outputs[i].resize_pending = true;
+					return DefWindowProc(hWnd, uMsg, wParam, lParam);
+				}
+			}
+			vk_resize_pending = true;
 			break;
 		default:
 			break;
@@ -234,7 +937,8 @@ void create_window(uint32_t size_x, uint32_t size_y, const char* name)
 	}
 
 	DWORD ex_style = WS_EX_APPWINDOW | WS_EX_WINDOWEDGE;
-	DWORD style = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX;
+	DWORD style = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX
+			| WS_MAXIMIZEBOX | WS_THICKFRAME;
 
 	RECT r = {0, 0, (LONG)size_x, (LONG)size_y};
 	AdjustWindowRectEx(&r, style, FALSE, ex_style);
@@ -252,267 +956,106 @@ void create_window(uint32_t size_x, uint32_t size_y, const char* name)
 	SetFocus(win32_window);
 }
 
-/* Monstruous shit */
-void init_vk()
+/* Same class as the main window, closing any of them quits. */
+HWND create_output_window(uint32_t size_x, uint32_t size_y, uint32_t index)
 {
-	/* Get windows surface extension. */
-	{
-		uint32_t ext_count = 0;
-		vk_error(vkEnumerateInstanceExtensionProperties(NULL, &ext_count,
-				NULL));
+	char title[128];
+	snprintf(title, sizeof(title), "%s - output %d", win32_class_name,
+			index + 1);
 
-#if defined(_MSC_VER)
-		VkExtensionProperties ext_list[32];
-#else
-		VkExtensionProperties ext_list[ext_count];
-#endif
-		vk_error(vkEnumerateInstanceExtensionProperties(NULL, &ext_count,
-				ext_list));
+	DWORD ex_style = WS_EX_APPWINDOW | WS_EX_WINDOWEDGE;
+	DWORD style = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX
+			| WS_MAXIMIZEBOX | WS_THICKFRAME;
 
-		bool found = false;
-		int ext_names_count = sizeof(vk_extensions_data.instance_extensions)
-				/ sizeof(vk_extensions_data.instance_extensions[0]);
+	RECT r = {0, 0, (LONG)size_x, (LONG)size_y};
+	AdjustWindowRectEx(&r, style, FALSE, ex_style);
+	HWND window = CreateWindowEx(0, win32_class_name, title, style,
+			CW_USEDEFAULT, CW_USEDEFAULT, r.right - r.left, r.bottom - r.top,
+			NULL, NULL, win32_instance, NULL);
 
-		for (int i = 0; i < ext_names_count; ++i) {
-			for (int j = 0; j < ext_count; ++j) {
-				if (strcmp(vk_extensions_data.instance_extensions[i],
-							ext_list[j].extensionName) == 0)
-				{
-					found = true;
-				}
-			}
-			if (!found) {
-				printf("Didn't find required extension! Much sadness was had.\n");
-				exit(-1);
-			}
-		}
+	if (window == NULL) {
+		printf("Couldn't create output window %d.\n", index + 1);
+		exit(-1);
 	}
+	ShowWindow(window, SW_SHOWNOACTIVATE);
+	return window;
+}
 
-	/* Create instance. */
+bool vk_device_has_extension(const char* name)
+{
+	for (uint32_t i = 0;
+			i < vk_extensions_data.available_device_extensions_size; ++i)
 	{
-		const VkApplicationInfo AppInfo = {
-			.sType					= VK_STRUCTURE_TYPE_APPLICATION_INFO
-			, .pNext				= NULL
-			, .pApplicationName		= app_name
-			, .applicationVersion	= VK_MAKE_VERSION(1, 0, 0)
-			, .pEngineName			= app_name
-			, .engineVersion		= VK_MAKE_VERSION(1, 0, 0)
-			, .apiVersion			= VK_API_VERSION_1_0
-		};
-
-		const VkInstanceCreateInfo instance_info = {
-			.sType					= VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO
-			, .pNext				= NULL
-			, .flags				= 0
-			, .pApplicationInfo		= &AppInfo
-			, .enabledExtensionCount	= sizeof(vk_extensions_data.instance_extensions)
-					/ sizeof(vk_extensions_data.instance_extensions[0])
-			, .ppEnabledExtensionNames	= vk_extensions_data.instance_extensions
-			, .enabledLayerCount	= 0
-			, .ppEnabledLayerNames	= NULL
-		};
-
-		vk_error(vkCreateInstance(&instance_info, NULL,
-				&vk_data.instance));
+		if (strcmp(vk_extensions_data.available_device_extensions[i]
+					.extensionName, name) == 0)
+		{
+			return true;
+		}
 	}
+	return false;
+}
 
-	/* Get physical device. */
-	{
-		uint32_t gpu_count = 1;
-		vk_error(vkEnumeratePhysicalDevices(vk_data.instance,
-				&gpu_count, NULL));
-		assert(gpu_count);
-
-#if defined(_MSC_VER)
-		VkPhysicalDevice devices[8];
-#else
-		VkPhysicalDevice devices[gpu_count];
-#endif
-		vk_error(vkEnumeratePhysicalDevices(vk_data.instance,
-				&gpu_count, devices));
-		assert(gpu_count >= 1);
+/* Adds to the device creation list if the device has it. */
+bool enable_device_extension(const char* name)
+{
+	if (!vk_device_has_extension(name))
+		return false;
+
+	assert(vk_extensions_data.enabled_device_extensions_size
+			< MAX_DEVICE_EXTENSIONS);
+	vk_extensions_data.enabled_device_extensions[
+			vk_extensions_data.enabled_device_extensions_size++] = name;
+	return true;
+}
 
-		printf("Found %d GPUs\n", gpu_count);
-		for (int i = 0; i < gpu_count; ++i) {
-			VkPhysicalDeviceProperties props;
-			vkGetPhysicalDeviceProperties(devices[i], &props);
-			printf("%s\n", props.deviceName);
-			printf("    Maximum texture size : %d\n",
-					props.limits.maxImageDimension2D);
+VkPresentModeKHR select_present_mode(const VkPresentModeKHR* modes,
+		uint32_t count)
+{
+	if (vk_options.force_present_mode) {
+		for (uint32_t i = 0; i < count; ++i) {
+			if (modes[i] == vk_options.present_mode)
+				return modes[i];
 		}
+		printf("Present mode %s not supported, using policy.\n",
+				present_mode_name(vk_options.present_mode));
+	}
 
-		vk_data.phys_device = devices[0];
+	const VkPresentModeKHR* wanted =
+			present_policy_modes[vk_options.present_policy];
+	for (int w = 0; w < 4; ++w) {
+		for (uint32_t i = 0; i < count; ++i) {
+			if (modes[i] == wanted[w])
+				return modes[i];
+		}
 	}
 
-	/* Get Swap Chain extensions */
+	printf("Your GPU doesn't support any presentation mode.\n");
+	exit(-1);
+}
+
+/* Also used to recreate it, the old one is handed over and destroyed. */
+void create_swapchain()
+{
+	/* Create Swap Chain. */
 	{
-		uint32_t ext_count = 0;
-		vk_error(vkEnumerateDeviceExtensionProperties(vk_data.phys_device,
-				NULL, &ext_count, NULL));
-		assert(ext_count >= 1);
+		/* Example of getting a funtion pointer ourselves. */
+		vk_ext_pfn.fpGetPhysicalDeviceSurfaceFormatsKHR =
+				(PFN_vkGetPhysicalDeviceSurfaceFormatsKHR)vkGetInstanceProcAddr(
+						vk_data.instance,
+						"vkGetPhysicalDeviceSurfaceFormatsKHR");
+
+		uint32_t format_count = 0;
+		vk_ext_pfn.fpGetPhysicalDeviceSurfaceFormatsKHR(vk_data.phys_device,
+				vk_data.surface, &format_count, NULL);
+		assert(format_count >= 1);
 
 #if defined(_MSC_VER)
-		VkExtensionProperties ext_props[32];
+		VkSurfaceFormatKHR surface_formats[32];
 #else
-		VkExtensionProperties ext_props[ext_count];
+		VkSurfaceFormatKHR surface_formats[format_count];
 #endif
-		vk_error(vkEnumerateDeviceExtensionProperties(vk_data.phys_device,
-				NULL, &ext_count, ext_props));
-
-		bool found = false;
-		int ext_names_count = sizeof(vk_extensions_data.device_extensions)
-				/ sizeof(vk_extensions_data.device_extensions[0]);
-
-		for (int i = 0; i < ext_count; ++i) {
-			for (int j = 0; j < ext_names_count; ++j) {
-				if (strcmp(ext_props[i].extensionName,
-							vk_extensions_data.device_extensions[j])
-						== 0)
-				{
-					found = true;
-				}
-			}
-			if (!found) {
-				printf("Didn't find swap chain extension on device.\n");
-				exit(-1);
-			}
-		}
-	}
-
-	/* Get available graphics queue. */
-	{
-		uint32_t queue_fam_count = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties(vk_data.phys_device,
-				&queue_fam_count, NULL);
-		assert(queue_fam_count >= 1 );
-
-#if defined(_MSC_VER)
-		VkQueueFamilyProperties queue_fams[32];
-#else
-		VkQueueFamilyProperties queue_fams[queue_fam_count];
-#endif
-		vkGetPhysicalDeviceQueueFamilyProperties(vk_data.phys_device,
-				&queue_fam_count, queue_fams);
-
-		bool found = false;
-		printf("Found %d Queue Families\n", queue_fam_count);
-		for (int i = 0; i < queue_fam_count; ++i) {
-			if (queue_fams[i].queueCount > 0 &&
-					queue_fams[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
-			{
-				vk_data.queue_family_index = i;
-				found = true;
-			}
-		}
-
-		if (!found) {
-			printf("Did not find graphic queue family! Exiting.\n");
-			exit(-1);
-		}
-	}
-
-	/* Create device. */
-	{
-		float q_priorities[] = { 1.0f };
-		const VkDeviceQueueCreateInfo q_create_info = {
-			.sType					= VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO
-			, .pNext				= NULL
-			, .flags				= 0
-			, .queueFamilyIndex		= vk_data.queue_family_index
-			, .queueCount			= 1
-			, .pQueuePriorities		= q_priorities
-		};
-
-		const VkDeviceCreateInfo device_create_info = {
-			.sType					= VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO
-			, .pNext				= NULL
-			, .flags				= 0
-			, .queueCreateInfoCount	= 1
-			, .pQueueCreateInfos	= &q_create_info
-			, .enabledLayerCount	= 0
-			, .ppEnabledLayerNames	= NULL
-			, .enabledExtensionCount	= sizeof(vk_extensions_data.device_extensions)
-					/ sizeof(vk_extensions_data.device_extensions[0])
-			, .ppEnabledExtensionNames	= vk_extensions_data.device_extensions
-			, .pEnabledFeatures		= 0
-		};
-
-		vk_error(vkCreateDevice(vk_data.phys_device,
-				&device_create_info, VK_NULL_HANDLE,
-				&vk_data.device));
-	}
-
-	/* Get Device Function Pointers. */
-	{
-		vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkCreateSwapchainKHR)
-		vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkDestroySwapchainKHR)
-		vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkGetSwapchainImagesKHR)
-		vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkAcquireNextImageKHR)
-		vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkQueuePresentKHR)
-	}
-
-	/* Get queue. */
-	{
-		vkGetDeviceQueue(vk_data.device,
-				vk_data.queue_family_index, 0,
-				&vk_data.queue);
-	}
-
-	/* Get surface. */
-	{
-#if defined(VK_USE_PLATFORM_WIN32_KHR)
-		vk_ext_pfn.fpCreateWin32SurfaceKHR = (PFN_vkCreateWin32SurfaceKHR)vkGetInstanceProcAddr(
-				vk_data.instance, "vkCreateWin32SurfaceKHR");
-
-		VkWin32SurfaceCreateInfoKHR surface_create_info = {
-			.sType				= VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR
-			, .pNext			= NULL
-			, .flags			= 0
-			, .hinstance		= win32_instance
-			, .hwnd				= win32_window
-		};
-
-		vk_error(vk_ext_pfn.fpCreateWin32SurfaceKHR(vk_data.instance,
-				&surface_create_info, NULL, &vk_data.surface));
-#endif
-
-	}
-
-	/* Create drawing and presentation Semaphores. */
-	{
-		VkSemaphoreCreateInfo sem_create_info = {
-			.sType					= VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
-			, .pNext				= NULL
-			, .flags				= 0
-		};
-
-		vk_error(vkCreateSemaphore(vk_data.device, &sem_create_info,
-				NULL, &vk_sync_data.s_image_available));
-		vk_error(vkCreateSemaphore(vk_data.device, &sem_create_info,
-				NULL, &vk_sync_data.s_render_finished));
-
-	}
-
-	/* Create Swap Chain. */
-	{
-		/* Example of getting a funtion pointer ourselves. */
-		vk_ext_pfn.fpGetPhysicalDeviceSurfaceFormatsKHR =
-				(PFN_vkGetPhysicalDeviceSurfaceFormatsKHR)vkGetInstanceProcAddr(
-						vk_data.instance,
-						"vkGetPhysicalDeviceSurfaceFormatsKHR");
-
-		uint32_t format_count = 0;
-		vk_ext_pfn.fpGetPhysicalDeviceSurfaceFormatsKHR(vk_data.phys_device,
-				vk_data.surface, &format_count, NULL);
-		assert(format_count >= 1);
-
-#if defined(_MSC_VER)
-		VkSurfaceFormatKHR surface_formats[32];
-#else
-		VkSurfaceFormatKHR surface_formats[format_count];
-#endif
-		vk_ext_pfn.fpGetPhysicalDeviceSurfaceFormatsKHR(vk_data.phys_device,
-				vk_data.surface, &format_count, surface_formats);
+		vk_ext_pfn.fpGetPhysicalDeviceSurfaceFormatsKHR(vk_data.phys_device,
+				vk_data.surface, &format_count, surface_formats);
 
 		/* Only 1 format if the device doesn't care. */
 		if (format_count == 1 &&
@@ -589,6 +1132,20 @@ void init_vk()
 			exit(-1);
 		}
 
+		/* Read back from, or mirrored to the other outputs. */
+		if (vk_options.readback_latency > 0 || vk_options.output_count > 1) {
+			if (surface_capabilities.supportedUsageFlags
+					& VK_IMAGE_USAGE_TRANSFER_SRC_BIT)
+			{
+				image_flags |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			} else {
+				printf("Swapchain images can't be copied, no readback "
+						"and no extra outputs.\n");
+				vk_options.readback_latency = 0;
+				vk_options.output_count = 1;
+			}
+		}
+
 		/* Do we want image transforms, like tablet orientation switching? */
 		VkSurfaceTransformFlagBitsKHR transform_flags;
 		if (surface_capabilities.supportedTransforms
@@ -599,7 +1156,7 @@ void init_vk()
 			transform_flags = surface_capabilities.currentTransform;
 		}
 
-		/* Select presentation mode, MAILBOX best for games. */
+		/* Select presentation mode, from the command line or policy. */
 		uint32_t p_count = 0;
 		vk_error(vkGetPhysicalDeviceSurfacePresentModesKHR(
 				vk_data.phys_device,
@@ -617,23 +1174,12 @@ void init_vk()
 				present_modes));
 
 
-		VkPresentModeKHR selected_p_mode = VK_NULL_HANDLE;
-		for (int i = 0; i < p_count; ++i) {
-			if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
-				selected_p_mode = present_modes[i];
-			}
-		}
-		if (selected_p_mode == VK_NULL_HANDLE) {
-			for (int i = 0; i < p_count; ++i) {
-				if (present_modes[i] == VK_PRESENT_MODE_FIFO_KHR) {
-					selected_p_mode = present_modes[i];
-				}
-			}
-		}
-		if (selected_p_mode == VK_NULL_HANDLE) {
-			printf("Your GPU doesn't support any presentation mode.\n");
-			exit(-1);
-		}
+		VkPresentModeKHR selected_p_mode = select_present_mode(present_modes,
+				p_count);
+		vk_present_data.present_mode = selected_p_mode;
+		printf("Present mode : %s (policy %s)\n",
+				present_mode_name(selected_p_mode),
+				present_policy_names[vk_options.present_policy]);
 
 		VkSwapchainKHR old_swapchain = vk_data.swapchain;
 
@@ -660,158 +1206,1966 @@ void init_vk()
 		};
 
 		vk_error(vk_ext_pfn.vkCreateSwapchainKHR(vk_data.device,
-				&swapchain_create_info, NULL, &vk_data.swapchain));
+				&swapchain_create_info, vk_allocator, &vk_data.swapchain));
 
 		if (old_swapchain != VK_NULL_HANDLE) {
-			vk_ext_pfn.vkDestroySwapchainKHR(vk_data.device, old_swapchain, NULL);
+			vk_ext_pfn.vkDestroySwapchainKHR(vk_data.device, old_swapchain,
+					vk_allocator);
 		}
-	}
-
-	/* Create Command Pool. */
-	{
-		VkCommandPoolCreateInfo cmd_pool_create_info = {
-			.sType					= VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO
-			, .pNext				= NULL
-			, .flags				= 0
-			, .queueFamilyIndex		= vk_data.queue_family_index
-		};
 
-		vk_error(vkCreateCommandPool(vk_data.device,
-				&cmd_pool_create_info, NULL,
-				&vk_data.queue_cmd_pool));
+		/* Present ids belong to the swapchain. */
+		vk_present_data.last_present_id = 0;
+		vk_present_data.last_completed_id = 0;
 	}
 
-	/* Allocate Command Buffers. */
+	/* Get Swap Chain images. */
 	{
 		uint32_t image_count = 0;
 		vk_error(vk_ext_pfn.vkGetSwapchainImagesKHR(vk_data.device,
 				vk_data.swapchain, &image_count, NULL));
 		assert(image_count >= 1);
+		printf("Swapchain image size : %d, %dx%d\n", image_count,
+				vk_surface_data.extent_2d.width,
+				vk_surface_data.extent_2d.height);
 
-		vk_data.queue_cmd_buffers = malloc(sizeof(VkCommandBuffer) * image_count);
-		vk_data.queue_cmd_buffers_size = image_count;
+		free(vk_data.swapchain_images);
+		vk_data.swapchain_images = malloc(sizeof(VkImage) * image_count);
+		vk_data.swapchain_images_size = image_count;
 
-		VkCommandBufferAllocateInfo cmd_buffer_allocate_info = {
-			.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO
-			, .pNext				= NULL
-			, .commandPool			= vk_data.queue_cmd_pool
-			, .level				= VK_COMMAND_BUFFER_LEVEL_PRIMARY
-			, .commandBufferCount	= image_count
-		};
-
-		vk_error(vkAllocateCommandBuffers(vk_data.device,
-				&cmd_buffer_allocate_info,
-				vk_data.queue_cmd_buffers));
+		vk_error(vk_ext_pfn.vkGetSwapchainImagesKHR(vk_data.device,
+				vk_data.swapchain, &image_count, vk_data.swapchain_images));
 	}
+}
 
-	/* Record Command Buffers. HYPE */
+/* Monstruous shit */
+void init_vk()
+{
+	/* Get windows surface extension. */
 	{
-		uint32_t image_count = vk_data.queue_cmd_buffers_size;
-		printf("Swapchain image size : %d\n", image_count);
+		uint32_t ext_count = 0;
+		vk_error(vkEnumerateInstanceExtensionProperties(NULL, &ext_count,
+				NULL));
 
 #if defined(_MSC_VER)
-		VkImage swapchain_images[32];
+		VkExtensionProperties ext_list[32];
 #else
-		VkImage swapchain_images[image_count];
+		VkExtensionProperties ext_list[ext_count];
 #endif
-		vk_error(vk_ext_pfn.vkGetSwapchainImagesKHR(vk_data.device,
-				vk_data.swapchain, &image_count, swapchain_images));
+		vk_error(vkEnumerateInstanceExtensionProperties(NULL, &ext_count,
+				ext_list));
 
-		VkCommandBufferBeginInfo cmd_buffer_begin_info = {
-			.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
-			, .pNext				= NULL
-			, .flags				= VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT
-			, .pInheritanceInfo		= NULL
-		};
+		bool found = false;
+		int ext_names_count = sizeof(vk_extensions_data.instance_extensions)
+				/ sizeof(vk_extensions_data.instance_extensions[0]);
+
+		for (int i = 0; i < ext_names_count; ++i) {
+			for (int j = 0; j < ext_count; ++j) {
+				if (strcmp(vk_extensions_data.instance_extensions[i],
+							ext_list[j].extensionName) == 0)
+				{
+					found = true;
+				}
+			}
+			if (!found) {
+				printf("Didn't find required extension! Much sadness was had.\n");
+				exit(-1);
+			}
+		}
+	}
 
-		VkClearColorValue clear_color = {
-			{0.0f, 1.0f, 0.0f, 0.0f }
+	/* Create instance. */
+	{
+		const VkApplicationInfo AppInfo = {
+			.sType					= VK_STRUCTURE_TYPE_APPLICATION_INFO
+			, .pNext				= NULL
+			, .pApplicationName		= app_name
+			, .applicationVersion	= VK_MAKE_VERSION(1, 0, 0)
+			, .pEngineName			= app_name
+			, .engineVersion		= VK_MAKE_VERSION(1, 0, 0)
+			, .apiVersion			= VK_API_VERSION_1_3
 		};
 
-		VkImageSubresourceRange image_subresource_range = {
-			.aspectMask				= VK_IMAGE_ASPECT_COLOR_BIT
-			, .baseMipLevel			= 0
-			, .levelCount			= 1
-			, .baseArrayLayer		= 0
-			, .layerCount			= 1
+		const VkInstanceCreateInfo instance_info = {
+			.sType					= VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .pApplicationInfo		= &AppInfo
+			, .enabledExtensionCount	= sizeof(vk_extensions_data.instance_extensions)
+					/ sizeof(vk_extensions_data.instance_extensions[0])
+			, .ppEnabledExtensionNames	= vk_extensions_data.instance_extensions
+			, .enabledLayerCount	= 0
+			, .ppEnabledLayerNames	= NULL
 		};
 
-		/* TODO : Read up on ImageBarriers and understand them. */
-		for (int i = 0; i < image_count; ++i) {
-			VkImageMemoryBarrier barrier_from_present_to_clear = {
-				.sType				= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER
-				, .pNext			= NULL
-				, .srcAccessMask	= VK_ACCESS_MEMORY_READ_BIT
-				, .dstAccessMask	= VK_ACCESS_TRANSFER_WRITE_BIT
-				, .oldLayout		= VK_IMAGE_LAYOUT_UNDEFINED
-				, .newLayout		= VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-				, .srcQueueFamilyIndex	= vk_data.queue_family_index
-				, .dstQueueFamilyIndex	= vk_data.queue_family_index
-				, .image			= swapchain_images[i]
-				, .subresourceRange	= image_subresource_range
-			};
+		vk_error(vkCreateInstance(&instance_info, vk_allocator,
+				&vk_data.instance));
+	}
 
-			VkImageMemoryBarrier barrier_from_clear_to_present = {
-				.sType				= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER
-				, .pNext			= NULL
-				, .srcAccessMask	= VK_ACCESS_TRANSFER_WRITE_BIT
-				, .dstAccessMask	= VK_ACCESS_MEMORY_READ_BIT
-				, .oldLayout		= VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-				, .newLayout		= VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-				, .srcQueueFamilyIndex	= vk_data.queue_family_index
-				, .dstQueueFamilyIndex	= vk_data.queue_family_index
-				, .image			= swapchain_images[i]
-				, .subresourceRange	= image_subresource_range
-			};
+	/* Get physical device. */
+	{
+		uint32_t gpu_count = 1;
+		vk_error(vkEnumeratePhysicalDevices(vk_data.instance,
+				&gpu_count, NULL));
+		assert(gpu_count);
 
-			vkBeginCommandBuffer(vk_data.queue_cmd_buffers[i],
-					&cmd_buffer_begin_info);
-			vkCmdPipelineBarrier(vk_data.queue_cmd_buffers[i],
-					VK_PIPELINE_STAGE_TRANSFER_BIT,
-					VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL,
-					1, &barrier_from_present_to_clear);
-			vkCmdClearColorImage(vk_data.queue_cmd_buffers[i],
-					swapchain_images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-					&clear_color, 1, &image_subresource_range);
-			vkCmdPipelineBarrier(vk_data.queue_cmd_buffers[i],
-					VK_PIPELINE_STAGE_TRANSFER_BIT,
-					VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL,
-					1, &barrier_from_clear_to_present);
-			vk_error(vkEndCommandBuffer(vk_data.queue_cmd_buffers[i]));
+#if defined(_MSC_VER)
+		VkPhysicalDevice devices[8];
+#else
+		VkPhysicalDevice devices[gpu_count];
+#endif
+		vk_error(vkEnumeratePhysicalDevices(vk_data.instance,
+				&gpu_count, devices));
+		assert(gpu_count >= 1);
 
+		printf("Found %d GPUs\n", gpu_count);
+		for (int i = 0; i < gpu_count; ++i) {
+			VkPhysicalDeviceProperties props;
+			vkGetPhysicalDeviceProperties(devices[i], &props);
+			printf("%s\n", props.deviceName);
+			printf("    Maximum texture size : %d\n",
+					props.limits.maxImageDimension2D);
 		}
 
-	}
+		vk_data.phys_device = devices[0];
 
-}
+		VkPhysicalDeviceProperties props;
+		vkGetPhysicalDeviceProperties(vk_data.phys_device, &props);
+		vk_data.timestamp_period = props.limits.timestampPeriod;
+		vk_data.device_api_version = props.apiVersion;
+		vk_data.max_draw_indirect_count = props.limits.maxDrawIndirectCount;
+	}
 
-/* Rendering Pipeline*/
-void init_vk_pipeline()
-{
-	/* Create Render Pass. */
+	/* Get device extensions. */
 	{
-		VkAttachmentDescription attachment_descriptions[] = {
-			{
-				.flags					= 0
-				, .format				= vk_surface_data.color_format
-				, .samples				= VK_SAMPLE_COUNT_1_BIT
-				, .loadOp				= VK_ATTACHMENT_LOAD_OP_CLEAR
-				, .storeOp				= VK_ATTACHMENT_STORE_OP_STORE
-				, .stencilLoadOp		= VK_ATTACHMENT_LOAD_OP_DONT_CARE
-				, .stencilStoreOp		= VK_ATTACHMENT_STORE_OP_DONT_CARE
-				, .initialLayout		= VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-				, .finalLayout			= VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-			}
-		};
+		uint32_t ext_count = 0;
+		vk_error(vkEnumerateDeviceExtensionProperties(vk_data.phys_device,
+				NULL, &ext_count, NULL));
+		assert(ext_count >= 1);
 
-		VkAttachmentReference color_attachment_references[] = {
-			{
-				.attachment				= 0
-				, .layout				= VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-			}
-		};
+		vk_extensions_data.available_device_extensions =
+				malloc(sizeof(VkExtensionProperties) * ext_count);
+		vk_extensions_data.available_device_extensions_size = ext_count;
+		vk_error(vkEnumerateDeviceExtensionProperties(vk_data.phys_device,
+				NULL, &ext_count,
+				vk_extensions_data.available_device_extensions));
 
-		VkSubpassDescription subpass_descriptions[] = {
+		int ext_names_count = sizeof(vk_extensions_data.device_extensions)
+				/ sizeof(vk_extensions_data.device_extensions[0]);
+
+		/* Nothing to present to when headless. */
+		for (int i = 0; i < ext_names_count && !vk_options.headless; ++i) {
+			if (!enable_device_extension(
+						vk_extensions_data.device_extensions[i]))
+			{
+				printf("Didn't find swap chain extension on device.\n");
+				exit(-1);
+			}
+		}
+
+		/* Present wait needs present id. */
+		vk_extensions_data.present_id = !vk_options.headless
+				&& enable_device_extension(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+		if (vk_extensions_data.present_id) {
+			vk_extensions_data.present_wait =
+					enable_device_extension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+		}
+
+		/* Core in 1.3. The extension's own dependencies are core in 1.2. */
+		if (!vk_options.no_dynamic_rendering) {
+			if (vk_data.device_api_version >= VK_API_VERSION_1_3) {
+				vk_extensions_data.dynamic_rendering = true;
+			} else if (vk_data.device_api_version >= VK_API_VERSION_1_2) {
+				vk_extensions_data.dynamic_rendering = enable_device_extension(
+						VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+			}
+		}
+
+		/* Core in 1.2, behind the drawIndirectCount feature. */
+		if (vk_data.device_api_version < VK_API_VERSION_1_2) {
+			vk_extensions_data.draw_indirect_count = enable_device_extension(
+					VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+
+		/* Core in 1.2. The extension needs maintenance3, core in 1.1. */
+		if (vk_data.device_api_version >= VK_API_VERSION_1_1
+				&& vk_data.device_api_version < VK_API_VERSION_1_2)
+		{
+			vk_extensions_data.descriptor_indexing = enable_device_extension(
+					VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		}
+
+		/* Core in 1.3. The render graph falls back to the old barriers. */
+		if (vk_data.device_api_version >= VK_API_VERSION_1_3) {
+			vk_extensions_data.synchronization2 = true;
+		} else {
+			vk_extensions_data.synchronization2 = enable_device_extension(
+					VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+		}
+
+		/* Needs SPIR-V 1.4, core in 1.2. Only when asked for. */
+		if (vk_options.mesh_shader
+				&& vk_data.device_api_version >= VK_API_VERSION_1_2)
+		{
+			vk_extensions_data.mesh_shader = enable_device_extension(
+					VK_EXT_MESH_SHADER_EXTENSION_NAME);
+		}
+	}
+
+	/* Get device features. Only what we use gets enabled. */
+	{
+		vk_features_data.features2 = (VkPhysicalDeviceFeatures2){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2
+			, .pNext				= NULL
+		};
+		vk_features_data.vulkan12 = (VkPhysicalDeviceVulkan12Features){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+			, .pNext				= NULL
+		};
+		vk_features_data.present_id = (VkPhysicalDevicePresentIdFeaturesKHR){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR
+			, .pNext				= NULL
+		};
+		vk_features_data.present_wait = (VkPhysicalDevicePresentWaitFeaturesKHR){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR
+			, .pNext				= NULL
+		};
+		vk_features_data.dynamic_rendering =
+				(VkPhysicalDeviceDynamicRenderingFeaturesKHR){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR
+			, .pNext				= NULL
+		};
+		vk_features_data.descriptor_indexing =
+				(VkPhysicalDeviceDescriptorIndexingFeaturesEXT){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT
+			, .pNext				= NULL
+		};
+		vk_features_data.synchronization2 =
+				(VkPhysicalDeviceSynchronization2FeaturesKHR){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR
+			, .pNext				= NULL
+		};
+		vk_features_data.mesh_shader = (VkPhysicalDeviceMeshShaderFeaturesEXT){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT
+			, .pNext				= NULL
+		};
+
+		if (vk_data.device_api_version >= VK_API_VERSION_1_2) {
+			vk_features_data.vulkan12.pNext = vk_features_data.features2.pNext;
+			vk_features_data.features2.pNext = &vk_features_data.vulkan12;
+		}
+		if (vk_extensions_data.present_id) {
+			vk_features_data.present_id.pNext = vk_features_data.features2.pNext;
+			vk_features_data.features2.pNext = &vk_features_data.present_id;
+		}
+		if (vk_extensions_data.present_wait) {
+			vk_features_data.present_wait.pNext = vk_features_data.features2.pNext;
+			vk_features_data.features2.pNext = &vk_features_data.present_wait;
+		}
+		if (vk_extensions_data.dynamic_rendering) {
+			vk_features_data.dynamic_rendering.pNext =
+					vk_features_data.features2.pNext;
+			vk_features_data.features2.pNext =
+					&vk_features_data.dynamic_rendering;
+		}
+		if (vk_extensions_data.descriptor_indexing) {
+			vk_features_data.descriptor_indexing.pNext =
+					vk_features_data.features2.pNext;
+			vk_features_data.features2.pNext =
+					&vk_features_data.descriptor_indexing;
+		}
+		if (vk_extensions_data.synchronization2) {
+			vk_features_data.synchronization2.pNext =
+					vk_features_data.features2.pNext;
+			vk_features_data.features2.pNext =
+					&vk_features_data.synchronization2;
+		}
+		if (vk_extensions_data.mesh_shader) {
+			vk_features_data.mesh_shader.pNext =
+					vk_features_data.features2.pNext;
+			vk_features_data.features2.pNext = &vk_features_data.mesh_shader;
+		}
+
+		vkGetPhysicalDeviceFeatures2(vk_data.phys_device,
+				&vk_features_data.features2);
+
+		vk_features_data.supported = vk_features_data.features2.features;
+		memset(&vk_features_data.features2.features, 0,
+				sizeof(VkPhysicalDeviceFeatures));
+		vk_features_data.features2.features.multiDrawIndirect =
+				vk_features_data.supported.multiDrawIndirect;
+		vk_features_data.features2.features.drawIndirectFirstInstance =
+				vk_features_data.supported.drawIndirectFirstInstance;
+		/* The bindless table without descriptor indexing. */
+		vk_features_data.features2.features
+				.shaderStorageBufferArrayDynamicIndexing =
+				vk_features_data.supported
+						.shaderStorageBufferArrayDynamicIndexing;
+
+		vk_features_data.vulkan12_supported = vk_features_data.vulkan12;
+
+		/* Software raster, 64-bit atomics from compute and fragment
+		 * shaders, and the primitive id in the fragment shader. Only when
+		 * asked for.
+		 */
+		vk_extensions_data.sw_raster = vk_options.sw_raster
+				&& vk_data.device_api_version >= VK_API_VERSION_1_2
+				&& vk_features_data.vulkan12_supported.shaderBufferInt64Atomics
+				&& vk_features_data.supported.shaderInt64
+				&& vk_features_data.supported.fragmentStoresAndAtomics
+				&& vk_features_data.supported.geometryShader;
+		vk_features_data.features2.features.shaderInt64 =
+				vk_extensions_data.sw_raster;
+		vk_features_data.features2.features.fragmentStoresAndAtomics =
+				vk_extensions_data.sw_raster;
+		vk_features_data.features2.features.geometryShader =
+				vk_extensions_data.sw_raster;
+
+		/* What the bindless table needs, all or nothing. Same fields in the
+		 * 1.2 features and the extension's.
+		 */
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_supported =
+				vk_features_data.descriptor_indexing;
+		if (vk_data.device_api_version >= VK_API_VERSION_1_2) {
+			VkPhysicalDeviceVulkan12Features* v12 =
+					&vk_features_data.vulkan12_supported;
+			indexing_supported.runtimeDescriptorArray =
+					v12->runtimeDescriptorArray;
+			indexing_supported.descriptorBindingPartiallyBound =
+					v12->descriptorBindingPartiallyBound;
+			indexing_supported.descriptorBindingUpdateUnusedWhilePending =
+					v12->descriptorBindingUpdateUnusedWhilePending;
+			indexing_supported.descriptorBindingStorageBufferUpdateAfterBind =
+					v12->descriptorBindingStorageBufferUpdateAfterBind;
+			indexing_supported.descriptorBindingSampledImageUpdateAfterBind =
+					v12->descriptorBindingSampledImageUpdateAfterBind;
+		}
+		bool bindless = indexing_supported.runtimeDescriptorArray
+				&& indexing_supported.descriptorBindingPartiallyBound
+				&& indexing_supported.descriptorBindingUpdateUnusedWhilePending
+				&& indexing_supported.descriptorBindingStorageBufferUpdateAfterBind
+				&& indexing_supported.descriptorBindingSampledImageUpdateAfterBind;
+
+		vk_features_data.vulkan12 = (VkPhysicalDeviceVulkan12Features){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+			, .pNext				= vk_features_data.vulkan12_supported.pNext
+			, .drawIndirectCount	=
+					vk_features_data.vulkan12_supported.drawIndirectCount
+			, .runtimeDescriptorArray							= bindless
+			, .descriptorBindingPartiallyBound					= bindless
+			, .descriptorBindingUpdateUnusedWhilePending		= bindless
+			, .descriptorBindingStorageBufferUpdateAfterBind	= bindless
+			, .descriptorBindingSampledImageUpdateAfterBind		= bindless
+			, .shaderBufferInt64Atomics	= vk_extensions_data.sw_raster
+		};
+		vk_features_data.descriptor_indexing =
+				(VkPhysicalDeviceDescriptorIndexingFeaturesEXT){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT
+			, .pNext				= indexing_supported.pNext
+			, .runtimeDescriptorArray							= bindless
+			, .descriptorBindingPartiallyBound					= bindless
+			, .descriptorBindingUpdateUnusedWhilePending		= bindless
+			, .descriptorBindingStorageBufferUpdateAfterBind	= bindless
+			, .descriptorBindingSampledImageUpdateAfterBind		= bindless
+		};
+		vk_extensions_data.descriptor_indexing = bindless;
+
+		if (vk_data.device_api_version >= VK_API_VERSION_1_2) {
+			vk_extensions_data.draw_indirect_count =
+					vk_features_data.vulkan12.drawIndirectCount;
+		}
+
+		vk_extensions_data.present_id = vk_extensions_data.present_id
+				&& vk_features_data.present_id.presentId;
+		vk_extensions_data.present_wait = vk_extensions_data.present_wait
+				&& vk_extensions_data.present_id
+				&& vk_features_data.present_wait.presentWait;
+
+		vk_extensions_data.dynamic_rendering =
+				vk_extensions_data.dynamic_rendering
+				&& vk_features_data.dynamic_rendering.dynamicRendering;
+
+		vk_extensions_data.synchronization2 =
+				vk_extensions_data.synchronization2
+				&& vk_features_data.synchronization2.synchronization2;
+
+		/* Task and mesh, none of the extras. Their shaders are only built
+		 * for the descriptor indexing table.
+		 */
+		vk_extensions_data.mesh_shader = vk_extensions_data.mesh_shader
+				&& bindless
+				&& vk_features_data.mesh_shader.taskShader
+				&& vk_features_data.mesh_shader.meshShader;
+		vk_features_data.mesh_shader = (VkPhysicalDeviceMeshShaderFeaturesEXT){
+			.sType					= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT
+			, .pNext				= vk_features_data.mesh_shader.pNext
+			, .taskShader			= vk_extensions_data.mesh_shader
+			, .meshShader			= vk_extensions_data.mesh_shader
+		};
+
+		printf("Present wait : %s\n",
+				vk_extensions_data.present_wait ? "yes" : "no");
+		printf("Dynamic rendering : %s\n",
+				vk_extensions_data.dynamic_rendering ? "yes" : "no");
+		printf("Draw indirect count : %s\n",
+				vk_extensions_data.draw_indirect_count ? "yes" : "no");
+		printf("Descriptor indexing : %s\n",
+				vk_extensions_data.descriptor_indexing ? "yes" : "no");
+		printf("Synchronization2 : %s\n",
+				vk_extensions_data.synchronization2 ? "yes" : "no");
+		if (vk_options.mesh_shader) {
+			printf("Mesh shader : %s\n",
+					vk_extensions_data.mesh_shader ? "yes" : "no");
+		}
+		if (vk_options.sw_raster) {
+			printf("64-bit atomics : %s\n",
+					vk_extensions_data.sw_raster ? "yes" : "no");
+		}
+	}
+
+	/* Get available graphics queue. */
+	{
+		uint32_t queue_fam_count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(vk_data.phys_device,
+				&queue_fam_count, NULL);
+		assert(queue_fam_count >= 1 );
+
+#if defined(_MSC_VER)
+		VkQueueFamilyProperties queue_fams[32];
+#else
+		VkQueueFamilyProperties queue_fams[queue_fam_count];
+#endif
+		vkGetPhysicalDeviceQueueFamilyProperties(vk_data.phys_device,
+				&queue_fam_count, queue_fams);
+
+		bool found = false;
+		printf("Found %d Queue Families\n", queue_fam_count);
+		for (int i = 0; i < queue_fam_count; ++i) {
+			if (queue_fams[i].queueCount > 0 &&
+					queue_fams[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			{
+				vk_data.queue_family_index = i;
+				vk_data.timestamp_valid_bits = queue_fams[i].timestampValidBits;
+				found = true;
+			}
+		}
+
+		if (!found) {
+			printf("Did not find graphic queue family! Exiting.\n");
+			exit(-1);
+		}
+
+		if (vk_data.timestamp_valid_bits == 0) {
+			printf("Queue doesn't support timestamps, no GPU timings.\n");
+		}
+
+		/* Async compute. A compute only family is the real thing, a second
+		 * graphics queue may still overlap.
+		 */
+		if (!vk_options.no_async_compute) {
+			for (int i = 0; i < queue_fam_count; ++i) {
+				if (queue_fams[i].queueCount > 0
+						&& (queue_fams[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
+						&& !(queue_fams[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+				{
+					vk_data.async_compute = true;
+					vk_data.compute_family_index = i;
+					vk_data.compute_queue_index = 0;
+					break;
+				}
+			}
+
+			if (!vk_data.async_compute
+					&& queue_fams[vk_data.queue_family_index].queueCount > 1)
+			{
+				vk_data.async_compute = true;
+				vk_data.compute_family_index = vk_data.queue_family_index;
+				vk_data.compute_queue_index = 1;
+			}
+		}
+
+		vk_data.async_compute_active = vk_data.async_compute;
+		if (vk_data.async_compute) {
+			printf("Async compute : family %d, queue %d\n",
+					vk_data.compute_family_index,
+					vk_data.compute_queue_index);
+		} else {
+			printf("Async compute : no, compute goes on the graphics queue\n");
+		}
+	}
+
+	/* Create device. */
+	{
+		float q_priorities[] = { 1.0f, 1.0f };
+		VkDeviceQueueCreateInfo q_create_infos[] = {
+			{
+				.sType					= VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO
+				, .pNext				= NULL
+				, .flags				= 0
+				, .queueFamilyIndex		= vk_data.queue_family_index
+				, .queueCount			= 1
+				, .pQueuePriorities		= q_priorities
+			}
+			, {
+				.sType					= VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO
+				, .pNext				= NULL
+				, .flags				= 0
+				, .queueFamilyIndex		= vk_data.compute_family_index
+				, .queueCount			= 1
+				, .pQueuePriorities		= q_priorities
+			}
+		};
+
+		/* Second queue of the graphics family, or its own family. */
+		uint32_t q_create_info_count = 1;
+		if (vk_data.async_compute) {
+			if (vk_data.compute_family_index == vk_data.queue_family_index) {
+				q_create_infos[0].queueCount = 2;
+			} else {
+				q_create_info_count = 2;
+			}
+		}
+
+		/* Features go through pNext, so pEnabledFeatures stays NULL. */
+		const VkDeviceCreateInfo device_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO
+			, .pNext				= &vk_features_data.features2
+			, .flags				= 0
+			, .queueCreateInfoCount	= q_create_info_count
+			, .pQueueCreateInfos	= q_create_infos
+			, .enabledLayerCount	= 0
+			, .ppEnabledLayerNames	= NULL
+			, .enabledExtensionCount	=
+					vk_extensions_data.enabled_device_extensions_size
+			, .ppEnabledExtensionNames	=
+					vk_extensions_data.enabled_device_extensions
+			, .pEnabledFeatures		= 0
+		};
+
+		vk_error(vkCreateDevice(vk_data.phys_device,
+				&device_create_info, vk_allocator,
+				&vk_data.device));
+	}
+
+	/* Get Device Function Pointers. */
+	{
+		if (!vk_options.headless) {
+			vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkCreateSwapchainKHR)
+			vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkDestroySwapchainKHR)
+			vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkGetSwapchainImagesKHR)
+			vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkAcquireNextImageKHR)
+			vk_ext_pfn.VK_DEVICE_LEVEL_FUNCTION(vkQueuePresentKHR)
+		}
+
+		if (vk_extensions_data.present_wait) {
+			VK_DEVICE_EXTENSION_FUNCTION(vkWaitForPresentKHR)
+		}
+
+		/* Same signatures, core names first. */
+		if (vk_extensions_data.dynamic_rendering) {
+			if (vk_data.device_api_version >= VK_API_VERSION_1_3) {
+				vk_ext_pfn.vkCmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)
+						vkGetDeviceProcAddr(vk_data.device, "vkCmdBeginRendering");
+				vk_ext_pfn.vkCmdEndRendering = (PFN_vkCmdEndRenderingKHR)
+						vkGetDeviceProcAddr(vk_data.device, "vkCmdEndRendering");
+			} else {
+				vk_ext_pfn.vkCmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)
+						vkGetDeviceProcAddr(vk_data.device,
+								"vkCmdBeginRenderingKHR");
+				vk_ext_pfn.vkCmdEndRendering = (PFN_vkCmdEndRenderingKHR)
+						vkGetDeviceProcAddr(vk_data.device,
+								"vkCmdEndRenderingKHR");
+			}
+
+			if (vk_ext_pfn.vkCmdBeginRendering == NULL
+					|| vk_ext_pfn.vkCmdEndRendering == NULL)
+			{
+				printf("Could not load dynamic rendering functions.\n");
+				exit(-1);
+			}
+		}
+
+		if (vk_extensions_data.draw_indirect_count) {
+			vk_ext_pfn.vkCmdDrawIndexedIndirectCount =
+					(PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(
+							vk_data.device,
+							vk_data.device_api_version >= VK_API_VERSION_1_2
+									? "vkCmdDrawIndexedIndirectCount"
+									: "vkCmdDrawIndexedIndirectCountKHR");
+
+			if (vk_ext_pfn.vkCmdDrawIndexedIndirectCount == NULL) {
+				printf("Could not load indirect count draw function.\n");
+				exit(-1);
+			}
+		}
+
+		if (vk_extensions_data.synchronization2) {
+			vk_ext_pfn.vkCmdPipelineBarrier2 =
+					(PFN_vkCmdPipelineBarrier2KHR)vkGetDeviceProcAddr(
+							vk_data.device,
+							vk_data.device_api_version >= VK_API_VERSION_1_3
+									? "vkCmdPipelineBarrier2"
+									: "vkCmdPipelineBarrier2KHR");
+
+			if (vk_ext_pfn.vkCmdPipelineBarrier2 == NULL) {
+				printf("Could not load synchronization2 barrier function.\n");
+				exit(-1);
+			}
+		}
+
+		if (vk_extensions_data.mesh_shader) {
+			VK_DEVICE_EXTENSION_FUNCTION(vkCmdDrawMeshTasksEXT)
+		}
+	}
+
+	/* Get queues. */
+	{
+		vkGetDeviceQueue(vk_data.device,
+				vk_data.queue_family_index, 0,
+				&vk_data.queue);
+
+		if (vk_data.async_compute) {
+			vkGetDeviceQueue(vk_data.device,
+					vk_data.compute_family_index, vk_data.compute_queue_index,
+					&vk_data.compute_queue);
+		}
+	}
+
+	/* Get surface. Headless frames go to offscreen targets instead. */
+	if (!vk_options.headless) {
+#if defined(VK_USE_PLATFORM_WIN32_KHR)
+		vk_ext_pfn.fpCreateWin32SurfaceKHR = (PFN_vkCreateWin32SurfaceKHR)vkGetInstanceProcAddr(
+				vk_data.instance, "vkCreateWin32SurfaceKHR");
+
+		VkWin32SurfaceCreateInfoKHR surface_create_info = {
+			.sType				= VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR
+			, .pNext			= NULL
+			, .flags			= 0
+			, .hinstance		= win32_instance
+			, .hwnd				= win32_window
+		};
+
+		vk_error(vk_ext_pfn.fpCreateWin32SurfaceKHR(vk_data.instance,
+				&surface_create_info, vk_allocator, &vk_data.surface));
+#endif
+
+	}
+
+	/* Create drawing and presentation Semaphores and Fences. */
+	{
+		VkSemaphoreCreateInfo sem_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+		};
+
+		/* Signaled, so the first wait on each frame doesn't block. */
+		VkFenceCreateInfo fence_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= VK_FENCE_CREATE_SIGNALED_BIT
+		};
+
+		for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+			vk_error(vkCreateSemaphore(vk_data.device, &sem_create_info,
+					vk_allocator, &vk_frames[i].s_image_available));
+			vk_error(vkCreateSemaphore(vk_data.device, &sem_create_info,
+					vk_allocator, &vk_frames[i].s_render_finished));
+			vk_error(vkCreateFence(vk_data.device, &fence_create_info,
+					vk_allocator, &vk_frames[i].f_in_flight));
+
+			if (vk_data.async_compute) {
+				vk_error(vkCreateSemaphore(vk_data.device, &sem_create_info,
+						vk_allocator, &vk_frames[i].s_compute_finished));
+				vk_error(vkCreateFence(vk_data.device, &fence_create_info,
+						vk_allocator, &vk_frames[i].f_compute));
+			}
+		}
+	}
+
+	/* Create timestamp Query Pools, 2 queries per scope. */
+	if (vk_data.timestamp_valid_bits > 0) {
+		VkQueryPoolCreateInfo query_pool_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .queryType			= VK_QUERY_TYPE_TIMESTAMP
+			, .queryCount			= MAX_GPU_SCOPES * 2
+			, .pipelineStatistics	= 0
+		};
+
+		for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+			vk_error(vkCreateQueryPool(vk_data.device, &query_pool_create_info,
+					vk_allocator, &vk_frames[i].timestamp_pool));
+		}
+	}
+
+	/* Create Swap Chain. */
+	if (!vk_options.headless) {
+		create_swapchain();
+	}
+
+	/* Create Command Pool. Buffers are re-recorded every frame. */
+	{
+		VkCommandPoolCreateInfo cmd_pool_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+			, .queueFamilyIndex		= vk_data.queue_family_index
+		};
+
+		vk_error(vkCreateCommandPool(vk_data.device,
+				&cmd_pool_create_info, vk_allocator,
+				&vk_data.queue_cmd_pool));
+	}
+
+	/* Allocate Command Buffers, one per frame in flight. */
+	{
+		VkCommandBufferAllocateInfo cmd_buffer_allocate_info = {
+			.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO
+			, .pNext				= NULL
+			, .commandPool			= vk_data.queue_cmd_pool
+			, .level				= VK_COMMAND_BUFFER_LEVEL_PRIMARY
+			, .commandBufferCount	= 1
+		};
+
+		for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+			vk_error(vkAllocateCommandBuffers(vk_data.device,
+					&cmd_buffer_allocate_info,
+					&vk_frames[i].cmd_buffer));
+		}
+	}
+
+	/* Compute Command Pool and Buffers, for the async queue. */
+	if (vk_data.async_compute) {
+		VkCommandPoolCreateInfo cmd_pool_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+			, .queueFamilyIndex		= vk_data.compute_family_index
+		};
+
+		vk_error(vkCreateCommandPool(vk_data.device,
+				&cmd_pool_create_info, vk_allocator,
+				&vk_data.compute_cmd_pool));
+
+		VkCommandBufferAllocateInfo cmd_buffer_allocate_info = {
+			.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO
+			, .pNext				= NULL
+			, .commandPool			= vk_data.compute_cmd_pool
+			, .level				= VK_COMMAND_BUFFER_LEVEL_PRIMARY
+			, .commandBufferCount	= 1
+		};
+
+		for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+			vk_error(vkAllocateCommandBuffers(vk_data.device,
+					&cmd_buffer_allocate_info,
+					&vk_frames[i].compute_cmd_buffer));
+		}
+	}
+
+}
+
+/* Everything sized on the swapchain images. */
+void create_swapchain_targets()
+{
+	{
+		uint32_t image_count = vk_data.swapchain_images_size;
+
+		vk_data.image_views = malloc(sizeof(VkImageView) * image_count);
+		vk_data.image_views_size = image_count;
+
+		/* Dynamic rendering draws straight into the views. */
+		if (!vk_extensions_data.dynamic_rendering) {
+			vk_data.frame_buffers = malloc(sizeof(VkFramebuffer) * image_count);
+			vk_data.frame_buffers_size = image_count;
+		}
+
+		for (int i = 0; i < image_count; ++i) {
+			VkImageViewCreateInfo image_view_create_info = {
+				.sType					= VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO
+				, .pNext				= NULL
+				, .flags				= 0
+				, .image				= vk_data.swapchain_images[i]
+				, .viewType				= VK_IMAGE_VIEW_TYPE_2D
+				, .format				= vk_surface_data.color_format
+				, .components			= {
+					.r					= VK_COMPONENT_SWIZZLE_IDENTITY
+					, .g				= VK_COMPONENT_SWIZZLE_IDENTITY
+					, .b				= VK_COMPONENT_SWIZZLE_IDENTITY
+					, .a				= VK_COMPONENT_SWIZZLE_IDENTITY
+				}
+				, .subresourceRange		= {
+					.aspectMask			= VK_IMAGE_ASPECT_COLOR_BIT
+					, .baseMipLevel		= 0
+					, .levelCount		= 1
+					, .baseArrayLayer	= 0
+					, .layerCount		= 1
+				}
+			};
+
+			vk_error(vkCreateImageView(vk_data.device, &image_view_create_info,
+					vk_allocator, &vk_data.image_views[i]));
+
+			if (vk_extensions_data.dynamic_rendering)
+				continue;
+
+			VkFramebufferCreateInfo framebuffer_create_info = {
+				.sType					= VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO
+				, .pNext				= NULL
+				, .flags				= 0
+				, .renderPass			= vk_data.render_pass
+				, .attachmentCount		= 1
+				, .pAttachments			= &vk_data.image_views[i]
+				, .width				= vk_surface_data.extent_2d.width
+				, .height				= vk_surface_data.extent_2d.height
+				, .layers				= 1
+			};
+
+			vk_error(vkCreateFramebuffer(vk_data.device,
+					&framebuffer_create_info, vk_allocator,
+					&vk_data.frame_buffers[i]));
+		}
+	}
+}
+
+void destroy_swapchain_targets()
+{
+	for (int i = 0; i < vk_data.frame_buffers_size; ++i) {
+		vkDestroyFramebuffer(vk_data.device, vk_data.frame_buffers[i],
+				vk_allocator);
+	}
+	for (int i = 0; i < vk_data.image_views_size; ++i) {
+		vkDestroyImageView(vk_data.device, vk_data.image_views[i],
+				vk_allocator);
+	}
+
+	free(vk_data.frame_buffers);
+	vk_data.frame_buffers = NULL;
+	vk_data.frame_buffers_size = 0;
+	free(vk_data.image_views);
+	vk_data.image_views = NULL;
+	vk_data.image_views_size = 0;
+}
+
+/* Window resized or surface out of date. Only the swapchain and its views
+ * are rebuilt, the pipeline uses dynamic viewport and scissor.
+ */
+void recreate_swapchain()
+{
+	VkSurfaceCapabilitiesKHR surface_capabilities;
+	vk_error(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vk_data.phys_device,
+			vk_data.surface, &surface_capabilities));
+
+	/* Minimized, try again later. */
+	if (surface_capabilities.currentExtent.width == 0
+			|| surface_capabilities.currentExtent.height == 0)
+	{
+		vk_surface_data.extent_2d = surface_capabilities.currentExtent;
+		return;
+	}
+
+	vkDeviceWaitIdle(vk_data.device);
+
+	destroy_swapchain_targets();
+	create_swapchain();
+	create_swapchain_targets();
+
+	vk_resize_pending = false;
+}
+
+/* Extra outputs. The format follows the main swapchain when the surface has
+ * it, the blit converts otherwise.
+ */
+void create_output_swapchain(OutputData* output)
+{
+	VkSurfaceCapabilitiesKHR surface_capabilities;
+	vk_error(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vk_data.phys_device,
+			output->surface, &surface_capabilities));
+
+	/* Minimized, try again once it has a size, see acquire_outputs. */
+	output->extent_2d = surface_capabilities.currentExtent;
+	if (output->extent_2d.width == 0 || output->extent_2d.height == 0) {
+		output->resize_pending = true;
+		return;
+	}
+	/* The surface takes the swapchain's size. */
+	if (output->extent_2d.width == UINT32_MAX) {
+		output->extent_2d = vk_surface_data.extent_2d;
+	}
+
+	if (!(surface_capabilities.supportedUsageFlags
+			& VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+	{
+		printf("Output swapchains can't be blitted to.\n");
+		exit(-1);
+	}
+
+	uint32_t format_count = 0;
+	vk_ext_pfn.fpGetPhysicalDeviceSurfaceFormatsKHR(vk_data.phys_device,
+			output->surface, &format_count, NULL);
+	assert(format_count >= 1);
+
+#if defined(_MSC_VER)
+	VkSurfaceFormatKHR surface_formats[32];
+	if (format_count > 32) {
+		format_count = 32;
+	}
+#else
+	VkSurfaceFormatKHR surface_formats[format_count];
+#endif
+	vk_ext_pfn.fpGetPhysicalDeviceSurfaceFormatsKHR(vk_data.phys_device,
+			output->surface, &format_count, surface_formats);
+
+	/* The main format if the surface has it, else the first one. Either
+	 * way, one the blit can write to optimally tiled images.
+	 */
+	bool found = false;
+	for (uint32_t i = 0; i < format_count; ++i) {
+		VkFormat format = surface_formats[i].format;
+		VkColorSpaceKHR color_space = surface_formats[i].colorSpace;
+		/* Any format. */
+		if (format == VK_FORMAT_UNDEFINED) {
+			format = vk_surface_data.color_format;
+			color_space = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+		}
+
+		VkFormatProperties format_props;
+		vkGetPhysicalDeviceFormatProperties(vk_data.phys_device, format,
+				&format_props);
+		if (!(format_props.optimalTilingFeatures
+				& VK_FORMAT_FEATURE_BLIT_DST_BIT))
+			continue;
+
+		if (!found || format == vk_surface_data.color_format) {
+			output->color_format = format;
+			output->color_space = color_space;
+			found = true;
+		}
+	}
+	if (!found) {
+		printf("Output swapchains have no format that can be blitted to.\n");
+		exit(-1);
+	}
+
+	uint32_t image_count = surface_capabilities.minImageCount + 1;
+	if (surface_capabilities.maxImageCount > 0
+			&& image_count > surface_capabilities.maxImageCount)
+	{
+		image_count = surface_capabilities.maxImageCount;
+	}
+
+	uint32_t p_count = 0;
+	vk_error(vkGetPhysicalDeviceSurfacePresentModesKHR(vk_data.phys_device,
+			output->surface, &p_count, NULL));
+	assert(p_count >= 1);
+
+#if defined(_MSC_VER)
+	VkPresentModeKHR present_modes[32];
+	if (p_count > 32) {
+		p_count = 32;
+	}
+#else
+	VkPresentModeKHR present_modes[p_count];
+#endif
+	vk_error(vkGetPhysicalDeviceSurfacePresentModesKHR(vk_data.phys_device,
+			output->surface, &p_count, present_modes));
+
+	VkSwapchainKHR old_swapchain = output->swapchain;
+
+	VkSwapchainCreateInfoKHR swapchain_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR
+		, .pNext				= NULL
+		, .flags				= 0
+		, .surface				= output->surface
+		, .minImageCount		= image_count
+		, .imageFormat			= output->color_format
+		, .imageColorSpace		= output->color_space
+		, .imageExtent			= output->extent_2d
+		, .imageArrayLayers		= 1
+		, .imageUsage			= VK_IMAGE_USAGE_TRANSFER_DST_BIT
+		, .imageSharingMode		= VK_SHARING_MODE_EXCLUSIVE
+		, .queueFamilyIndexCount	= 0
+		, .pQueueFamilyIndices	= NULL
+		, .preTransform			= surface_capabilities.currentTransform
+		, .compositeAlpha		= VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR
+		, .presentMode			= select_present_mode(present_modes, p_count)
+		, .clipped				= VK_TRUE
+		, .oldSwapchain			= old_swapchain
+	};
+
+	vk_error(vk_ext_pfn.vkCreateSwapchainKHR(vk_data.device,
+			&swapchain_create_info, vk_allocator, &output->swapchain));
+
+	if (old_swapchain != VK_NULL_HANDLE) {
+		vk_ext_pfn.vkDestroySwapchainKHR(vk_data.device, old_swapchain,
+				vk_allocator);
+	}
+
+	vk_error(vk_ext_pfn.vkGetSwapchainImagesKHR(vk_data.device,
+			output->swapchain, &image_count, NULL));
+	free(output->images);
+	output->images = malloc(sizeof(VkImage) * image_count);
+	output->images_size = image_count;
+	vk_error(vk_ext_pfn.vkGetSwapchainImagesKHR(vk_data.device,
+			output->swapchain, &image_count, output->images));
+
+	output->resize_pending = false;
+}
+
+/* After the main swapchain, it has to be a blit source. */
+void init_outputs()
+{
+	uint32_t count = vk_options.output_count - 1;
+	if (count > MAX_OUTPUTS - 1) {
+		count = MAX_OUTPUTS - 1;
+	}
+
+	/* Linear scaling, when the main format can be filtered. */
+	VkFormatProperties format_props;
+	vkGetPhysicalDeviceFormatProperties(vk_data.phys_device,
+			vk_surface_data.color_format, &format_props);
+	if (!(format_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT)) {
+		printf("Swapchain format can't be blitted, no extra outputs.\n");
+		return;
+	}
+	vk_outputs_data.filter = (format_props.optimalTilingFeatures
+			& VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+			? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+	VkSemaphoreCreateInfo sem_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+	};
+
+	for (uint32_t i = 0; i < count; ++i) {
+		OutputData* output = &vk_outputs_data.outputs[i];
+		output->window = create_output_window(vk_surface_data.extent_2d.width,
+				vk_surface_data.extent_2d.height, i + 1);
+
+		VkWin32SurfaceCreateInfoKHR surface_create_info = {
+			.sType				= VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR
+			, .pNext			= NULL
+			, .flags			= 0
+			, .hinstance		= win32_instance
+			, .hwnd				= output->window
+		};
+		vk_error(vk_ext_pfn.fpCreateWin32SurfaceKHR(vk_data.instance,
+				&surface_create_info, vk_allocator, &output->surface));
+
+		/* Everything is presented from the graphics queue. */
+		VkBool32 supported = VK_FALSE;
+		vk_error(vkGetPhysicalDeviceSurfaceSupportKHR(vk_data.phys_device,
+				vk_data.queue_family_index, output->surface, &supported));
+		if (!supported) {
+			printf("Output %d can't be presented from the graphics queue.\n",
+					i + 2);
+			exit(-1);
+		}
+
+		for (int f = 0; f < FRAMES_IN_FLIGHT; ++f) {
+			vk_error(vkCreateSemaphore(vk_data.device, &sem_create_info,
+					vk_allocator, &output->s_image_available[f]));
+		}
+
+		create_output_swapchain(output);
+		++vk_outputs_data.count;
+	}
+
+	printf("Outputs : %d, one present for all\n", vk_outputs_data.count + 1);
+}
+
+/* Device idle. */
+void deinit_outputs()
+{
+	for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+		OutputData* output = &vk_outputs_data.outputs[i];
+		for (int f = 0; f < FRAMES_IN_FLIGHT; ++f) {
+			vkDestroySemaphore(vk_data.device, output->s_image_available[f],
+					vk_allocator);
+		}
+		if (output->swapchain != VK_NULL_HANDLE) {
+			vk_ext_pfn.vkDestroySwapchainKHR(vk_data.device, output->swapchain,
+					vk_allocator);
+		}
+		vkDestroySurfaceKHR(vk_data.instance, output->surface, vk_allocator);
+		free(output->images);
+		DestroyWindow(output->window);
+	}
+	vk_outputs_data.count = 0;
+}
+
+/* Never blocks, an output without a free image skips the frame. */
+void acquire_outputs(uint32_t frame_slot)
+{
+	for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+		OutputData* output = &vk_outputs_data.outputs[i];
+		output->acquired = false;
+
+		/* Minimized outputs stay pending, without waiting on the device
+		 * every frame until they're restored.
+		 */
+		if (output->resize_pending) {
+			VkSurfaceCapabilitiesKHR surface_capabilities;
+			vk_error(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+					vk_data.phys_device, output->surface,
+					&surface_capabilities));
+			if (surface_capabilities.currentExtent.width == 0
+					|| surface_capabilities.currentExtent.height == 0)
+				continue;
+
+			vkDeviceWaitIdle(vk_data.device);
+			create_output_swapchain(output);
+		}
+		if (output->extent_2d.width == 0 || output->extent_2d.height == 0)
+			continue;
+
+		VkResult result = vk_ext_pfn.vkAcquireNextImageKHR(vk_data.device,
+				output->swapchain, 0, output->s_image_available[frame_slot],
+				VK_NULL_HANDLE, &output->image_index);
+
+		switch (result) {
+			case VK_SUCCESS:
+			case VK_SUBOPTIMAL_KHR:
+				output->acquired = true;
+				break;
+			case VK_ERROR_OUT_OF_DATE_KHR:
+				output->resize_pending = true;
+				++output->skip_count;
+				break;
+			case VK_NOT_READY:
+			case VK_TIMEOUT:
+				++output->skip_count;
+				break;
+			default:
+				printf("Problem acquiring output %d image.\n", i + 2);
+				vk_error(result);
+				break;
+		}
+	}
+}
+
+/* Caller frees. NULL when the file can't be read. */
+uint32_t* try_load_spirv(const char* filename, size_t* out_size)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f) {
+		char result[256];
+		GetCurrentDirectory(256, result);
+		printf("Unable to read %s %s\n", result, filename);
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	size_t filesize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	uint32_t* code = (uint32_t*)malloc(filesize);
+	fread(code, 1, filesize, f);
+	fclose(f);
+
+	*out_size = filesize;
+	return code;
+}
+
+/* VK_NULL_HANDLE when the file can't be read or the driver refuses it.
+ * Pipeline builds go through this, hot reload must survive broken shaders.
+ */
+VkShaderModule try_create_shader_module(const char* filename)
+{
+	size_t code_size = 0;
+	uint32_t* code = try_load_spirv(filename, &code_size);
+	if (code == NULL)
+		return VK_NULL_HANDLE;
+
+	VkShaderModuleCreateInfo module_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .codeSize				= code_size
+		, .pCode				= code
+	};
+
+	VkShaderModule module = VK_NULL_HANDLE;
+	VkResult result = vkCreateShaderModule(vk_data.device,
+			&module_create_info, vk_allocator, &module);
+	if (result != VK_SUCCESS) {
+		printf("Can't create a shader module from %s, VkResult %d\n",
+				filename, result);
+		module = VK_NULL_HANDLE;
+	}
+
+	free(code);
+	return module;
+}
+
+VkShaderModule create_shader_module(const char* filename)
+{
+	VkShaderModule module = try_create_shader_module(filename);
+	if (module == VK_NULL_HANDLE)
+		exit(-1);
+	return module;
+}
+
+/* What the draw pass renders to, next to the target. The multisampled color
+ * and the depth are render graph transients, never stored, so they can live
+ * in lazily allocated memory on tilers. Both need dynamic rendering.
+ */
+typedef struct AttachmentData {
+	VkSampleCountFlagBits	samples;
+	/* VK_FORMAT_UNDEFINED without depth. */
+	VkFormat				depth_format;
+	/* This frame's graph resources, RG_NONE when unused. */
+	uint32_t				color_resource;
+	uint32_t				depth_resource;
+} AttachmentData;
+
+AttachmentData vk_attachment_data = {
+	.samples						= VK_SAMPLE_COUNT_1_BIT
+	, .depth_format					= VK_FORMAT_UNDEFINED
+	, .color_resource				= UINT32_MAX
+	, .depth_resource				= UINT32_MAX
+};
+
+/* Before the pipelines, they're built for these. */
+void init_vk_attachments()
+{
+	if (vk_options.msaa_samples <= 1 && !vk_options.depth)
+		return;
+
+	if (!vk_extensions_data.dynamic_rendering) {
+		printf("Depth and MSAA need dynamic rendering, ignored.\n");
+		return;
+	}
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(vk_data.phys_device, &props);
+
+	if (vk_options.depth) {
+		const VkFormat depth_formats[] = {
+			VK_FORMAT_D32_SFLOAT
+			, VK_FORMAT_D16_UNORM
+		};
+		for (int i = 0; i < 2; ++i) {
+			VkFormatProperties format_props;
+			vkGetPhysicalDeviceFormatProperties(vk_data.phys_device,
+					depth_formats[i], &format_props);
+			if (format_props.optimalTilingFeatures
+					& VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+			{
+				vk_attachment_data.depth_format = depth_formats[i];
+				break;
+			}
+		}
+	}
+
+	/* Highest supported count at or below the one asked for. */
+	VkSampleCountFlags sample_counts =
+			props.limits.framebufferColorSampleCounts;
+	if (vk_attachment_data.depth_format != VK_FORMAT_UNDEFINED) {
+		sample_counts &= props.limits.framebufferDepthSampleCounts;
+	}
+	uint32_t samples = vk_options.msaa_samples;
+	while (samples & (samples - 1)) {
+		samples &= samples - 1;
+	}
+	while (samples > 1 && !(sample_counts & samples)) {
+		samples /= 2;
+	}
+	vk_attachment_data.samples = samples > 1
+			? (VkSampleCountFlagBits)samples : VK_SAMPLE_COUNT_1_BIT;
+
+	printf("Attachments : %dx color, %s depth\n", vk_attachment_data.samples,
+			vk_attachment_data.depth_format == VK_FORMAT_D32_SFLOAT ? "d32"
+			: vk_attachment_data.depth_format == VK_FORMAT_D16_UNORM ? "d16"
+			: "no");
+}
+
+/* Color, plus depth when there is some, dynamic viewport and scissor.
+ * Targets the swapchain, through the render pass or dynamic rendering. Mesh
+ * pipelines have no vertex input. Front faces are counter clockwise. Without
+ * blend state, writes are opaque. Multisampled pipelines need dynamic
+ * rendering, the render pass is single sampled. VK_NULL_HANDLE if a module
+ * is, or the pipeline can't be created.
+ */
+VkPipeline create_pipeline_state(VkPipelineCache cache,
+		const VkPipelineShaderStageCreateInfo* stages,
+		uint32_t stage_count, VkPipelineLayout layout,
+		const VkPipelineVertexInputStateCreateInfo* vertex_input,
+		VkCullModeFlags cull_mode, VkSampleCountFlagBits samples,
+		const VkPipelineColorBlendAttachmentState* blend)
+{
+	for (uint32_t i = 0; i < stage_count; ++i) {
+		if (stages[i].module == VK_NULL_HANDLE)
+			return VK_NULL_HANDLE;
+	}
+
+	VkPipelineInputAssemblyStateCreateInfo input_assembly_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .topology				= VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
+		, .primitiveRestartEnable	= VK_FALSE
+	};
+
+	/* Viewport and scissor are dynamic, set when recording. */
+	VkPipelineViewportStateCreateInfo viewport_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .viewportCount		= 1
+		, .pViewports			= NULL
+		, .scissorCount			= 1
+		, .pScissors			= NULL
+	};
+
+	VkPipelineRasterizationStateCreateInfo rasterization_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .depthClampEnable		= VK_FALSE
+		, .rasterizerDiscardEnable	= VK_FALSE
+		, .polygonMode			= VK_POLYGON_MODE_FILL
+		, .cullMode				= cull_mode
+		, .frontFace			= VK_FRONT_FACE_COUNTER_CLOCKWISE
+		, .depthBiasEnable		= VK_FALSE
+		, .depthBiasConstantFactor	= 0.0f
+		, .depthBiasClamp		= 0.0f
+		, .depthBiasSlopeFactor	= 0.0f
+		, .lineWidth			= 1.0f
+	};
+
+	VkPipelineMultisampleStateCreateInfo multisample_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .rasterizationSamples	= samples
+		, .sampleShadingEnable	= VK_FALSE
+		, .minSampleShading		= 1.0f
+		, .pSampleMask			= NULL
+		, .alphaToCoverageEnable	= VK_FALSE
+		, .alphaToOneEnable		= VK_FALSE
+	};
+
+	VkPipelineColorBlendAttachmentState color_blend_attachment_state = {
+		.blendEnable			= VK_FALSE
+		, .srcColorBlendFactor	= VK_BLEND_FACTOR_ONE
+		, .dstColorBlendFactor	= VK_BLEND_FACTOR_ZERO
+		, .colorBlendOp			= VK_BLEND_OP_ADD
+		, .srcAlphaBlendFactor	= VK_BLEND_FACTOR_ONE
+		, .dstAlphaBlendFactor	= VK_BLEND_FACTOR_ZERO
+		, .alphaBlendOp			= VK_BLEND_OP_ADD
+		, .colorWriteMask		= VK_COLOR_COMPONENT_R_BIT
+				| VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT
+				| VK_COLOR_COMPONENT_A_BIT
+	};
+
+	VkPipelineColorBlendStateCreateInfo color_blend_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .logicOpEnable		= VK_FALSE
+		, .logicOp				= VK_LOGIC_OP_COPY
+		, .attachmentCount		= 1
+		, .pAttachments			= blend != NULL
+				? blend : &color_blend_attachment_state
+		, .blendConstants		= { 0.0f, 0.0f, 0.0f, 0.0f }
+	};
+
+	/* Reversed depth would be nicer, the projection is the usual 0 to 1. */
+	bool depth = vk_attachment_data.depth_format != VK_FORMAT_UNDEFINED;
+	VkPipelineDepthStencilStateCreateInfo depth_stencil_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .depthTestEnable		= VK_TRUE
+		, .depthWriteEnable		= VK_TRUE
+		, .depthCompareOp		= VK_COMPARE_OP_LESS_OR_EQUAL
+		, .depthBoundsTestEnable	= VK_FALSE
+		, .stencilTestEnable	= VK_FALSE
+		, .front				= {0}
+		, .back					= {0}
+		, .minDepthBounds		= 0.0f
+		, .maxDepthBounds		= 1.0f
+	};
+
+	VkDynamicState dynamic_states[] = {
+		VK_DYNAMIC_STATE_VIEWPORT
+		, VK_DYNAMIC_STATE_SCISSOR
+	};
+
+	VkPipelineDynamicStateCreateInfo dynamic_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .dynamicStateCount	= 2
+		, .pDynamicStates		= dynamic_states
+	};
+
+	/* With dynamic rendering, formats replace the render pass. */
+	VkPipelineRenderingCreateInfoKHR rendering_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR
+		, .pNext				= NULL
+		, .viewMask				= 0
+		, .colorAttachmentCount	= 1
+		, .pColorAttachmentFormats	= &vk_surface_data.color_format
+		, .depthAttachmentFormat	= vk_attachment_data.depth_format
+		, .stencilAttachmentFormat	= VK_FORMAT_UNDEFINED
+	};
+
+	VkGraphicsPipelineCreateInfo pipeline_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO
+		, .pNext				= vk_extensions_data.dynamic_rendering
+				? &rendering_create_info : NULL
+		, .flags				= 0
+		, .stageCount			= stage_count
+		, .pStages				= stages
+		, .pVertexInputState	= vertex_input
+		, .pInputAssemblyState	= vertex_input != NULL
+				? &input_assembly_create_info : NULL
+		, .pTessellationState	= NULL
+		, .pViewportState		= &viewport_create_info
+		, .pRasterizationState	= &rasterization_create_info
+		, .pMultisampleState	= &multisample_create_info
+		, .pDepthStencilState	= depth ? &depth_stencil_create_info : NULL
+		, .pColorBlendState		= &color_blend_create_info
+		, .pDynamicState		= &dynamic_create_info
+		, .layout				= layout
+		, .renderPass			= vk_data.render_pass
+		, .subpass				= 0
+		, .basePipelineHandle	= VK_NULL_HANDLE
+		, .basePipelineIndex	= -1
+	};
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkResult result = vkCreateGraphicsPipelines(vk_data.device, cache, 1,
+			&pipeline_create_info, vk_allocator, &pipeline);
+	if (result != VK_SUCCESS) {
+		printf("Can't create a graphics pipeline, VkResult %d\n", result);
+		return VK_NULL_HANDLE;
+	}
+	return pipeline;
+}
+
+/* Draw pass samples and opaque, through the shared cache. */
+VkPipeline create_pipeline(const VkPipelineShaderStageCreateInfo* stages,
+		uint32_t stage_count, VkPipelineLayout layout,
+		const VkPipelineVertexInputStateCreateInfo* vertex_input,
+		VkCullModeFlags cull_mode)
+{
+	return create_pipeline_state(vk_data.pipeline_cache, stages, stage_count,
+			layout, vertex_input, cull_mode, vk_attachment_data.samples, NULL);
+}
+
+VkPipeline create_graphics_pipeline(VkShaderModule vert_module,
+		VkShaderModule frag_module, VkPipelineLayout layout,
+		const VkPipelineVertexInputStateCreateInfo* vertex_input,
+		VkCullModeFlags cull_mode)
+{
+	VkPipelineShaderStageCreateInfo stage_create_infos[] = {
+		{
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_VERTEX_BIT
+			, .module				= vert_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= NULL
+		}
+		, {
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_FRAGMENT_BIT
+			, .module				= frag_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= NULL
+		}
+	};
+
+	return create_pipeline(stage_create_infos, 2, layout, vertex_input,
+			cull_mode);
+}
+
+/* Task, mesh and fragment. */
+VkPipeline create_mesh_pipeline(VkShaderModule task_module,
+		VkShaderModule mesh_module, VkShaderModule frag_module,
+		VkPipelineLayout layout, VkCullModeFlags cull_mode)
+{
+	VkPipelineShaderStageCreateInfo stage_create_infos[] = {
+		{
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_TASK_BIT_EXT
+			, .module				= task_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= NULL
+		}
+		, {
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_MESH_BIT_EXT
+			, .module				= mesh_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= NULL
+		}
+		, {
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_FRAGMENT_BIT
+			, .module				= frag_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= NULL
+		}
+	};
+
+	return create_pipeline(stage_create_infos, 3, layout, NULL, cull_mode);
+}
+
+/* One stage, compute. VK_NULL_HANDLE like create_pipeline_state. */
+VkPipeline create_compute_pipeline(VkShaderModule module,
+		VkPipelineLayout layout)
+{
+	if (module == VK_NULL_HANDLE)
+		return VK_NULL_HANDLE;
+
+	VkComputePipelineCreateInfo pipeline_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .stage				= {
+			.sType				= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext			= NULL
+			, .flags			= 0
+			, .stage			= VK_SHADER_STAGE_COMPUTE_BIT
+			, .module			= module
+			, .pName			= "main"
+			, .pSpecializationInfo	= NULL
+		}
+		, .layout				= layout
+		, .basePipelineHandle	= VK_NULL_HANDLE
+		, .basePipelineIndex	= -1
+	};
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkResult result = vkCreateComputePipelines(vk_data.device,
+			vk_data.pipeline_cache, 1, &pipeline_create_info, vk_allocator,
+			&pipeline);
+	if (result != VK_SUCCESS) {
+		printf("Can't create a compute pipeline, VkResult %d\n", result);
+		return VK_NULL_HANDLE;
+	}
+	return pipeline;
+}
+
+/* Milliseconds from the high resolution counter. */
+double time_ms()
+{
+	static LARGE_INTEGER frequency = {0};
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+}
+
+/* Shader hot reload. Every pipeline registers the SPIR-V files it's built
+ * from, and a function that builds it from scratch. A worker thread watches
+ * the working directory, and rebuilds the pipelines of changed files,
+ * through the shared pipeline cache. The new pipeline is swapped in at the
+ * next frame boundary, the old one is destroyed once no frame in flight can
+ * use it. Rendering never waits on a compile.
+ */
+#define HOT_RELOAD_MAX_PIPELINES 16
+#define HOT_RELOAD_MAX_STAGES 3
+#define HOT_RELOAD_MAX_FILES 16
+/* Compilers write in several steps, let the files settle. */
+#define HOT_RELOAD_SETTLE_MS 100
+
+/* VK_NULL_HANDLE when a shader doesn't load or compile, never exits. */
+typedef VkPipeline (*HotBuildFn)(void);
+
+typedef struct HotPipeline {
+	const char*		name;
+	VkPipeline*		live;
+	HotBuildFn		build;
+	uint32_t		files[HOT_RELOAD_MAX_STAGES];
+	uint32_t		file_count;
+	/* Built by the worker, swapped in by the frame. Under the lock. */
+	VkPipeline		pending;
+	/* Worker only. */
+	bool			dirty;
+} HotPipeline;
+
+typedef struct HotFile {
+	const char*		name;
+	FILETIME		last_write;
+} HotFile;
+
+typedef struct HotRetired {
+	VkPipeline		pipeline;
+	uint64_t		frame_number;
+} HotRetired;
+
+typedef struct HotReloadData {
+	HotPipeline			pipelines[HOT_RELOAD_MAX_PIPELINES];
+	uint32_t			pipeline_count;
+	HotFile				files[HOT_RELOAD_MAX_FILES];
+	uint32_t			file_count;
+	/* Main thread only. At most one per pipeline per frame. */
+	HotRetired			retired[HOT_RELOAD_MAX_PIPELINES * FRAMES_IN_FLIGHT];
+	uint32_t			retired_count;
+
+	CRITICAL_SECTION	lock;
+	HANDLE				thread;
+	HANDLE				stop_event;
+	HANDLE				change_handle;
+	uint32_t			reload_count;
+
+	/* Startup, registering doesn't build. See build_registered_pipelines. */
+	bool				defer_builds;
+} HotReloadData;
+
+HotReloadData vk_hot_reload = {0};
+
+void hot_reload_file_time(const char* name, FILETIME* last_write)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (GetFileAttributesExA(name, GetFileExInfoStandard, &attributes)) {
+		*last_write = attributes.ftLastWriteTime;
+	} else {
+		*last_write = (FILETIME){0};
+	}
+}
+
+uint32_t hot_reload_add_file(const char* name)
+{
+	for (uint32_t i = 0; i < vk_hot_reload.file_count; ++i) {
+		if (strcmp(vk_hot_reload.files[i].name, name) == 0)
+			return i;
+	}
+
+	assert(vk_hot_reload.file_count < HOT_RELOAD_MAX_FILES);
+	HotFile* file = &vk_hot_reload.files[vk_hot_reload.file_count];
+	file->name = name;
+	hot_reload_file_time(name, &file->last_write);
+	return vk_hot_reload.file_count++;
+}
+
+/* Up to HOT_RELOAD_MAX_STAGES files, unused ones NULL. Builds the first
+ * pipeline right away, on this thread, unless builds are deferred.
+ */
+void hot_reload_register(const char* name, VkPipeline* live, HotBuildFn build,
+		const char* file_a, const char* file_b, const char* file_c)
+{
+	assert(vk_hot_reload.pipeline_count < HOT_RELOAD_MAX_PIPELINES);
+	HotPipeline* hot = &vk_hot_reload.pipelines[vk_hot_reload.pipeline_count++];
+	*hot = (HotPipeline){
+		.name					= name
+		, .live					= live
+		, .build				= build
+	};
+
+	const char* files[HOT_RELOAD_MAX_STAGES] = { file_a, file_b, file_c };
+	for (int i = 0; i < HOT_RELOAD_MAX_STAGES; ++i) {
+		if (files[i] != NULL) {
+			hot->files[hot->file_count++] = hot_reload_add_file(files[i]);
+		}
+	}
+
+	if (!vk_hot_reload.defer_builds) {
+		*live = build();
+		if (*live == VK_NULL_HANDLE) {
+			printf("Could not build the %s pipeline.\n", name);
+			exit(-1);
+		}
+	}
+}
+
+void build_registered_pipeline_job(void* data, uint32_t begin, uint32_t end)
+{
+	(void)data;
+	for (uint32_t p = begin; p < end; ++p) {
+		HotPipeline* hot = &vk_hot_reload.pipelines[p];
+		if (*hot->live == VK_NULL_HANDLE) {
+			*hot->live = hot->build();
+		}
+	}
+}
+
+/* Startup builds every registered pipeline at once, one job each. Loading
+ * the SPIR-V and compiling is most of the startup. Pipeline creation and the
+ * pipeline cache are thread safe, so is the host allocator. Nothing may use
+ * a registered pipeline before this.
+ */
+void build_registered_pipelines()
+{
+	double start = time_ms();
+	JobCounter counter = {0};
+	job_parallel_for(build_registered_pipeline_job, NULL,
+			vk_hot_reload.pipeline_count, 1, &counter);
+	job_wait(&counter);
+	vk_hot_reload.defer_builds = false;
+
+	/* Unlike reloads, startup has nothing to fall back to. */
+	for (uint32_t p = 0; p < vk_hot_reload.pipeline_count; ++p) {
+		HotPipeline* hot = &vk_hot_reload.pipelines[p];
+		if (*hot->live == VK_NULL_HANDLE) {
+			printf("Could not build the %s pipeline.\n", hot->name);
+			exit(-1);
+		}
+	}
+
+	printf("Pipelines : %d built in %.1f ms on %d threads\n",
+			vk_hot_reload.pipeline_count, time_ms() - start,
+			job_system.worker_count);
+}
+
+/* Skips the obviously half written files. Anything else broken fails in the
+ * build, which keeps the old pipeline.
+ */
+bool spirv_file_valid(const char* filename)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+		return false;
+
+	uint32_t magic = 0;
+	size_t read = fread(&magic, sizeof(magic), 1, f);
+	fseek(f, 0, SEEK_END);
+	long filesize = ftell(f);
+	fclose(f);
+
+	return read == 1 && magic == 0x07230203 && filesize >= 20
+			&& filesize % 4 == 0;
+}
+
+/* Worker thread. */
+void hot_reload_rebuild()
+{
+	for (uint32_t i = 0; i < vk_hot_reload.file_count; ++i) {
+		HotFile* file = &vk_hot_reload.files[i];
+		FILETIME last_write;
+		hot_reload_file_time(file->name, &last_write);
+		if (CompareFileTime(&last_write, &file->last_write) == 0)
+			continue;
+
+		file->last_write = last_write;
+		for (uint32_t p = 0; p < vk_hot_reload.pipeline_count; ++p) {
+			HotPipeline* hot = &vk_hot_reload.pipelines[p];
+			for (uint32_t f = 0; f < hot->file_count; ++f) {
+				hot->dirty = hot->dirty || hot->files[f] == i;
+			}
+		}
+	}
+
+	for (uint32_t p = 0; p < vk_hot_reload.pipeline_count; ++p) {
+		HotPipeline* hot = &vk_hot_reload.pipelines[p];
+		if (!hot->dirty)
+			continue;
+		hot->dirty = false;
+
+		bool valid = true;
+		for (uint32_t f = 0; f < hot->file_count; ++f) {
+			const char* name = vk_hot_reload.files[hot->files[f]].name;
+			valid = valid && spirv_file_valid(name);
+		}
+		if (!valid) {
+			printf("Hot reload : %s skipped, invalid SPIR-V\n", hot->name);
+			continue;
+		}
+
+		double start = time_ms();
+		VkPipeline pipeline = hot->build();
+		double build_ms = time_ms() - start;
+		if (pipeline == VK_NULL_HANDLE) {
+			printf("Hot reload : %s failed, keeping the old pipeline\n",
+					hot->name);
+			continue;
+		}
+
+		/* Never recorded if the frame didn't pick it up yet. */
+		EnterCriticalSection(&vk_hot_reload.lock);
+		VkPipeline stale = hot->pending;
+		hot->pending = pipeline;
+		LeaveCriticalSection(&vk_hot_reload.lock);
+		if (stale != VK_NULL_HANDLE) {
+			vkDestroyPipeline(vk_data.device, stale, vk_allocator);
+		}
+
+		printf("Hot reload : %s rebuilt in %.1f ms\n", hot->name, build_ms);
+	}
+}
+
+DWORD WINAPI hot_reload_thread(LPVOID param)
+{
+	(void)param;
+	HANDLE handles[] = {
+		vk_hot_reload.stop_event
+		, vk_hot_reload.change_handle
+	};
+
+	while (WaitForMultipleObjects(2, handles, FALSE, INFINITE)
+			== WAIT_OBJECT_0 + 1)
+	{
+		if (WaitForSingleObject(vk_hot_reload.stop_event,
+				HOT_RELOAD_SETTLE_MS) == WAIT_OBJECT_0)
+			break;
+
+		FindNextChangeNotification(vk_hot_reload.change_handle);
+		hot_reload_rebuild();
+	}
+	return 0;
+}
+
+/* After every pipeline is registered. */
+void start_hot_reload()
+{
+	vk_hot_reload.change_handle = FindFirstChangeNotificationA(".", FALSE,
+			FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (vk_hot_reload.change_handle == INVALID_HANDLE_VALUE) {
+		printf("Hot reload : can't watch the working directory.\n");
+		vk_hot_reload.change_handle = NULL;
+		return;
+	}
+
+	InitializeCriticalSection(&vk_hot_reload.lock);
+	vk_hot_reload.stop_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+	vk_hot_reload.thread = CreateThread(NULL, 0, hot_reload_thread, NULL, 0,
+			NULL);
+
+	printf("Hot reload : watching %d files for %d pipelines\n",
+			vk_hot_reload.file_count, vk_hot_reload.pipeline_count);
+}
+
+/* Frame boundary, after the frame's fences. Only holds the lock to take the
+ * pending pipelines, never while compiling.
+ */
+void hot_reload_swap()
+{
+	if (vk_hot_reload.thread == NULL)
+		return;
+
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < vk_hot_reload.retired_count; ++i) {
+		HotRetired retired = vk_hot_reload.retired[i];
+		if (retired.frame_number + FRAMES_IN_FLIGHT <= vk_frame_number) {
+			vkDestroyPipeline(vk_data.device, retired.pipeline, vk_allocator);
+		} else {
+			vk_hot_reload.retired[kept++] = retired;
+		}
+	}
+	vk_hot_reload.retired_count = kept;
+
+	EnterCriticalSection(&vk_hot_reload.lock);
+	for (uint32_t p = 0; p < vk_hot_reload.pipeline_count; ++p) {
+		HotPipeline* hot = &vk_hot_reload.pipelines[p];
+		if (hot->pending == VK_NULL_HANDLE)
+			continue;
+
+		assert(vk_hot_reload.retired_count
+				< HOT_RELOAD_MAX_PIPELINES * FRAMES_IN_FLIGHT);
+		vk_hot_reload.retired[vk_hot_reload.retired_count++] = (HotRetired){
+			.pipeline				= *hot->live
+			, .frame_number			= vk_frame_number
+		};
+		*hot->live = hot->pending;
+		hot->pending = VK_NULL_HANDLE;
+		++vk_hot_reload.reload_count;
+	}
+	LeaveCriticalSection(&vk_hot_reload.lock);
+}
+
+/* Device idle. Live pipelines are left to their owners. */
+void stop_hot_reload()
+{
+	if (vk_hot_reload.thread == NULL)
+		return;
+
+	SetEvent(vk_hot_reload.stop_event);
+	WaitForSingleObject(vk_hot_reload.thread, INFINITE);
+	CloseHandle(vk_hot_reload.thread);
+	CloseHandle(vk_hot_reload.stop_event);
+	FindCloseChangeNotification(vk_hot_reload.change_handle);
+	vk_hot_reload.thread = NULL;
+
+	for (uint32_t p = 0; p < vk_hot_reload.pipeline_count; ++p) {
+		if (vk_hot_reload.pipelines[p].pending != VK_NULL_HANDLE) {
+			vkDestroyPipeline(vk_data.device,
+					vk_hot_reload.pipelines[p].pending, vk_allocator);
+		}
+	}
+	for (uint32_t i = 0; i < vk_hot_reload.retired_count; ++i) {
+		vkDestroyPipeline(vk_data.device, vk_hot_reload.retired[i].pipeline,
+				vk_allocator);
+	}
+	vk_hot_reload.retired_count = 0;
+	DeleteCriticalSection(&vk_hot_reload.lock);
+
+	printf("Hot reload : %d pipelines swapped\n", vk_hot_reload.reload_count);
+}
+
+/* The vertex shader has its positions baked in, so there is no vertex
+ * input.
+ */
+VkPipeline build_triangle_pipeline()
+{
+	VkShaderModule vert_module =
+			try_create_shader_module("win_vulkan_vert.spv");
+	VkShaderModule frag_module =
+			try_create_shader_module("win_vulkan_frag.spv");
+
+	VkPipelineVertexInputStateCreateInfo vertex_input_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .vertexBindingDescriptionCount	= 0
+		, .pVertexBindingDescriptions		= NULL
+		, .vertexAttributeDescriptionCount	= 0
+		, .pVertexAttributeDescriptions		= NULL
+	};
+
+	VkPipeline pipeline = create_graphics_pipeline(vert_module, frag_module,
+			vk_data.pipeline_layout, &vertex_input_create_info,
+			VK_CULL_MODE_NONE);
+
+	vkDestroyShaderModule(vk_data.device, vert_module, vk_allocator);
+	vkDestroyShaderModule(vk_data.device, frag_module, vk_allocator);
+	return pipeline;
+}
+
+/* Rendering Pipeline*/
+void init_vk_pipeline()
+{
+	/* Create Render Pass. Only needed without dynamic rendering. */
+	if (!vk_extensions_data.dynamic_rendering) {
+		VkAttachmentDescription attachment_descriptions[] = {
+			{
+				.flags					= 0
+				, .format				= vk_surface_data.color_format
+				, .samples				= VK_SAMPLE_COUNT_1_BIT
+				, .loadOp				= VK_ATTACHMENT_LOAD_OP_LOAD
+				, .storeOp				= VK_ATTACHMENT_STORE_OP_STORE
+				, .stencilLoadOp		= VK_ATTACHMENT_LOAD_OP_DONT_CARE
+				, .stencilStoreOp		= VK_ATTACHMENT_STORE_OP_DONT_CARE
+				, .initialLayout		= VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+				, .finalLayout			= VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+			}
+		};
+
+		VkAttachmentReference color_attachment_references[] = {
+			{
+				.attachment				= 0
+				, .layout				= VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+			}
+		};
+
+		VkSubpassDescription subpass_descriptions[] = {
 			{
 				.flags					= 0
 				, .pipelineBindPoint	= VK_PIPELINE_BIND_POINT_GRAPHICS
@@ -826,128 +3180,4741 @@ void init_vk_pipeline()
 			}
 		};
 
-		VkRenderPassCreateInfo render_pass_create_info = {
-			.sType						= VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO
-			, .pNext					= NULL
-			, .flags					= 0
-			, .attachmentCount			= 1
-			, .pAttachments				= attachment_descriptions
-			, .subpassCount				= 1
-			, .pSubpasses				= subpass_descriptions
-			, .dependencyCount			= 0
-			, .pDependencies			= NULL
+		VkRenderPassCreateInfo render_pass_create_info = {
+			.sType						= VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO
+			, .pNext					= NULL
+			, .flags					= 0
+			, .attachmentCount			= 1
+			, .pAttachments				= attachment_descriptions
+			, .subpassCount				= 1
+			, .pSubpasses				= subpass_descriptions
+			, .dependencyCount			= 0
+			, .pDependencies			= NULL
+		};
+
+		vk_error(vkCreateRenderPass(vk_data.device, &render_pass_create_info,
+				vk_allocator, &vk_data.render_pass));
+	}
+
+	/* Create Image Views and Framebuffers. */
+	create_swapchain_targets();
+
+	/* Create Pipeline Cache. */
+	{
+		VkPipelineCacheCreateInfo cache_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .initialDataSize		= 0
+			, .pInitialData			= NULL
+		};
+
+		vk_error(vkCreatePipelineCache(vk_data.device, &cache_create_info,
+				vk_allocator, &vk_data.pipeline_cache));
+	}
+
+	/* Create Pipeline Layout. Nothing bound yet. */
+	{
+		VkPipelineLayoutCreateInfo layout_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .setLayoutCount		= 0
+			, .pSetLayouts			= NULL
+			, .pushConstantRangeCount	= 0
+			, .pPushConstantRanges	= NULL
+		};
+
+		vk_error(vkCreatePipelineLayout(vk_data.device, &layout_create_info,
+				vk_allocator, &vk_data.pipeline_layout));
+	}
+
+	/* Create Graphics Pipeline. */
+	hot_reload_register("triangle", &vk_data.pipeline,
+			build_triangle_pipeline, "win_vulkan_vert.spv",
+			"win_vulkan_frag.spv", NULL);
+}
+
+/* GPU timestamps. Scopes are named, and written as 2 queries (begin, end)
+ * in the frame's pool. Returns the scope index to pass to end.
+ */
+uint32_t vk_timestamp_begin(FrameData* frame, const char* name)
+{
+	if (frame->timestamp_pool == VK_NULL_HANDLE
+			|| frame->scope_count >= MAX_GPU_SCOPES)
+	{
+		return MAX_GPU_SCOPES;
+	}
+
+	uint32_t scope = frame->scope_count++;
+	frame->scope_names[scope] = name;
+	vkCmdWriteTimestamp(frame->cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			frame->timestamp_pool, scope * 2);
+	return scope;
+}
+
+void vk_timestamp_end(FrameData* frame, uint32_t scope)
+{
+	if (scope >= MAX_GPU_SCOPES)
+		return;
+
+	vkCmdWriteTimestamp(frame->cmd_buffer,
+			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			frame->timestamp_pool, scope * 2 + 1);
+}
+
+/* Called once the frame's fence has signaled. Never waits, if a query
+ * isn't available the previous stats are kept.
+ */
+void vk_read_timestamps(FrameData* frame)
+{
+	if (frame->timestamp_pool == VK_NULL_HANDLE || !frame->submitted
+			|| frame->scope_count == 0)
+	{
+		return;
+	}
+
+	/* Pairs of value, availability. */
+	uint64_t results[MAX_GPU_SCOPES * 2 * 2];
+	uint32_t query_count = frame->scope_count * 2;
+	VkResult result = vkGetQueryPoolResults(vk_data.device,
+			frame->timestamp_pool, 0, query_count, sizeof(results), results,
+			sizeof(uint64_t) * 2,
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	if (result != VK_SUCCESS && result != VK_NOT_READY) {
+		vk_error(result);
+		return;
+	}
+
+	for (uint32_t i = 0; i < query_count; ++i) {
+		if (results[i * 2 + 1] == 0)
+			return;
+	}
+
+	uint64_t mask = vk_data.timestamp_valid_bits >= 64 ? UINT64_MAX
+			: (((uint64_t)1 << vk_data.timestamp_valid_bits) - 1);
+	double ticks_to_ms = (double)vk_data.timestamp_period / 1000000.0;
+
+	uint64_t first = results[0] & mask;
+	uint64_t last = first;
+	for (uint32_t i = 0; i < frame->scope_count; ++i) {
+		uint64_t begin = results[(i * 2) * 2] & mask;
+		uint64_t end = results[(i * 2 + 1) * 2] & mask;
+
+		vk_frame_stats.gpu_scope_names[i] = frame->scope_names[i];
+		vk_frame_stats.gpu_scope_ms[i] = (double)((end - begin) & mask)
+				* ticks_to_ms;
+		if (end > last)
+			last = end;
+	}
+	vk_frame_stats.gpu_scope_count = frame->scope_count;
+	vk_frame_stats.gpu_frame_ms = (double)((last - first) & mask) * ticks_to_ms;
+}
+
+/* A present wait that neither saw the present nor timed out. Out of date
+ * or suboptimal, the swapchain is recreated like after a present, and what
+ * was queued on the old one is never waited for. A lost surface ends it
+ * like a present does.
+ */
+void vk_present_wait_failed(VkResult result)
+{
+	switch (result) {
+		case VK_ERROR_OUT_OF_DATE_KHR:
+		case VK_SUBOPTIMAL_KHR:
+			vk_resize_pending = true;
+			vk_present_data.last_completed_id
+					= vk_present_data.last_present_id;
+			break;
+		default:
+			printf("Problem waiting for a present. Eeeek!\n");
+			vk_error(result);
+			break;
+	}
+}
+
+/* Low latency mode, keep at most max_queued_frames between submit and
+ * screen. With present wait we wait on the display itself, otherwise on the
+ * older frames' fences.
+ */
+void vk_cap_queued_frames()
+{
+	uint32_t max_queued = vk_options.max_queued_frames;
+	if (max_queued == 0)
+		return;
+
+	if (!vk_extensions_data.present_wait) {
+		for (uint32_t k = max_queued; k < FRAMES_IN_FLIGHT; ++k) {
+			FrameData* older = &vk_frames[(vk_frame_index + FRAMES_IN_FLIGHT - k)
+					% FRAMES_IN_FLIGHT];
+			if (older->submitted) {
+				vk_error(vkWaitForFences(vk_data.device, 1,
+						&older->f_in_flight, VK_TRUE, UINT64_MAX));
+			}
+		}
+		return;
+	}
+
+	if (vk_present_data.last_present_id + 1 <= max_queued)
+		return;
+
+	uint64_t wait_id = vk_present_data.last_present_id + 1 - max_queued;
+	if (wait_id <= vk_present_data.last_completed_id)
+		return;
+
+	/* Don't hang forever if a present got dropped. */
+	VkResult result = vk_ext_pfn.vkWaitForPresentKHR(vk_data.device,
+			vk_data.swapchain, wait_id, 100000000);
+	if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+		vk_present_wait_failed(result);
+	}
+}
+
+/* Never blocks, picks up every present that made it to screen since last
+ * time, oldest first.
+ */
+void vk_poll_present_latency()
+{
+	if (!vk_extensions_data.present_wait)
+		return;
+
+	while (vk_present_data.last_completed_id
+			< vk_present_data.last_present_id)
+	{
+		uint64_t id = vk_present_data.last_completed_id + 1;
+		VkResult result = vk_ext_pfn.vkWaitForPresentKHR(vk_data.device,
+				vk_data.swapchain, id, 0);
+		if (result != VK_SUCCESS) {
+			if (result != VK_TIMEOUT) {
+				vk_present_wait_failed(result);
+			}
+			return;
+		}
+
+		vk_present_data.last_completed_id = id;
+		if (vk_present_data.last_present_id - id < PRESENT_HISTORY) {
+			vk_frame_stats.present_latency_ms = time_ms()
+					- vk_present_data.submit_ms[id % PRESENT_HISTORY];
+		}
+	}
+}
+
+/* Starts drawing into a swapchain image in COLOR_ATTACHMENT_OPTIMAL, with
+ * dynamic rendering or the fallback render pass. With a multisampled view,
+ * that's drawn into and resolved to the image at the end of the pass. The
+ * multisampled color and the depth start cleared and are never stored.
+ */
+void vk_begin_draw(VkCommandBuffer cmd, uint32_t image_index,
+		VkImageView msaa_view, VkImageView depth_view)
+{
+	VkRect2D render_area = {
+		.offset					= { 0, 0 }
+		, .extent				= vk_surface_data.extent_2d
+	};
+
+	if (!vk_extensions_data.dynamic_rendering) {
+		VkRenderPassBeginInfo render_pass_begin_info = {
+			.sType					= VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO
+			, .pNext				= NULL
+			, .renderPass			= vk_data.render_pass
+			, .framebuffer			= vk_data.frame_buffers[image_index]
+			, .renderArea			= render_area
+			, .clearValueCount		= 0
+			, .pClearValues			= NULL
+		};
+
+		vkCmdBeginRenderPass(cmd, &render_pass_begin_info,
+				VK_SUBPASS_CONTENTS_INLINE);
+		return;
+	}
+
+	VkRenderingAttachmentInfoKHR color_attachment_info = {
+		.sType					= VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR
+		, .pNext				= NULL
+		, .imageView			= vk_data.image_views[image_index]
+		, .imageLayout			= VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+		, .resolveMode			= VK_RESOLVE_MODE_NONE
+		, .resolveImageView		= VK_NULL_HANDLE
+		, .resolveImageLayout	= VK_IMAGE_LAYOUT_UNDEFINED
+		, .loadOp				= VK_ATTACHMENT_LOAD_OP_LOAD
+		, .storeOp				= VK_ATTACHMENT_STORE_OP_STORE
+		, .clearValue			= {{{ 0.0f, 0.0f, 0.0f, 0.0f }}}
+	};
+
+	/* Same color as the clear pass, which the resolve makes useless. */
+	if (msaa_view != VK_NULL_HANDLE) {
+		color_attachment_info.imageView = msaa_view;
+		color_attachment_info.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+		color_attachment_info.resolveImageView =
+				vk_data.image_views[image_index];
+		color_attachment_info.resolveImageLayout =
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		color_attachment_info.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		color_attachment_info.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		color_attachment_info.clearValue = (VkClearValue){
+			{{ 0.0f, 1.0f, 0.0f, 0.0f }}
+		};
+	}
+
+	VkRenderingAttachmentInfoKHR depth_attachment_info = {
+		.sType					= VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR
+		, .pNext				= NULL
+		, .imageView			= depth_view
+		, .imageLayout			= VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+		, .resolveMode			= VK_RESOLVE_MODE_NONE
+		, .resolveImageView		= VK_NULL_HANDLE
+		, .resolveImageLayout	= VK_IMAGE_LAYOUT_UNDEFINED
+		, .loadOp				= VK_ATTACHMENT_LOAD_OP_CLEAR
+		, .storeOp				= VK_ATTACHMENT_STORE_OP_DONT_CARE
+		, .clearValue			= { .depthStencil = { 1.0f, 0 } }
+	};
+
+	VkRenderingInfoKHR rendering_info = {
+		.sType					= VK_STRUCTURE_TYPE_RENDERING_INFO_KHR
+		, .pNext				= NULL
+		, .flags				= 0
+		, .renderArea			= render_area
+		, .layerCount			= 1
+		, .viewMask				= 0
+		, .colorAttachmentCount	= 1
+		, .pColorAttachments	= &color_attachment_info
+		, .pDepthAttachment		= depth_view != VK_NULL_HANDLE
+				? &depth_attachment_info : NULL
+		, .pStencilAttachment	= NULL
+	};
+
+	vk_ext_pfn.vkCmdBeginRendering(cmd, &rendering_info);
+}
+
+/* Leaves the swapchain image in COLOR_ATTACHMENT_OPTIMAL, the render graph
+ * transitions it for present.
+ */
+void vk_end_draw(VkCommandBuffer cmd)
+{
+	if (!vk_extensions_data.dynamic_rendering) {
+		vkCmdEndRenderPass(cmd);
+		return;
+	}
+
+	vk_ext_pfn.vkCmdEndRendering(cmd);
+}
+
+/* Column major, Vulkan clip space (y down, z 0 to 1). */
+typedef struct Mat4 {
+	float m[16];
+} Mat4;
+
+Mat4 mat4_mul(Mat4 a, Mat4 b)
+{
+	Mat4 r;
+	for (int c = 0; c < 4; ++c) {
+		for (int row = 0; row < 4; ++row) {
+			float sum = 0.0f;
+			for (int k = 0; k < 4; ++k) {
+				sum += a.m[k * 4 + row] * b.m[c * 4 + k];
+			}
+			r.m[c * 4 + row] = sum;
+		}
+	}
+	return r;
+}
+
+Mat4 mat4_perspective(float fov_y, float aspect, float z_near, float z_far)
+{
+	float f = 1.0f / tanf(fov_y * 0.5f);
+	Mat4 r = {{0}};
+	r.m[0] = f / aspect;
+	r.m[5] = -f;
+	r.m[10] = z_far / (z_near - z_far);
+	r.m[11] = -1.0f;
+	r.m[14] = z_near * z_far / (z_near - z_far);
+	return r;
+}
+
+Mat4 mat4_look_at(const float eye[3], const float center[3],
+		const float up[3])
+{
+	float f[3] = { center[0] - eye[0], center[1] - eye[1], center[2] - eye[2] };
+	float f_len = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+	f[0] /= f_len; f[1] /= f_len; f[2] /= f_len;
+
+	float s[3] = {
+		f[1] * up[2] - f[2] * up[1]
+		, f[2] * up[0] - f[0] * up[2]
+		, f[0] * up[1] - f[1] * up[0]
+	};
+	float s_len = sqrtf(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+	s[0] /= s_len; s[1] /= s_len; s[2] /= s_len;
+
+	float u[3] = {
+		s[1] * f[2] - s[2] * f[1]
+		, s[2] * f[0] - s[0] * f[2]
+		, s[0] * f[1] - s[1] * f[0]
+	};
+
+	Mat4 r = {{0}};
+	r.m[0] = s[0]; r.m[4] = s[1]; r.m[8] = s[2];
+	r.m[1] = u[0]; r.m[5] = u[1]; r.m[9] = u[2];
+	r.m[2] = -f[0]; r.m[6] = -f[1]; r.m[10] = -f[2];
+	r.m[12] = -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]);
+	r.m[13] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+	r.m[14] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
+	r.m[15] = 1.0f;
+	return r;
+}
+
+/* Left, right, bottom, top, near, far. Normals point inside. */
+void mat4_frustum_planes(Mat4 view_proj, float planes[6][4])
+{
+	const float* m = view_proj.m;
+	for (int i = 0; i < 4; ++i) {
+		float row0 = m[i * 4 + 0];
+		float row1 = m[i * 4 + 1];
+		float row2 = m[i * 4 + 2];
+		float row3 = m[i * 4 + 3];
+		planes[0][i] = row3 + row0;
+		planes[1][i] = row3 - row0;
+		planes[2][i] = row3 + row1;
+		planes[3][i] = row3 - row1;
+		planes[4][i] = row2;
+		planes[5][i] = row3 - row2;
+	}
+
+	for (int p = 0; p < 6; ++p) {
+		float len = sqrtf(planes[p][0] * planes[p][0]
+				+ planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+		for (int i = 0; i < 4; ++i) {
+			planes[p][i] /= len;
+		}
+	}
+}
+
+
+/* Buffers. UINT32_MAX when nothing fits. */
+uint32_t try_find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags flags)
+{
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(vk_data.phys_device, &mem_props);
+
+	for (uint32_t i = 0; i < mem_props.memoryTypeCount; ++i) {
+		if ((type_bits & (1u << i))
+				&& (mem_props.memoryTypes[i].propertyFlags & flags) == flags)
+		{
+			return i;
+		}
+	}
+	return UINT32_MAX;
+}
+
+uint32_t find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags flags)
+{
+	uint32_t index = try_find_memory_type(type_bits, flags);
+	if (index != UINT32_MAX)
+		return index;
+
+	printf("No memory type fits. Memory is hard.\n");
+	exit(-1);
+}
+
+/* Whether any memory type has all the flags, whatever the resource. */
+bool has_memory_type(VkMemoryPropertyFlags flags)
+{
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(vk_data.phys_device, &mem_props);
+
+	for (uint32_t i = 0; i < mem_props.memoryTypeCount; ++i) {
+		if ((mem_props.memoryTypes[i].propertyFlags & flags) == flags)
+			return true;
+	}
+	return false;
+}
+
+void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
+		VkMemoryPropertyFlags mem_flags, VkBuffer* buffer,
+		VkDeviceMemory* memory)
+{
+	/* Shared with the async compute family, so no ownership transfers. */
+	uint32_t families[] = {
+		vk_data.queue_family_index
+		, vk_data.compute_family_index
+	};
+	bool shared = vk_data.async_compute
+			&& vk_data.compute_family_index != vk_data.queue_family_index;
+
+	VkBufferCreateInfo buffer_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .size					= size
+		, .usage				= usage
+		, .sharingMode			= shared ? VK_SHARING_MODE_CONCURRENT
+				: VK_SHARING_MODE_EXCLUSIVE
+		, .queueFamilyIndexCount	= shared ? 2 : 0
+		, .pQueueFamilyIndices	= shared ? families : NULL
+	};
+	vk_error(vkCreateBuffer(vk_data.device, &buffer_create_info, vk_allocator,
+			buffer));
+
+	VkMemoryRequirements mem_reqs;
+	vkGetBufferMemoryRequirements(vk_data.device, *buffer, &mem_reqs);
+
+	VkMemoryAllocateInfo allocate_info = {
+		.sType					= VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO
+		, .pNext				= NULL
+		, .allocationSize		= mem_reqs.size
+		, .memoryTypeIndex		= find_memory_type(mem_reqs.memoryTypeBits,
+				mem_flags)
+	};
+	vk_error(vkAllocateMemory(vk_data.device, &allocate_info, vk_allocator,
+			memory));
+	vk_error(vkBindBufferMemory(vk_data.device, *buffer, *memory, 0));
+}
+
+/* Through a staging buffer. Waits, only use at init. */
+void upload_buffer(VkBuffer dst, const void* data, VkDeviceSize size)
+{
+	VkBuffer staging;
+	VkDeviceMemory staging_memory;
+	create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+					| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&staging, &staging_memory);
+
+	void* mapped = NULL;
+	vk_error(vkMapMemory(vk_data.device, staging_memory, 0, size, 0, &mapped));
+	memcpy(mapped, data, size);
+	vkUnmapMemory(vk_data.device, staging_memory);
+
+	VkCommandBufferAllocateInfo cmd_buffer_allocate_info = {
+		.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO
+		, .pNext				= NULL
+		, .commandPool			= vk_data.queue_cmd_pool
+		, .level				= VK_COMMAND_BUFFER_LEVEL_PRIMARY
+		, .commandBufferCount	= 1
+	};
+	VkCommandBuffer cmd;
+	vk_error(vkAllocateCommandBuffers(vk_data.device, &cmd_buffer_allocate_info,
+			&cmd));
+
+	VkCommandBufferBeginInfo cmd_buffer_begin_info = {
+		.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+		, .pNext				= NULL
+		, .flags				= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+		, .pInheritanceInfo		= NULL
+	};
+	VkBufferCopy region = {
+		.srcOffset				= 0
+		, .dstOffset			= 0
+		, .size					= size
+	};
+
+	vk_error(vkBeginCommandBuffer(cmd, &cmd_buffer_begin_info));
+	vkCmdCopyBuffer(cmd, staging, dst, 1, &region);
+	vk_error(vkEndCommandBuffer(cmd));
+
+	VkSubmitInfo submit_info = {
+		.sType						= VK_STRUCTURE_TYPE_SUBMIT_INFO
+		, .pNext					= NULL
+		, .waitSemaphoreCount		= 0
+		, .pWaitSemaphores			= NULL
+		, .pWaitDstStageMask		= NULL
+		, .commandBufferCount		= 1
+		, .pCommandBuffers			= &cmd
+		, .signalSemaphoreCount		= 0
+		, .pSignalSemaphores		= NULL
+	};
+	vk_error(vkQueueSubmit(vk_data.queue, 1, &submit_info, VK_NULL_HANDLE));
+	vk_error(vkQueueWaitIdle(vk_data.queue));
+
+	vkFreeCommandBuffers(vk_data.device, vk_data.queue_cmd_pool, 1, &cmd);
+	vkDestroyBuffer(vk_data.device, staging, vk_allocator);
+	vkFreeMemory(vk_data.device, staging_memory, vk_allocator);
+}
+
+/* Offscreen targets, for headless runs. They stand in for the swapchain
+ * images, one per frame in flight, so everything sized on the swapchain
+ * works unchanged.
+ */
+typedef struct OffscreenData {
+	VkImage					images[FRAMES_IN_FLIGHT];
+	VkDeviceMemory			memories[FRAMES_IN_FLIGHT];
+} OffscreenData;
+
+OffscreenData vk_offscreen_data = {0};
+
+void create_offscreen_targets()
+{
+	vk_surface_data.color_format = VK_FORMAT_B8G8R8A8_UNORM;
+	vk_surface_data.extent_2d = (VkExtent2D){
+		vk_options.offscreen_width, vk_options.offscreen_height
+	};
+
+	free(vk_data.swapchain_images);
+	vk_data.swapchain_images = malloc(sizeof(VkImage) * FRAMES_IN_FLIGHT);
+	vk_data.swapchain_images_size = FRAMES_IN_FLIGHT;
+
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		VkImageCreateInfo image_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .imageType			= VK_IMAGE_TYPE_2D
+			, .format				= vk_surface_data.color_format
+			, .extent				= {
+				vk_surface_data.extent_2d.width
+				, vk_surface_data.extent_2d.height
+				, 1
+			}
+			, .mipLevels			= 1
+			, .arrayLayers			= 1
+			, .samples				= VK_SAMPLE_COUNT_1_BIT
+			, .tiling				= VK_IMAGE_TILING_OPTIMAL
+			, .usage				= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+					| VK_IMAGE_USAGE_TRANSFER_DST_BIT
+					| VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+			, .sharingMode			= VK_SHARING_MODE_EXCLUSIVE
+			, .queueFamilyIndexCount	= 0
+			, .pQueueFamilyIndices	= NULL
+			, .initialLayout		= VK_IMAGE_LAYOUT_UNDEFINED
+		};
+		vk_error(vkCreateImage(vk_data.device, &image_create_info,
+				vk_allocator, &vk_offscreen_data.images[i]));
+
+		VkMemoryRequirements mem_reqs;
+		vkGetImageMemoryRequirements(vk_data.device,
+				vk_offscreen_data.images[i], &mem_reqs);
+
+		VkMemoryAllocateInfo allocate_info = {
+			.sType					= VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO
+			, .pNext				= NULL
+			, .allocationSize		= mem_reqs.size
+			, .memoryTypeIndex		= find_memory_type(mem_reqs.memoryTypeBits,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+		};
+		vk_error(vkAllocateMemory(vk_data.device, &allocate_info,
+				vk_allocator, &vk_offscreen_data.memories[i]));
+		vk_error(vkBindImageMemory(vk_data.device,
+				vk_offscreen_data.images[i], vk_offscreen_data.memories[i], 0));
+
+		vk_data.swapchain_images[i] = vk_offscreen_data.images[i];
+	}
+
+	printf("Offscreen : %dx%d\n", vk_surface_data.extent_2d.width,
+			vk_surface_data.extent_2d.height);
+}
+
+/* After the views on them are gone. */
+void destroy_offscreen_targets()
+{
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		if (vk_offscreen_data.images[i] == VK_NULL_HANDLE)
+			continue;
+		vkDestroyImage(vk_data.device, vk_offscreen_data.images[i],
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_offscreen_data.memories[i],
+				vk_allocator);
+	}
+}
+
+/* Readback. Every frame copies its target to a slot of a ring of host
+ * buffers, and frames come back latency frames later. That's after their
+ * fence was already waited on, so reading never stalls the queue. Frames are
+ * handed to the callback in order, the pixels are only valid during the
+ * call.
+ */
+#define READBACK_MAX_LATENCY 8
+
+typedef struct ReadbackFrame {
+	uint64_t		frame_number;
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		row_pitch;
+	VkFormat		format;
+	const uint8_t*	pixels;
+} ReadbackFrame;
+
+typedef void (*ReadbackFn)(const ReadbackFrame* frame, void* user_data);
+
+typedef struct ReadbackSlot {
+	VkBuffer		buffer;
+	VkDeviceMemory	memory;
+	uint8_t*		mapped;
+	uint64_t		frame_number;
+	bool			pending;
+} ReadbackSlot;
+
+typedef struct ReadbackData {
+	uint32_t		latency;
+	/* One more than the latency, the slot being written isn't read. */
+	uint32_t		slot_count;
+	ReadbackSlot	slots[READBACK_MAX_LATENCY + 1];
+	/* The targets', when the ring was made. */
+	uint32_t		width;
+	uint32_t		height;
+	VkDeviceSize	size;
+	/* Cached memory needs invalidating before reads. */
+	bool			cached;
+
+	ReadbackFn		callback;
+	void*			user_data;
+	uint64_t		frame_count;
+	uint64_t		byte_count;
+	double			callback_ms;
+} ReadbackData;
+
+ReadbackData vk_readback_data = {0};
+
+void set_readback_callback(ReadbackFn callback, void* user_data)
+{
+	vk_readback_data.callback = callback;
+	vk_readback_data.user_data = user_data;
+}
+
+/* Binary PPM, alpha dropped. The disk usually sets the pace. */
+void write_readback_frame(const ReadbackFrame* frame, void* user_data)
+{
+	const char* dir = user_data;
+	char filename[512];
+	snprintf(filename, sizeof(filename), "%s/frame_%06llu.ppm", dir,
+			(unsigned long long)frame->frame_number);
+
+	FILE* f = fopen(filename, "wb");
+	if (!f) {
+		printf("Unable to write %s\n", filename);
+		return;
+	}
+
+	bool bgra = frame->format == VK_FORMAT_B8G8R8A8_UNORM
+			|| frame->format == VK_FORMAT_B8G8R8A8_SRGB;
+	uint8_t* row = malloc(frame->width * 3);
+
+	fprintf(f, "P6\n%d %d\n255\n", frame->width, frame->height);
+	for (uint32_t y = 0; y < frame->height; ++y) {
+		const uint8_t* src = frame->pixels + y * frame->row_pitch;
+		for (uint32_t x = 0; x < frame->width; ++x) {
+			row[x * 3 + 0] = src[x * 4 + (bgra ? 2 : 0)];
+			row[x * 3 + 1] = src[x * 4 + 1];
+			row[x * 3 + 2] = src[x * 4 + (bgra ? 0 : 2)];
+		}
+		fwrite(row, 1, frame->width * 3, f);
+	}
+
+	free(row);
+	fclose(f);
+}
+
+/* After the targets, they give the size. */
+void init_readback()
+{
+	uint32_t latency = vk_options.readback_latency;
+	if (latency < FRAMES_IN_FLIGHT) {
+		latency = FRAMES_IN_FLIGHT;
+	}
+	if (latency > READBACK_MAX_LATENCY) {
+		latency = READBACK_MAX_LATENCY;
+	}
+	vk_readback_data.latency = latency;
+	vk_readback_data.slot_count = latency + 1;
+	vk_readback_data.width = vk_surface_data.extent_2d.width;
+	vk_readback_data.height = vk_surface_data.extent_2d.height;
+	vk_readback_data.size = (VkDeviceSize)vk_readback_data.width
+			* vk_readback_data.height * 4;
+
+	/* CPU reads from uncached memory crawl. */
+	VkMemoryPropertyFlags mem_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+			| VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	vk_readback_data.cached = has_memory_type(mem_flags);
+	if (!vk_readback_data.cached) {
+		mem_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+				| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	}
+
+	for (uint32_t i = 0; i < vk_readback_data.slot_count; ++i) {
+		ReadbackSlot* slot = &vk_readback_data.slots[i];
+		create_buffer(vk_readback_data.size,
+				VK_BUFFER_USAGE_TRANSFER_DST_BIT, mem_flags,
+				&slot->buffer, &slot->memory);
+		vk_error(vkMapMemory(vk_data.device, slot->memory, 0, VK_WHOLE_SIZE,
+				0, (void**)&slot->mapped));
+	}
+
+	printf("Readback : %d frames late, %s memory\n", latency,
+			vk_readback_data.cached ? "cached" : "uncached");
+}
+
+/* Hands every pending frame up to last_frame to the callback, oldest
+ * first.
+ */
+void deliver_readback(uint64_t last_frame)
+{
+	while (true) {
+		ReadbackSlot* oldest = NULL;
+		for (uint32_t i = 0; i < vk_readback_data.slot_count; ++i) {
+			ReadbackSlot* slot = &vk_readback_data.slots[i];
+			if (slot->pending && slot->frame_number <= last_frame
+					&& (oldest == NULL
+							|| slot->frame_number < oldest->frame_number))
+			{
+				oldest = slot;
+			}
+		}
+		if (oldest == NULL)
+			return;
+
+		if (vk_readback_data.cached) {
+			VkMappedMemoryRange range = {
+				.sType				= VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE
+				, .pNext			= NULL
+				, .memory			= oldest->memory
+				, .offset			= 0
+				, .size				= VK_WHOLE_SIZE
+			};
+			vk_error(vkInvalidateMappedMemoryRanges(vk_data.device, 1,
+					&range));
+		}
+
+		ReadbackFrame frame = {
+			.frame_number			= oldest->frame_number
+			, .width				= vk_readback_data.width
+			, .height				= vk_readback_data.height
+			, .row_pitch			= vk_readback_data.width * 4
+			, .format				= vk_surface_data.color_format
+			, .pixels				= oldest->mapped
+		};
+
+		double start = time_ms();
+		if (vk_readback_data.callback != NULL) {
+			vk_readback_data.callback(&frame, vk_readback_data.user_data);
+		}
+		vk_readback_data.callback_ms += time_ms() - start;
+
+		oldest->pending = false;
+		++vk_readback_data.frame_count;
+		vk_readback_data.byte_count += vk_readback_data.size;
+	}
+}
+
+/* Frame boundary, after the fences. */
+void poll_readback()
+{
+	if (vk_readback_data.slot_count == 0
+			|| vk_frame_number < vk_readback_data.latency)
+		return;
+
+	deliver_readback(vk_frame_number - vk_readback_data.latency);
+}
+
+/* Device idle, whatever is left. */
+void flush_readback()
+{
+	if (vk_readback_data.slot_count == 0)
+		return;
+
+	deliver_readback(UINT64_MAX);
+}
+
+void deinit_readback()
+{
+	for (uint32_t i = 0; i < vk_readback_data.slot_count; ++i) {
+		vkDestroyBuffer(vk_data.device, vk_readback_data.slots[i].buffer,
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_readback_data.slots[i].memory,
+				vk_allocator);
+	}
+	vk_readback_data.slot_count = 0;
+}
+
+/* After the draw, the target is in TRANSFER_SRC_OPTIMAL. */
+void record_readback(VkCommandBuffer cmd, VkImage image)
+{
+	ReadbackSlot* slot = &vk_readback_data.slots[vk_frame_number
+			% vk_readback_data.slot_count];
+	assert(!slot->pending);
+	slot->frame_number = vk_frame_number;
+	slot->pending = true;
+
+	VkBufferImageCopy region = {
+		.bufferOffset			= 0
+		, .bufferRowLength		= 0
+		, .bufferImageHeight	= 0
+		, .imageSubresource		= {
+			.aspectMask			= VK_IMAGE_ASPECT_COLOR_BIT
+			, .mipLevel			= 0
+			, .baseArrayLayer	= 0
+			, .layerCount		= 1
+		}
+		, .imageOffset			= { 0, 0, 0 }
+		, .imageExtent			= {
+			vk_readback_data.width
+			, vk_readback_data.height
+			, 1
+		}
+	};
+	vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			slot->buffer, 1, &region);
+
+	/* The fence alone doesn't make the copy visible to the host. */
+	VkMemoryBarrier barrier_from_copy_to_host = {
+		.sType					= VK_STRUCTURE_TYPE_MEMORY_BARRIER
+		, .pNext				= NULL
+		, .srcAccessMask		= VK_ACCESS_TRANSFER_WRITE_BIT
+		, .dstAccessMask		= VK_ACCESS_HOST_READ_BIT
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT, 0,
+			1, &barrier_from_copy_to_host, 0, NULL, 0, NULL);
+}
+
+/* Bindless resource table. One descriptor set holds every storage buffer,
+ * sampled image and sampler, and is bound once per command buffer. Shaders
+ * get their resource indices through push constants. Slots are written
+ * after bind, released ones are reused once no frame in flight can see them.
+ */
+typedef enum BindlessKind {
+	BINDLESS_STORAGE_BUFFER
+	, BINDLESS_SAMPLED_IMAGE
+	, BINDLESS_SAMPLER
+	, BINDLESS_KIND_COUNT
+} BindlessKind;
+
+/* Guaranteed minimum maxPushConstantsSize. */
+#define BINDLESS_PUSH_CONSTANT_SIZE 128
+
+/* Without descriptor indexing, the table is this many storage buffers,
+ * written before the first frame. Shaders are built for it a second time,
+ * with BINDLESS_FIXED, see bindless_spv. The scene, compute load and vertex
+ * pipeline dense mesh run on it, the mesh shader and software raster don't.
+ */
+#define BINDLESS_FIXED_BUFFERS 32
+
+typedef struct BindlessRetired {
+	uint32_t		slot;
+	uint64_t		frame_number;
+} BindlessRetired;
+
+typedef struct BindlessSlots {
+	uint32_t			capacity;
+	/* Slots past this were never used. */
+	uint32_t			high_water;
+	uint32_t			free_count;
+	uint32_t*			free_slots;
+	uint32_t			retired_count;
+	BindlessRetired*	retired;
+} BindlessSlots;
+
+typedef struct BindlessData {
+	BindlessSlots			slots[BINDLESS_KIND_COUNT];
+	VkDescriptorSetLayout	set_layout;
+	VkDescriptorPool		descriptor_pool;
+	VkDescriptorSet			set;
+	/* Shared by every bindless pipeline, so binding the set once is enough. */
+	VkPipelineLayout		layout;
+
+	/* No descriptor indexing, BINDLESS_FIXED_BUFFERS. Slots never used
+	 * point to the placeholder.
+	 */
+	bool					fixed;
+	VkBuffer				placeholder_buffer;
+	VkDeviceMemory			placeholder_memory;
+} BindlessData;
+
+BindlessData vk_bindless_data = {0};
+
+const VkDescriptorType bindless_descriptor_types[BINDLESS_KIND_COUNT] = {
+	VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+	, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+	, VK_DESCRIPTOR_TYPE_SAMPLER
+};
+
+const char* bindless_kind_names[BINDLESS_KIND_COUNT] = {
+	"storage buffers"
+	, "sampled images"
+	, "samplers"
+};
+
+void init_vk_bindless()
+{
+	vk_bindless_data.fixed = !vk_extensions_data.descriptor_indexing;
+
+	/* Capacities, clamped to the update after bind limits. The fixed table
+	 * only has storage buffers, and as many as its shaders were built for.
+	 */
+	{
+		uint32_t capacities[BINDLESS_KIND_COUNT] = { 0, 0, 0 };
+		if (vk_bindless_data.fixed) {
+			VkPhysicalDeviceProperties props;
+			vkGetPhysicalDeviceProperties(vk_data.phys_device, &props);
+			if (!vk_features_data.supported
+							.shaderStorageBufferArrayDynamicIndexing
+					|| props.limits.maxPerStageDescriptorStorageBuffers
+							< BINDLESS_FIXED_BUFFERS
+					|| props.limits.maxDescriptorSetStorageBuffers
+							< BINDLESS_FIXED_BUFFERS)
+			{
+				printf("Bindless table : no, needs descriptor indexing or "
+						"%d dynamically indexed storage buffers\n",
+						BINDLESS_FIXED_BUFFERS);
+				return;
+			}
+			capacities[BINDLESS_STORAGE_BUFFER] = BINDLESS_FIXED_BUFFERS;
+		} else {
+			VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexing_props = {
+				.sType				= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT
+				, .pNext			= NULL
+			};
+			VkPhysicalDeviceProperties2 props = {
+				.sType				= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2
+				, .pNext			= &indexing_props
+			};
+			vkGetPhysicalDeviceProperties2(vk_data.phys_device, &props);
+
+			/* Buffers and images share the per stage resource budget. */
+			uint32_t resources =
+					indexing_props.maxPerStageUpdateAfterBindResources / 2;
+			uint32_t limits[BINDLESS_KIND_COUNT] = {
+				indexing_props.maxPerStageDescriptorUpdateAfterBindStorageBuffers
+				, indexing_props.maxPerStageDescriptorUpdateAfterBindSampledImages
+				, indexing_props.maxPerStageDescriptorUpdateAfterBindSamplers
+			};
+			uint32_t wanted[BINDLESS_KIND_COUNT] = { 4096, 4096, 64 };
+
+			for (int k = 0; k < BINDLESS_KIND_COUNT; ++k) {
+				capacities[k] = wanted[k];
+				if (capacities[k] > limits[k]) {
+					capacities[k] = limits[k];
+				}
+				if (k != BINDLESS_SAMPLER && capacities[k] > resources) {
+					capacities[k] = resources;
+				}
+			}
+		}
+
+		for (int k = 0; k < BINDLESS_KIND_COUNT; ++k) {
+			BindlessSlots* slots = &vk_bindless_data.slots[k];
+			slots->capacity = capacities[k];
+			slots->free_slots = malloc(sizeof(uint32_t) * capacities[k]);
+			slots->retired = malloc(sizeof(BindlessRetired) * capacities[k]);
+		}
+	}
+
+	/* Set layout. Bindings are partially bound, only used slots need to be
+	 * valid. The fixed table's are neither, see the placeholder below.
+	 */
+	{
+		VkDescriptorSetLayoutBinding bindings[BINDLESS_KIND_COUNT];
+		VkDescriptorBindingFlagsEXT binding_flags[BINDLESS_KIND_COUNT];
+		for (uint32_t k = 0; k < BINDLESS_KIND_COUNT; ++k) {
+			bindings[k] = (VkDescriptorSetLayoutBinding){
+				.binding				= k
+				, .descriptorType		= bindless_descriptor_types[k]
+				, .descriptorCount		= vk_bindless_data.slots[k].capacity
+				, .stageFlags			= VK_SHADER_STAGE_ALL
+				, .pImmutableSamplers	= NULL
+			};
+			binding_flags[k] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT
+					| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT
+					| VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+		}
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT
+			, .pNext				= NULL
+			, .bindingCount			= BINDLESS_KIND_COUNT
+			, .pBindingFlags		= binding_flags
+		};
+
+		VkDescriptorSetLayoutCreateInfo set_layout_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO
+			, .pNext				= vk_bindless_data.fixed
+					? NULL : &binding_flags_create_info
+			, .flags				= vk_bindless_data.fixed ? 0
+					: VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT
+			, .bindingCount			= BINDLESS_KIND_COUNT
+			, .pBindings			= bindings
+		};
+		vk_error(vkCreateDescriptorSetLayout(vk_data.device,
+				&set_layout_create_info, vk_allocator,
+				&vk_bindless_data.set_layout));
+	}
+
+	/* The one set. Pool sizes can't be 0. */
+	{
+		VkDescriptorPoolSize pool_sizes[BINDLESS_KIND_COUNT];
+		uint32_t pool_size_count = 0;
+		for (int k = 0; k < BINDLESS_KIND_COUNT; ++k) {
+			if (vk_bindless_data.slots[k].capacity == 0)
+				continue;
+			pool_sizes[pool_size_count++] = (VkDescriptorPoolSize){
+				.type					= bindless_descriptor_types[k]
+				, .descriptorCount		= vk_bindless_data.slots[k].capacity
+			};
+		}
+
+		VkDescriptorPoolCreateInfo pool_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= vk_bindless_data.fixed ? 0
+					: VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT
+			, .maxSets				= 1
+			, .poolSizeCount		= pool_size_count
+			, .pPoolSizes			= pool_sizes
+		};
+		vk_error(vkCreateDescriptorPool(vk_data.device, &pool_create_info,
+				vk_allocator, &vk_bindless_data.descriptor_pool));
+
+		VkDescriptorSetAllocateInfo set_allocate_info = {
+			.sType					= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO
+			, .pNext				= NULL
+			, .descriptorPool		= vk_bindless_data.descriptor_pool
+			, .descriptorSetCount	= 1
+			, .pSetLayouts			= &vk_bindless_data.set_layout
+		};
+		vk_error(vkAllocateDescriptorSets(vk_data.device, &set_allocate_info,
+				&vk_bindless_data.set));
+	}
+
+	/* Not partially bound, the shaders index the whole array : every slot
+	 * starts as a small placeholder buffer.
+	 */
+	if (vk_bindless_data.fixed) {
+		create_buffer(256, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_bindless_data.placeholder_buffer,
+				&vk_bindless_data.placeholder_memory);
+
+		VkDescriptorBufferInfo buffer_infos[BINDLESS_FIXED_BUFFERS];
+		for (uint32_t i = 0; i < BINDLESS_FIXED_BUFFERS; ++i) {
+			buffer_infos[i] = (VkDescriptorBufferInfo){
+				vk_bindless_data.placeholder_buffer, 0, VK_WHOLE_SIZE
+			};
+		}
+		VkWriteDescriptorSet write = {
+			.sType				= VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET
+			, .pNext			= NULL
+			, .dstSet			= vk_bindless_data.set
+			, .dstBinding		= BINDLESS_STORAGE_BUFFER
+			, .dstArrayElement	= 0
+			, .descriptorCount	= BINDLESS_FIXED_BUFFERS
+			, .descriptorType	= VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+			, .pImageInfo		= NULL
+			, .pBufferInfo		= buffer_infos
+			, .pTexelBufferView	= NULL
+		};
+		vkUpdateDescriptorSets(vk_data.device, 1, &write, 0, NULL);
+	}
+
+	/* Shared pipeline layout. Set 0 is the table, push constants are free
+	 * for every stage.
+	 */
+	{
+		VkPushConstantRange push_range = {
+			.stageFlags				= VK_SHADER_STAGE_ALL
+			, .offset				= 0
+			, .size					= BINDLESS_PUSH_CONSTANT_SIZE
+		};
+
+		VkPipelineLayoutCreateInfo layout_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .setLayoutCount		= 1
+			, .pSetLayouts			= &vk_bindless_data.set_layout
+			, .pushConstantRangeCount	= 1
+			, .pPushConstantRanges	= &push_range
+		};
+		vk_error(vkCreatePipelineLayout(vk_data.device, &layout_create_info,
+				vk_allocator, &vk_bindless_data.layout));
+	}
+
+	printf("Bindless table : %d %s, %d %s, %d %s%s\n",
+			vk_bindless_data.slots[0].capacity, bindless_kind_names[0],
+			vk_bindless_data.slots[1].capacity, bindless_kind_names[1],
+			vk_bindless_data.slots[2].capacity, bindless_kind_names[2],
+			vk_bindless_data.fixed ? ", fixed" : "");
+}
+
+void deinit_vk_bindless()
+{
+	if (vk_bindless_data.set == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyPipelineLayout(vk_data.device, vk_bindless_data.layout,
+			vk_allocator);
+	vkDestroyDescriptorPool(vk_data.device, vk_bindless_data.descriptor_pool,
+			vk_allocator);
+	vkDestroyDescriptorSetLayout(vk_data.device, vk_bindless_data.set_layout,
+			vk_allocator);
+	if (vk_bindless_data.fixed) {
+		vkDestroyBuffer(vk_data.device, vk_bindless_data.placeholder_buffer,
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_bindless_data.placeholder_memory,
+				vk_allocator);
+	}
+
+	for (int k = 0; k < BINDLESS_KIND_COUNT; ++k) {
+		free(vk_bindless_data.slots[k].free_slots);
+		free(vk_bindless_data.slots[k].retired);
+	}
+}
+
+/* Free list first, then never used slots. */
+uint32_t bindless_alloc_slot(BindlessKind kind)
+{
+	BindlessSlots* slots = &vk_bindless_data.slots[kind];
+
+	if (slots->free_count > 0)
+		return slots->free_slots[--slots->free_count];
+
+	if (slots->high_water == slots->capacity) {
+		printf("Bindless table is out of %s.\n", bindless_kind_names[kind]);
+		exit(-1);
+	}
+	return slots->high_water++;
+}
+
+/* The slot may still be read by frames in flight, including the one being
+ * recorded. It's reused once that frame is done, see bindless_recycle.
+ */
+void bindless_release(BindlessKind kind, uint32_t slot)
+{
+	BindlessSlots* slots = &vk_bindless_data.slots[kind];
+	slots->retired[slots->retired_count++] = (BindlessRetired){
+		.slot				= slot
+		, .frame_number		= vk_frame_number
+	};
+}
+
+/* Call once the current frame's fences have signaled. Frames complete in
+ * order, so everything up to FRAMES_IN_FLIGHT frames ago is done.
+ */
+void bindless_recycle()
+{
+	if (vk_frame_number < FRAMES_IN_FLIGHT)
+		return;
+
+	uint64_t done = vk_frame_number - FRAMES_IN_FLIGHT;
+	for (int k = 0; k < BINDLESS_KIND_COUNT; ++k) {
+		BindlessSlots* slots = &vk_bindless_data.slots[k];
+
+		uint32_t kept = 0;
+		for (uint32_t i = 0; i < slots->retired_count; ++i) {
+			if (slots->retired[i].frame_number <= done) {
+				slots->free_slots[slots->free_count++] =
+						slots->retired[i].slot;
+			} else {
+				slots->retired[kept++] = slots->retired[i];
+			}
+		}
+		slots->retired_count = kept;
+	}
+}
+
+/* The fixed table isn't update after bind, the set can't be in use. */
+void bindless_write(BindlessKind kind, uint32_t slot,
+		const VkDescriptorBufferInfo* buffer_info,
+		const VkDescriptorImageInfo* image_info)
+{
+	assert(!vk_bindless_data.fixed || vk_frame_number == 0);
+
+	VkWriteDescriptorSet write = {
+		.sType				= VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET
+		, .pNext			= NULL
+		, .dstSet			= vk_bindless_data.set
+		, .dstBinding		= kind
+		, .dstArrayElement	= slot
+		, .descriptorCount	= 1
+		, .descriptorType	= bindless_descriptor_types[kind]
+		, .pImageInfo		= image_info
+		, .pBufferInfo		= buffer_info
+		, .pTexelBufferView	= NULL
+	};
+	vkUpdateDescriptorSets(vk_data.device, 1, &write, 0, NULL);
+}
+
+/* Returns the index to pass to shaders. */
+uint32_t bindless_add_buffer(VkBuffer buffer, VkDeviceSize offset,
+		VkDeviceSize range)
+{
+	uint32_t slot = bindless_alloc_slot(BINDLESS_STORAGE_BUFFER);
+	VkDescriptorBufferInfo buffer_info = { buffer, offset, range };
+	bindless_write(BINDLESS_STORAGE_BUFFER, slot, &buffer_info, NULL);
+	return slot;
+}
+
+uint32_t bindless_add_image(VkImageView image_view, VkImageLayout layout)
+{
+	uint32_t slot = bindless_alloc_slot(BINDLESS_SAMPLED_IMAGE);
+	VkDescriptorImageInfo image_info = { VK_NULL_HANDLE, image_view, layout };
+	bindless_write(BINDLESS_SAMPLED_IMAGE, slot, NULL, &image_info);
+	return slot;
+}
+
+uint32_t bindless_add_sampler(VkSampler sampler)
+{
+	uint32_t slot = bindless_alloc_slot(BINDLESS_SAMPLER);
+	VkDescriptorImageInfo image_info = {
+		sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED
+	};
+	bindless_write(BINDLESS_SAMPLER, slot, NULL, &image_info);
+	return slot;
+}
+
+/* The SPIR-V of shaders that index the table, the one built for the fixed
+ * table without descriptor indexing.
+ */
+const char* bindless_spv(const char* spv, const char* fixed_spv)
+{
+	return vk_bindless_data.fixed ? fixed_spv : spv;
+}
+
+/* Once per command buffer and bind point. */
+void bindless_bind(VkCommandBuffer cmd, VkPipelineBindPoint bind_point)
+{
+	vkCmdBindDescriptorSets(cmd, bind_point, vk_bindless_data.layout, 0, 1,
+			&vk_bindless_data.set, 0, NULL);
+}
+
+void bindless_push(VkCommandBuffer cmd, const void* data, uint32_t size)
+{
+	assert(size <= BINDLESS_PUSH_CONSTANT_SIZE);
+	vkCmdPushConstants(cmd, vk_bindless_data.layout, VK_SHADER_STAGE_ALL, 0,
+			size, data);
+}
+
+
+/* Pipeline variants. Every permutation of vertex format, blend mode, sample
+ * count and color comes from the same vertex and fragment SPIR-V, the color
+ * through specialization constants. They compile through one pipeline
+ * cache, either all at startup in jobs, or lazily the first time a variant
+ * is asked for, on a background thread of their own so the frame never
+ * waits for one. Until it's ready, callers fall back to their own pipeline.
+ * Both take the next variant from one queue, lazy requests in front.
+ */
+#define VARIANT_MAX_COUNT 128
+#define VARIANT_TINT_COUNT 4
+
+typedef enum VariantBlend {
+	VARIANT_BLEND_OPAQUE
+	, VARIANT_BLEND_ALPHA
+	, VARIANT_BLEND_ADDITIVE
+	, VARIANT_BLEND_COUNT
+} VariantBlend;
+
+typedef enum VariantState {
+	VARIANT_NONE
+	, VARIANT_QUEUED
+	, VARIANT_READY
+} VariantState;
+
+typedef struct VariantKey {
+	VkFormat				vertex_format;
+	VariantBlend			blend;
+	VkSampleCountFlagBits	samples;
+	/* Index in variant_tints, specialized in the fragment shader. */
+	uint32_t				tint;
+} VariantKey;
+
+typedef struct PipelineVariants {
+	uint32_t				count;
+	VariantKey				keys[VARIANT_MAX_COUNT];
+	VkPipeline				pipelines[VARIANT_MAX_COUNT];
+	/* VariantState, written by whoever compiles. */
+	volatile LONG			states[VARIANT_MAX_COUNT];
+
+	VkShaderModule			vert_module;
+	VkShaderModule			frag_module;
+	VkPipelineCache			cache;
+
+	/* Lazy requests go in front of the startup ones, the first lazy_count
+	 * are lazy. The background thread only takes those.
+	 */
+	CRITICAL_SECTION		lock;
+	CONDITION_VARIABLE		wake;
+	CONDITION_VARIABLE		idle;
+	uint32_t				queue[VARIANT_MAX_COUNT];
+	uint32_t				queue_head;
+	uint32_t				queue_size;
+	uint32_t				lazy_count;
+	uint32_t				busy_count;
+	bool					stopping;
+	HANDLE					thread;
+} PipelineVariants;
+
+PipelineVariants vk_variants = {0};
+
+const VkFormat variant_vertex_formats[] = {
+	VK_FORMAT_R32G32B32_SFLOAT
+	, VK_FORMAT_R16G16B16A16_SFLOAT
+	, VK_FORMAT_R16G16B16A16_SNORM
+};
+
+const float variant_tints[VARIANT_TINT_COUNT][4] = {
+	{ 1.0f, 0.5f, 0.2f, 1.0f }
+	, { 0.2f, 0.6f, 1.0f, 1.0f }
+	, { 1.0f, 1.0f, 1.0f, 0.5f }
+	, { 0.9f, 0.2f, 0.6f, 1.0f }
+};
+
+uint32_t vertex_format_size(VkFormat format)
+{
+	switch (format) {
+		case VK_FORMAT_R32G32B32_SFLOAT:
+			return 12;
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+		case VK_FORMAT_R16G16B16A16_SNORM:
+			return 8;
+		default:
+			assert(false);
+			return 0;
+	}
+}
+
+/* Any thread. */
+VkPipeline build_pipeline_variant(const VariantKey* key)
+{
+	VkVertexInputBindingDescription vertex_binding = {
+		.binding				= 0
+		, .stride				= vertex_format_size(key->vertex_format)
+		, .inputRate			= VK_VERTEX_INPUT_RATE_VERTEX
+	};
+	VkVertexInputAttributeDescription vertex_attribute = {
+		.location				= 0
+		, .binding				= 0
+		, .format				= key->vertex_format
+		, .offset				= 0
+	};
+	VkPipelineVertexInputStateCreateInfo vertex_input_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .vertexBindingDescriptionCount	= 1
+		, .pVertexBindingDescriptions		= &vertex_binding
+		, .vertexAttributeDescriptionCount	= 1
+		, .pVertexAttributeDescriptions		= &vertex_attribute
+	};
+
+	/* constant_id 0 to 3, see win_vulkan_variant.frag. */
+	VkSpecializationMapEntry map_entries[4];
+	for (uint32_t i = 0; i < 4; ++i) {
+		map_entries[i] = (VkSpecializationMapEntry){
+			.constantID			= i
+			, .offset			= i * sizeof(float)
+			, .size				= sizeof(float)
+		};
+	}
+	VkSpecializationInfo specialization_info = {
+		.mapEntryCount			= 4
+		, .pMapEntries			= map_entries
+		, .dataSize				= sizeof(variant_tints[0])
+		, .pData				= variant_tints[key->tint]
+	};
+
+	VkPipelineShaderStageCreateInfo stage_create_infos[] = {
+		{
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_VERTEX_BIT
+			, .module				= vk_variants.vert_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= NULL
+		}
+		, {
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_FRAGMENT_BIT
+			, .module				= vk_variants.frag_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= &specialization_info
+		}
+	};
+
+	VkPipelineColorBlendAttachmentState blend_state = {
+		.blendEnable			= key->blend != VARIANT_BLEND_OPAQUE
+		, .srcColorBlendFactor	= key->blend == VARIANT_BLEND_ALPHA
+				? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE
+		, .dstColorBlendFactor	= key->blend == VARIANT_BLEND_ALPHA
+				? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE
+		, .colorBlendOp			= VK_BLEND_OP_ADD
+		, .srcAlphaBlendFactor	= VK_BLEND_FACTOR_ONE
+		, .dstAlphaBlendFactor	= key->blend == VARIANT_BLEND_ALPHA
+				? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE
+		, .alphaBlendOp			= VK_BLEND_OP_ADD
+		, .colorWriteMask		= VK_COLOR_COMPONENT_R_BIT
+				| VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT
+				| VK_COLOR_COMPONENT_A_BIT
+	};
+
+	return create_pipeline_state(vk_variants.cache, stage_create_infos, 2,
+			vk_bindless_data.layout, &vertex_input_create_info,
+			VK_CULL_MODE_NONE, key->samples, &blend_state);
+}
+
+/* Lock held. False when there's nothing to take. */
+bool take_pipeline_variant(bool lazy_only, uint32_t* index)
+{
+	if (vk_variants.queue_size == 0
+			|| (lazy_only && vk_variants.lazy_count == 0))
+		return false;
+
+	*index = vk_variants.queue[vk_variants.queue_head];
+	vk_variants.queue_head = (vk_variants.queue_head + 1) % VARIANT_MAX_COUNT;
+	--vk_variants.queue_size;
+	if (vk_variants.lazy_count > 0) {
+		--vk_variants.lazy_count;
+	}
+	++vk_variants.busy_count;
+	return true;
+}
+
+/* Lock not held. Handle first, then the state, readers check the state. */
+void compile_pipeline_variant(uint32_t index)
+{
+	vk_variants.pipelines[index] =
+			build_pipeline_variant(&vk_variants.keys[index]);
+	InterlockedExchange(&vk_variants.states[index], VARIANT_READY);
+
+	EnterCriticalSection(&vk_variants.lock);
+	--vk_variants.busy_count;
+	if (vk_variants.queue_size == 0 && vk_variants.busy_count == 0) {
+		WakeAllConditionVariable(&vk_variants.idle);
+	}
+	LeaveCriticalSection(&vk_variants.lock);
+}
+
+/* One variant per job, whichever is first in the queue. */
+void compile_pipeline_variant_job(void* data, uint32_t begin, uint32_t end)
+{
+	(void)data;
+	for (uint32_t i = begin; i < end; ++i) {
+		uint32_t index;
+		EnterCriticalSection(&vk_variants.lock);
+		bool taken = take_pipeline_variant(false, &index);
+		LeaveCriticalSection(&vk_variants.lock);
+		if (!taken)
+			return;
+		compile_pipeline_variant(index);
+	}
+}
+
+/* Lazy requests only, never a job, so never on a thread that draws. */
+DWORD WINAPI variant_thread(LPVOID param)
+{
+	(void)param;
+	EnterCriticalSection(&vk_variants.lock);
+	while (true) {
+		uint32_t index;
+		while (!vk_variants.stopping && !take_pipeline_variant(true, &index)) {
+			SleepConditionVariableCS(&vk_variants.wake, &vk_variants.lock,
+					INFINITE);
+		}
+		if (vk_variants.stopping)
+			break;
+
+		LeaveCriticalSection(&vk_variants.lock);
+		compile_pipeline_variant(index);
+		EnterCriticalSection(&vk_variants.lock);
+	}
+	LeaveCriticalSection(&vk_variants.lock);
+	return 0;
+}
+
+/* Lazy requests go in front, and wake the background thread. */
+void request_pipeline_variant(uint32_t index, bool lazy)
+{
+	if (InterlockedCompareExchange(&vk_variants.states[index], VARIANT_QUEUED,
+			VARIANT_NONE) != VARIANT_NONE)
+		return;
+
+	EnterCriticalSection(&vk_variants.lock);
+	if (lazy) {
+		vk_variants.queue_head = (vk_variants.queue_head + VARIANT_MAX_COUNT
+				- 1) % VARIANT_MAX_COUNT;
+		vk_variants.queue[vk_variants.queue_head] = index;
+		++vk_variants.lazy_count;
+		WakeConditionVariable(&vk_variants.wake);
+	} else {
+		vk_variants.queue[(vk_variants.queue_head + vk_variants.queue_size)
+				% VARIANT_MAX_COUNT] = index;
+	}
+	++vk_variants.queue_size;
+	LeaveCriticalSection(&vk_variants.lock);
+}
+
+/* Until the queue is empty and nothing is compiling. */
+void wait_pipeline_variants()
+{
+	EnterCriticalSection(&vk_variants.lock);
+	while (vk_variants.queue_size > 0 || vk_variants.busy_count > 0) {
+		SleepConditionVariableCS(&vk_variants.idle, &vk_variants.lock,
+				INFINITE);
+	}
+	LeaveCriticalSection(&vk_variants.lock);
+}
+
+uint32_t find_pipeline_variant(const VariantKey* key)
+{
+	for (uint32_t i = 0; i < vk_variants.count; ++i) {
+		const VariantKey* k = &vk_variants.keys[i];
+		if (k->vertex_format == key->vertex_format && k->blend == key->blend
+				&& k->samples == key->samples && k->tint == key->tint)
+			return i;
+	}
+	return UINT32_MAX;
+}
+
+/* Never blocks. VK_NULL_HANDLE until the variant is compiled, the first
+ * call queues it.
+ */
+VkPipeline get_pipeline_variant(const VariantKey* key)
+{
+	uint32_t index = find_pipeline_variant(key);
+	if (index == UINT32_MAX)
+		return VK_NULL_HANDLE;
+
+	if (vk_variants.states[index] == VARIANT_READY)
+		return vk_variants.pipelines[index];
+
+	request_pipeline_variant(index, true);
+	return VK_NULL_HANDLE;
+}
+
+/* All of them in jobs, the calling thread helps. Lazy requests made
+ * meanwhile still go first. Returns the time it took.
+ */
+double compile_pipeline_variants()
+{
+	double start = time_ms();
+	for (uint32_t i = 0; i < vk_variants.count; ++i) {
+		request_pipeline_variant(i, false);
+	}
+	JobCounter counter = {0};
+	job_parallel_for(compile_pipeline_variant_job, NULL, vk_variants.count,
+			1, &counter);
+	job_wait(&counter);
+	wait_pipeline_variants();
+	return time_ms() - start;
+}
+
+void init_pipeline_variants()
+{
+	if (vk_bindless_data.set == VK_NULL_HANDLE) {
+		printf("Pipeline variants need the bindless table.\n");
+		exit(-1);
+	}
+
+	/* Multisampled variants target dynamic rendering only. */
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(vk_data.phys_device, &props);
+	bool msaa = vk_extensions_data.dynamic_rendering
+			&& (props.limits.framebufferColorSampleCounts
+					& VK_SAMPLE_COUNT_4_BIT);
+
+	const VkSampleCountFlagBits samples[] = {
+		VK_SAMPLE_COUNT_1_BIT
+		, VK_SAMPLE_COUNT_4_BIT
+	};
+	for (uint32_t f = 0; f < 3; ++f) {
+		for (uint32_t b = 0; b < VARIANT_BLEND_COUNT; ++b) {
+			for (uint32_t s = 0; s < (msaa ? 2u : 1u); ++s) {
+				for (uint32_t t = 0; t < VARIANT_TINT_COUNT; ++t) {
+					vk_variants.keys[vk_variants.count++] = (VariantKey){
+						.vertex_format		= variant_vertex_formats[f]
+						, .blend			= (VariantBlend)b
+						, .samples			= samples[s]
+						, .tint				= t
+					};
+				}
+			}
+		}
+	}
+
+	vk_variants.vert_module = create_shader_module(bindless_spv(
+			"win_vulkan_scene_vert.spv", "win_vulkan_scene_vert_fixed.spv"));
+	vk_variants.frag_module =
+			create_shader_module("win_vulkan_variant_frag.spv");
+	vk_variants.cache = vk_data.pipeline_cache;
+
+	InitializeCriticalSection(&vk_variants.lock);
+	InitializeConditionVariable(&vk_variants.wake);
+	InitializeConditionVariable(&vk_variants.idle);
+	vk_variants.stopping = false;
+	vk_variants.thread = CreateThread(NULL, 0, variant_thread, NULL, 0, NULL);
+	if (vk_variants.thread == NULL) {
+		printf("Could not start the pipeline variant thread.\n");
+		exit(-1);
+	}
+
+	if (vk_options.pipeline_variants == VARIANTS_EAGER) {
+		double compile_ms = compile_pipeline_variants();
+		printf("Pipeline variants : %d compiled in %.1f ms on %d threads\n",
+				vk_variants.count, compile_ms, job_system.worker_count);
+	} else {
+		printf("Pipeline variants : %d, compiled on first use in the "
+				"background\n", vk_variants.count);
+	}
+}
+
+/* Device idle. */
+void deinit_pipeline_variants()
+{
+	if (vk_variants.count == 0)
+		return;
+
+	/* The lazy request compiling finishes, queued ones stay queued. */
+	EnterCriticalSection(&vk_variants.lock);
+	vk_variants.stopping = true;
+	WakeAllConditionVariable(&vk_variants.wake);
+	LeaveCriticalSection(&vk_variants.lock);
+	WaitForSingleObject(vk_variants.thread, INFINITE);
+	CloseHandle(vk_variants.thread);
+	vk_variants.thread = NULL;
+
+	for (uint32_t i = 0; i < vk_variants.count; ++i) {
+		if (vk_variants.states[i] == VARIANT_READY) {
+			vkDestroyPipeline(vk_data.device, vk_variants.pipelines[i],
+					vk_allocator);
+		}
+	}
+	vkDestroyShaderModule(vk_data.device, vk_variants.vert_module,
+			vk_allocator);
+	vkDestroyShaderModule(vk_data.device, vk_variants.frag_module,
+			vk_allocator);
+	DeleteCriticalSection(&vk_variants.lock);
+	vk_variants.count = 0;
+}
+
+/* Throws away the compiled variants, and compiles them again with that
+ * many job workers and an empty cache. The job system is restarted, nothing
+ * else may have jobs queued.
+ */
+double recompile_pipeline_variants(uint32_t thread_count)
+{
+	wait_pipeline_variants();
+	for (uint32_t i = 0; i < vk_variants.count; ++i) {
+		if (vk_variants.states[i] == VARIANT_READY) {
+			vkDestroyPipeline(vk_data.device, vk_variants.pipelines[i],
+					vk_allocator);
+		}
+		vk_variants.states[i] = VARIANT_NONE;
+	}
+	jobs_shutdown();
+	jobs_init(thread_count);
+
+	VkPipelineCacheCreateInfo cache_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .initialDataSize		= 0
+		, .pInitialData			= NULL
+	};
+	VkPipelineCache cache;
+	vk_error(vkCreatePipelineCache(vk_data.device, &cache_create_info,
+			vk_allocator, &cache));
+	vk_variants.cache = cache;
+
+	double compile_ms = compile_pipeline_variants();
+
+	vk_variants.cache = vk_data.pipeline_cache;
+	vkDestroyPipelineCache(vk_data.device, cache, vk_allocator);
+	return compile_ms;
+}
+
+/* The scene's own pipeline, the color changing every second. */
+VariantKey scene_variant_key()
+{
+	return (VariantKey){
+		.vertex_format			= VK_FORMAT_R32G32B32_SFLOAT
+		, .blend				= VARIANT_BLEND_OPAQUE
+		, .samples				= vk_attachment_data.samples
+		, .tint					= (uint32_t)(time_ms() / 1000.0)
+				% VARIANT_TINT_COUNT
+	};
+}
+
+/* GPU driven scene. Objects are uploaded once, a compute pass culls them
+ * every frame and writes the indirect draws, one draw call renders them all.
+ * Draw and count buffers are per frame in flight, the GPU may still be
+ * reading last frame's while this one is culled.
+ */
+typedef struct SceneObject {
+	Mat4			model;
+	float			bounds[4];
+} SceneObject;
+
+typedef struct CullConstants {
+	float			planes[6][4];
+	uint32_t		object_count;
+	uint32_t		index_count;
+	uint32_t		compact;
+	/* Bindless buffer indices. */
+	uint32_t		objects;
+	uint32_t		draws;
+	uint32_t		count;
+	/* UINT32_MAX without occlusion culling. */
+	uint32_t		visibility;
+} CullConstants;
+
+typedef struct SceneDrawConstants {
+	Mat4			view_proj;
+	uint32_t		objects;
+} SceneDrawConstants;
+
+typedef struct SceneData {
+	uint32_t				object_count;
+	uint32_t				index_count;
+	float					grid_extent;
+	Mat4					view_proj;
+	float					planes[6][4];
+
+	VkBuffer				vertex_buffer;
+	VkDeviceMemory			vertex_memory;
+	VkBuffer				index_buffer;
+	VkDeviceMemory			index_memory;
+	VkBuffer				object_buffer;
+	VkDeviceMemory			object_memory;
+	VkBuffer				draw_buffers[FRAMES_IN_FLIGHT];
+	VkDeviceMemory			draw_memories[FRAMES_IN_FLIGHT];
+	VkBuffer				count_buffers[FRAMES_IN_FLIGHT];
+	VkDeviceMemory			count_memories[FRAMES_IN_FLIGHT];
+
+	/* Bindless buffer indices. */
+	uint32_t				object_slot;
+	uint32_t				draw_slots[FRAMES_IN_FLIGHT];
+	uint32_t				count_slots[FRAMES_IN_FLIGHT];
+
+	VkPipeline				cull_pipeline;
+	VkPipeline				draw_pipeline;
+
+	/* CPU occlusion culling, the nearest objects occlude the others. One
+	 * visibility word per object and frame in flight, read by the cull pass.
+	 */
+	bool					occlusion;
+	float					(*bounds)[4];
+	uint32_t*				occluders;
+	uint32_t				occluder_count;
+	OcclusionBuffer			occlusion_buffer;
+	VkBuffer				visibility_buffers[FRAMES_IN_FLIGHT];
+	VkDeviceMemory			visibility_memories[FRAMES_IN_FLIGHT];
+	uint32_t*				visibilities[FRAMES_IN_FLIGHT];
+	uint32_t				visibility_slots[FRAMES_IN_FLIGHT];
+	uint32_t				occluded_count;
+	double					occlusion_ms;
+} SceneData;
+
+SceneData vk_scene_data = {0};
+
+VkPipeline build_scene_cull_pipeline()
+{
+	VkShaderModule cull_module = try_create_shader_module(bindless_spv(
+			"win_vulkan_cull_comp.spv", "win_vulkan_cull_comp_fixed.spv"));
+	VkPipeline pipeline = create_compute_pipeline(cull_module,
+			vk_bindless_data.layout);
+	vkDestroyShaderModule(vk_data.device, cull_module, vk_allocator);
+	return pipeline;
+}
+
+VkPipeline build_scene_draw_pipeline()
+{
+	VkVertexInputBindingDescription vertex_binding = {
+		.binding				= 0
+		, .stride				= sizeof(float) * 3
+		, .inputRate			= VK_VERTEX_INPUT_RATE_VERTEX
+	};
+	VkVertexInputAttributeDescription vertex_attribute = {
+		.location				= 0
+		, .binding				= 0
+		, .format				= VK_FORMAT_R32G32B32_SFLOAT
+		, .offset				= 0
+	};
+	VkPipelineVertexInputStateCreateInfo vertex_input_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .vertexBindingDescriptionCount	= 1
+		, .pVertexBindingDescriptions		= &vertex_binding
+		, .vertexAttributeDescriptionCount	= 1
+		, .pVertexAttributeDescriptions		= &vertex_attribute
+	};
+
+	VkShaderModule vert_module = try_create_shader_module(bindless_spv(
+			"win_vulkan_scene_vert.spv", "win_vulkan_scene_vert_fixed.spv"));
+	VkShaderModule frag_module =
+			try_create_shader_module("win_vulkan_frag.spv");
+
+	VkPipeline pipeline = create_graphics_pipeline(vert_module, frag_module,
+			vk_bindless_data.layout, &vertex_input_create_info,
+			VK_CULL_MODE_NONE);
+
+	vkDestroyShaderModule(vk_data.device, vert_module, vk_allocator);
+	vkDestroyShaderModule(vk_data.device, frag_module, vk_allocator);
+	return pipeline;
+}
+
+/* An octahedron of radius 1. */
+#define SCENE_MESH_INDEX_COUNT 24
+
+const float scene_mesh_vertices[] = {
+	1.0f, 0.0f, 0.0f,	-1.0f, 0.0f, 0.0f
+	, 0.0f, 1.0f, 0.0f,	0.0f, -1.0f, 0.0f
+	, 0.0f, 0.0f, 1.0f,	0.0f, 0.0f, -1.0f
+};
+
+const uint32_t scene_mesh_indices[SCENE_MESH_INDEX_COUNT] = {
+	0, 2, 4,	2, 1, 4,	1, 3, 4,	3, 0, 4
+	, 2, 0, 5,	1, 2, 5,	3, 1, 5,	0, 3, 5
+};
+
+/* The camera only turns in place, so the nearest objects stay the nearest.
+ * Small enough that rasterizing them costs less than what they hide.
+ */
+#define SCENE_OCCLUDERS 64
+#define SCENE_OCCLUSION_WIDTH 256
+#define SCENE_OCCLUSION_HEIGHT 128
+
+int compare_scene_distance(const void* a, const void* b)
+{
+	const float* ba = vk_scene_data.bounds[*(const uint32_t*)a];
+	const float* bb = vk_scene_data.bounds[*(const uint32_t*)b];
+	float da = ba[0] * ba[0] + ba[1] * ba[1] + ba[2] * ba[2];
+	float db = bb[0] * bb[0] + bb[1] * bb[1] + bb[2] * bb[2];
+	return da < db ? -1 : da > db ? 1 : 0;
+}
+
+/* After the objects, bounds kept. */
+void init_scene_occlusion()
+{
+	uint32_t object_count = vk_scene_data.object_count;
+
+	uint32_t* order = malloc(sizeof(uint32_t) * object_count);
+	for (uint32_t i = 0; i < object_count; ++i) {
+		order[i] = i;
+	}
+	qsort(order, object_count, sizeof(uint32_t), compare_scene_distance);
+	vk_scene_data.occluder_count = object_count < SCENE_OCCLUDERS
+			? object_count : SCENE_OCCLUDERS;
+	vk_scene_data.occluders = order;
+
+	occlusion_init(&vk_scene_data.occlusion_buffer, SCENE_OCCLUSION_WIDTH,
+			SCENE_OCCLUSION_HEIGHT);
+
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		create_buffer(sizeof(uint32_t) * object_count,
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+						| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&vk_scene_data.visibility_buffers[i],
+				&vk_scene_data.visibility_memories[i]);
+		vk_error(vkMapMemory(vk_data.device,
+				vk_scene_data.visibility_memories[i], 0,
+				sizeof(uint32_t) * object_count, 0,
+				(void**)&vk_scene_data.visibilities[i]));
+		vk_scene_data.visibility_slots[i] = bindless_add_buffer(
+				vk_scene_data.visibility_buffers[i], 0, VK_WHOLE_SIZE);
+	}
+
+	vk_scene_data.occlusion = true;
+	printf("Occlusion culling : %d occluders, %dx%d, %d levels\n",
+			vk_scene_data.occluder_count,
+			vk_scene_data.occlusion_buffer.widths[0],
+			vk_scene_data.occlusion_buffer.heights[0],
+			vk_scene_data.occlusion_buffer.level_count);
+}
+
+void deinit_scene_occlusion()
+{
+	if (!vk_scene_data.occlusion)
+		return;
+
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		bindless_release(BINDLESS_STORAGE_BUFFER,
+				vk_scene_data.visibility_slots[i]);
+		vkDestroyBuffer(vk_data.device, vk_scene_data.visibility_buffers[i],
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_scene_data.visibility_memories[i],
+				vk_allocator);
+	}
+	occlusion_destroy(&vk_scene_data.occlusion_buffer);
+	free(vk_scene_data.occluders);
+	free(vk_scene_data.bounds);
+	vk_scene_data.occlusion = false;
+}
+
+/* Objects per box test job. */
+#define SCENE_OCCLUSION_GRAIN 256
+
+typedef struct SceneOcclusionJob {
+	uint32_t*		visibility;
+	atomic_uint		culled;
+} SceneOcclusionJob;
+
+void test_scene_boxes_job(void* data, uint32_t begin, uint32_t end)
+{
+	SceneOcclusionJob* job = data;
+	const OcclusionBuffer* ob = &vk_scene_data.occlusion_buffer;
+
+	uint32_t culled = 0;
+	for (uint32_t i = begin; i < end; ++i) {
+		const float* b = vk_scene_data.bounds[i];
+		float box_min[3] = { b[0] - b[3], b[1] - b[3], b[2] - b[3] };
+		float box_max[3] = { b[0] + b[3], b[1] + b[3], b[2] + b[3] };
+		bool visible = occlusion_box_visible(ob, box_min, box_max);
+		job->visibility[i] = visible ? 1 : 0;
+		culled += visible ? 0 : 1;
+	}
+	atomic_fetch_add(&job->culled, culled);
+}
+
+/* Writes the frame slot's visibility, its last frame is done with it.
+ * Occluders go in serially, the box tests in parallel.
+ */
+void cull_scene_occlusion(uint32_t frame_slot)
+{
+	double start = time_ms();
+	OcclusionBuffer* ob = &vk_scene_data.occlusion_buffer;
+	occlusion_begin(ob, vk_scene_data.view_proj.m);
+
+	for (uint32_t o = 0; o < vk_scene_data.occluder_count; ++o) {
+		const float* b = vk_scene_data.bounds[vk_scene_data.occluders[o]];
+		float model[16] = {
+			b[3], 0.0f, 0.0f, 0.0f
+			, 0.0f, b[3], 0.0f, 0.0f
+			, 0.0f, 0.0f, b[3], 0.0f
+			, b[0], b[1], b[2], 1.0f
+		};
+		occlusion_add_mesh(ob, model, scene_mesh_vertices, scene_mesh_indices,
+				SCENE_MESH_INDEX_COUNT / 3);
+	}
+	occlusion_build_pyramid(ob);
+
+	SceneOcclusionJob job = {
+		.visibility				= vk_scene_data.visibilities[frame_slot]
+	};
+	atomic_init(&job.culled, 0);
+	JobCounter counter = {0};
+	job_parallel_for(test_scene_boxes_job, &job, vk_scene_data.object_count,
+			SCENE_OCCLUSION_GRAIN, &counter);
+	job_wait(&counter);
+
+	vk_scene_data.occluded_count = atomic_load(&job.culled);
+	vk_scene_data.occlusion_ms = time_ms() - start;
+}
+
+void init_vk_scene()
+{
+	uint32_t object_count = vk_options.scene_objects;
+	vk_scene_data.object_count = object_count;
+
+	if (!vk_features_data.features2.features.multiDrawIndirect
+			|| !vk_features_data.features2.features.drawIndirectFirstInstance
+			|| vk_data.max_draw_indirect_count < object_count)
+	{
+		printf("GPU driven scene needs multi draw indirect with first "
+				"instance, for %d draws.\n", object_count);
+		exit(-1);
+	}
+
+	if (vk_bindless_data.set == VK_NULL_HANDLE) {
+		printf("GPU driven scene needs the bindless table.\n");
+		exit(-1);
+	}
+
+	/* Upload mesh and objects. */
+	{
+		const float* vertices = scene_mesh_vertices;
+		const uint32_t* indices = scene_mesh_indices;
+		vk_scene_data.index_count = SCENE_MESH_INDEX_COUNT;
+
+		create_buffer(sizeof(scene_mesh_vertices),
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_scene_data.vertex_buffer, &vk_scene_data.vertex_memory);
+		upload_buffer(vk_scene_data.vertex_buffer, vertices,
+				sizeof(scene_mesh_vertices));
+
+		create_buffer(sizeof(scene_mesh_indices),
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_scene_data.index_buffer, &vk_scene_data.index_memory);
+		upload_buffer(vk_scene_data.index_buffer, indices,
+				sizeof(scene_mesh_indices));
+
+		/* A cube grid around the camera. */
+		uint32_t side = (uint32_t)ceilf(cbrtf((float)object_count));
+		float spacing = 4.0f;
+		vk_scene_data.grid_extent = side * spacing;
+
+		size_t objects_size = sizeof(SceneObject) * object_count;
+		SceneObject* objects = malloc(objects_size);
+		srand(42);
+		for (uint32_t i = 0; i < object_count; ++i) {
+			float x = ((float)(i % side) - side * 0.5f) * spacing;
+			float y = ((float)((i / side) % side) - side * 0.5f) * spacing;
+			float z = ((float)(i / (side * side)) - side * 0.5f) * spacing;
+			float scale = 0.5f + (float)rand() / (float)RAND_MAX;
+
+			memset(&objects[i].model, 0, sizeof(Mat4));
+			objects[i].model.m[0] = scale;
+			objects[i].model.m[5] = scale;
+			objects[i].model.m[10] = scale;
+			objects[i].model.m[12] = x;
+			objects[i].model.m[13] = y;
+			objects[i].model.m[14] = z;
+			objects[i].model.m[15] = 1.0f;
+
+			objects[i].bounds[0] = x;
+			objects[i].bounds[1] = y;
+			objects[i].bounds[2] = z;
+			objects[i].bounds[3] = scale;
+		}
+
+		create_buffer(objects_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_scene_data.object_buffer, &vk_scene_data.object_memory);
+		upload_buffer(vk_scene_data.object_buffer, objects, objects_size);
+
+		if (vk_options.occlusion) {
+			vk_scene_data.bounds = malloc(sizeof(float) * 4 * object_count);
+			for (uint32_t i = 0; i < object_count; ++i) {
+				memcpy(vk_scene_data.bounds[i], objects[i].bounds,
+						sizeof(float) * 4);
+			}
+		}
+		free(objects);
+	}
+
+	/* Per frame draw and count buffers. */
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		create_buffer(sizeof(VkDrawIndexedIndirectCommand) * object_count,
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_scene_data.draw_buffers[i],
+				&vk_scene_data.draw_memories[i]);
+		create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_scene_data.count_buffers[i],
+				&vk_scene_data.count_memories[i]);
+	}
+
+	/* Into the bindless table. */
+	vk_scene_data.object_slot = bindless_add_buffer(vk_scene_data.object_buffer,
+			0, VK_WHOLE_SIZE);
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		vk_scene_data.draw_slots[i] = bindless_add_buffer(
+				vk_scene_data.draw_buffers[i], 0, VK_WHOLE_SIZE);
+		vk_scene_data.count_slots[i] = bindless_add_buffer(
+				vk_scene_data.count_buffers[i], 0, VK_WHOLE_SIZE);
+	}
+
+	if (vk_options.occlusion) {
+		init_scene_occlusion();
+	}
+
+	/* Cull compute and scene graphics pipelines. */
+	hot_reload_register("scene cull", &vk_scene_data.cull_pipeline,
+			build_scene_cull_pipeline, bindless_spv("win_vulkan_cull_comp.spv",
+					"win_vulkan_cull_comp_fixed.spv"), NULL, NULL);
+	hot_reload_register("scene draw", &vk_scene_data.draw_pipeline,
+			build_scene_draw_pipeline, bindless_spv("win_vulkan_scene_vert.spv",
+					"win_vulkan_scene_vert_fixed.spv"),
+			"win_vulkan_frag.spv", NULL);
+
+	printf("GPU driven scene : %d objects, %s\n", object_count,
+			vk_extensions_data.draw_indirect_count
+					? "indirect count" : "indirect, culled draws are empty");
+}
+
+void deinit_vk_scene()
+{
+	if (vk_scene_data.object_count == 0)
+		return;
+
+	deinit_scene_occlusion();
+
+	vkDestroyPipeline(vk_data.device, vk_scene_data.draw_pipeline,
+			vk_allocator);
+	vkDestroyPipeline(vk_data.device, vk_scene_data.cull_pipeline,
+			vk_allocator);
+
+	bindless_release(BINDLESS_STORAGE_BUFFER, vk_scene_data.object_slot);
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		bindless_release(BINDLESS_STORAGE_BUFFER, vk_scene_data.draw_slots[i]);
+		bindless_release(BINDLESS_STORAGE_BUFFER,
+				vk_scene_data.count_slots[i]);
+	}
+
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		vkDestroyBuffer(vk_data.device, vk_scene_data.draw_buffers[i],
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_scene_data.draw_memories[i],
+				vk_allocator);
+		vkDestroyBuffer(vk_data.device, vk_scene_data.count_buffers[i],
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_scene_data.count_memories[i],
+				vk_allocator);
+	}
+
+	vkDestroyBuffer(vk_data.device, vk_scene_data.object_buffer, vk_allocator);
+	vkFreeMemory(vk_data.device, vk_scene_data.object_memory, vk_allocator);
+	vkDestroyBuffer(vk_data.device, vk_scene_data.index_buffer, vk_allocator);
+	vkFreeMemory(vk_data.device, vk_scene_data.index_memory, vk_allocator);
+	vkDestroyBuffer(vk_data.device, vk_scene_data.vertex_buffer, vk_allocator);
+	vkFreeMemory(vk_data.device, vk_scene_data.vertex_memory, vk_allocator);
+}
+
+/* Camera spins in place, in the middle of the grid. */
+void update_scene_camera()
+{
+	float angle = (float)(time_ms() * 0.0003);
+	float eye[3] = { 0.0f, 0.0f, 0.0f };
+	float center[3] = { cosf(angle), 0.2f, sinf(angle) };
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+
+	float aspect = (float)vk_surface_data.extent_2d.width
+			/ (float)vk_surface_data.extent_2d.height;
+	Mat4 proj = mat4_perspective(1.0f, aspect, 0.1f,
+			vk_scene_data.grid_extent);
+	Mat4 view = mat4_look_at(eye, center, up);
+
+	vk_scene_data.view_proj = mat4_mul(proj, view);
+	mat4_frustum_planes(vk_scene_data.view_proj, vk_scene_data.planes);
+}
+
+/* Outside any render pass, before drawing. The render graph, or the async
+ * compute semaphore, syncs the results with the draw.
+ */
+void record_scene_cull(VkCommandBuffer cmd, uint32_t frame_slot)
+{
+	CullConstants constants = {
+		.object_count			= vk_scene_data.object_count
+		, .index_count			= vk_scene_data.index_count
+		, .compact				= vk_extensions_data.draw_indirect_count
+		, .objects				= vk_scene_data.object_slot
+		, .draws				= vk_scene_data.draw_slots[frame_slot]
+		, .count				= vk_scene_data.count_slots[frame_slot]
+		, .visibility			= vk_scene_data.occlusion
+				? vk_scene_data.visibility_slots[frame_slot] : UINT32_MAX
+	};
+	memcpy(constants.planes, vk_scene_data.planes, sizeof(constants.planes));
+
+	if (vk_scene_data.occlusion) {
+		cull_scene_occlusion(frame_slot);
+	}
+
+	vkCmdFillBuffer(cmd, vk_scene_data.count_buffers[frame_slot], 0,
+			sizeof(uint32_t), 0);
+
+	VkMemoryBarrier barrier_from_fill_to_cull = {
+		.sType					= VK_STRUCTURE_TYPE_MEMORY_BARRIER
+		, .pNext				= NULL
+		, .srcAccessMask		= VK_ACCESS_TRANSFER_WRITE_BIT
+		, .dstAccessMask		= VK_ACCESS_SHADER_READ_BIT
+				| VK_ACCESS_SHADER_WRITE_BIT
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &barrier_from_fill_to_cull, 0, NULL, 0, NULL);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+			vk_scene_data.cull_pipeline);
+	bindless_push(cmd, &constants, sizeof(constants));
+	vkCmdDispatch(cmd, (vk_scene_data.object_count + 63) / 64, 1, 1);
+}
+
+/* Inside the draw pass. One call, whatever the object count. */
+void record_scene_draw(VkCommandBuffer cmd, uint32_t frame_slot)
+{
+	VkDeviceSize vertex_offset = 0;
+	SceneDrawConstants constants = {
+		.view_proj				= vk_scene_data.view_proj
+		, .objects				= vk_scene_data.object_slot
+	};
+
+	/* Until its variant is compiled, the scene keeps its own pipeline. */
+	VkPipeline pipeline = vk_scene_data.draw_pipeline;
+	if (vk_variants.count > 0) {
+		VariantKey key = scene_variant_key();
+		VkPipeline variant = get_pipeline_variant(&key);
+		if (variant != VK_NULL_HANDLE) {
+			pipeline = variant;
+		}
+	}
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	bindless_push(cmd, &constants, sizeof(constants));
+	vkCmdBindVertexBuffers(cmd, 0, 1, &vk_scene_data.vertex_buffer,
+			&vertex_offset);
+	vkCmdBindIndexBuffer(cmd, vk_scene_data.index_buffer, 0,
+			VK_INDEX_TYPE_UINT32);
+
+	if (vk_extensions_data.draw_indirect_count) {
+		vk_ext_pfn.vkCmdDrawIndexedIndirectCount(cmd,
+				vk_scene_data.draw_buffers[frame_slot], 0,
+				vk_scene_data.count_buffers[frame_slot], 0,
+				vk_scene_data.object_count,
+				sizeof(VkDrawIndexedIndirectCommand));
+	} else {
+		vkCmdDrawIndexedIndirect(cmd, vk_scene_data.draw_buffers[frame_slot],
+				0, vk_scene_data.object_count,
+				sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+/* Synthetic compute load, see win_vulkan_load.comp. Each frame slot works on
+ * its own slice of the buffer.
+ */
+#define COMPUTE_LOAD_INVOCATIONS (64 * 1024)
+
+typedef struct ComputeLoadConstants {
+	uint32_t		iterations;
+	/* Bindless buffer index. */
+	uint32_t		values;
+} ComputeLoadConstants;
+
+typedef struct ComputeLoadData {
+	uint32_t				iterations;
+	VkBuffer				buffer;
+	VkDeviceMemory			memory;
+	uint32_t				slots[FRAMES_IN_FLIGHT];
+	VkPipeline				pipeline;
+} ComputeLoadData;
+
+ComputeLoadData vk_compute_load_data = {0};
+
+VkPipeline build_compute_load_pipeline()
+{
+	VkShaderModule load_module = try_create_shader_module(bindless_spv(
+			"win_vulkan_load_comp.spv", "win_vulkan_load_comp_fixed.spv"));
+	VkPipeline pipeline = create_compute_pipeline(load_module,
+			vk_bindless_data.layout);
+	vkDestroyShaderModule(vk_data.device, load_module, vk_allocator);
+	return pipeline;
+}
+
+void init_vk_compute_load()
+{
+	if (vk_bindless_data.set == VK_NULL_HANDLE) {
+		printf("Compute load needs the bindless table.\n");
+		exit(-1);
+	}
+
+	vk_compute_load_data.iterations = vk_options.compute_load;
+	VkDeviceSize slice_size = sizeof(float) * 4 * COMPUTE_LOAD_INVOCATIONS;
+
+	create_buffer(slice_size * FRAMES_IN_FLIGHT,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&vk_compute_load_data.buffer, &vk_compute_load_data.memory);
+
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		vk_compute_load_data.slots[i] = bindless_add_buffer(
+				vk_compute_load_data.buffer, slice_size * i, slice_size);
+	}
+
+	hot_reload_register("compute load", &vk_compute_load_data.pipeline,
+			build_compute_load_pipeline,
+			bindless_spv("win_vulkan_load_comp.spv",
+					"win_vulkan_load_comp_fixed.spv"), NULL, NULL);
+
+	printf("Compute load : %d iterations\n", vk_compute_load_data.iterations);
+}
+
+void deinit_vk_compute_load()
+{
+	if (vk_compute_load_data.iterations == 0)
+		return;
+
+	vkDestroyPipeline(vk_data.device, vk_compute_load_data.pipeline,
+			vk_allocator);
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		bindless_release(BINDLESS_STORAGE_BUFFER,
+				vk_compute_load_data.slots[i]);
+	}
+	vkDestroyBuffer(vk_data.device, vk_compute_load_data.buffer, vk_allocator);
+	vkFreeMemory(vk_data.device, vk_compute_load_data.memory, vk_allocator);
+}
+
+void record_compute_load(VkCommandBuffer cmd, uint32_t frame_slot)
+{
+	ComputeLoadConstants constants = {
+		.iterations				= vk_compute_load_data.iterations
+		, .values				= vk_compute_load_data.slots[frame_slot]
+	};
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+			vk_compute_load_data.pipeline);
+	bindless_push(cmd, &constants, sizeof(constants));
+	vkCmdDispatch(cmd, COMPUTE_LOAD_INVOCATIONS / 64, 1, 1);
+}
+
+bool has_compute_work()
+{
+	return vk_scene_data.object_count > 0
+			|| vk_compute_load_data.iterations > 0;
+}
+
+/* Compute for the async queue. The semaphore the graphics submit waits on
+ * makes the results visible. Not timed, timestamps are on the graphics queue.
+ */
+void record_compute_work(FrameData* frame, VkCommandBuffer cmd)
+{
+	uint32_t frame_slot = (uint32_t)(frame - vk_frames);
+
+	if (vk_compute_load_data.iterations > 0) {
+		record_compute_load(cmd, frame_slot);
+	}
+	if (vk_scene_data.object_count > 0) {
+		record_scene_cull(cmd, frame_slot);
+	}
+}
+
+void record_compute_cmd_buffer(FrameData* frame)
+{
+	VkCommandBufferBeginInfo cmd_buffer_begin_info = {
+		.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+		, .pNext				= NULL
+		, .flags				= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+		, .pInheritanceInfo		= NULL
+	};
+
+	vk_error(vkBeginCommandBuffer(frame->compute_cmd_buffer,
+			&cmd_buffer_begin_info));
+	bindless_bind(frame->compute_cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE);
+	record_compute_work(frame, frame->compute_cmd_buffer);
+	vk_error(vkEndCommandBuffer(frame->compute_cmd_buffer));
+}
+
+/* Dense mesh. A grid of finely tessellated spheres, drawn either with the
+ * classic vertex pipeline, or split in meshlets for the mesh shader pipeline.
+ * There, the task shader culls whole meshlets against the frustum and their
+ * normal cone, and the mesh shader culls the remaining back facing
+ * triangles. The classic pipeline leaves all of it to the rasterizer.
+ */
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_TASK_GROUP 32
+#define DENSE_MESH_GRID_SIDE 8
+
+/* Bounds and cone are tested together, see win_vulkan_mesh.task. */
+typedef struct Meshlet {
+	/* Center, radius. */
+	float			bounds[4];
+	/* Axis, cutoff. */
+	float			cone[4];
+	uint32_t		vertex_offset;
+	uint32_t		triangle_offset;
+	uint32_t		vertex_count;
+	uint32_t		triangle_count;
+} Meshlet;
+
+typedef struct MeshCamera {
+	Mat4			view_proj;
+	float			eye[4];
+	float			planes[6][4];
+} MeshCamera;
+
+/* Bindless buffer indices, and the instance grid. */
+typedef struct MeshConstants {
+	uint32_t		camera;
+	uint32_t		positions;
+	uint32_t		meshlets;
+	uint32_t		meshlet_vertices;
+	uint32_t		meshlet_triangles;
+	uint32_t		meshlet_count;
+	uint32_t		grid_side;
+	float			spacing;
+} MeshConstants;
+
+typedef struct DenseMeshData {
+	uint32_t				triangle_count;
+	uint32_t				index_count;
+	uint32_t				meshlet_count;
+	bool					use_mesh_shader;
+	/* Pixels per unit at distance 1, from the last camera. */
+	float					pixel_scale;
+
+	VkBuffer				vertex_buffer;
+	VkDeviceMemory			vertex_memory;
+	VkBuffer				index_buffer;
+	VkDeviceMemory			index_memory;
+	VkBuffer				meshlet_buffer;
+	VkDeviceMemory			meshlet_memory;
+	VkBuffer				meshlet_vertex_buffer;
+	VkDeviceMemory			meshlet_vertex_memory;
+	VkBuffer				meshlet_triangle_buffer;
+	VkDeviceMemory			meshlet_triangle_memory;
+
+	/* Written every frame, persistently mapped. */
+	VkBuffer				camera_buffers[FRAMES_IN_FLIGHT];
+	VkDeviceMemory			camera_memories[FRAMES_IN_FLIGHT];
+	MeshCamera*				cameras[FRAMES_IN_FLIGHT];
+
+	uint32_t				position_slot;
+	uint32_t				meshlet_slot;
+	uint32_t				meshlet_vertex_slot;
+	uint32_t				meshlet_triangle_slot;
+	uint32_t				camera_slots[FRAMES_IN_FLIGHT];
+
+	VkPipeline				vertex_pipeline;
+	VkPipeline				mesh_pipeline;
+} DenseMeshData;
+
+DenseMeshData vk_dense_mesh_data = {0};
+
+/* Greedy, in index order. A meshlet closes when the next triangle would
+ * overflow its vertices or triangles. Triangles are packed 8 bits per local
+ * index. Returns the meshlet count.
+ */
+uint32_t build_meshlets(const float* positions, uint32_t vertex_count,
+		const uint32_t* indices, uint32_t index_count, Meshlet* meshlets,
+		uint32_t* meshlet_vertices, uint32_t* meshlet_triangles)
+{
+	/* Which meshlet last used a vertex, and where. */
+	uint32_t* owner = malloc(sizeof(uint32_t) * vertex_count);
+	uint8_t* local = malloc(vertex_count);
+	memset(owner, 0xff, sizeof(uint32_t) * vertex_count);
+
+	uint32_t meshlet_count = 0;
+	uint32_t vertex_offset = 0;
+	uint32_t triangle_offset = 0;
+	Meshlet* m = NULL;
+
+	for (uint32_t t = 0; t < index_count / 3; ++t) {
+		const uint32_t* tri = &indices[t * 3];
+
+		uint32_t new_vertices = 0;
+		for (int c = 0; c < 3; ++c) {
+			new_vertices += (m == NULL || owner[tri[c]] != meshlet_count - 1)
+					? 1 : 0;
+		}
+
+		if (m == NULL
+				|| m->vertex_count + new_vertices > MESHLET_MAX_VERTICES
+				|| m->triangle_count == MESHLET_MAX_TRIANGLES)
+		{
+			if (m != NULL) {
+				vertex_offset += m->vertex_count;
+				triangle_offset += m->triangle_count;
+			}
+			m = &meshlets[meshlet_count++];
+			*m = (Meshlet){
+				.vertex_offset		= vertex_offset
+				, .triangle_offset	= triangle_offset
+			};
+		}
+
+		uint32_t packed = 0;
+		for (int c = 0; c < 3; ++c) {
+			uint32_t v = tri[c];
+			if (owner[v] != meshlet_count - 1) {
+				owner[v] = meshlet_count - 1;
+				local[v] = (uint8_t)m->vertex_count;
+				meshlet_vertices[vertex_offset + m->vertex_count++] = v;
+			}
+			packed |= (uint32_t)local[v] << (c * 8);
+		}
+		meshlet_triangles[triangle_offset + m->triangle_count++] = packed;
+	}
+
+	free(local);
+	free(owner);
+
+	/* Bounds around the vertex average, cone around the average normal. */
+	for (uint32_t i = 0; i < meshlet_count; ++i) {
+		m = &meshlets[i];
+		const uint32_t* verts = &meshlet_vertices[m->vertex_offset];
+		const uint32_t* tris = &meshlet_triangles[m->triangle_offset];
+
+		float center[3] = { 0.0f, 0.0f, 0.0f };
+		for (uint32_t v = 0; v < m->vertex_count; ++v) {
+			for (int c = 0; c < 3; ++c) {
+				center[c] += positions[verts[v] * 4 + c] / m->vertex_count;
+			}
+		}
+
+		float radius = 0.0f;
+		for (uint32_t v = 0; v < m->vertex_count; ++v) {
+			const float* p = &positions[verts[v] * 4];
+			float d[3] = { p[0] - center[0], p[1] - center[1], p[2] - center[2] };
+			float dist = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+			if (dist > radius) {
+				radius = dist;
+			}
+		}
+
+		float normals[MESHLET_MAX_TRIANGLES][3];
+		float axis[3] = { 0.0f, 0.0f, 0.0f };
+		for (uint32_t t = 0; t < m->triangle_count; ++t) {
+			const float* a = &positions[verts[tris[t] & 0xff] * 4];
+			const float* b = &positions[verts[(tris[t] >> 8) & 0xff] * 4];
+			const float* c = &positions[verts[(tris[t] >> 16) & 0xff] * 4];
+			float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = {
+				e0[1] * e1[2] - e0[2] * e1[1]
+				, e0[2] * e1[0] - e0[0] * e1[2]
+				, e0[0] * e1[1] - e0[1] * e1[0]
+			};
+			float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int k = 0; k < 3; ++k) {
+				normals[t][k] = len > 0.0f ? n[k] / len : 0.0f;
+				axis[k] += normals[t][k];
+			}
+		}
+
+		float axis_len = sqrtf(axis[0] * axis[0] + axis[1] * axis[1]
+				+ axis[2] * axis[2]);
+		float min_dot = 1.0f;
+		for (uint32_t t = 0; t < m->triangle_count; ++t) {
+			float d = axis_len > 0.0f
+					? (normals[t][0] * axis[0] + normals[t][1] * axis[1]
+							+ normals[t][2] * axis[2]) / axis_len
+					: -1.0f;
+			if (d < min_dot) {
+				min_dot = d;
+			}
+		}
+
+		/* All normals within acos(min_dot) of the axis. The whole meshlet
+		 * faces away when the view direction is within 90 degrees minus
+		 * that of the axis. A cutoff of 1 never culls.
+		 */
+		m->bounds[0] = center[0];
+		m->bounds[1] = center[1];
+		m->bounds[2] = center[2];
+		m->bounds[3] = radius;
+		for (int k = 0; k < 3; ++k) {
+			m->cone[k] = axis_len > 0.0f ? axis[k] / axis_len : 0.0f;
+		}
+		m->cone[3] = min_dot > 0.0f ? sqrtf(1.0f - min_dot * min_dot) : 1.0f;
+	}
+
+	return meshlet_count;
+}
+
+/* Counter clockwise from outside. Pole triangles that collapse are skipped.
+ * Positions are padded to 4 floats for the storage buffer.
+ */
+void build_sphere(uint32_t segments, float** out_positions,
+		uint32_t* out_vertex_count, uint32_t** out_indices,
+		uint32_t* out_index_count)
+{
+	uint32_t rings = segments / 2;
+	uint32_t vertex_count = (rings + 1) * (segments + 1);
+	float* positions = malloc(sizeof(float) * 4 * vertex_count);
+
+	const float pi = 3.14159265f;
+	for (uint32_t r = 0; r <= rings; ++r) {
+		float theta = pi * (float)r / (float)rings;
+		for (uint32_t s = 0; s <= segments; ++s) {
+			float phi = 2.0f * pi * (float)s / (float)segments;
+			float* p = &positions[(r * (segments + 1) + s) * 4];
+			p[0] = sinf(theta) * cosf(phi);
+			p[1] = cosf(theta);
+			p[2] = sinf(theta) * sinf(phi);
+			p[3] = 1.0f;
+		}
+	}
+
+	uint32_t* indices = malloc(sizeof(uint32_t) * 6 * rings * segments);
+	uint32_t index_count = 0;
+	for (uint32_t r = 0; r < rings; ++r) {
+		for (uint32_t s = 0; s < segments; ++s) {
+			uint32_t a = r * (segments + 1) + s;
+			uint32_t b = a + segments + 1;
+			uint32_t c = b + 1;
+			uint32_t d = a + 1;
+
+			if (r != rings - 1) {
+				indices[index_count++] = a;
+				indices[index_count++] = c;
+				indices[index_count++] = b;
+			}
+			if (r != 0) {
+				indices[index_count++] = a;
+				indices[index_count++] = d;
+				indices[index_count++] = c;
+			}
+		}
+	}
+
+	*out_positions = positions;
+	*out_vertex_count = vertex_count;
+	*out_indices = indices;
+	*out_index_count = index_count;
+}
+
+VkPipeline build_dense_mesh_vertex_pipeline()
+{
+	VkVertexInputBindingDescription vertex_binding = {
+		.binding				= 0
+		, .stride				= sizeof(float) * 4
+		, .inputRate			= VK_VERTEX_INPUT_RATE_VERTEX
+	};
+	VkVertexInputAttributeDescription vertex_attribute = {
+		.location				= 0
+		, .binding				= 0
+		, .format				= VK_FORMAT_R32G32B32_SFLOAT
+		, .offset				= 0
+	};
+	VkPipelineVertexInputStateCreateInfo vertex_input_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .vertexBindingDescriptionCount	= 1
+		, .pVertexBindingDescriptions		= &vertex_binding
+		, .vertexAttributeDescriptionCount	= 1
+		, .pVertexAttributeDescriptions		= &vertex_attribute
+	};
+
+	VkShaderModule vert_module = try_create_shader_module(bindless_spv(
+			"win_vulkan_mesh_vert.spv", "win_vulkan_mesh_vert_fixed.spv"));
+	VkShaderModule frag_module =
+			try_create_shader_module("win_vulkan_frag.spv");
+
+	VkPipeline pipeline = create_graphics_pipeline(vert_module, frag_module,
+			vk_bindless_data.layout, &vertex_input_create_info,
+			VK_CULL_MODE_BACK_BIT);
+
+	vkDestroyShaderModule(vk_data.device, vert_module, vk_allocator);
+	vkDestroyShaderModule(vk_data.device, frag_module, vk_allocator);
+	return pipeline;
+}
+
+VkPipeline build_dense_mesh_pipeline()
+{
+	VkShaderModule task_module =
+			try_create_shader_module("win_vulkan_mesh_task.spv");
+	VkShaderModule mesh_module =
+			try_create_shader_module("win_vulkan_mesh_mesh.spv");
+	VkShaderModule frag_module =
+			try_create_shader_module("win_vulkan_frag.spv");
+
+	VkPipeline pipeline = create_mesh_pipeline(task_module, mesh_module,
+			frag_module, vk_bindless_data.layout, VK_CULL_MODE_BACK_BIT);
+
+	vkDestroyShaderModule(vk_data.device, task_module, vk_allocator);
+	vkDestroyShaderModule(vk_data.device, mesh_module, vk_allocator);
+	vkDestroyShaderModule(vk_data.device, frag_module, vk_allocator);
+	return pipeline;
+}
+
+void init_vk_dense_mesh()
+{
+	if (vk_bindless_data.set == VK_NULL_HANDLE) {
+		printf("Dense mesh needs the bindless table.\n");
+		exit(-1);
+	}
+
+	/* Geometry and meshlets. */
+	{
+		float* positions;
+		uint32_t vertex_count;
+		uint32_t* indices;
+		uint32_t index_count;
+		build_sphere(vk_options.dense_mesh_segments, &positions, &vertex_count,
+				&indices, &index_count);
+
+		uint32_t triangle_count = index_count / 3;
+		vk_dense_mesh_data.index_count = index_count;
+		vk_dense_mesh_data.triangle_count = triangle_count;
+
+		/* Worst cases, every triangle its own meshlet. */
+		Meshlet* meshlets = malloc(sizeof(Meshlet) * triangle_count);
+		uint32_t* meshlet_vertices = malloc(sizeof(uint32_t) * index_count);
+		uint32_t* meshlet_triangles = malloc(sizeof(uint32_t) * triangle_count);
+		uint32_t meshlet_count = build_meshlets(positions, vertex_count,
+				indices, index_count, meshlets, meshlet_vertices,
+				meshlet_triangles);
+		vk_dense_mesh_data.meshlet_count = meshlet_count;
+
+		uint32_t meshlet_vertex_count =
+				meshlets[meshlet_count - 1].vertex_offset
+				+ meshlets[meshlet_count - 1].vertex_count;
+
+		VkDeviceSize positions_size = sizeof(float) * 4 * vertex_count;
+		create_buffer(positions_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+						| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_dense_mesh_data.vertex_buffer,
+				&vk_dense_mesh_data.vertex_memory);
+		upload_buffer(vk_dense_mesh_data.vertex_buffer, positions,
+				positions_size);
+
+		VkDeviceSize indices_size = sizeof(uint32_t) * index_count;
+		/* The software raster resolve reads triangles back from it. */
+		create_buffer(indices_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+						| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_dense_mesh_data.index_buffer,
+				&vk_dense_mesh_data.index_memory);
+		upload_buffer(vk_dense_mesh_data.index_buffer, indices, indices_size);
+
+		VkDeviceSize meshlets_size = sizeof(Meshlet) * meshlet_count;
+		create_buffer(meshlets_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_dense_mesh_data.meshlet_buffer,
+				&vk_dense_mesh_data.meshlet_memory);
+		upload_buffer(vk_dense_mesh_data.meshlet_buffer, meshlets,
+				meshlets_size);
+
+		VkDeviceSize meshlet_vertices_size =
+				sizeof(uint32_t) * meshlet_vertex_count;
+		create_buffer(meshlet_vertices_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_dense_mesh_data.meshlet_vertex_buffer,
+				&vk_dense_mesh_data.meshlet_vertex_memory);
+		upload_buffer(vk_dense_mesh_data.meshlet_vertex_buffer,
+				meshlet_vertices, meshlet_vertices_size);
+
+		VkDeviceSize meshlet_triangles_size = sizeof(uint32_t) * triangle_count;
+		create_buffer(meshlet_triangles_size,
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_dense_mesh_data.meshlet_triangle_buffer,
+				&vk_dense_mesh_data.meshlet_triangle_memory);
+		upload_buffer(vk_dense_mesh_data.meshlet_triangle_buffer,
+				meshlet_triangles, meshlet_triangles_size);
+
+		free(meshlet_triangles);
+		free(meshlet_vertices);
+		free(meshlets);
+		free(indices);
+		free(positions);
+	}
+
+	/* Per frame cameras. */
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		create_buffer(sizeof(MeshCamera), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+						| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&vk_dense_mesh_data.camera_buffers[i],
+				&vk_dense_mesh_data.camera_memories[i]);
+		vk_error(vkMapMemory(vk_data.device,
+				vk_dense_mesh_data.camera_memories[i], 0, sizeof(MeshCamera),
+				0, (void**)&vk_dense_mesh_data.cameras[i]));
+	}
+
+	/* Into the bindless table. */
+	vk_dense_mesh_data.position_slot = bindless_add_buffer(
+			vk_dense_mesh_data.vertex_buffer, 0, VK_WHOLE_SIZE);
+	vk_dense_mesh_data.meshlet_slot = bindless_add_buffer(
+			vk_dense_mesh_data.meshlet_buffer, 0, VK_WHOLE_SIZE);
+	vk_dense_mesh_data.meshlet_vertex_slot = bindless_add_buffer(
+			vk_dense_mesh_data.meshlet_vertex_buffer, 0, VK_WHOLE_SIZE);
+	vk_dense_mesh_data.meshlet_triangle_slot = bindless_add_buffer(
+			vk_dense_mesh_data.meshlet_triangle_buffer, 0, VK_WHOLE_SIZE);
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		vk_dense_mesh_data.camera_slots[i] = bindless_add_buffer(
+				vk_dense_mesh_data.camera_buffers[i], 0, VK_WHOLE_SIZE);
+	}
+
+	/* Both pipelines cull back faces, so they draw the same thing. */
+	hot_reload_register("dense mesh vertex",
+			&vk_dense_mesh_data.vertex_pipeline,
+			build_dense_mesh_vertex_pipeline,
+			bindless_spv("win_vulkan_mesh_vert.spv",
+					"win_vulkan_mesh_vert_fixed.spv"),
+			"win_vulkan_frag.spv", NULL);
+	if (vk_extensions_data.mesh_shader) {
+		hot_reload_register("dense mesh", &vk_dense_mesh_data.mesh_pipeline,
+				build_dense_mesh_pipeline, "win_vulkan_mesh_task.spv",
+				"win_vulkan_mesh_mesh.spv", "win_vulkan_frag.spv");
+	} else if (vk_options.mesh_shader) {
+		printf("No mesh shader support, using the vertex pipeline.\n");
+	}
+
+	vk_dense_mesh_data.use_mesh_shader = vk_extensions_data.mesh_shader;
+
+	printf("Dense mesh : %d instances of %d triangles, %d meshlets, %s\n",
+			DENSE_MESH_GRID_SIDE * DENSE_MESH_GRID_SIDE,
+			vk_dense_mesh_data.triangle_count,
+			vk_dense_mesh_data.meshlet_count,
+			vk_dense_mesh_data.use_mesh_shader ? "mesh shader" : "vertex shader");
+}
+
+void deinit_vk_dense_mesh()
+{
+	if (vk_dense_mesh_data.triangle_count == 0)
+		return;
+
+	if (vk_dense_mesh_data.mesh_pipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(vk_data.device, vk_dense_mesh_data.mesh_pipeline,
+				vk_allocator);
+	}
+	vkDestroyPipeline(vk_data.device, vk_dense_mesh_data.vertex_pipeline,
+			vk_allocator);
+
+	bindless_release(BINDLESS_STORAGE_BUFFER, vk_dense_mesh_data.position_slot);
+	bindless_release(BINDLESS_STORAGE_BUFFER, vk_dense_mesh_data.meshlet_slot);
+	bindless_release(BINDLESS_STORAGE_BUFFER,
+			vk_dense_mesh_data.meshlet_vertex_slot);
+	bindless_release(BINDLESS_STORAGE_BUFFER,
+			vk_dense_mesh_data.meshlet_triangle_slot);
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		bindless_release(BINDLESS_STORAGE_BUFFER,
+				vk_dense_mesh_data.camera_slots[i]);
+	}
+
+	VkBuffer buffers[] = {
+		vk_dense_mesh_data.vertex_buffer
+		, vk_dense_mesh_data.index_buffer
+		, vk_dense_mesh_data.meshlet_buffer
+		, vk_dense_mesh_data.meshlet_vertex_buffer
+		, vk_dense_mesh_data.meshlet_triangle_buffer
+	};
+	VkDeviceMemory memories[] = {
+		vk_dense_mesh_data.vertex_memory
+		, vk_dense_mesh_data.index_memory
+		, vk_dense_mesh_data.meshlet_memory
+		, vk_dense_mesh_data.meshlet_vertex_memory
+		, vk_dense_mesh_data.meshlet_triangle_memory
+	};
+	for (int i = 0; i < 5; ++i) {
+		vkDestroyBuffer(vk_data.device, buffers[i], vk_allocator);
+		vkFreeMemory(vk_data.device, memories[i], vk_allocator);
+	}
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		vkDestroyBuffer(vk_data.device, vk_dense_mesh_data.camera_buffers[i],
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_dense_mesh_data.camera_memories[i],
+				vk_allocator);
+	}
+}
+
+/* Orbits the grid, looking at its center. */
+void update_dense_mesh_camera(uint32_t frame_slot)
+{
+	float angle = (float)(time_ms() * 0.0002);
+	float distance = DENSE_MESH_GRID_SIDE * 2.5f;
+	float eye[3] = {
+		cosf(angle) * distance, distance * 0.4f, sinf(angle) * distance
+	};
+	float center[3] = { 0.0f, 0.0f, 0.0f };
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+
+	float aspect = (float)vk_surface_data.extent_2d.width
+			/ (float)vk_surface_data.extent_2d.height;
+	Mat4 proj = mat4_perspective(1.0f, aspect, 0.1f, distance * 3.0f);
+	Mat4 view = mat4_look_at(eye, center, up);
+
+	MeshCamera* camera = vk_dense_mesh_data.cameras[frame_slot];
+	camera->view_proj = mat4_mul(proj, view);
+	camera->eye[0] = eye[0];
+	camera->eye[1] = eye[1];
+	camera->eye[2] = eye[2];
+	camera->eye[3] = 1.0f;
+	mat4_frustum_planes(camera->view_proj, camera->planes);
+
+	/* The projection flips y. */
+	vk_dense_mesh_data.pixel_scale = fabsf(proj.m[5]) * 0.5f
+			* (float)vk_surface_data.extent_2d.height;
+}
+
+/* Inside the draw pass. Instances are laid out by the shaders. */
+void record_dense_mesh_draw(VkCommandBuffer cmd, uint32_t frame_slot)
+{
+	uint32_t instance_count = DENSE_MESH_GRID_SIDE * DENSE_MESH_GRID_SIDE;
+	MeshConstants constants = {
+		.camera					= vk_dense_mesh_data.camera_slots[frame_slot]
+		, .positions			= vk_dense_mesh_data.position_slot
+		, .meshlets				= vk_dense_mesh_data.meshlet_slot
+		, .meshlet_vertices		= vk_dense_mesh_data.meshlet_vertex_slot
+		, .meshlet_triangles	= vk_dense_mesh_data.meshlet_triangle_slot
+		, .meshlet_count		= vk_dense_mesh_data.meshlet_count
+		, .grid_side			= DENSE_MESH_GRID_SIDE
+		, .spacing				= 2.5f
+	};
+
+	if (vk_dense_mesh_data.use_mesh_shader) {
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+				vk_dense_mesh_data.mesh_pipeline);
+		bindless_push(cmd, &constants, sizeof(constants));
+
+		/* x is meshlet groups, y is the instance. */
+		vk_ext_pfn.vkCmdDrawMeshTasksEXT(cmd,
+				(vk_dense_mesh_data.meshlet_count + MESHLET_TASK_GROUP - 1)
+						/ MESHLET_TASK_GROUP,
+				instance_count, 1);
+		return;
+	}
+
+	VkDeviceSize vertex_offset = 0;
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			vk_dense_mesh_data.vertex_pipeline);
+	bindless_push(cmd, &constants, sizeof(constants));
+	vkCmdBindVertexBuffers(cmd, 0, 1, &vk_dense_mesh_data.vertex_buffer,
+			&vertex_offset);
+	vkCmdBindIndexBuffer(cmd, vk_dense_mesh_data.index_buffer, 0,
+			VK_INDEX_TYPE_UINT32);
+	vkCmdDrawIndexed(cmd, vk_dense_mesh_data.index_count, instance_count, 0, 0,
+			0);
+}
+
+/* Software raster of the dense mesh, for meshlets whose triangles cover about
+ * a pixel or less, where the hardware rasterizer wastes most of its quads.
+ * A compute pass classifies every meshlet of every instance by its estimated
+ * pixels per triangle. Small ones are rasterized right there, the others
+ * become indirect draws, like the GPU driven scene's. Both write the
+ * visibility buffer with 64-bit atomic min, depth in the high bits, instance
+ * and triangle in the low ones. A fullscreen pass shades it.
+ */
+#define SW_RASTER_GROUP 128
+/* Payload is instance << SW_RASTER_TRIANGLE_BITS | triangle, in 32 bits. */
+#define SW_RASTER_TRIANGLE_BITS 24
+
+/* MeshConstants, then the raster's own. See win_vulkan_swr.comp. */
+typedef struct SwRasterConstants {
+	MeshConstants	mesh;
+	uint32_t		visibility;
+	uint32_t		draws;
+	uint32_t		count;
+	uint32_t		compact;
+	uint32_t		indices;
+	uint32_t		width;
+	uint32_t		height;
+	float			threshold;
+	float			pixel_scale;
+} SwRasterConstants;
+
+typedef struct SwRasterData {
+	/* Off, the dense mesh draws the usual way. */
+	bool					active;
+	/* Pixels per triangle, meshlets under it are rasterized in compute. */
+	float					threshold;
+	/* Hardware draws of the last frame read, with indirect count only. */
+	uint32_t				hw_meshlet_count;
+
+	/* Sized on the extent, rebuilt with it. */
+	uint32_t				width;
+	uint32_t				height;
+	VkBuffer				visibility_buffers[FRAMES_IN_FLIGHT];
+	VkDeviceMemory			visibility_memories[FRAMES_IN_FLIGHT];
+	uint32_t				visibility_slots[FRAMES_IN_FLIGHT];
+
+	/* One per meshlet and instance. */
+	VkBuffer				draw_buffers[FRAMES_IN_FLIGHT];
+	VkDeviceMemory			draw_memories[FRAMES_IN_FLIGHT];
+	uint32_t				draw_slots[FRAMES_IN_FLIGHT];
+	/* Host visible, for the stats. */
+	VkBuffer				count_buffers[FRAMES_IN_FLIGHT];
+	VkDeviceMemory			count_memories[FRAMES_IN_FLIGHT];
+	uint32_t*				counts[FRAMES_IN_FLIGHT];
+	uint32_t				count_slots[FRAMES_IN_FLIGHT];
+	uint32_t				index_slot;
+
+	VkPipeline				raster_pipeline;
+	VkPipeline				hw_pipeline;
+	VkPipeline				resolve_pipeline;
+} SwRasterData;
+
+SwRasterData vk_sw_raster_data = {0};
+
+VkPipeline build_sw_raster_pipeline()
+{
+	VkShaderModule module = try_create_shader_module("win_vulkan_swr_comp.spv");
+	VkPipeline pipeline = create_compute_pipeline(module,
+			vk_bindless_data.layout);
+	vkDestroyShaderModule(vk_data.device, module, vk_allocator);
+	return pipeline;
+}
+
+/* Same input as the dense mesh vertex pipeline. Color writes are masked, the
+ * fragment shader only writes the visibility buffer.
+ */
+VkPipeline build_sw_raster_hw_pipeline()
+{
+	VkVertexInputBindingDescription vertex_binding = {
+		.binding				= 0
+		, .stride				= sizeof(float) * 4
+		, .inputRate			= VK_VERTEX_INPUT_RATE_VERTEX
+	};
+	VkVertexInputAttributeDescription vertex_attribute = {
+		.location				= 0
+		, .binding				= 0
+		, .format				= VK_FORMAT_R32G32B32_SFLOAT
+		, .offset				= 0
+	};
+	VkPipelineVertexInputStateCreateInfo vertex_input_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .vertexBindingDescriptionCount	= 1
+		, .pVertexBindingDescriptions		= &vertex_binding
+		, .vertexAttributeDescriptionCount	= 1
+		, .pVertexAttributeDescriptions		= &vertex_attribute
+	};
+
+	VkShaderModule vert_module =
+			try_create_shader_module("win_vulkan_vis_vert.spv");
+	VkShaderModule frag_module =
+			try_create_shader_module("win_vulkan_vis_frag.spv");
+
+	VkPipelineShaderStageCreateInfo stage_create_infos[] = {
+		{
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_VERTEX_BIT
+			, .module				= vert_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= NULL
+		}
+		, {
+			.sType					= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .stage				= VK_SHADER_STAGE_FRAGMENT_BIT
+			, .module				= frag_module
+			, .pName				= "main"
+			, .pSpecializationInfo	= NULL
+		}
+	};
+
+	VkPipelineColorBlendAttachmentState blend_state = {
+		.blendEnable			= VK_FALSE
+		, .srcColorBlendFactor	= VK_BLEND_FACTOR_ONE
+		, .dstColorBlendFactor	= VK_BLEND_FACTOR_ZERO
+		, .colorBlendOp			= VK_BLEND_OP_ADD
+		, .srcAlphaBlendFactor	= VK_BLEND_FACTOR_ONE
+		, .dstAlphaBlendFactor	= VK_BLEND_FACTOR_ZERO
+		, .alphaBlendOp			= VK_BLEND_OP_ADD
+		, .colorWriteMask		= 0
+	};
+
+	VkPipeline pipeline = create_pipeline_state(vk_data.pipeline_cache,
+			stage_create_infos, 2, vk_bindless_data.layout,
+			&vertex_input_create_info, VK_CULL_MODE_BACK_BIT,
+			VK_SAMPLE_COUNT_1_BIT, &blend_state);
+
+	vkDestroyShaderModule(vk_data.device, vert_module, vk_allocator);
+	vkDestroyShaderModule(vk_data.device, frag_module, vk_allocator);
+	return pipeline;
+}
+
+/* One triangle over the whole target, no vertex input. */
+VkPipeline build_sw_raster_resolve_pipeline()
+{
+	VkPipelineVertexInputStateCreateInfo vertex_input_create_info = {
+		.sType					= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
+		, .pNext				= NULL
+		, .flags				= 0
+		, .vertexBindingDescriptionCount	= 0
+		, .pVertexBindingDescriptions		= NULL
+		, .vertexAttributeDescriptionCount	= 0
+		, .pVertexAttributeDescriptions		= NULL
+	};
+
+	VkShaderModule vert_module =
+			try_create_shader_module("win_vulkan_resolve_vert.spv");
+	VkShaderModule frag_module =
+			try_create_shader_module("win_vulkan_resolve_frag.spv");
+
+	VkPipeline pipeline = create_graphics_pipeline(vert_module, frag_module,
+			vk_bindless_data.layout, &vertex_input_create_info,
+			VK_CULL_MODE_NONE);
+
+	vkDestroyShaderModule(vk_data.device, vert_module, vk_allocator);
+	vkDestroyShaderModule(vk_data.device, frag_module, vk_allocator);
+	return pipeline;
+}
+
+/* A uint64 per pixel, per frame slot. Call idle. */
+void create_sw_raster_targets()
+{
+	vk_sw_raster_data.width = vk_surface_data.extent_2d.width;
+	vk_sw_raster_data.height = vk_surface_data.extent_2d.height;
+	VkDeviceSize size = sizeof(uint64_t) * vk_sw_raster_data.width
+			* vk_sw_raster_data.height;
+
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		create_buffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_sw_raster_data.visibility_buffers[i],
+				&vk_sw_raster_data.visibility_memories[i]);
+		vk_sw_raster_data.visibility_slots[i] = bindless_add_buffer(
+				vk_sw_raster_data.visibility_buffers[i], 0, VK_WHOLE_SIZE);
+	}
+}
+
+void destroy_sw_raster_targets()
+{
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		if (vk_sw_raster_data.visibility_buffers[i] == VK_NULL_HANDLE)
+			continue;
+
+		bindless_release(BINDLESS_STORAGE_BUFFER,
+				vk_sw_raster_data.visibility_slots[i]);
+		vkDestroyBuffer(vk_data.device,
+				vk_sw_raster_data.visibility_buffers[i], vk_allocator);
+		vkFreeMemory(vk_data.device,
+				vk_sw_raster_data.visibility_memories[i], vk_allocator);
+		vk_sw_raster_data.visibility_buffers[i] = VK_NULL_HANDLE;
+	}
+}
+
+/* After the dense mesh. Falls back to drawing it the usual way when the
+ * device can't.
+ */
+void init_sw_raster()
+{
+	uint32_t instance_count = DENSE_MESH_GRID_SIDE * DENSE_MESH_GRID_SIDE;
+	uint32_t draw_count = vk_dense_mesh_data.meshlet_count * instance_count;
+
+	if (!vk_extensions_data.sw_raster) {
+		printf("No 64-bit buffer atomics, no software raster.\n");
+		return;
+	}
+	if (vk_bindless_data.fixed) {
+		printf("No descriptor indexing, no software raster.\n");
+		return;
+	}
+	/* --dense-mesh has no upper bound. */
+	if (vk_dense_mesh_data.triangle_count >= 1u << SW_RASTER_TRIANGLE_BITS
+			|| instance_count > 1u << (32 - SW_RASTER_TRIANGLE_BITS))
+	{
+		printf("Software raster ids need fewer than %u triangles, the mesh "
+				"has %d, no software raster.\n",
+				1u << SW_RASTER_TRIANGLE_BITS,
+				vk_dense_mesh_data.triangle_count);
+		return;
+	}
+	if (!vk_features_data.features2.features.multiDrawIndirect
+			|| !vk_features_data.features2.features.drawIndirectFirstInstance
+			|| vk_data.max_draw_indirect_count < draw_count)
+	{
+		printf("Software raster needs multi draw indirect with first "
+				"instance, for %d draws.\n", draw_count);
+		return;
+	}
+
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		create_buffer(sizeof(VkDrawIndexedIndirectCommand) * draw_count,
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vk_sw_raster_data.draw_buffers[i],
+				&vk_sw_raster_data.draw_memories[i]);
+		create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+						| VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+						| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+						| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&vk_sw_raster_data.count_buffers[i],
+				&vk_sw_raster_data.count_memories[i]);
+		vk_error(vkMapMemory(vk_data.device,
+				vk_sw_raster_data.count_memories[i], 0, sizeof(uint32_t), 0,
+				(void**)&vk_sw_raster_data.counts[i]));
+		*vk_sw_raster_data.counts[i] = 0;
+
+		vk_sw_raster_data.draw_slots[i] = bindless_add_buffer(
+				vk_sw_raster_data.draw_buffers[i], 0, VK_WHOLE_SIZE);
+		vk_sw_raster_data.count_slots[i] = bindless_add_buffer(
+				vk_sw_raster_data.count_buffers[i], 0, VK_WHOLE_SIZE);
+	}
+	vk_sw_raster_data.index_slot = bindless_add_buffer(
+			vk_dense_mesh_data.index_buffer, 0, VK_WHOLE_SIZE);
+
+	create_sw_raster_targets();
+
+	hot_reload_register("software raster", &vk_sw_raster_data.raster_pipeline,
+			build_sw_raster_pipeline, "win_vulkan_swr_comp.spv", NULL, NULL);
+	hot_reload_register("software raster hw",
+			&vk_sw_raster_data.hw_pipeline, build_sw_raster_hw_pipeline,
+			"win_vulkan_vis_vert.spv", "win_vulkan_vis_frag.spv", NULL);
+	hot_reload_register("software raster resolve",
+			&vk_sw_raster_data.resolve_pipeline,
+			build_sw_raster_resolve_pipeline, "win_vulkan_resolve_vert.spv",
+			"win_vulkan_resolve_frag.spv", NULL);
+
+	vk_sw_raster_data.threshold = vk_options.sw_raster_threshold;
+	vk_sw_raster_data.active = true;
+
+	printf("Software raster : under %.2f pixels per triangle, %s\n",
+			vk_sw_raster_data.threshold,
+			vk_extensions_data.draw_indirect_count
+					? "indirect count" : "indirect, software draws are empty");
+}
+
+void deinit_sw_raster()
+{
+	if (vk_sw_raster_data.raster_pipeline == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyPipeline(vk_data.device, vk_sw_raster_data.resolve_pipeline,
+			vk_allocator);
+	vkDestroyPipeline(vk_data.device, vk_sw_raster_data.hw_pipeline,
+			vk_allocator);
+	vkDestroyPipeline(vk_data.device, vk_sw_raster_data.raster_pipeline,
+			vk_allocator);
+
+	destroy_sw_raster_targets();
+
+	bindless_release(BINDLESS_STORAGE_BUFFER, vk_sw_raster_data.index_slot);
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		bindless_release(BINDLESS_STORAGE_BUFFER,
+				vk_sw_raster_data.draw_slots[i]);
+		bindless_release(BINDLESS_STORAGE_BUFFER,
+				vk_sw_raster_data.count_slots[i]);
+
+		vkDestroyBuffer(vk_data.device, vk_sw_raster_data.draw_buffers[i],
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_sw_raster_data.draw_memories[i],
+				vk_allocator);
+		vkDestroyBuffer(vk_data.device, vk_sw_raster_data.count_buffers[i],
+				vk_allocator);
+		vkFreeMemory(vk_data.device, vk_sw_raster_data.count_memories[i],
+				vk_allocator);
+	}
+}
+
+SwRasterConstants sw_raster_constants(uint32_t frame_slot)
+{
+	return (SwRasterConstants){
+		.mesh					= {
+			.camera				= vk_dense_mesh_data.camera_slots[frame_slot]
+			, .positions		= vk_dense_mesh_data.position_slot
+			, .meshlets			= vk_dense_mesh_data.meshlet_slot
+			, .meshlet_vertices	= vk_dense_mesh_data.meshlet_vertex_slot
+			, .meshlet_triangles	= vk_dense_mesh_data.meshlet_triangle_slot
+			, .meshlet_count	= vk_dense_mesh_data.meshlet_count
+			, .grid_side		= DENSE_MESH_GRID_SIDE
+			, .spacing			= 2.5f
+		}
+		, .visibility			= vk_sw_raster_data.visibility_slots[frame_slot]
+		, .draws				= vk_sw_raster_data.draw_slots[frame_slot]
+		, .count				= vk_sw_raster_data.count_slots[frame_slot]
+		, .compact				= vk_extensions_data.draw_indirect_count
+		, .indices				= vk_sw_raster_data.index_slot
+		, .width				= vk_sw_raster_data.width
+		, .height				= vk_sw_raster_data.height
+		, .threshold			= vk_sw_raster_data.threshold
+		, .pixel_scale			= vk_dense_mesh_data.pixel_scale
+	};
+}
+
+/* Nothing drawn is all ones, farther than anything. */
+void record_sw_raster_clear(VkCommandBuffer cmd, uint32_t frame_slot)
+{
+	vkCmdFillBuffer(cmd, vk_sw_raster_data.visibility_buffers[frame_slot], 0,
+			VK_WHOLE_SIZE, 0xffffffff);
+	vkCmdFillBuffer(cmd, vk_sw_raster_data.count_buffers[frame_slot], 0,
+			sizeof(uint32_t), 0);
+}
+
+/* Workgroups are meshlets in x, instances in y. */
+void record_sw_raster(VkCommandBuffer cmd, uint32_t frame_slot)
+{
+	SwRasterConstants constants = sw_raster_constants(frame_slot);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+			vk_sw_raster_data.raster_pipeline);
+	bindless_push(cmd, &constants, sizeof(constants));
+	vkCmdDispatch(cmd, vk_dense_mesh_data.meshlet_count,
+			DENSE_MESH_GRID_SIDE * DENSE_MESH_GRID_SIDE, 1);
+}
+
+/* Inside a render pass, the meshlets left to the hardware. */
+void record_sw_raster_hw(VkCommandBuffer cmd, uint32_t frame_slot)
+{
+	SwRasterConstants constants = sw_raster_constants(frame_slot);
+	uint32_t draw_count = vk_dense_mesh_data.meshlet_count
+			* DENSE_MESH_GRID_SIDE * DENSE_MESH_GRID_SIDE;
+
+	VkDeviceSize vertex_offset = 0;
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			vk_sw_raster_data.hw_pipeline);
+	bindless_push(cmd, &constants, sizeof(constants));
+	vkCmdBindVertexBuffers(cmd, 0, 1, &vk_dense_mesh_data.vertex_buffer,
+			&vertex_offset);
+	vkCmdBindIndexBuffer(cmd, vk_dense_mesh_data.index_buffer, 0,
+			VK_INDEX_TYPE_UINT32);
+
+	if (vk_extensions_data.draw_indirect_count) {
+		vk_ext_pfn.vkCmdDrawIndexedIndirectCount(cmd,
+				vk_sw_raster_data.draw_buffers[frame_slot], 0,
+				vk_sw_raster_data.count_buffers[frame_slot], 0, draw_count,
+				sizeof(VkDrawIndexedIndirectCommand));
+	} else {
+		vkCmdDrawIndexedIndirect(cmd,
+				vk_sw_raster_data.draw_buffers[frame_slot], 0, draw_count,
+				sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+void record_sw_raster_resolve(VkCommandBuffer cmd, uint32_t frame_slot)
+{
+	SwRasterConstants constants = sw_raster_constants(frame_slot);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			vk_sw_raster_data.resolve_pipeline);
+	bindless_push(cmd, &constants, sizeof(constants));
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+}
+
+/* Render graph. Every frame, passes are declared in execution order with the
+ * resources they use. Compiling culls passes nothing depends on, and gives
+ * transient images memory, aliased between images whose lifetimes don't
+ * overlap. Executing places the barriers and layout transitions, batched in
+ * one vkCmdPipelineBarrier2 per pass, and only where there is a hazard.
+ */
+#define RG_MAX_PASSES 16
+#define RG_MAX_RESOURCES 32
+#define RG_MAX_PASS_USES 8
+#define RG_NONE UINT32_MAX
+
+typedef enum RgUsage {
+	RG_USAGE_TRANSFER_WRITE
+	, RG_USAGE_COLOR_ATTACHMENT
+	, RG_USAGE_DEPTH_ATTACHMENT
+	, RG_USAGE_SAMPLED
+	, RG_USAGE_COMPUTE_READ
+	, RG_USAGE_COMPUTE_WRITE
+	, RG_USAGE_INDIRECT_READ
+	, RG_USAGE_TRANSFER_READ
+	, RG_USAGE_RESOLVE_ATTACHMENT
+	, RG_USAGE_FRAGMENT_STORAGE
+	, RG_USAGE_PRESENT
+	, RG_USAGE_COUNT
+} RgUsage;
+
+typedef struct RgUsageInfo {
+	VkPipelineStageFlags2KHR	stages;
+	VkAccessFlags2KHR			read_access;
+	VkAccessFlags2KHR			write_access;
+	/* Ignored for buffers. */
+	VkImageLayout				layout;
+} RgUsageInfo;
+
+/* Only bits that exist in the original synchronization API, so the fallback
+ * can cast them.
+ */
+const RgUsageInfo rg_usage_infos[RG_USAGE_COUNT] = {
+	{
+		VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR
+		, 0
+		, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR
+		, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+	}
+	, {
+		VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR
+		, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR
+		, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR
+		, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	}
+	, {
+		VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR
+				| VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR
+		, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR
+		, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR
+		, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	}
+	, {
+		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR
+		, VK_ACCESS_2_SHADER_READ_BIT_KHR
+		, 0
+		, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	}
+	, {
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR
+		, VK_ACCESS_2_SHADER_READ_BIT_KHR
+		, 0
+		, VK_IMAGE_LAYOUT_GENERAL
+	}
+	, {
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR
+		, VK_ACCESS_2_SHADER_READ_BIT_KHR
+		, VK_ACCESS_2_SHADER_WRITE_BIT_KHR
+		, VK_IMAGE_LAYOUT_GENERAL
+	}
+	, {
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR
+		, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR
+		, 0
+		, VK_IMAGE_LAYOUT_UNDEFINED
+	}
+	, {
+		VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR
+		, VK_ACCESS_2_TRANSFER_READ_BIT_KHR
+		, 0
+		, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+	}
+	/* Write only, what was there before doesn't matter. */
+	, {
+		VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR
+		, 0
+		, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR
+		, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	}
+	/* Atomics from fragment shaders, buffers only. */
+	, {
+		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR
+		, VK_ACCESS_2_SHADER_READ_BIT_KHR
+		, VK_ACCESS_2_SHADER_WRITE_BIT_KHR
+		, VK_IMAGE_LAYOUT_GENERAL
+	}
+	, {
+		VK_PIPELINE_STAGE_2_NONE_KHR
+		, 0
+		, 0
+		, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+	}
+};
+
+typedef struct RgResource {
+	const char*		name;
+	bool			is_image;
+	VkImage			image;
+	VkImageView		view;
+	VkImageAspectFlags	aspect;
+	VkBuffer		buffer;
+
+	/* Transient images are created by the graph, imported ones aren't. */
+	bool			transient;
+	VkFormat		format;
+	VkExtent2D		extent;
+	VkImageUsageFlags	usage;
+	VkSampleCountFlagBits	samples;
+	uint32_t		transient_index;
+
+	/* Used after the graph, keeps its writers alive. */
+	RgUsage			final_usage;
+	bool			needed;
+	/* Live pass indices. */
+	uint32_t		first_pass;
+	uint32_t		last_pass;
+
+	/* Tracked while executing. The read stages have seen the last write. */
+	bool			seeded;
+	VkImageLayout	layout;
+	bool			dirty;
+	VkPipelineStageFlags2KHR	write_stages;
+	VkAccessFlags2KHR			write_access;
+	VkPipelineStageFlags2KHR	read_stages;
+	VkAccessFlags2KHR			read_access;
+} RgResource;
+
+typedef void (*RgRecordFn)(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index);
+
+typedef struct RgPassUse {
+	uint32_t		resource;
+	RgUsage			usage;
+} RgPassUse;
+
+typedef struct RgPass {
+	const char*		name;
+	RgRecordFn		record;
+	/* Never culled. */
+	bool			side_effects;
+	bool			live;
+	uint32_t		use_count;
+	RgPassUse		uses[RG_MAX_PASS_USES];
+} RgPass;
+
+/* Transient images live across frames, and are only rebuilt when the frame's
+ * transients change. Images sharing a bucket share its memory, one after the
+ * other. Transient attachments get a lazily allocated bucket of their own
+ * when the device has the memory for it, only the tiles touched get backed.
+ */
+typedef struct RgTransient {
+	VkFormat		format;
+	VkExtent2D		extent;
+	VkImageUsageFlags	usage;
+	VkSampleCountFlagBits	samples;
+	uint32_t		first_pass;
+	uint32_t		last_pass;
+
+	VkImage			image;
+	VkImageView		view;
+	VkMemoryRequirements	mem_reqs;
+	uint32_t		bucket;
+	/* Previous image in the bucket this frame, its last use must finish
+	 * before this one overwrites the memory.
+	 */
+	uint32_t		alias_of;
+	uint32_t		resource;
+} RgTransient;
+
+typedef struct RgBucket {
+	VkDeviceSize	offset;
+	VkDeviceSize	size;
+	VkDeviceSize	alignment;
+	/* Lazy buckets own their memory, the others are in the shared one. */
+	VkDeviceMemory	lazy_memory;
+	uint32_t		last_transient;
+	/* Last use of the bucket in the previous frame. */
+	VkPipelineStageFlags2KHR	carry_stages;
+	VkAccessFlags2KHR			carry_access;
+} RgBucket;
+
+typedef struct RenderGraph {
+	uint32_t		pass_count;
+	RgPass			passes[RG_MAX_PASSES];
+	uint32_t		resource_count;
+	RgResource		resources[RG_MAX_RESOURCES];
+
+	uint32_t		transient_count;
+	RgTransient		transients[RG_MAX_RESOURCES];
+	uint32_t		bucket_count;
+	RgBucket		buckets[RG_MAX_RESOURCES];
+	VkDeviceMemory	transient_memory;
+	VkDeviceSize	transient_size;
+	VkDeviceSize	unaliased_size;
+	VkDeviceSize	lazy_size;
+
+	/* Last frame's numbers, for stats. */
+	uint32_t		live_pass_count;
+	uint32_t		culled_pass_count;
+	uint32_t		barrier_count;
+	uint32_t		transition_count;
+} RenderGraph;
+
+RenderGraph vk_graph = {0};
+
+void rg_begin()
+{
+	vk_graph.pass_count = 0;
+	vk_graph.resource_count = 0;
+}
+
+uint32_t rg_add_resource(const char* name)
+{
+	assert(vk_graph.resource_count < RG_MAX_RESOURCES);
+	uint32_t index = vk_graph.resource_count++;
+	vk_graph.resources[index] = (RgResource){
+		.name				= name
+		, .final_usage		= RG_USAGE_COUNT
+		, .first_pass		= RG_NONE
+		, .last_pass		= RG_NONE
+		, .transient_index	= RG_NONE
+		, .layout			= VK_IMAGE_LAYOUT_UNDEFINED
+	};
+	return index;
+}
+
+/* wait_stages is where the frame waits before touching it, a semaphore wait
+ * stage or nothing.
+ */
+uint32_t rg_import_image(const char* name, VkImage image, VkImageView view,
+		VkImageLayout layout, VkPipelineStageFlags2KHR wait_stages)
+{
+	uint32_t index = rg_add_resource(name);
+	RgResource* res = &vk_graph.resources[index];
+	res->is_image = true;
+	res->image = image;
+	res->view = view;
+	res->aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+	res->layout = layout;
+	res->write_stages = wait_stages;
+	return index;
+}
+
+uint32_t rg_import_buffer(const char* name, VkBuffer buffer,
+		VkPipelineStageFlags2KHR wait_stages)
+{
+	uint32_t index = rg_add_resource(name);
+	RgResource* res = &vk_graph.resources[index];
+	res->buffer = buffer;
+	res->write_stages = wait_stages;
+	return index;
+}
+
+bool rg_is_depth_format(VkFormat format)
+{
+	return format == VK_FORMAT_D16_UNORM
+			|| format == VK_FORMAT_D32_SFLOAT
+			|| format == VK_FORMAT_D24_UNORM_S8_UINT
+			|| format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+/* Contents don't survive the frame. */
+uint32_t rg_create_image(const char* name, VkFormat format, VkExtent2D extent,
+		VkSampleCountFlagBits samples, VkImageUsageFlags usage)
+{
+	uint32_t index = rg_add_resource(name);
+	RgResource* res = &vk_graph.resources[index];
+	res->is_image = true;
+	res->transient = true;
+	res->format = format;
+	res->extent = extent;
+	res->samples = samples;
+	res->usage = usage;
+	res->aspect = rg_is_depth_format(format) ? VK_IMAGE_ASPECT_DEPTH_BIT
+			: VK_IMAGE_ASPECT_COLOR_BIT;
+	return index;
+}
+
+/* Left in usage's state after the last pass. */
+void rg_export(uint32_t resource, RgUsage usage)
+{
+	vk_graph.resources[resource].final_usage = usage;
+}
+
+uint32_t rg_add_pass(const char* name, RgRecordFn record)
+{
+	assert(vk_graph.pass_count < RG_MAX_PASSES);
+	uint32_t index = vk_graph.pass_count++;
+	vk_graph.passes[index] = (RgPass){
+		.name				= name
+		, .record			= record
+	};
+	return index;
+}
+
+void rg_side_effects(uint32_t pass)
+{
+	vk_graph.passes[pass].side_effects = true;
+}
+
+void rg_use(uint32_t pass, uint32_t resource, RgUsage usage)
+{
+	RgPass* p = &vk_graph.passes[pass];
+	assert(p->use_count < RG_MAX_PASS_USES);
+	p->uses[p->use_count++] = (RgPassUse){ resource, usage };
+}
+
+VkImageView rg_image_view(uint32_t resource)
+{
+	return vk_graph.resources[resource].view;
+}
+
+void rg_destroy_transients()
+{
+	for (uint32_t i = 0; i < vk_graph.transient_count; ++i) {
+		vkDestroyImageView(vk_data.device, vk_graph.transients[i].view,
+				vk_allocator);
+		vkDestroyImage(vk_data.device, vk_graph.transients[i].image,
+				vk_allocator);
+	}
+	for (uint32_t b = 0; b < vk_graph.bucket_count; ++b) {
+		if (vk_graph.buckets[b].lazy_memory != VK_NULL_HANDLE) {
+			vkFreeMemory(vk_data.device, vk_graph.buckets[b].lazy_memory,
+					vk_allocator);
+		}
+	}
+	if (vk_graph.transient_memory != VK_NULL_HANDLE) {
+		vkFreeMemory(vk_data.device, vk_graph.transient_memory, vk_allocator);
+	}
+
+	vk_graph.transient_count = 0;
+	vk_graph.bucket_count = 0;
+	vk_graph.transient_memory = VK_NULL_HANDLE;
+	vk_graph.transient_size = 0;
+	vk_graph.unaliased_size = 0;
+	vk_graph.lazy_size = 0;
+}
+
+/* What the lazy buckets really use, the driver grows them as they're
+ * touched. Zero on devices that back them all upfront.
+ */
+VkDeviceSize rg_lazy_committed_size()
+{
+	VkDeviceSize committed = 0;
+	for (uint32_t b = 0; b < vk_graph.bucket_count; ++b) {
+		if (vk_graph.buckets[b].lazy_memory == VK_NULL_HANDLE)
+			continue;
+
+		VkDeviceSize bytes = 0;
+		vkGetDeviceMemoryCommitment(vk_data.device,
+				vk_graph.buckets[b].lazy_memory, &bytes);
+		committed += bytes;
+	}
+	return committed;
+}
+
+void print_transient_memory_report()
+{
+	double mib = 1024.0 * 1024.0;
+	printf("Render graph : %d transients in %d buckets\n",
+			vk_graph.transient_count, vk_graph.bucket_count);
+	printf("    device   : %.2f MiB instead of %.2f MiB\n",
+			(double)vk_graph.transient_size / mib,
+			(double)vk_graph.unaliased_size / mib);
+	if (vk_graph.lazy_size > 0) {
+		printf("    lazy     : %.2f MiB reserved, %.2f MiB committed\n",
+				(double)vk_graph.lazy_size / mib,
+				(double)rg_lazy_committed_size() / mib);
+	}
+}
+
+/* Buckets are filled in first use order, best fit among the ones whose
+ * current image is dead by then. One allocation holds them all.
+ */
+void rg_allocate_transients()
+{
+	uint32_t order[RG_MAX_RESOURCES];
+	for (uint32_t i = 0; i < vk_graph.transient_count; ++i) {
+		RgTransient* t = &vk_graph.transients[i];
+
+		VkImageCreateInfo image_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .imageType			= VK_IMAGE_TYPE_2D
+			, .format				= t->format
+			, .extent				= { t->extent.width, t->extent.height, 1 }
+			, .mipLevels			= 1
+			, .arrayLayers			= 1
+			, .samples				= t->samples
+			, .tiling				= VK_IMAGE_TILING_OPTIMAL
+			, .usage				= t->usage
+			, .sharingMode			= VK_SHARING_MODE_EXCLUSIVE
+			, .queueFamilyIndexCount	= 0
+			, .pQueueFamilyIndices	= NULL
+			, .initialLayout		= VK_IMAGE_LAYOUT_UNDEFINED
+		};
+		vk_error(vkCreateImage(vk_data.device, &image_create_info, vk_allocator,
+				&t->image));
+		vkGetImageMemoryRequirements(vk_data.device, t->image, &t->mem_reqs);
+
+		/* Insertion sort on first use. */
+		uint32_t j = i;
+		while (j > 0 && vk_graph.transients[order[j - 1]].first_pass
+				> t->first_pass)
+		{
+			order[j] = order[j - 1];
+			--j;
+		}
+		order[j] = i;
+	}
+
+	uint32_t type_bits = UINT32_MAX;
+	VkDeviceSize unaliased_size = 0;
+	uint32_t shared_count = 0;
+	for (uint32_t o = 0; o < vk_graph.transient_count; ++o) {
+		uint32_t i = order[o];
+		RgTransient* t = &vk_graph.transients[i];
+		unaliased_size += t->mem_reqs.size;
+
+		/* Aliasing buys nothing when untouched memory is free anyway. */
+		uint32_t lazy_type = UINT32_MAX;
+		if ((t->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+				&& !vk_options.no_lazy_memory)
+		{
+			lazy_type = try_find_memory_type(t->mem_reqs.memoryTypeBits,
+					VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+		}
+		if (lazy_type != UINT32_MAX) {
+			uint32_t b = vk_graph.bucket_count++;
+			vk_graph.buckets[b] = (RgBucket){
+				.size				= t->mem_reqs.size
+				, .alignment		= t->mem_reqs.alignment
+				, .last_transient	= i
+			};
+
+			VkMemoryAllocateInfo allocate_info = {
+				.sType				= VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO
+				, .pNext			= NULL
+				, .allocationSize	= t->mem_reqs.size
+				, .memoryTypeIndex	= lazy_type
+			};
+			vk_error(vkAllocateMemory(vk_data.device, &allocate_info,
+					vk_allocator, &vk_graph.buckets[b].lazy_memory));
+
+			vk_graph.lazy_size += t->mem_reqs.size;
+			t->alias_of = RG_NONE;
+			t->bucket = b;
+			continue;
+		}
+
+		type_bits &= t->mem_reqs.memoryTypeBits;
+		++shared_count;
+
+		uint32_t best = RG_NONE;
+		for (uint32_t b = 0; b < vk_graph.bucket_count; ++b) {
+			RgBucket* bucket = &vk_graph.buckets[b];
+			if (bucket->lazy_memory != VK_NULL_HANDLE
+					|| vk_graph.transients[bucket->last_transient].last_pass
+						>= t->first_pass
+					|| bucket->size < t->mem_reqs.size)
+			{
+				continue;
+			}
+			if (best == RG_NONE || bucket->size < vk_graph.buckets[best].size) {
+				best = b;
+			}
+		}
+
+		if (best == RG_NONE) {
+			best = vk_graph.bucket_count++;
+			vk_graph.buckets[best] = (RgBucket){
+				.size				= t->mem_reqs.size
+				, .alignment		= t->mem_reqs.alignment
+				, .last_transient	= RG_NONE
+			};
+			t->alias_of = RG_NONE;
+		} else {
+			t->alias_of = vk_graph.buckets[best].last_transient;
+		}
+
+		RgBucket* bucket = &vk_graph.buckets[best];
+		if (t->mem_reqs.alignment > bucket->alignment) {
+			bucket->alignment = t->mem_reqs.alignment;
+		}
+		bucket->last_transient = i;
+		t->bucket = best;
+	}
+
+	if (type_bits == 0) {
+		printf("Render graph transients have no memory type in common.\n");
+		exit(-1);
+	}
+
+	VkDeviceSize size = 0;
+	for (uint32_t b = 0; b < vk_graph.bucket_count; ++b) {
+		RgBucket* bucket = &vk_graph.buckets[b];
+		if (bucket->lazy_memory != VK_NULL_HANDLE)
+			continue;
+
+		bucket->offset = (size + bucket->alignment - 1)
+				/ bucket->alignment * bucket->alignment;
+		size = bucket->offset + bucket->size;
+	}
+
+	if (shared_count > 0) {
+		VkMemoryAllocateInfo allocate_info = {
+			.sType					= VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO
+			, .pNext				= NULL
+			, .allocationSize		= size
+			, .memoryTypeIndex		= find_memory_type(type_bits,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+		};
+		vk_error(vkAllocateMemory(vk_data.device, &allocate_info,
+				vk_allocator, &vk_graph.transient_memory));
+	}
+
+	for (uint32_t i = 0; i < vk_graph.transient_count; ++i) {
+		RgTransient* t = &vk_graph.transients[i];
+		RgBucket* bucket = &vk_graph.buckets[t->bucket];
+		vk_error(vkBindImageMemory(vk_data.device, t->image,
+				bucket->lazy_memory != VK_NULL_HANDLE
+						? bucket->lazy_memory : vk_graph.transient_memory,
+				bucket->offset));
+
+		VkImageViewCreateInfo view_create_info = {
+			.sType					= VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO
+			, .pNext				= NULL
+			, .flags				= 0
+			, .image				= t->image
+			, .viewType				= VK_IMAGE_VIEW_TYPE_2D
+			, .format				= t->format
+			, .components			= {
+				VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY
+				, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY
+			}
+			, .subresourceRange		= {
+				.aspectMask			= rg_is_depth_format(t->format)
+						? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT
+				, .baseMipLevel		= 0
+				, .levelCount		= 1
+				, .baseArrayLayer	= 0
+				, .layerCount		= 1
+			}
+		};
+		vk_error(vkCreateImageView(vk_data.device, &view_create_info,
+				vk_allocator,
+				&t->view));
+	}
+
+	vk_graph.transient_size = size;
+	vk_graph.unaliased_size = unaliased_size;
+	print_transient_memory_report();
+}
+
+/* Walks back from what's used after the graph. A pass lives if it has side
+ * effects, or writes something a later live pass or the frame needs.
+ */
+void rg_compile()
+{
+	for (uint32_t r = 0; r < vk_graph.resource_count; ++r) {
+		RgResource* res = &vk_graph.resources[r];
+		res->needed = res->final_usage != RG_USAGE_COUNT;
+	}
+
+	vk_graph.live_pass_count = 0;
+	for (uint32_t p = vk_graph.pass_count; p-- > 0;) {
+		RgPass* pass = &vk_graph.passes[p];
+
+		pass->live = pass->side_effects;
+		for (uint32_t u = 0; u < pass->use_count; ++u) {
+			const RgUsageInfo* info = &rg_usage_infos[pass->uses[u].usage];
+			if (info->write_access != 0
+					&& vk_graph.resources[pass->uses[u].resource].needed)
+			{
+				pass->live = true;
+			}
+		}
+		if (!pass->live)
+			continue;
+
+		++vk_graph.live_pass_count;
+
+		/* Overwritten here, so earlier writers aren't needed for it. */
+		for (uint32_t u = 0; u < pass->use_count; ++u) {
+			const RgUsageInfo* info = &rg_usage_infos[pass->uses[u].usage];
+			if (info->write_access != 0 && info->read_access == 0) {
+				vk_graph.resources[pass->uses[u].resource].needed = false;
+			}
+		}
+		for (uint32_t u = 0; u < pass->use_count; ++u) {
+			const RgUsageInfo* info = &rg_usage_infos[pass->uses[u].usage];
+			if (info->read_access != 0) {
+				vk_graph.resources[pass->uses[u].resource].needed = true;
+			}
+		}
+	}
+	vk_graph.culled_pass_count = vk_graph.pass_count
+			- vk_graph.live_pass_count;
+
+	/* Lifetimes. */
+	for (uint32_t p = 0; p < vk_graph.pass_count; ++p) {
+		RgPass* pass = &vk_graph.passes[p];
+		if (!pass->live)
+			continue;
+
+		for (uint32_t u = 0; u < pass->use_count; ++u) {
+			RgResource* res = &vk_graph.resources[pass->uses[u].resource];
+			if (res->first_pass == RG_NONE) {
+				res->first_pass = p;
+			}
+			res->last_pass = p;
+		}
+	}
+
+	/* Reuse last frame's transients if they're the same. */
+	RgTransient wanted[RG_MAX_RESOURCES];
+	uint32_t wanted_count = 0;
+	for (uint32_t r = 0; r < vk_graph.resource_count; ++r) {
+		RgResource* res = &vk_graph.resources[r];
+		if (!res->transient || res->first_pass == RG_NONE)
+			continue;
+
+		res->transient_index = wanted_count;
+		wanted[wanted_count++] = (RgTransient){
+			.format				= res->format
+			, .extent			= res->extent
+			, .usage			= res->usage
+			, .samples			= res->samples
+			, .first_pass		= res->first_pass
+			, .last_pass		= res->last_pass
 		};
+	}
 
-		vk_error(vkCreateRenderPass(vk_data.device, &render_pass_create_info,
-				NULL, &vk_data.render_pass));
+	bool same = wanted_count == vk_graph.transient_count;
+	for (uint32_t i = 0; same && i < wanted_count; ++i) {
+		RgTransient* t = &vk_graph.transients[i];
+		same = t->format == wanted[i].format
+				&& t->extent.width == wanted[i].extent.width
+				&& t->extent.height == wanted[i].extent.height
+				&& t->usage == wanted[i].usage
+				&& t->samples == wanted[i].samples
+				&& t->first_pass == wanted[i].first_pass
+				&& t->last_pass == wanted[i].last_pass;
 	}
 
-	/* Create Framebuffer. */
-	{
-		uint32_t image_count = vk_data.queue_cmd_buffers_size;
-#if defined(_MSC_VER)
-		VkImage swapchain_images[32];
-#else
-		VkImage swapchain_images[image_count];
-#endif
-		vk_error(vk_ext_pfn.vkGetSwapchainImagesKHR(vk_data.device,
-				vk_data.swapchain, &image_count, swapchain_images));
+	if (!same) {
+		/* Frames in flight may still use them. */
+		vkDeviceWaitIdle(vk_data.device);
+		rg_destroy_transients();
 
-		vk_data.image_views = malloc(sizeof(VkImageView) * image_count);
-		vk_data.image_views_size = image_count;
+		vk_graph.transient_count = wanted_count;
+		memcpy(vk_graph.transients, wanted, sizeof(RgTransient) * wanted_count);
+		if (wanted_count > 0) {
+			rg_allocate_transients();
+		}
+	}
 
-		vk_data.frame_buffers = malloc(sizeof(VkFramebuffer) * image_count);
-		vk_data.frame_buffers_size = image_count;
+	for (uint32_t r = 0; r < vk_graph.resource_count; ++r) {
+		RgResource* res = &vk_graph.resources[r];
+		if (res->transient_index == RG_NONE)
+			continue;
 
-		for (int i = 0; i < image_count; ++i) {
-			VkImageViewCreateInfo image_view_create_info = {
-				.sType					= VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO
-				, .pNext				= NULL
-				, .flags				= 0
-				, .image				= swapchain_images[i]
-				, .viewType				= VK_IMAGE_VIEW_TYPE_2D
-				, .format				= vk_surface_data.color_format
-				, .components			= {
-					.r					= VK_COMPONENT_SWIZZLE_IDENTITY
-					, .g				= VK_COMPONENT_SWIZZLE_IDENTITY
-					, .b				= VK_COMPONENT_SWIZZLE_IDENTITY
-					, .a				= VK_COMPONENT_SWIZZLE_IDENTITY
-				}
-				, .subresourceRange		= {
-					.aspectMask			= VK_IMAGE_ASPECT_COLOR_BIT
+		RgTransient* t = &vk_graph.transients[res->transient_index];
+		t->resource = r;
+		res->image = t->image;
+		res->view = t->view;
+	}
+}
+
+typedef struct RgBarriers {
+	VkMemoryBarrier2KHR			memory;
+	uint32_t					image_count;
+	VkImageMemoryBarrier2KHR	images[RG_MAX_RESOURCES];
+} RgBarriers;
+
+/* The memory written by the transient's previous user must be done with.
+ * Contents are discarded.
+ */
+void rg_seed_transient(RgResource* res)
+{
+	RgTransient* t = &vk_graph.transients[res->transient_index];
+	res->seeded = true;
+	res->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	res->dirty = true;
+	res->read_stages = 0;
+	res->read_access = 0;
+
+	if (t->alias_of != RG_NONE) {
+		RgResource* prev = &vk_graph.resources[
+				vk_graph.transients[t->alias_of].resource];
+		res->write_stages = prev->write_stages | prev->read_stages;
+		res->write_access = prev->write_access;
+	} else {
+		RgBucket* bucket = &vk_graph.buckets[t->bucket];
+		res->write_stages = bucket->carry_stages;
+		res->write_access = bucket->carry_access;
+	}
+}
+
+/* Adds what it takes for res to be used as usage, if anything. */
+void rg_transition(RgBarriers* barriers, RgResource* res, RgUsage usage)
+{
+	const RgUsageInfo* info = &rg_usage_infos[usage];
+	bool writes = info->write_access != 0;
+	bool layout_change = res->is_image && res->layout != info->layout;
+	bool covered = (info->stages & ~res->read_stages) == 0
+			&& (info->read_access & ~res->read_access) == 0;
+
+	VkPipelineStageFlags2KHR src_stages = 0;
+	VkAccessFlags2KHR src_access = 0;
+	bool barrier = false;
+
+	if (layout_change || writes) {
+		/* Write after write, and after read. */
+		src_stages = res->write_stages | res->read_stages;
+		src_access = res->write_access;
+		barrier = layout_change || src_stages != 0;
+	} else if (res->dirty && !covered) {
+		/* Read after write. */
+		src_stages = res->write_stages;
+		src_access = res->write_access;
+		barrier = true;
+	}
+
+	if (barrier) {
+		if (res->is_image) {
+			barriers->images[barriers->image_count++] =
+					(VkImageMemoryBarrier2KHR){
+				.sType				= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR
+				, .pNext			= NULL
+				, .srcStageMask		= src_stages
+				, .srcAccessMask	= src_access
+				, .dstStageMask		= info->stages
+				, .dstAccessMask	= info->read_access | info->write_access
+				, .oldLayout		= res->layout
+				, .newLayout		= info->layout
+				, .srcQueueFamilyIndex	= VK_QUEUE_FAMILY_IGNORED
+				, .dstQueueFamilyIndex	= VK_QUEUE_FAMILY_IGNORED
+				, .image			= res->image
+				, .subresourceRange	= {
+					.aspectMask			= res->aspect
 					, .baseMipLevel		= 0
 					, .levelCount		= 1
 					, .baseArrayLayer	= 0
 					, .layerCount		= 1
 				}
 			};
+			if (layout_change) {
+				++vk_graph.transition_count;
+			}
+		} else {
+			/* Buffers all go in one global barrier. */
+			barriers->memory.srcStageMask |= src_stages;
+			barriers->memory.srcAccessMask |= src_access;
+			barriers->memory.dstStageMask |= info->stages;
+			barriers->memory.dstAccessMask |= info->read_access
+					| info->write_access;
+		}
+	}
 
-			vk_error(vkCreateImageView(vk_data.device, &image_view_create_info,
-					NULL, &vk_data.image_views[i]));
+	if (writes) {
+		res->write_stages = info->stages;
+		res->write_access = info->write_access;
+		res->read_stages = 0;
+		res->read_access = 0;
+		res->dirty = true;
+	} else if (layout_change) {
+		/* The transition is a write of its own. */
+		res->write_stages = info->stages;
+		res->write_access = 0;
+		res->read_stages = info->stages;
+		res->read_access = info->read_access;
+		res->dirty = true;
+	} else {
+		res->read_stages |= info->stages;
+		res->read_access |= info->read_access;
+	}
+	res->layout = info->layout;
+}
 
-			VkFramebufferCreateInfo framebuffer_create_info = {
-				.sType					= VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO
-				, .pNext				= NULL
-				, .flags				= 0
-				, .renderPass			= vk_data.render_pass
-				, .attachmentCount		= 1
-				, .pAttachments			= &vk_data.image_views[i]
-				, .width				= 300
-				, .height				= 300
-				, .layers				= 1
-			};
+/* Without synchronization2 the stage and access bits we use cast down, but
+ * stages are per call instead of per barrier.
+ */
+void rg_flush_barriers(VkCommandBuffer cmd, RgBarriers* barriers)
+{
+	bool has_memory = barriers->memory.srcStageMask != 0
+			|| barriers->memory.dstStageMask != 0;
+	if (!has_memory && barriers->image_count == 0)
+		return;
 
-			vk_error(vkCreateFramebuffer(vk_data.device,
-					&framebuffer_create_info, NULL, &vk_data.frame_buffers[i]));
+	++vk_graph.barrier_count;
+
+	if (vk_extensions_data.synchronization2) {
+		VkDependencyInfoKHR dependency_info = {
+			.sType						= VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR
+			, .pNext					= NULL
+			, .dependencyFlags			= 0
+			, .memoryBarrierCount		= has_memory ? 1 : 0
+			, .pMemoryBarriers			= &barriers->memory
+			, .bufferMemoryBarrierCount	= 0
+			, .pBufferMemoryBarriers	= NULL
+			, .imageMemoryBarrierCount	= barriers->image_count
+			, .pImageMemoryBarriers		= barriers->images
+		};
+		vk_ext_pfn.vkCmdPipelineBarrier2(cmd, &dependency_info);
+		return;
+	}
+
+	VkPipelineStageFlags src_stages =
+			(VkPipelineStageFlags)barriers->memory.srcStageMask;
+	VkPipelineStageFlags dst_stages =
+			(VkPipelineStageFlags)barriers->memory.dstStageMask;
+
+	VkMemoryBarrier memory_barrier = {
+		.sType					= VK_STRUCTURE_TYPE_MEMORY_BARRIER
+		, .pNext				= NULL
+		, .srcAccessMask		= (VkAccessFlags)barriers->memory.srcAccessMask
+		, .dstAccessMask		= (VkAccessFlags)barriers->memory.dstAccessMask
+	};
+
+	VkImageMemoryBarrier image_barriers[RG_MAX_RESOURCES];
+	for (uint32_t i = 0; i < barriers->image_count; ++i) {
+		VkImageMemoryBarrier2KHR* b = &barriers->images[i];
+		src_stages |= (VkPipelineStageFlags)b->srcStageMask;
+		dst_stages |= (VkPipelineStageFlags)b->dstStageMask;
+
+		image_barriers[i] = (VkImageMemoryBarrier){
+			.sType				= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER
+			, .pNext			= NULL
+			, .srcAccessMask	= (VkAccessFlags)b->srcAccessMask
+			, .dstAccessMask	= (VkAccessFlags)b->dstAccessMask
+			, .oldLayout		= b->oldLayout
+			, .newLayout		= b->newLayout
+			, .srcQueueFamilyIndex	= VK_QUEUE_FAMILY_IGNORED
+			, .dstQueueFamilyIndex	= VK_QUEUE_FAMILY_IGNORED
+			, .image			= b->image
+			, .subresourceRange	= b->subresourceRange
+		};
+	}
+
+	vkCmdPipelineBarrier(cmd,
+			src_stages != 0 ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			dst_stages != 0 ? dst_stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, has_memory ? 1 : 0, &memory_barrier, 0, NULL,
+			barriers->image_count, image_barriers);
+}
+
+void rg_execute(VkCommandBuffer cmd, FrameData* frame, uint32_t image_index)
+{
+	vk_graph.barrier_count = 0;
+	vk_graph.transition_count = 0;
+
+	for (uint32_t p = 0; p < vk_graph.pass_count; ++p) {
+		RgPass* pass = &vk_graph.passes[p];
+		if (!pass->live)
+			continue;
+
+		RgBarriers barriers = {
+			.memory = {
+				.sType			= VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR
+				, .pNext		= NULL
+			}
+			, .image_count		= 0
+		};
+
+		for (uint32_t u = 0; u < pass->use_count; ++u) {
+			RgResource* res = &vk_graph.resources[pass->uses[u].resource];
+			if (res->transient_index != RG_NONE && !res->seeded) {
+				rg_seed_transient(res);
+			}
+			rg_transition(&barriers, res, pass->uses[u].usage);
 		}
+		rg_flush_barriers(cmd, &barriers);
+
+		uint32_t scope = vk_timestamp_begin(frame, pass->name);
+		pass->record(cmd, frame, image_index);
+		vk_timestamp_end(frame, scope);
 	}
 
-	/* Creating Shaders. */
-	{
-		FILE* f = fopen("win_vulkan_vert.spv", "rb");
-		if (!f) {
-			char result[256];
-			GetCurrentDirectory(256, result);
-			printf("Unable to read %s win_vulkan_vert.spv\n", result);
-			exit(-1);
+	/* Hand exported resources over in their final state. */
+	RgBarriers barriers = {
+		.memory = {
+			.sType			= VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR
+			, .pNext		= NULL
+		}
+		, .image_count		= 0
+	};
+	for (uint32_t r = 0; r < vk_graph.resource_count; ++r) {
+		RgResource* res = &vk_graph.resources[r];
+		if (res->final_usage != RG_USAGE_COUNT) {
+			rg_transition(&barriers, res, res->final_usage);
+		}
+	}
+	rg_flush_barriers(cmd, &barriers);
+
+	/* Next frame's first user of each bucket waits on this. */
+	for (uint32_t b = 0; b < vk_graph.bucket_count; ++b) {
+		RgBucket* bucket = &vk_graph.buckets[b];
+		RgResource* res = &vk_graph.resources[
+				vk_graph.transients[bucket->last_transient].resource];
+		bucket->carry_stages = res->write_stages | res->read_stages;
+		bucket->carry_access = res->write_access;
+	}
+}
+
+/* Frame passes. */
+void record_compute_load_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	(void)image_index;
+	record_compute_load(cmd, (uint32_t)(frame - vk_frames));
+}
+
+void record_cull_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	(void)image_index;
+	record_scene_cull(cmd, (uint32_t)(frame - vk_frames));
+}
+
+void record_clear_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	(void)frame;
+
+	VkClearColorValue clear_color = {
+		{0.0f, 1.0f, 0.0f, 0.0f }
+	};
+
+	VkImageSubresourceRange image_subresource_range = {
+		.aspectMask				= VK_IMAGE_ASPECT_COLOR_BIT
+		, .baseMipLevel			= 0
+		, .levelCount			= 1
+		, .baseArrayLayer		= 0
+		, .layerCount			= 1
+	};
+
+	vkCmdClearColorImage(cmd,
+			vk_data.swapchain_images[image_index],
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			&clear_color, 1, &image_subresource_range);
+}
+
+void record_draw_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	VkViewport viewport = {
+		.x						= 0.0f
+		, .y					= 0.0f
+		, .width				= (float)vk_surface_data.extent_2d.width
+		, .height				= (float)vk_surface_data.extent_2d.height
+		, .minDepth				= 0.0f
+		, .maxDepth				= 1.0f
+	};
+
+	VkRect2D scissor = {
+		.offset					= { 0, 0 }
+		, .extent				= vk_surface_data.extent_2d
+	};
+
+	VkImageView msaa_view = vk_attachment_data.color_resource != RG_NONE
+			? rg_image_view(vk_attachment_data.color_resource)
+			: VK_NULL_HANDLE;
+	VkImageView depth_view = vk_attachment_data.depth_resource != RG_NONE
+			? rg_image_view(vk_attachment_data.depth_resource)
+			: VK_NULL_HANDLE;
+
+	vk_begin_draw(cmd, image_index, msaa_view, depth_view);
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+	if (vk_dense_mesh_data.triangle_count > 0) {
+		record_dense_mesh_draw(cmd, (uint32_t)(frame - vk_frames));
+	} else if (vk_scene_data.object_count > 0) {
+		record_scene_draw(cmd, (uint32_t)(frame - vk_frames));
+	} else {
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+				vk_data.pipeline);
+		vkCmdDraw(cmd, 3, 1, 0, 0);
+	}
+	vk_end_draw(cmd);
+}
+
+void record_vis_clear_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	(void)image_index;
+	record_sw_raster_clear(cmd, (uint32_t)(frame - vk_frames));
+}
+
+void record_sw_raster_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	(void)image_index;
+	record_sw_raster(cmd, (uint32_t)(frame - vk_frames));
+}
+
+/* Shared by the hardware raster and the resolve, full target. */
+void begin_sw_raster_draw(VkCommandBuffer cmd, uint32_t image_index)
+{
+	VkViewport viewport = {
+		.x						= 0.0f
+		, .y					= 0.0f
+		, .width				= (float)vk_surface_data.extent_2d.width
+		, .height				= (float)vk_surface_data.extent_2d.height
+		, .minDepth				= 0.0f
+		, .maxDepth				= 1.0f
+	};
+
+	VkRect2D scissor = {
+		.offset					= { 0, 0 }
+		, .extent				= vk_surface_data.extent_2d
+	};
+
+	vk_begin_draw(cmd, image_index, VK_NULL_HANDLE, VK_NULL_HANDLE);
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+}
+
+void record_hw_raster_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	begin_sw_raster_draw(cmd, image_index);
+	record_sw_raster_hw(cmd, (uint32_t)(frame - vk_frames));
+	vk_end_draw(cmd);
+}
+
+void record_vis_resolve_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	begin_sw_raster_draw(cmd, image_index);
+	record_sw_raster_resolve(cmd, (uint32_t)(frame - vk_frames));
+	vk_end_draw(cmd);
+}
+
+void record_readback_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	(void)frame;
+	record_readback(cmd, vk_data.swapchain_images[image_index]);
+}
+
+/* The whole frame, scaled to each output. */
+void record_outputs_pass(VkCommandBuffer cmd, FrameData* frame,
+		uint32_t image_index)
+{
+	(void)frame;
+
+	for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+		OutputData* output = &vk_outputs_data.outputs[i];
+		if (!output->acquired)
+			continue;
+
+		VkImageBlit region = {
+			.srcSubresource		= { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 }
+			, .srcOffsets		= {
+				{ 0, 0, 0 }
+				, {
+					(int32_t)vk_surface_data.extent_2d.width
+					, (int32_t)vk_surface_data.extent_2d.height
+					, 1
+				}
+			}
+			, .dstSubresource	= { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 }
+			, .dstOffsets		= {
+				{ 0, 0, 0 }
+				, {
+					(int32_t)output->extent_2d.width
+					, (int32_t)output->extent_2d.height
+					, 1
+				}
+			}
+		};
+		vkCmdBlitImage(cmd, vk_data.swapchain_images[image_index],
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				output->images[output->image_index],
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region,
+				vk_outputs_data.filter);
+	}
+}
+
+/* This frame's passes. Compute moved to the async queue is already synced
+ * by the semaphore, at the draw indirect stage.
+ */
+void build_frame_graph(FrameData* frame, uint32_t image_index)
+{
+	uint32_t frame_slot = (uint32_t)(frame - vk_frames);
+	bool async_compute = vk_data.async_compute_active;
+
+	rg_begin();
+
+	/* The acquire semaphore is waited on at the transfer stage. Offscreen
+	 * targets are left ready for the next copy, nobody presents them.
+	 */
+	uint32_t backbuffer = rg_import_image("backbuffer",
+			vk_data.swapchain_images[image_index],
+			vk_data.image_views[image_index], VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR);
+	rg_export(backbuffer, vk_options.headless
+			? RG_USAGE_TRANSFER_READ : RG_USAGE_PRESENT);
+
+	if (!async_compute && vk_compute_load_data.iterations > 0) {
+		uint32_t values = rg_import_buffer("compute load",
+				vk_compute_load_data.buffer, 0);
+		uint32_t pass = rg_add_pass("compute", record_compute_load_pass);
+		rg_use(pass, values, RG_USAGE_COMPUTE_WRITE);
+		/* Nobody reads it, it's only there to load the GPU. */
+		rg_side_effects(pass);
+	}
+
+	uint32_t draws = RG_NONE;
+	uint32_t count = RG_NONE;
+	if (vk_scene_data.object_count > 0) {
+		VkPipelineStageFlags2KHR wait_stages = async_compute
+				? VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR : 0;
+		draws = rg_import_buffer("draws",
+				vk_scene_data.draw_buffers[frame_slot], wait_stages);
+		count = rg_import_buffer("draw count",
+				vk_scene_data.count_buffers[frame_slot], wait_stages);
+
+		if (!async_compute) {
+			uint32_t pass = rg_add_pass("cull", record_cull_pass);
+			rg_use(pass, draws, RG_USAGE_COMPUTE_WRITE);
+			rg_use(pass, count, RG_USAGE_COMPUTE_WRITE);
 		}
+	}
+
+	{
+		uint32_t pass = rg_add_pass("clear", record_clear_pass);
+		rg_use(pass, backbuffer, RG_USAGE_TRANSFER_WRITE);
+	}
 
-		fseek(f, 0, SEEK_END);
-		size_t filesize = ftell(f);
-		fseek(f, 0, SEEK_SET);
+	/* Only ever live inside the draw pass, transient attachments. */
+	vk_attachment_data.color_resource = RG_NONE;
+	vk_attachment_data.depth_resource = RG_NONE;
+	if (vk_attachment_data.samples > VK_SAMPLE_COUNT_1_BIT) {
+		vk_attachment_data.color_resource = rg_create_image("msaa color",
+				vk_surface_data.color_format, vk_surface_data.extent_2d,
+				vk_attachment_data.samples,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+						| VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+	}
+	if (vk_attachment_data.depth_format != VK_FORMAT_UNDEFINED) {
+		vk_attachment_data.depth_resource = rg_create_image("depth",
+				vk_attachment_data.depth_format, vk_surface_data.extent_2d,
+				vk_attachment_data.samples,
+				VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+						| VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+	}
 
-		uint32_t* vert_code = (uint32_t*)malloc(filesize);
-		fread(vert_code, 1, filesize, f);
-		fclose(f);
+	/* Instead of the draw pass. Hardware raster and resolve only touch the
+	 * color attachment to be in a render pass, the resolve keeps the clear
+	 * color where nothing was drawn.
+	 */
+	if (vk_sw_raster_data.active) {
+		uint32_t visibility = rg_import_buffer("visibility",
+				vk_sw_raster_data.visibility_buffers[frame_slot], 0);
+		uint32_t sw_draws = rg_import_buffer("meshlet draws",
+				vk_sw_raster_data.draw_buffers[frame_slot], 0);
+		uint32_t sw_count = rg_import_buffer("meshlet draw count",
+				vk_sw_raster_data.count_buffers[frame_slot], 0);
+
+		/* Last read before it's cleared, the fence has signaled. */
+		vk_sw_raster_data.hw_meshlet_count =
+				*vk_sw_raster_data.counts[frame_slot];
+
+		uint32_t pass = rg_add_pass("vis clear", record_vis_clear_pass);
+		rg_use(pass, visibility, RG_USAGE_TRANSFER_WRITE);
+		rg_use(pass, sw_count, RG_USAGE_TRANSFER_WRITE);
+
+		pass = rg_add_pass("sw raster", record_sw_raster_pass);
+		rg_use(pass, visibility, RG_USAGE_COMPUTE_WRITE);
+		rg_use(pass, sw_draws, RG_USAGE_COMPUTE_WRITE);
+		rg_use(pass, sw_count, RG_USAGE_COMPUTE_WRITE);
+
+		pass = rg_add_pass("hw raster", record_hw_raster_pass);
+		rg_use(pass, backbuffer, RG_USAGE_COLOR_ATTACHMENT);
+		rg_use(pass, visibility, RG_USAGE_FRAGMENT_STORAGE);
+		rg_use(pass, sw_draws, RG_USAGE_INDIRECT_READ);
+		rg_use(pass, sw_count, RG_USAGE_INDIRECT_READ);
+
+		pass = rg_add_pass("vis resolve", record_vis_resolve_pass);
+		rg_use(pass, backbuffer, RG_USAGE_COLOR_ATTACHMENT);
+		rg_use(pass, visibility, RG_USAGE_SAMPLED);
+	} else {
+		/* The resolve overwrites it all, the clear pass gets culled. */
+		uint32_t pass = rg_add_pass("draw", record_draw_pass);
+		if (vk_attachment_data.color_resource != RG_NONE) {
+			rg_use(pass, vk_attachment_data.color_resource,
+					RG_USAGE_COLOR_ATTACHMENT);
+			rg_use(pass, backbuffer, RG_USAGE_RESOLVE_ATTACHMENT);
+		} else {
+			rg_use(pass, backbuffer, RG_USAGE_COLOR_ATTACHMENT);
+		}
+		if (vk_attachment_data.depth_resource != RG_NONE) {
+			rg_use(pass, vk_attachment_data.depth_resource,
+					RG_USAGE_DEPTH_ATTACHMENT);
+		}
+		if (draws != RG_NONE) {
+			rg_use(pass, draws, RG_USAGE_INDIRECT_READ);
+			rg_use(pass, count, RG_USAGE_INDIRECT_READ);
+		}
+	}
 
+	/* Each acquired output waits on its own semaphore, at transfer. */
+	uint32_t outputs_pass = RG_NONE;
+	for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+		OutputData* output = &vk_outputs_data.outputs[i];
+		if (!output->acquired)
+			continue;
 
-		f = fopen("win_vulkan_frag.spv", "rb");
-		if (!f) {
-			char result[256];
-			GetCurrentDirectory(256, result);
-			printf("Unable to read %s win_vulkan_frag.spv\n", result);
-			exit(-1);
+		if (outputs_pass == RG_NONE) {
+			outputs_pass = rg_add_pass("outputs", record_outputs_pass);
+			rg_use(outputs_pass, backbuffer, RG_USAGE_TRANSFER_READ);
 		}
+		uint32_t image = rg_import_image("output",
+				output->images[output->image_index], VK_NULL_HANDLE,
+				VK_IMAGE_LAYOUT_UNDEFINED,
+				VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR);
+		rg_export(image, RG_USAGE_PRESENT);
+		rg_use(outputs_pass, image, RG_USAGE_TRANSFER_WRITE);
+	}
+
+	if (vk_readback_data.slot_count > 0) {
+		uint32_t pass = rg_add_pass("readback", record_readback_pass);
+		rg_use(pass, backbuffer, RG_USAGE_TRANSFER_READ);
+		/* The host reads it, the graph can't see that. */
+		rg_side_effects(pass);
+	}
 
-		fseek(f, 0, SEEK_END);
-		filesize = ftell(f);
-		fseek(f, 0, SEEK_SET);
+	rg_compile();
+}
+
+/* Record this frame's work for the acquired swapchain image. HYPE */
+void record_cmd_buffer(FrameData* frame, uint32_t image_index)
+{
+	VkCommandBuffer cmd = frame->cmd_buffer;
+
+	VkCommandBufferBeginInfo cmd_buffer_begin_info = {
+		.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+		, .pNext				= NULL
+		, .flags				= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+		, .pInheritanceInfo		= NULL
+	};
+
+	build_frame_graph(frame, image_index);
 
-		uint32_t* frag_code = (uint32_t*)malloc(filesize);
-		fread(vert_code, 1, filesize, f);
-		fclose(f);
+	frame->scope_count = 0;
+	vk_error(vkBeginCommandBuffer(cmd, &cmd_buffer_begin_info));
+
+	if (frame->timestamp_pool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(cmd, frame->timestamp_pool, 0,
+				MAX_GPU_SCOPES * 2);
+	}
 
+	/* The whole frame's resources, in one bind. */
+	if (vk_bindless_data.set != VK_NULL_HANDLE) {
+		bindless_bind(cmd, VK_PIPELINE_BIND_POINT_COMPUTE);
+		bindless_bind(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS);
 	}
 
+	rg_execute(cmd, frame, image_index);
+
+	vk_error(vkEndCommandBuffer(cmd));
 }
 
 /* YES, OH YESSSSS FINALLLY! */
 void vk_draw()
 {
-	uint32_t image_index;
-	VkResult result = vk_ext_pfn.vkAcquireNextImageKHR(vk_data.device,
-			vk_data.swapchain, UINT64_MAX,
-			vk_sync_data.s_image_available, VK_NULL_HANDLE, &image_index);
+	if (vk_resize_pending && !vk_options.headless) {
+		recreate_swapchain();
+
+		/* The ring is sized on the images, deliver what's in it first. */
+		if (vk_readback_data.slot_count > 0
+				&& (vk_readback_data.width != vk_surface_data.extent_2d.width
+						|| vk_readback_data.height
+								!= vk_surface_data.extent_2d.height)
+				&& vk_surface_data.extent_2d.width > 0
+				&& vk_surface_data.extent_2d.height > 0)
+		{
+			vkDeviceWaitIdle(vk_data.device);
+			flush_readback();
+			deinit_readback();
+			init_readback();
+		}
+	}
+
+	/* Minimized. */
+	if (vk_surface_data.extent_2d.width == 0
+			|| vk_surface_data.extent_2d.height == 0)
+	{
+		Sleep(10);
+		return;
+	}
+
+	/* The visibility buffers are sized on the images too. */
+	if (vk_sw_raster_data.raster_pipeline != VK_NULL_HANDLE
+			&& (vk_sw_raster_data.width != vk_surface_data.extent_2d.width
+					|| vk_sw_raster_data.height
+							!= vk_surface_data.extent_2d.height))
+	{
+		vkDeviceWaitIdle(vk_data.device);
+		destroy_sw_raster_targets();
+		create_sw_raster_targets();
+	}
+
+	FrameData* frame = &vk_frames[vk_frame_index];
+
+	/* Everything after this is CPU work, unless acquire blocks. */
+	double wait_start = time_ms();
+	vk_error(vkWaitForFences(vk_data.device, 1, &frame->f_in_flight, VK_TRUE,
+			UINT64_MAX));
+	if (frame->compute_submitted) {
+		vk_error(vkWaitForFences(vk_data.device, 1, &frame->f_compute,
+				VK_TRUE, UINT64_MAX));
+	}
+	vk_read_timestamps(frame);
+	host_allocator_new_frame();
+	hot_reload_swap();
+	if (vk_bindless_data.set != VK_NULL_HANDLE) {
+		bindless_recycle();
+	}
+	vk_cap_queued_frames();
+	vk_poll_present_latency();
+	poll_readback();
+
+	/* Offscreen targets belong to their frame slot, nothing to acquire. */
+	uint32_t image_index = vk_frame_index;
+	VkResult result = VK_SUCCESS;
+	if (!vk_options.headless) {
+		result = vk_ext_pfn.vkAcquireNextImageKHR(vk_data.device,
+				vk_data.swapchain, UINT64_MAX,
+				frame->s_image_available, VK_NULL_HANDLE, &image_index);
+	}
+	vk_frame_stats.cpu_wait_ms = time_ms() - wait_start;
 
 	switch (result) {
 		case VK_SUCCESS:
@@ -955,60 +7922,176 @@ void vk_draw()
 			//printf("success\n");
 			break;
 		case VK_ERROR_OUT_OF_DATE_KHR:
-			printf("TODO : Add window resizing.\n");
-			return; // TEMPORARY
+			vk_resize_pending = true;
+			return;
 		default:
 			printf("Problem acquiring swapchain image. Eeeek!\n");
 			vk_error(result);
 			return;
 	}
 
-	/* Submit work for free image. */
-	VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	VkSubmitInfo submit_info = {
-		.sType						= VK_STRUCTURE_TYPE_SUBMIT_INFO
+	/* After the main one, so a failure there doesn't strand their images. */
+	acquire_outputs(vk_frame_index);
+
+	if (vk_scene_data.object_count > 0) {
+		update_scene_camera();
+	}
+	if (vk_dense_mesh_data.triangle_count > 0) {
+		update_dense_mesh_camera(vk_frame_index);
+	}
+
+	/* Compute goes first, the graphics submit may wait on it. Only the scene
+	 * cull results are consumed this frame, the rest just overlaps.
+	 */
+	bool async_compute = vk_data.async_compute_active && has_compute_work();
+	bool wait_compute = async_compute && vk_scene_data.object_count > 0;
+	frame->compute_submitted = false;
+
+	if (async_compute) {
+		record_compute_cmd_buffer(frame);
+		vk_error(vkResetFences(vk_data.device, 1, &frame->f_compute));
+
+		VkSubmitInfo compute_submit_info = {
+			.sType						= VK_STRUCTURE_TYPE_SUBMIT_INFO
+			, .pNext					= NULL
+			, .waitSemaphoreCount		= 0
+			, .pWaitSemaphores			= NULL
+			, .pWaitDstStageMask		= NULL
+			, .commandBufferCount		= 1
+			, .pCommandBuffers			= &frame->compute_cmd_buffer
+			, .signalSemaphoreCount		= wait_compute ? 1 : 0
+			, .pSignalSemaphores		= &frame->s_compute_finished
+		};
+
+		vk_error(vkQueueSubmit(vk_data.compute_queue, 1, &compute_submit_info,
+				frame->f_compute));
+		frame->compute_submitted = true;
+	}
+
+	/* Only reset once we know we'll submit, or we'd wait forever. */
+	vk_error(vkResetFences(vk_data.device, 1, &frame->f_in_flight));
+	record_cmd_buffer(frame, image_index);
+
+	/* Submit work for free image. */
+	VkSemaphore wait_semaphores[MAX_OUTPUTS + 1];
+	VkPipelineStageFlags wait_dst_stage_masks[MAX_OUTPUTS + 1];
+	uint32_t wait_count = 0;
+	if (!vk_options.headless) {
+		wait_semaphores[wait_count] = frame->s_image_available;
+		wait_dst_stage_masks[wait_count++] = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+		OutputData* output = &vk_outputs_data.outputs[i];
+		if (output->acquired) {
+			wait_semaphores[wait_count] =
+					output->s_image_available[vk_frame_index];
+			wait_dst_stage_masks[wait_count++] =
+					VK_PIPELINE_STAGE_TRANSFER_BIT;
+		}
+	}
+	if (wait_compute) {
+		wait_semaphores[wait_count] = frame->s_compute_finished;
+		wait_dst_stage_masks[wait_count++] =
+				VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+	}
+	VkSubmitInfo submit_info = {
+		.sType						= VK_STRUCTURE_TYPE_SUBMIT_INFO
+		, .pNext					= NULL
+		, .waitSemaphoreCount		= wait_count
+		, .pWaitSemaphores			= wait_semaphores
+		, .pWaitDstStageMask		= wait_dst_stage_masks
+		, .commandBufferCount		= 1
+		, .pCommandBuffers			= &frame->cmd_buffer
+		, .signalSemaphoreCount		= vk_options.headless ? 0 : 1
+		, .pSignalSemaphores		= &frame->s_render_finished
+	};
+
+	vk_error(vkQueueSubmit(vk_data.queue, 1, &submit_info,
+			frame->f_in_flight));
+	frame->submitted = true;
+	vk_frame_index = (vk_frame_index + 1) % FRAMES_IN_FLIGHT;
+	++vk_frame_number;
+
+	if (vk_options.headless)
+		return;
+
+	/* Every acquired swapchain in one go, the main one first. */
+	VkSwapchainKHR swapchains[MAX_OUTPUTS] = { vk_data.swapchain };
+	uint32_t image_indices[MAX_OUTPUTS] = { image_index };
+	OutputData* presented[MAX_OUTPUTS] = { NULL };
+	VkResult results[MAX_OUTPUTS];
+	uint32_t swapchain_count = 1;
+	for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+		OutputData* output = &vk_outputs_data.outputs[i];
+		if (output->acquired) {
+			swapchains[swapchain_count] = output->swapchain;
+			image_indices[swapchain_count] = output->image_index;
+			presented[swapchain_count++] = output;
+		}
+	}
+
+	/* Tag the present, so we can wait for it to hit the screen. Only the
+	 * main swapchain is waited on, 0 leaves the others untagged.
+	 */
+	uint64_t present_id = vk_present_data.last_present_id + 1;
+	uint64_t present_ids[MAX_OUTPUTS] = { present_id };
+	VkPresentIdKHR present_id_info = {
+		.sType						= VK_STRUCTURE_TYPE_PRESENT_ID_KHR
 		, .pNext					= NULL
-		, .waitSemaphoreCount		= 1
-		, .pWaitSemaphores			= &vk_sync_data.s_image_available
-		, .pWaitDstStageMask		= &wait_dst_stage_mask
-		, .commandBufferCount		= 1
-		, .pCommandBuffers			= &vk_data.queue_cmd_buffers[image_index]
-		, .signalSemaphoreCount		= 1
-		, .pSignalSemaphores		= &vk_sync_data.s_render_finished
+		, .swapchainCount			= swapchain_count
+		, .pPresentIds				= present_ids
 	};
 
-	vk_error(vkQueueSubmit(vk_data.queue, 1, &submit_info,
-			VK_NULL_HANDLE));
+	if (vk_extensions_data.present_id) {
+		vk_present_data.last_present_id = present_id;
+		vk_present_data.submit_ms[present_id % PRESENT_HISTORY] = time_ms();
+	}
 
 	/* Swap images with the prepared image. */
 	VkPresentInfoKHR present_info = {
 		.sType						= VK_STRUCTURE_TYPE_PRESENT_INFO_KHR
-		, .pNext					= NULL
+		, .pNext					= vk_extensions_data.present_id
+				? &present_id_info : NULL
 		, .waitSemaphoreCount		= 1
-		, .pWaitSemaphores			= &vk_sync_data.s_render_finished
-		, .swapchainCount			= 1
-		, .pSwapchains				= &vk_data.swapchain
-		, .pImageIndices			= &image_index
-		, .pResults					= NULL
+		, .pWaitSemaphores			= &frame->s_render_finished
+		, .swapchainCount			= swapchain_count
+		, .pSwapchains				= swapchains
+		, .pImageIndices			= image_indices
+		, .pResults					= results
 	};
 
 	result = vk_ext_pfn.vkQueuePresentKHR(vk_data.queue, &present_info);
 
-	switch (result) {
-		case VK_SUCCESS:
-			//printf("present success\n");
-			break;
-		case VK_ERROR_OUT_OF_DATE_KHR:
-		case VK_SUBOPTIMAL_KHR:
-			printf("TODO : Add window resizing.\n");
-			return; // TEMPORARY
-		default:
-			printf("Problem acquiring swapchain image. Eeeek!\n");
-			vk_error(result);
-			return;
+	/* The call returns the worst, each swapchain gets its own. */
+	for (uint32_t i = 0; i < swapchain_count; ++i) {
+		if (presented[i] != NULL) {
+			presented[i]->last_result = results[i];
+			++presented[i]->present_count;
+		}
 
+		switch (results[i]) {
+			case VK_SUCCESS:
+				//printf("present success\n");
+				break;
+			case VK_ERROR_OUT_OF_DATE_KHR:
+			case VK_SUBOPTIMAL_KHR:
+				if (presented[i] != NULL) {
+					presented[i]->resize_pending = true;
+				} else {
+					vk_resize_pending = true;
+				}
+				break;
+			default:
+				printf("Problem presenting swapchain %d. Eeeek!\n", i);
+				vk_error(results[i]);
+				return;
+		}
 	}
 
+	/* Device loss and such don't get to the results. */
+	if (result < 0 && result != VK_ERROR_OUT_OF_DATE_KHR) {
+		vk_error(result);
+	}
 }
 
 void clear_vk_buffers()
@@ -1018,76 +8101,819 @@ void clear_vk_buffers()
 
 	vkDeviceWaitIdle(vk_data.device);
 
-	if (vk_data.queue_cmd_buffers_size > 0
-			&& vk_data.queue_cmd_buffers[0] != VK_NULL_HANDLE)
-	{
+	for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
 		/* For example, freeing command pool frees buffers. */
-		vkFreeCommandBuffers(vk_data.device, vk_data.queue_cmd_pool,
-				vk_data.queue_cmd_buffers_size, vk_data.queue_cmd_buffers);
-		free(vk_data.queue_cmd_buffers);
+		if (vk_frames[i].cmd_buffer != VK_NULL_HANDLE) {
+			vkFreeCommandBuffers(vk_data.device, vk_data.queue_cmd_pool, 1,
+					&vk_frames[i].cmd_buffer);
+			vk_frames[i].cmd_buffer = VK_NULL_HANDLE;
+		}
+		if (vk_frames[i].compute_cmd_buffer != VK_NULL_HANDLE) {
+			vkFreeCommandBuffers(vk_data.device, vk_data.compute_cmd_pool, 1,
+					&vk_frames[i].compute_cmd_buffer);
+			vk_frames[i].compute_cmd_buffer = VK_NULL_HANDLE;
+		}
 	}
 
 	if (vk_data.queue_cmd_pool != VK_NULL_HANDLE) {
-		vkDestroyCommandPool(vk_data.device, vk_data.queue_cmd_pool, NULL);
+		vkDestroyCommandPool(vk_data.device, vk_data.queue_cmd_pool,
+				vk_allocator);
 		vk_data.queue_cmd_pool = VK_NULL_HANDLE;
 	}
+	if (vk_data.compute_cmd_pool != VK_NULL_HANDLE) {
+		vkDestroyCommandPool(vk_data.device, vk_data.compute_cmd_pool,
+				vk_allocator);
+		vk_data.compute_cmd_pool = VK_NULL_HANDLE;
+	}
 }
 
 void deinit_vk()
 {
 	clear_vk_buffers();
-
-	free(vk_data.image_views);
-	free(vk_data.frame_buffers);
+	stop_hot_reload();
+	deinit_pipeline_variants();
+	/* Everything that queues jobs has waited on them. */
+	jobs_shutdown();
+	rg_destroy_transients();
+	deinit_sw_raster();
+	deinit_vk_dense_mesh();
+	deinit_vk_scene();
+	deinit_vk_compute_load();
+	deinit_vk_bindless();
+	/* Idle since the buffers were cleared. */
+	flush_readback();
+	deinit_readback();
+	deinit_outputs();
 
 	if (vk_data.device != VK_NULL_HANDLE) {
 		vkDeviceWaitIdle(vk_data.device);
 
-		if (vk_sync_data.s_image_available != VK_NULL_HANDLE) {
-			vkDestroySemaphore(vk_data.device, vk_sync_data.s_image_available,
-					NULL);
+		destroy_swapchain_targets();
+		destroy_offscreen_targets();
+		if (vk_data.pipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(vk_data.device, vk_data.pipeline, vk_allocator);
 		}
-		if (vk_sync_data.s_render_finished != VK_NULL_HANDLE) {
-			vkDestroySemaphore(vk_data.device, vk_sync_data.s_render_finished,
-					NULL);
+		if (vk_data.pipeline_cache != VK_NULL_HANDLE) {
+			vkDestroyPipelineCache(vk_data.device, vk_data.pipeline_cache,
+					vk_allocator);
+		}
+		if (vk_data.pipeline_layout != VK_NULL_HANDLE) {
+			vkDestroyPipelineLayout(vk_data.device, vk_data.pipeline_layout,
+					vk_allocator);
+		}
+		if (vk_data.render_pass != VK_NULL_HANDLE) {
+			vkDestroyRenderPass(vk_data.device, vk_data.render_pass,
+					vk_allocator);
+		}
+
+		for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+			if (vk_frames[i].s_image_available != VK_NULL_HANDLE) {
+				vkDestroySemaphore(vk_data.device,
+						vk_frames[i].s_image_available, vk_allocator);
+			}
+			if (vk_frames[i].s_render_finished != VK_NULL_HANDLE) {
+				vkDestroySemaphore(vk_data.device,
+						vk_frames[i].s_render_finished, vk_allocator);
+			}
+			if (vk_frames[i].f_in_flight != VK_NULL_HANDLE) {
+				vkDestroyFence(vk_data.device, vk_frames[i].f_in_flight,
+						vk_allocator);
+			}
+			if (vk_frames[i].s_compute_finished != VK_NULL_HANDLE) {
+				vkDestroySemaphore(vk_data.device,
+						vk_frames[i].s_compute_finished, vk_allocator);
+			}
+			if (vk_frames[i].f_compute != VK_NULL_HANDLE) {
+				vkDestroyFence(vk_data.device, vk_frames[i].f_compute,
+						vk_allocator);
+			}
+			if (vk_frames[i].timestamp_pool != VK_NULL_HANDLE) {
+				vkDestroyQueryPool(vk_data.device, vk_frames[i].timestamp_pool,
+						vk_allocator);
+			}
 		}
 		if (vk_data.swapchain != VK_NULL_HANDLE) {
 			vk_ext_pfn.vkDestroySwapchainKHR(vk_data.device, vk_data.swapchain,
-					NULL);
+					vk_allocator);
 		}
 
-		vkDestroyDevice(vk_data.device, NULL);
+		vkDestroyDevice(vk_data.device, vk_allocator);
 	}
 
+	free(vk_data.swapchain_images);
+	free(vk_extensions_data.available_device_extensions);
+
 	if (vk_data.surface != VK_NULL_HANDLE) {
-		vkDestroySurfaceKHR(vk_data.instance, vk_data.surface, NULL);
+		vkDestroySurfaceKHR(vk_data.instance, vk_data.surface, vk_allocator);
 	}
 
 
 	if (vk_data.instance != VK_NULL_HANDLE) {
-		vkDestroyInstance(vk_data.instance, NULL);
+		vkDestroyInstance(vk_data.instance, vk_allocator);
+	}
+
+	/* Anything still live here leaked. */
+	print_host_memory_report();
+	deinit_host_allocator();
+}
+
+void print_frame_stats(uint32_t fps)
+{
+	printf("%d fps | cpu %.3f ms (wait %.3f ms)", fps,
+			vk_frame_stats.cpu_frame_ms, vk_frame_stats.cpu_wait_ms);
+
+	if (vk_extensions_data.present_wait) {
+		printf(" | present %.3f ms", vk_frame_stats.present_latency_ms);
+	}
+
+	printf(" | %d passes (%d culled), %d barriers", vk_graph.live_pass_count,
+			vk_graph.culled_pass_count, vk_graph.barrier_count);
+
+	if (vk_allocator != NULL) {
+		printf(" | host %.1f KiB",
+				(double)host_allocator_live_bytes() / 1024.0);
+	}
+
+	if (vk_graph.lazy_size > 0) {
+		printf(" | lazy %.2f/%.2f MiB",
+				(double)rg_lazy_committed_size() / (1024.0 * 1024.0),
+				(double)vk_graph.lazy_size / (1024.0 * 1024.0));
+	}
+
+	if (vk_outputs_data.count > 0) {
+		uint64_t skips = 0;
+		for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+			skips += vk_outputs_data.outputs[i].skip_count;
+		}
+		printf(" | %d outputs, %llu skipped", vk_outputs_data.count + 1,
+				(unsigned long long)skips);
+	}
+
+	if (vk_sw_raster_data.active && vk_extensions_data.draw_indirect_count) {
+		printf(" | %d hw meshlets", vk_sw_raster_data.hw_meshlet_count);
+	}
+
+	if (vk_scene_data.occlusion) {
+		printf(" | occlusion %.3f ms, %.1f%% culled",
+				vk_scene_data.occlusion_ms,
+				100.0 * (double)vk_scene_data.occluded_count
+						/ (double)vk_scene_data.object_count);
+	}
+
+	if (vk_readback_data.slot_count > 0) {
+		printf(" | readback %llu frames",
+				(unsigned long long)vk_readback_data.frame_count);
+	}
+
+	if (vk_frame_stats.gpu_scope_count == 0) {
+		printf("\n");
+		return;
+	}
+
+	printf(" | gpu %.3f ms (", vk_frame_stats.gpu_frame_ms);
+	for (uint32_t i = 0; i < vk_frame_stats.gpu_scope_count; ++i) {
+		printf("%s%s %.3f ms", i == 0 ? "" : ", ",
+				vk_frame_stats.gpu_scope_names[i],
+				vk_frame_stats.gpu_scope_ms[i]);
+	}
+
+	/* Waiting on the GPU more than working means we're GPU-bound. */
+	double cpu_work_ms = vk_frame_stats.cpu_frame_ms
+			- vk_frame_stats.cpu_wait_ms;
+	printf(") | %s-bound\n", vk_frame_stats.gpu_frame_ms > cpu_work_ms
+			? "gpu" : "cpu");
+}
+
+/* Returns false once the window is closed. */
+bool pump_messages()
+{
+	MSG msg;
+	bool done = false;
+	while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+		if (msg.message == WM_QUIT)
+			done = true;
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+	return !done;
+}
+
+/* Average ms per frame over frame_count frames, after a warmup. Returns a
+ * negative value if the window was closed.
+ */
+double bench_frames(uint32_t frame_count)
+{
+	for (uint32_t i = 0; i < 30; ++i) {
+		if (!pump_messages())
+			return -1.0;
+		vk_draw();
+	}
+	vkDeviceWaitIdle(vk_data.device);
+
+	double start = time_ms();
+	for (uint32_t i = 0; i < frame_count; ++i) {
+		if (!pump_messages())
+			return -1.0;
+		vk_draw();
+	}
+	vkDeviceWaitIdle(vk_data.device);
+	return (time_ms() - start) / (double)frame_count;
+}
+
+/* Same work recorded inline on the graphics queue, then split across the
+ * graphics and compute queues. The difference is what the overlap buys.
+ */
+void bench_async_compute()
+{
+	uint32_t frame_count = vk_options.bench_async_compute;
+	printf("Async compute benchmark : %d frames, %d iterations, "
+			"%d objects\n", frame_count, vk_compute_load_data.iterations,
+			vk_scene_data.object_count);
+
+	vk_data.async_compute_active = false;
+	double serial_ms = bench_frames(frame_count);
+	if (serial_ms < 0.0)
+		return;
+	printf("    serial : %.3f ms/frame\n", serial_ms);
+
+	if (!vk_data.async_compute) {
+		printf("    async  : no async compute queue\n");
+		return;
+	}
+
+	vk_data.async_compute_active = true;
+	double async_ms = bench_frames(frame_count);
+	if (async_ms < 0.0)
+		return;
+	printf("    async  : %.3f ms/frame\n", async_ms);
+	printf("    overlap gain : %.1f %%\n",
+			(serial_ms - async_ms) / serial_ms * 100.0);
+}
+
+/* Same instances and triangles through both pipelines. Throughput counts
+ * the input triangles, culled or not.
+ */
+void bench_mesh_shader()
+{
+	uint32_t frame_count = vk_options.bench_mesh_shader;
+	uint64_t triangles = (uint64_t)vk_dense_mesh_data.triangle_count
+			* DENSE_MESH_GRID_SIDE * DENSE_MESH_GRID_SIDE;
+	printf("Mesh shader benchmark : %d frames, %llu triangles per frame\n",
+			frame_count, (unsigned long long)triangles);
+
+	vk_dense_mesh_data.use_mesh_shader = false;
+	double vertex_ms = bench_frames(frame_count);
+	if (vertex_ms < 0.0)
+		return;
+	printf("    vertex : %.3f ms/frame, %.1f Mtri/s\n", vertex_ms,
+			(double)triangles / vertex_ms / 1000.0);
+
+	if (vk_dense_mesh_data.mesh_pipeline == VK_NULL_HANDLE) {
+		printf("    mesh   : no mesh shader support\n");
+		return;
+	}
+
+	vk_dense_mesh_data.use_mesh_shader = true;
+	double mesh_ms = bench_frames(frame_count);
+	if (mesh_ms < 0.0)
+		return;
+	printf("    mesh   : %.3f ms/frame, %.1f Mtri/s\n", mesh_ms,
+			(double)triangles / mesh_ms / 1000.0);
+	printf("    speedup : %.2fx\n", vertex_ms / mesh_ms);
+}
+
+/* The vertex pipeline first, then the visibility buffer path from all
+ * hardware to all software. The threshold with the lowest frame time is
+ * where software starts paying off. The meshlet share needs indirect count.
+ */
+void bench_sw_raster()
+{
+	uint32_t frame_count = vk_options.bench_sw_raster;
+	uint32_t meshlets = vk_dense_mesh_data.meshlet_count
+			* DENSE_MESH_GRID_SIDE * DENSE_MESH_GRID_SIDE;
+	printf("Software raster benchmark : %d frames, %d meshlets of %d "
+			"triangles\n", frame_count, meshlets,
+			vk_dense_mesh_data.triangle_count
+					/ vk_dense_mesh_data.meshlet_count);
+
+	vk_sw_raster_data.active = false;
+	vk_dense_mesh_data.use_mesh_shader = false;
+	double vertex_ms = bench_frames(frame_count);
+	if (vertex_ms < 0.0)
+		return;
+	printf("    vertex       : %.3f ms/frame\n", vertex_ms);
+
+	if (vk_sw_raster_data.raster_pipeline == VK_NULL_HANDLE) {
+		printf("    visibility   : no software raster support\n");
+		return;
+	}
+
+	/* 0 is all hardware, the last all software. */
+	const float thresholds[] = {
+		0.0f, 0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f, 16.0f, FLT_MAX
+	};
+	uint32_t threshold_count = sizeof(thresholds) / sizeof(thresholds[0]);
+	float best_threshold = 0.0f;
+	double best_ms = 0.0;
+
+	vk_sw_raster_data.active = true;
+	for (uint32_t i = 0; i < threshold_count; ++i) {
+		vk_sw_raster_data.threshold = thresholds[i];
+		double ms = bench_frames(frame_count);
+		if (ms < 0.0)
+			return;
+
+		if (i == 0) {
+			printf("    all hardware : %.3f ms/frame", ms);
+		} else if (i == threshold_count - 1) {
+			printf("    all software : %.3f ms/frame", ms);
+		} else {
+			printf("    under %5.2f  : %.3f ms/frame", thresholds[i], ms);
+		}
+		if (vk_extensions_data.draw_indirect_count) {
+			printf(", %.1f %% meshlets in hardware",
+					100.0 * vk_sw_raster_data.hw_meshlet_count / meshlets);
+		}
+		printf("\n");
+
+		if (i == 0 || ms < best_ms) {
+			best_ms = ms;
+			best_threshold = thresholds[i];
+		}
+	}
+
+	if (best_threshold == 0.0f) {
+		printf("    crossover : none, hardware wins\n");
+	} else if (best_threshold == FLT_MAX) {
+		printf("    crossover : none, software wins\n");
+	} else {
+		printf("    crossover : about %.2f pixels per triangle\n",
+				best_threshold);
+	}
+	printf("    best vs vertex : %.2fx\n", vertex_ms / best_ms);
+}
+
+/* No window to close, runs a fixed number of frames. Readback is how the
+ * frames get out.
+ */
+void run_headless()
+{
+	printf("Headless : %d frames\n", vk_options.frame_count);
+
+	uint32_t count_fps = 0;
+	time_t last_second = time(NULL);
+	double start = time_ms();
+	double frame_start = start;
+
+	for (uint32_t i = 0; i < vk_options.frame_count; ++i) {
+		vk_draw();
+
+		double frame_end = time_ms();
+		vk_frame_stats.cpu_frame_ms = frame_end - frame_start;
+		frame_start = frame_end;
+
+		++count_fps;
+		time_t now = time(NULL);
+		if (now > last_second) {
+			print_frame_stats(count_fps);
+			last_second = now;
+			count_fps = 0;
+		}
+	}
+
+	vkDeviceWaitIdle(vk_data.device);
+	flush_readback();
+	double total_ms = time_ms() - start;
+
+	printf("    %.1f fps, %.3f ms/frame\n",
+			vk_options.frame_count / total_ms * 1000.0,
+			total_ms / vk_options.frame_count);
+	if (vk_readback_data.slot_count > 0) {
+		printf("    readback : %llu frames, %.1f MiB/s, callback %.3f ms/frame"
+				"\n", (unsigned long long)vk_readback_data.frame_count,
+				(double)vk_readback_data.byte_count / (1024.0 * 1024.0)
+						/ total_ms * 1000.0,
+				vk_readback_data.frame_count > 0
+						? vk_readback_data.callback_ms
+								/ vk_readback_data.frame_count
+						: 0.0);
+	}
+}
+
+/* Same variants each time, from an empty cache. Compile time should drop
+ * with the thread count, until the driver serializes.
+ */
+void bench_pipeline_variants()
+{
+	uint32_t max_threads = vk_options.job_threads > 0
+			? vk_options.job_threads : job_cpu_count();
+	if (max_threads > JOB_MAX_WORKERS) {
+		max_threads = JOB_MAX_WORKERS;
+	}
+	printf("Pipeline variant benchmark : %d variants, up to %d threads\n",
+			vk_variants.count, max_threads);
+
+	double single_ms = 0.0;
+	for (uint32_t threads = 1; ; threads *= 2) {
+		if (threads > max_threads) {
+			threads = max_threads;
+		}
+
+		double compile_ms = recompile_pipeline_variants(threads);
+		if (threads == 1) {
+			single_ms = compile_ms;
+		}
+		printf("    %2d threads : %8.1f ms, %.2fx\n", threads, compile_ms,
+				single_ms / compile_ms);
+
+		if (threads == max_threads)
+			break;
+	}
+}
+
+void print_usage()
+{
+	printf("Options :\n"
+			"    --present-policy=default|vsync|latency|throughput\n"
+			"    --present-mode=immediate|mailbox|fifo|fifo_relaxed\n"
+			"    --low-latency[=frames]  Cap queued frames, default 1.\n"
+			"    --no-dynamic-rendering  Use render pass and framebuffers.\n"
+			"    --scene=objects         GPU culled scene instead of the triangle.\n"
+			"    --occlusion             Hi-Z cull the scene on the CPU first.\n"
+			"    --no-async-compute      Record compute on the graphics queue.\n"
+			"    --compute-load=iterations  Synthetic compute work per frame.\n"
+			"    --bench=async-compute[=frames]  Serial vs async, then exit.\n"
+			"    --dense-mesh=segments   Grid of tessellated spheres.\n"
+			"    --mesh-shader           Draw the dense mesh with meshlets.\n"
+			"    --bench=mesh-shader[=frames]  Vertex vs mesh shader, then exit.\n"
+			"    --no-host-allocator     Driver's own host allocations, no stats.\n"
+			"    --hot-reload            Rebuild pipelines when .spv files change.\n"
+			"    --variants[=lazy]       Compile pipeline variants at startup, or on use.\n"
+			"    --job-threads=n         Job threads, default one per core.\n"
+			"    --bench=pipeline-variants  Compile time per thread count, then exit.\n"
+			"    --headless[=WxH]        Offscreen targets, no window. Reads back.\n"
+			"    --frames=n              Frames to render headless, default 300.\n"
+			"    --readback[=frames]     Copy frames to the host, this late.\n"
+			"    --readback-dir=path     Write read back frames as .ppm files.\n"
+			"    --msaa=samples          Multisampled drawing, resolved in the pass.\n"
+			"    --depth                 Depth test the draws.\n"
+			"    --no-lazy-memory        Transient attachments in device memory.\n"
+			"    --outputs=n             Windows, all presented at once, max 4.\n"
+			"    --sw-raster[=pixels]    Rasterize tiny dense mesh triangles in compute.\n"
+			"    --bench=sw-raster[=frames]  Hardware vs software per threshold, then exit.\n");
+}
+
+void parse_args(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+
+		if (strncmp(arg, "--present-policy=", 17) == 0) {
+			const char* value = arg + 17;
+			bool found = false;
+			for (int p = 0; p < PRESENT_POLICY_COUNT; ++p) {
+				if (strcmp(value, present_policy_names[p]) == 0) {
+					vk_options.present_policy = (PresentPolicy)p;
+					found = true;
+				}
+			}
+			if (!found) {
+				printf("Unknown present policy : %s\n", value);
+				print_usage();
+				exit(-1);
+			}
+
+		} else if (strncmp(arg, "--present-mode=", 15) == 0) {
+			const char* value = arg + 15;
+			const VkPresentModeKHR modes[] = {
+				VK_PRESENT_MODE_IMMEDIATE_KHR
+				, VK_PRESENT_MODE_MAILBOX_KHR
+				, VK_PRESENT_MODE_FIFO_KHR
+				, VK_PRESENT_MODE_FIFO_RELAXED_KHR
+			};
+			bool found = false;
+			for (int m = 0; m < 4; ++m) {
+				if (strcmp(value, present_mode_name(modes[m])) == 0) {
+					vk_options.present_mode = modes[m];
+					vk_options.force_present_mode = true;
+					found = true;
+				}
+			}
+			if (!found) {
+				printf("Unknown present mode : %s\n", value);
+				print_usage();
+				exit(-1);
+			}
+
+		} else if (strcmp(arg, "--low-latency") == 0) {
+			vk_options.max_queued_frames = 1;
+
+		} else if (strncmp(arg, "--low-latency=", 14) == 0) {
+			vk_options.max_queued_frames = (uint32_t)atoi(arg + 14);
+			if (vk_options.max_queued_frames == 0) {
+				vk_options.max_queued_frames = 1;
+			}
+
+		} else if (strncmp(arg, "--scene=", 8) == 0) {
+			vk_options.scene_objects = (uint32_t)atoi(arg + 8);
+
+		} else if (strcmp(arg, "--occlusion") == 0) {
+			vk_options.occlusion = true;
+
+		} else if (strcmp(arg, "--no-dynamic-rendering") == 0) {
+			vk_options.no_dynamic_rendering = true;
+
+		} else if (strcmp(arg, "--no-async-compute") == 0) {
+			vk_options.no_async_compute = true;
+
+		} else if (strncmp(arg, "--compute-load=", 15) == 0) {
+			vk_options.compute_load = (uint32_t)atoi(arg + 15);
+
+		} else if (strcmp(arg, "--bench=async-compute") == 0) {
+			vk_options.bench_async_compute = 300;
+
+		} else if (strncmp(arg, "--bench=async-compute=", 22) == 0) {
+			vk_options.bench_async_compute = (uint32_t)atoi(arg + 22);
+			if (vk_options.bench_async_compute == 0) {
+				vk_options.bench_async_compute = 300;
+			}
+
+		} else if (strncmp(arg, "--dense-mesh=", 13) == 0) {
+			vk_options.dense_mesh_segments = (uint32_t)atoi(arg + 13);
+
+		} else if (strcmp(arg, "--mesh-shader") == 0) {
+			vk_options.mesh_shader = true;
+
+		} else if (strcmp(arg, "--bench=mesh-shader") == 0) {
+			vk_options.bench_mesh_shader = 300;
+
+		} else if (strncmp(arg, "--bench=mesh-shader=", 20) == 0) {
+			vk_options.bench_mesh_shader = (uint32_t)atoi(arg + 20);
+			if (vk_options.bench_mesh_shader == 0) {
+				vk_options.bench_mesh_shader = 300;
+			}
+
+		} else if (strcmp(arg, "--no-host-allocator") == 0) {
+			vk_options.no_host_allocator = true;
+
+		} else if (strcmp(arg, "--hot-reload") == 0) {
+			vk_options.hot_reload = true;
+
+		} else if (strcmp(arg, "--variants") == 0) {
+			vk_options.pipeline_variants = VARIANTS_EAGER;
+
+		} else if (strcmp(arg, "--variants=lazy") == 0) {
+			vk_options.pipeline_variants = VARIANTS_LAZY;
+
+		} else if (strncmp(arg, "--job-threads=", 14) == 0) {
+			vk_options.job_threads = (uint32_t)atoi(arg + 14);
+
+		} else if (strcmp(arg, "--bench=pipeline-variants") == 0) {
+			vk_options.bench_pipeline_variants = true;
+
+		} else if (strcmp(arg, "--headless") == 0) {
+			vk_options.headless = true;
+
+		} else if (strncmp(arg, "--headless=", 11) == 0) {
+			vk_options.headless = true;
+			unsigned int width = 0;
+			unsigned int height = 0;
+			if (sscanf(arg + 11, "%ux%u", &width, &height) != 2
+					|| width == 0 || height == 0) {
+				printf("Bad offscreen size : %s\n", arg + 11);
+				print_usage();
+				exit(-1);
+			}
+			vk_options.offscreen_width = width;
+			vk_options.offscreen_height = height;
+
+		} else if (strncmp(arg, "--frames=", 9) == 0) {
+			vk_options.frame_count = (uint32_t)atoi(arg + 9);
+
+		} else if (strcmp(arg, "--readback") == 0) {
+			vk_options.readback_latency = FRAMES_IN_FLIGHT;
+
+		} else if (strncmp(arg, "--readback=", 11) == 0) {
+			vk_options.readback_latency = (uint32_t)atoi(arg + 11);
+			if (vk_options.readback_latency == 0) {
+				vk_options.readback_latency = FRAMES_IN_FLIGHT;
+			}
+
+		} else if (strncmp(arg, "--readback-dir=", 15) == 0) {
+			vk_options.readback_dir = arg + 15;
+
+		} else if (strncmp(arg, "--msaa=", 7) == 0) {
+			vk_options.msaa_samples = (uint32_t)atoi(arg + 7);
+			if (vk_options.msaa_samples == 0) {
+				vk_options.msaa_samples = 1;
+			}
+
+		} else if (strcmp(arg, "--depth") == 0) {
+			vk_options.depth = true;
+
+		} else if (strcmp(arg, "--no-lazy-memory") == 0) {
+			vk_options.no_lazy_memory = true;
+
+		} else if (strncmp(arg, "--outputs=", 10) == 0) {
+			vk_options.output_count = (uint32_t)atoi(arg + 10);
+			if (vk_options.output_count == 0) {
+				vk_options.output_count = 1;
+			}
+			if (vk_options.output_count > MAX_OUTPUTS) {
+				vk_options.output_count = MAX_OUTPUTS;
+			}
+
+		} else if (strcmp(arg, "--sw-raster") == 0) {
+			vk_options.sw_raster = true;
+
+		} else if (strncmp(arg, "--sw-raster=", 12) == 0) {
+			vk_options.sw_raster = true;
+			vk_options.sw_raster_threshold = (float)atof(arg + 12);
+
+		} else if (strcmp(arg, "--bench=sw-raster") == 0) {
+			vk_options.bench_sw_raster = 300;
+
+		} else if (strncmp(arg, "--bench=sw-raster=", 18) == 0) {
+			vk_options.bench_sw_raster = (uint32_t)atoi(arg + 18);
+			if (vk_options.bench_sw_raster == 0) {
+				vk_options.bench_sw_raster = 300;
+			}
+
+		} else {
+			printf("Unknown option : %s\n", arg);
+			print_usage();
+			exit(-1);
+		}
 	}
 }
 
 int main(int argc, char** argv) {
 	printf("%s - iLLOGIKA\n\n", app_name);
 
-	create_window(512, 512, app_name);
+	parse_args(argc, argv);
+
+	/* Don't let vsync hide the overlap. */
+	if (vk_options.bench_async_compute > 0) {
+		if (!vk_options.force_present_mode
+				&& vk_options.present_policy == PRESENT_POLICY_DEFAULT) {
+			vk_options.present_policy = PRESENT_POLICY_THROUGHPUT;
+		}
+		if (vk_options.compute_load == 0) {
+			vk_options.compute_load = 256;
+		}
+	}
+	if (vk_options.bench_mesh_shader > 0) {
+		if (!vk_options.force_present_mode
+				&& vk_options.present_policy == PRESENT_POLICY_DEFAULT) {
+			vk_options.present_policy = PRESENT_POLICY_THROUGHPUT;
+		}
+		if (vk_options.dense_mesh_segments == 0) {
+			vk_options.dense_mesh_segments = 256;
+		}
+		vk_options.mesh_shader = true;
+	}
+	if (vk_options.bench_sw_raster > 0) {
+		if (!vk_options.force_present_mode
+				&& vk_options.present_policy == PRESENT_POLICY_DEFAULT) {
+			vk_options.present_policy = PRESENT_POLICY_THROUGHPUT;
+		}
+		vk_options.sw_raster = true;
+	}
+
+	/* Rasterizes the dense mesh, and resolves to single sampled color. */
+	if (vk_options.sw_raster) {
+		if (vk_options.dense_mesh_segments == 0) {
+			vk_options.dense_mesh_segments = 256;
+		}
+		if (vk_options.msaa_samples > 1 || vk_options.depth) {
+			printf("No MSAA or depth with the software raster.\n");
+		}
+		vk_options.msaa_samples = 1;
+		vk_options.depth = false;
+	}
+
+	/* The scene is what gets occlusion culled. */
+	if (vk_options.occlusion && vk_options.scene_objects == 0) {
+		vk_options.scene_objects = 4096;
+	}
+
+	/* Fewer and the poles eat the whole sphere. */
+	if (vk_options.dense_mesh_segments > 0
+			&& vk_options.dense_mesh_segments < 4) {
+		vk_options.dense_mesh_segments = 4;
+	}
+
+	/* Headless frames are only seen through readback. */
+	if (vk_options.headless || vk_options.readback_dir != NULL) {
+		if (vk_options.readback_latency == 0) {
+			vk_options.readback_latency = FRAMES_IN_FLIGHT;
+		}
+	}
+
+	if (!vk_options.headless) {
+		create_window(512, 512, app_name);
+	}
+	if (!vk_options.no_host_allocator) {
+		init_host_allocator();
+	}
 	init_vk();
+	if (vk_options.headless) {
+		create_offscreen_targets();
+	}
+	if (!vk_options.headless && vk_options.output_count > 1) {
+		init_outputs();
+	}
+	init_vk_attachments();
+
+	/* Pipelines are registered by each feature's init, and all built at
+	 * once after the last.
+	 */
+	jobs_init(vk_options.job_threads);
+	vk_hot_reload.defer_builds = true;
 	init_vk_pipeline();
+	if (vk_options.readback_latency > 0) {
+		init_readback();
+		if (vk_options.readback_dir != NULL) {
+			set_readback_callback(write_readback_frame,
+					(void*)vk_options.readback_dir);
+		}
+	}
+	init_vk_bindless();
+	if (vk_options.scene_objects > 0) {
+		init_vk_scene();
+	}
+	if (vk_options.compute_load > 0) {
+		init_vk_compute_load();
+	}
+	if (vk_options.dense_mesh_segments > 0) {
+		init_vk_dense_mesh();
+	}
+	if (vk_options.sw_raster) {
+		init_sw_raster();
+	}
+	build_registered_pipelines();
+
+	if (vk_options.bench_pipeline_variants
+			&& vk_options.pipeline_variants == VARIANTS_OFF) {
+		vk_options.pipeline_variants = VARIANTS_LAZY;
+	}
+	if (vk_options.pipeline_variants != VARIANTS_OFF) {
+		init_pipeline_variants();
+	}
+	if (vk_options.hot_reload) {
+		start_hot_reload();
+	}
+
+	/* Window creation sends a WM_SIZE, but we just built everything. */
+	vk_resize_pending = false;
+	for (uint32_t i = 0; i < vk_outputs_data.count; ++i) {
+		vk_outputs_data.outputs[i].resize_pending = false;
+	}
+
+	if (vk_options.headless) {
+		run_headless();
+		deinit_vk();
+		return 0;
+	}
+
+	if (vk_options.bench_async_compute > 0) {
+		bench_async_compute();
+		deinit_vk();
+		return 0;
+	}
+	if (vk_options.bench_mesh_shader > 0) {
+		bench_mesh_shader();
+		deinit_vk();
+		return 0;
+	}
+	if (vk_options.bench_pipeline_variants) {
+		bench_pipeline_variants();
+		deinit_vk();
+		return 0;
+	}
+	if (vk_options.bench_sw_raster > 0) {
+		bench_sw_raster();
+		deinit_vk();
+		return 0;
+	}
 
 	uint32_t count_fps = 0;
 	time_t last_second = time(NULL);;
 	time_t now = time(NULL);
+	double frame_start = time_ms();
 
-	while (true) {
+	while (pump_messages()) {
 		vk_draw();
 
 		{
+			double frame_end = time_ms();
+			vk_frame_stats.cpu_frame_ms = frame_end - frame_start;
+			frame_start = frame_end;
+
 			++count_fps;
 			now = time(NULL);
 			if (now > last_second) {
-				printf("%d fps\n", count_fps);
+				print_frame_stats(count_fps);
 				last_second = now;
 				count_fps = 0;
 			}
@@ -0,0 +1,47 @@
+#version 450
+#ifdef BINDLESS_FIXED
+/* Without descriptor indexing, the table's fixed size. The indices come from
+ * push constants, dynamically uniform.
+ */
+#define BINDLESS_BUFFERS BINDLESS_FIXED
+#else
+#extension GL_EXT_nonuniform_qualifier : require
+#define BINDLESS_BUFFERS
+#endif
+
+/* Dense mesh through the vertex pipeline. Instances are laid out on a grid,
+ * like win_vulkan_mesh.task does.
+ */
+layout(location = 0) in vec3 position;
+
+layout(push_constant) uniform Mesh {
+	/* Bindless buffer indices. */
+	uint camera;
+	uint positions;
+	uint meshlets;
+	uint meshlet_vertices;
+	uint meshlet_triangles;
+	uint meshlet_count;
+	uint grid_side;
+	float spacing;
+} mesh;
+
+/* Storage buffers of the bindless table. */
+layout(std430, set = 0, binding = 0) readonly buffer Camera {
+	mat4 view_proj;
+	vec4 eye;
+	vec4 planes[6];
+} camera_buffers[BINDLESS_BUFFERS];
+
+vec3 instance_offset(uint instance)
+{
+	vec2 cell = vec2(instance % mesh.grid_side, instance / mesh.grid_side)
+			- 0.5 * float(mesh.grid_side - 1);
+	return vec3(cell.x, 0.0, cell.y) * mesh.spacing;
+}
+
+void main()
+{
+	gl_Position = camera_buffers[mesh.camera].view_proj
+			* vec4(position + instance_offset(gl_InstanceIndex), 1.0);
+}
@@ -0,0 +1,67 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+
+/* Shades the visibility buffer. The triangle is fetched back from the
+ * payload, pixels nothing was drawn to keep the clear color.
+ */
+layout(location = 0) out vec4 color;
+
+layout(push_constant) uniform Raster {
+	/* Bindless buffer indices. */
+	uint camera;
+	uint positions;
+	uint meshlets;
+	uint meshlet_vertices;
+	uint meshlet_triangles;
+	uint meshlet_count;
+	uint grid_side;
+	float spacing;
+	uint visibility;
+	uint draws;
+	uint count;
+	uint compact;
+	uint indices;
+	uint width;
+	uint height;
+	float threshold;
+	float pixel_scale;
+} raster;
+
+/* Storage buffers of the bindless table. */
+layout(std430, set = 0, binding = 0) readonly buffer Positions {
+	vec4 positions[];
+} position_buffers[];
+
+layout(std430, set = 0, binding = 0) readonly buffer Indices {
+	uint indices[];
+} index_buffers[];
+
+layout(std430, set = 0, binding = 0) readonly buffer Visibility {
+	uint64_t pixels[];
+} visibility_buffers[];
+
+void main()
+{
+	uvec2 p = uvec2(gl_FragCoord.xy);
+	uint64_t value = visibility_buffers[raster.visibility]
+			.pixels[p.y * raster.width + p.x];
+	if (value == 0xffffffffffffffffUL)
+		discard;
+
+	uint payload = uint(value);
+	uint instance = payload >> 24;
+	uint triangle = payload & 0xffffff;
+
+	vec3 position = vec3(0.0);
+	for (int v = 0; v < 3; ++v) {
+		uint index = index_buffers[raster.indices].indices[triangle * 3 + v];
+		position += position_buffers[raster.positions].positions[index].xyz;
+	}
+
+	/* The mesh is a sphere around the origin, the centroid is the normal. */
+	vec3 normal = normalize(position);
+	float light = max(dot(normal, normalize(vec3(0.4, 0.8, 0.4))), 0.0);
+	vec3 tint = 0.6 + 0.4 * cos(vec3(0.0, 2.1, 4.2) + float(instance) * 0.7);
+	color = vec4(tint * (0.15 + 0.85 * light), 1.0);
+}
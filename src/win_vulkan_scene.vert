@@ -0,0 +1,36 @@
+#version 450
+#ifdef BINDLESS_FIXED
+/* Without descriptor indexing, the table's fixed size. The indices come from
+ * push constants, dynamically uniform.
+ */
+#define BINDLESS_BUFFERS BINDLESS_FIXED
+#else
+#extension GL_EXT_nonuniform_qualifier : require
+#define BINDLESS_BUFFERS
+#endif
+
+struct Object {
+	mat4 model;
+	vec4 bounds;
+};
+
+layout(location = 0) in vec3 position;
+
+layout(push_constant) uniform Camera {
+	mat4 view_proj;
+	/* Bindless buffer index. */
+	uint objects;
+} camera;
+
+/* Storage buffers of the bindless table. */
+layout(std430, set = 0, binding = 0) readonly buffer Objects {
+	Object objects[];
+} object_buffers[BINDLESS_BUFFERS];
+
+void main()
+{
+	/* firstInstance of the indirect draw is the object index. */
+	gl_Position = camera.view_proj
+			* object_buffers[camera.objects].objects[gl_InstanceIndex].model
+			* vec4(position, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 450
+
+/* Flat color, baked in per pipeline variant. */
+layout(constant_id = 0) const float tint_r = 1.0;
+layout(constant_id = 1) const float tint_g = 0.5;
+layout(constant_id = 2) const float tint_b = 0.2;
+layout(constant_id = 3) const float tint_a = 1.0;
+
+layout(location = 0) out vec4 color;
+
+void main()
+{
+	color = vec4(tint_r, tint_g, tint_b, tint_a);
+}
@@ -0,0 +1,45 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+#extension GL_EXT_shader_atomic_int64 : require
+
+/* Writes the visibility buffer the same way win_vulkan_swr.comp does, the
+ * color attachment is write masked.
+ */
+layout(early_fragment_tests) in;
+
+layout(location = 0) flat in uint payload_base;
+
+layout(push_constant) uniform Raster {
+	/* Bindless buffer indices. */
+	uint camera;
+	uint positions;
+	uint meshlets;
+	uint meshlet_vertices;
+	uint meshlet_triangles;
+	uint meshlet_count;
+	uint grid_side;
+	float spacing;
+	uint visibility;
+	uint draws;
+	uint count;
+	uint compact;
+	uint indices;
+	uint width;
+	uint height;
+	float threshold;
+	float pixel_scale;
+} raster;
+
+layout(std430, set = 0, binding = 0) buffer Visibility {
+	uint64_t pixels[];
+} visibility_buffers[];
+
+void main()
+{
+	uvec2 p = uvec2(gl_FragCoord.xy);
+	uint64_t value = (uint64_t(floatBitsToUint(gl_FragCoord.z)) << 32)
+			| uint64_t(payload_base + uint(gl_PrimitiveID));
+	atomicMin(visibility_buffers[raster.visibility]
+			.pixels[p.y * raster.width + p.x], value);
+}
@@ -0,0 +1,71 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+/* Hardware half of the software raster, the meshlets win_vulkan_swr.comp
+ * left over. The instance encodes the meshlet and the grid cell.
+ */
+layout(location = 0) in vec3 position;
+
+layout(location = 0) flat out uint payload_base;
+
+struct Meshlet {
+	/* Center, radius. */
+	vec4 bounds;
+	/* Axis, cutoff. */
+	vec4 cone;
+	uint vertex_offset;
+	uint triangle_offset;
+	uint vertex_count;
+	uint triangle_count;
+};
+
+layout(push_constant) uniform Raster {
+	/* Bindless buffer indices. */
+	uint camera;
+	uint positions;
+	uint meshlets;
+	uint meshlet_vertices;
+	uint meshlet_triangles;
+	uint meshlet_count;
+	uint grid_side;
+	float spacing;
+	uint visibility;
+	uint draws;
+	uint count;
+	uint compact;
+	uint indices;
+	uint width;
+	uint height;
+	float threshold;
+	float pixel_scale;
+} raster;
+
+/* Storage buffers of the bindless table. */
+layout(std430, set = 0, binding = 0) readonly buffer Camera {
+	mat4 view_proj;
+	vec4 eye;
+	vec4 planes[6];
+} camera_buffers[];
+
+layout(std430, set = 0, binding = 0) readonly buffer Meshlets {
+	Meshlet meshlets[];
+} meshlet_buffers[];
+
+vec3 instance_offset(uint instance)
+{
+	vec2 cell = vec2(instance % raster.grid_side, instance / raster.grid_side)
+			- 0.5 * float(raster.grid_side - 1);
+	return vec3(cell.x, 0.0, cell.y) * raster.spacing;
+}
+
+void main()
+{
+	uint instance_count = raster.grid_side * raster.grid_side;
+	uint instance = gl_InstanceIndex % instance_count;
+	uint meshlet = gl_InstanceIndex / instance_count;
+
+	gl_Position = camera_buffers[raster.camera].view_proj
+			* vec4(position + instance_offset(instance), 1.0);
+	payload_base = (instance << 24)
+			| meshlet_buffers[raster.meshlets].meshlets[meshlet].triangle_offset;
+}
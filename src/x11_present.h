@@ -0,0 +1,272 @@
+/* CPU frames to an X11 window through MIT-SHM. Two shared memory XImages :
+ * the raster draws straight into one while the server reads the other.
+ * XShmPutImage only queues a request, the completion event it asks for says
+ * when the server is done reading and the buffer can be drawn again. No copy
+ * on our side, nothing but the request on the wire.
+ *
+ * Stands in for create_window and SwapBuffers of the Win32 demos. Fixed
+ * size. Images are padded like the raster's Framebuffer, rows to whole 8
+ * pixel blocks and their count to even, only width x height is shown.
+ * Needs a local server, 32 bit TrueColor. Link X11 and Xext.
+ */
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define X11_PRESENT_BUFFERS 2
+
+typedef struct X11Buffer {
+	XImage*				image;
+	XShmSegmentInfo		shm;
+	/* Presented, the server may still be reading it. */
+	bool				busy;
+} X11Buffer;
+
+typedef struct X11Presenter {
+	Display*			display;
+	Window				window;
+	GC					gc;
+	Atom				wm_delete;
+	int					completion_type;
+	/* Closed by the user. */
+	bool				open;
+
+	uint32_t			width;
+	uint32_t			height;
+	uint32_t			stride;
+	uint32_t			rows;
+	X11Buffer			buffers[X11_PRESENT_BUFFERS];
+	uint32_t			current;
+
+	/* Where RGBA's bytes go in the visual's pixels. */
+	uint32_t			shifts[3];
+	uint32_t			alpha;
+
+	uint64_t			presented;
+	/* Blocked on the server in x11_present_acquire. */
+	double				wait_ms;
+} X11Presenter;
+
+static bool x11_shm_failed = false;
+
+static inline int x11_shm_error_handler(Display* display, XErrorEvent* error)
+{
+	(void)display;
+	(void)error;
+	x11_shm_failed = true;
+	return 0;
+}
+
+static inline double x11_present_time_ms()
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+static inline uint32_t x11_mask_shift(unsigned long mask)
+{
+	uint32_t shift = 0;
+	while (shift < 32 && (mask & (1ul << shift)) == 0) {
+		++shift;
+	}
+	return shift;
+}
+
+/* Attaching fails on remote displays, the error comes back asynchronously. */
+static inline void x11_create_buffer(X11Presenter* p, X11Buffer* buffer,
+		Visual* visual, int depth)
+{
+	buffer->image = XShmCreateImage(p->display, visual, (unsigned int)depth,
+			ZPixmap, NULL, &buffer->shm, p->stride, p->rows);
+	if (buffer->image == NULL || buffer->image->bits_per_pixel != 32
+			|| buffer->image->bytes_per_line != (int)p->stride * 4)
+	{
+		printf("No 32 bit shared memory XImage.\n");
+		exit(-1);
+	}
+
+	size_t size = (size_t)buffer->image->bytes_per_line * p->rows;
+	buffer->shm.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+	if (buffer->shm.shmid < 0) {
+		printf("Could not get %zu bytes of shared memory.\n", size);
+		exit(-1);
+	}
+	buffer->shm.shmaddr = shmat(buffer->shm.shmid, NULL, 0);
+	buffer->image->data = buffer->shm.shmaddr;
+	buffer->shm.readOnly = True;
+	if (buffer->shm.shmaddr == (char*)-1) {
+		printf("Could not map shared memory.\n");
+		exit(-1);
+	}
+	memset(buffer->shm.shmaddr, 0, size);
+
+	x11_shm_failed = false;
+	int (*previous)(Display*, XErrorEvent*) =
+			XSetErrorHandler(x11_shm_error_handler);
+	XShmAttach(p->display, &buffer->shm);
+	XSync(p->display, False);
+	XSetErrorHandler(previous);
+
+	/* Attached or not, it's gone once both sides detach. */
+	shmctl(buffer->shm.shmid, IPC_RMID, NULL);
+	if (x11_shm_failed) {
+		printf("The X server can't attach shared memory, is it remote?\n");
+		exit(-1);
+	}
+}
+
+static inline void x11_present_init(X11Presenter* p, const char* title,
+		uint32_t width, uint32_t height)
+{
+	*p = (X11Presenter){
+		.width					= width
+		, .height				= height
+		, .stride				= (width + 7) & ~7u
+		, .rows					= (height + 1) & ~1u
+	};
+
+	p->display = XOpenDisplay(NULL);
+	if (p->display == NULL) {
+		printf("Could not open the X display, is DISPLAY set?\n");
+		exit(-1);
+	}
+	if (!XShmQueryExtension(p->display)) {
+		printf("The X server has no MIT-SHM.\n");
+		exit(-1);
+	}
+	p->completion_type = XShmGetEventBase(p->display) + ShmCompletion;
+
+	int screen = DefaultScreen(p->display);
+	Visual* visual = DefaultVisual(p->display, screen);
+	int depth = DefaultDepth(p->display, screen);
+	if (visual->class != TrueColor || depth < 24) {
+		printf("The default visual isn't 24 or 32 bit TrueColor.\n");
+		exit(-1);
+	}
+	p->shifts[0] = x11_mask_shift(visual->red_mask);
+	p->shifts[1] = x11_mask_shift(visual->green_mask);
+	p->shifts[2] = x11_mask_shift(visual->blue_mask);
+	p->alpha = ~(uint32_t)(visual->red_mask | visual->green_mask
+			| visual->blue_mask);
+
+	p->window = XCreateSimpleWindow(p->display, RootWindow(p->display, screen),
+			0, 0, width, height, 0, BlackPixel(p->display, screen),
+			BlackPixel(p->display, screen));
+	XStoreName(p->display, p->window, title);
+	p->wm_delete = XInternAtom(p->display, "WM_DELETE_WINDOW", False);
+	XSetWMProtocols(p->display, p->window, &p->wm_delete, 1);
+
+	/* No resizing. */
+	XSizeHints hints = {
+		.flags					= PMinSize | PMaxSize
+		, .min_width			= (int)width
+		, .min_height			= (int)height
+		, .max_width			= (int)width
+		, .max_height			= (int)height
+	};
+	XSetWMNormalHints(p->display, p->window, &hints);
+	XSelectInput(p->display, p->window, StructureNotifyMask);
+	p->gc = XCreateGC(p->display, p->window, 0, NULL);
+
+	for (int i = 0; i < X11_PRESENT_BUFFERS; ++i) {
+		x11_create_buffer(p, &p->buffers[i], visual, depth);
+	}
+
+	XMapWindow(p->display, p->window);
+	XSync(p->display, False);
+	p->open = true;
+}
+
+/* Packed RGBA, R in the lowest byte, to the visual's pixel. */
+static inline uint32_t x11_present_pixel(const X11Presenter* p, uint32_t rgba)
+{
+	return ((rgba & 0xff) << p->shifts[0])
+			| (((rgba >> 8) & 0xff) << p->shifts[1])
+			| (((rgba >> 16) & 0xff) << p->shifts[2])
+			| p->alpha;
+}
+
+static inline void x11_present_handle(X11Presenter* p, const XEvent* event)
+{
+	if (event->type == p->completion_type) {
+		const XShmCompletionEvent* done = (const XShmCompletionEvent*)event;
+		for (int i = 0; i < X11_PRESENT_BUFFERS; ++i) {
+			if (p->buffers[i].shm.shmseg == done->shmseg) {
+				p->buffers[i].busy = false;
+			}
+		}
+	} else if (event->type == ClientMessage
+			&& (Atom)event->xclient.data.l[0] == p->wm_delete)
+	{
+		p->open = false;
+	} else if (event->type == DestroyNotify) {
+		p->open = false;
+	}
+}
+
+/* Without blocking. False once the window is closed. */
+static inline bool x11_present_poll(X11Presenter* p)
+{
+	while (p->open && XPending(p->display) > 0) {
+		XEvent event;
+		XNextEvent(p->display, &event);
+		x11_present_handle(p, &event);
+	}
+	return p->open;
+}
+
+/* The next buffer's pixels, stride apart, once the server is done with
+ * them. NULL if the window was closed while waiting.
+ */
+static inline uint32_t* x11_present_acquire(X11Presenter* p)
+{
+	X11Buffer* buffer = &p->buffers[p->current];
+	if (buffer->busy) {
+		double start = x11_present_time_ms();
+		while (buffer->busy && p->open) {
+			XEvent event;
+			XNextEvent(p->display, &event);
+			x11_present_handle(p, &event);
+		}
+		p->wait_ms += x11_present_time_ms() - start;
+	}
+	return p->open ? (uint32_t*)buffer->image->data : NULL;
+}
+
+/* Queues the acquired buffer and moves to the other one. */
+static inline void x11_present_present(X11Presenter* p)
+{
+	X11Buffer* buffer = &p->buffers[p->current];
+	XShmPutImage(p->display, p->window, p->gc, buffer->image, 0, 0, 0, 0,
+			p->width, p->height, True);
+	XFlush(p->display);
+	buffer->busy = true;
+	p->current = (p->current + 1) % X11_PRESENT_BUFFERS;
+	++p->presented;
+}
+
+static inline void x11_present_destroy(X11Presenter* p)
+{
+	/* Every put done, before the memory goes. */
+	XSync(p->display, False);
+	for (int i = 0; i < X11_PRESENT_BUFFERS; ++i) {
+		X11Buffer* buffer = &p->buffers[i];
+		XShmDetach(p->display, &buffer->shm);
+		buffer->image->data = NULL;
+		XDestroyImage(buffer->image);
+		shmdt(buffer->shm.shmaddr);
+	}
+	XFreeGC(p->display, p->gc);
+	XDestroyWindow(p->display, p->window);
+	XCloseDisplay(p->display);
+	*p = (X11Presenter){0};
+}